@@ -3,11 +3,17 @@
 
 #include <util/izene_serialization.h>
 #include <3rdparty/msgpack/msgpack.hpp>
+#include "FibpTaskPriority.h"
 #include <string>
 #include <vector>
+#include <stdint.h>
 
 namespace fibp
 {
+namespace http
+{
+class response_stream_t;
+}
 
 enum method
 {
@@ -36,8 +42,26 @@ struct ServiceCallReq
     std::string service_cluster;
     int service_type;
     bool enable_cache;
+    // send a hedged request to another host if no response after the latency
+    // percentile of the service, 0 means using the setting of the service.
+    int hedge_percentile;
+    // the time the caller is willing to wait, 0 means no limit.
+    int timeout_ms;
+    // the absolute deadline on the steady clock converted from the timeout when the
+    // request arrived, it is not passed through the network.
+    uint64_t deadline_us;
+    // the identical calls at the same time will share one upstream request.
+    bool enable_coalesce;
+    // the index of the calls in the same list which should finish before this one,
+    // their responses can be used by the placeholders in the request.
+    std::vector<int> depends_on;
+    // relay the response of the http service tagged with stream to the client as
+    // it arrives, kept by the caller until the call finished and not passed through
+    // the network.
+    http::response_stream_t* rsp_stream;
     ServiceCallReq()
-        :method(POST), service_type(HTTP_Service), enable_cache(false)
+        :method(POST), service_type(HTTP_Service), enable_cache(false), hedge_percentile(0),
+        timeout_ms(0), deadline_us(0), enable_coalesce(false), rsp_stream(NULL)
     {
     }
     inline bool operator==(const ServiceCallReq& other) const
@@ -51,7 +75,7 @@ struct ServiceCallReq
     }
 
     MSGPACK_DEFINE(service_name, service_api, method, service_req_data, service_cluster,
-        service_type, enable_cache);
+        service_type, enable_cache, hedge_percentile, timeout_ms, enable_coalesce, depends_on);
 
     DATA_IO_LOAD_SAVE(ServiceCallReq, & service_name & service_api & method
         & service_req_data & service_cluster & service_type);
@@ -84,6 +108,32 @@ struct ServiceCallRsp
 
 typedef std::vector<ServiceCallRsp> ServicesRsp;
 
+// how to wait for the services called together.
+struct ServicesCallOption
+{
+    // return once this number of services succeeded, 0 to wait for all.
+    int wait_success_num;
+    // return what finished in time and cancel the others, 0 for no limit.
+    int timeout_ms;
+    // the max number of services called at the same time, 0 for the default.
+    int max_parallel;
+    // all the services are called in a transaction, set by the api called, not
+    // passed through the network.
+    bool do_transaction;
+    // the priority class of the calls in the fiber pool.
+    int priority;
+    ServicesCallOption()
+        :wait_success_num(0), timeout_ms(0), max_parallel(0), do_transaction(false),
+        priority(Priority_Normal)
+    {
+    }
+    bool need_wait_all() const
+    {
+        return wait_success_num <= 0 && timeout_ms <= 0;
+    }
+    MSGPACK_DEFINE(wait_success_num, timeout_ms, max_parallel, priority);
+};
+
 struct ForwardInfoT
 {
     std::string service_name;
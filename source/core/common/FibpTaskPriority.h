@@ -0,0 +1,33 @@
+#ifndef FIBP_TASK_PRIORITY_H
+#define FIBP_TASK_PRIORITY_H
+
+#include <string>
+#include <boost/algorithm/string/predicate.hpp>
+
+namespace fibp
+{
+
+// the priority class of the task in the fiber pool.
+enum TaskPriority
+{
+    Priority_High,
+    Priority_Normal,
+    Priority_Low,
+    Priority_Count
+};
+
+// accept both the name (high, normal, low) and the number.
+inline int parse_task_priority(const std::string& name, int default_priority)
+{
+    if (boost::iequals(name, "high") || name == "0")
+        return Priority_High;
+    if (boost::iequals(name, "normal") || name == "1")
+        return Priority_Normal;
+    if (boost::iequals(name, "low") || name == "2")
+        return Priority_Low;
+    return default_priority;
+}
+
+}
+
+#endif
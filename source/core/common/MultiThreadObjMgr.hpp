@@ -55,6 +55,22 @@ public:
         return *l;
     }
 
+    // the objects created by all the threads, they are still used by their
+    // threads, so only the thread-safe parts can be read.
+    void getAllObj(std::vector<boost::shared_ptr<ObjectType> >& objs)
+    {
+        for(std::size_t i = 0; i < obj_list_.size(); ++i)
+        {
+            typename ObjectItem::ItemRWLock::ReadHolder guard(obj_list_[i]->rw_lock);
+            const ObjectItem& item = *(obj_list_[i]);
+            for(typename ObjectItem::ItemListT::const_iterator it = item.item_list.begin();
+                it != item.item_list.end(); ++it)
+            {
+                objs.push_back(it->second);
+            }
+        }
+    }
+
     void clear()
     {
         obj_list_.clear();
@@ -11,6 +11,7 @@
 #include <util/driver/Keys.h>
 #include <log-manager/FibpLogger.h>
 #include "yield.hpp"
+#include "FibpRoutePriority.h"
 #include <boost/bind.hpp>
 #include <iostream>
 #include <glog/logging.h>
@@ -20,6 +21,8 @@ using namespace izenelib;
 using namespace izenelib::driver;
 
 static int s_guess_client_num = 0;
+static const std::string s_timeout_key("timeout_ms");
+static const std::string s_priority_key("priority");
 
 namespace fibp {
 
@@ -130,6 +133,11 @@ void FiberDriverConnection::writeRsp(context_ptr context)
     }
 }
 
+void FiberDriverConnection::writeAdmittedRsp(context_ptr context, FibpAdmissionTicketPtr ticket)
+{
+    writeRsp(context);
+}
+
 void FiberDriverConnection::asyncReadFormHeader()
 {
     FIBP_THREAD_MARK_LOG(0);
@@ -211,8 +219,13 @@ void FiberDriverConnection::afterReadFormPayload(
 }
 
 void FiberDriverConnection::handleRequestFunc(
-    context_ptr context)
+    context_ptr context, FibpAdmissionTicketPtr ticket)
 {
+    if (!ticket->on_start())
+    {
+        writeError(context, "Server Busy.");
+        return;
+    }
     driver::Router::handler_ptr handler = router_->find(
         context->request.controller(),
         context->request.action()
@@ -251,7 +264,8 @@ void FiberDriverConnection::handleRequestFunc(
                 handler->invoke_async(context->request,
                     context->response,
                     poller_,
-                    boost::bind(&FiberDriverConnection::writeRsp, shared_from_this(), context));
+                    boost::bind(&FiberDriverConnection::writeAdmittedRsp, shared_from_this(),
+                        context, ticket));
             }
         }
         catch (const std::exception& e)
@@ -288,14 +302,33 @@ void FiberDriverConnection::handleRequest(
         }
         context->request.assignTmp(requestValue);
 
+        int priority = parse_task_priority(
+            asString(context->request.header()[s_priority_key]),
+            FibpRoutePriority::get()->get_priority(context->request.controller(),
+                context->request.action()));
+        context->request.header()[s_priority_key] = priority;
+
+        FibpAdmissionTicketPtr ticket = FibpAdmissionControl::get()->try_admit();
+        if (!ticket)
+        {
+            writeError(context, "Server Busy.");
+            return;
+        }
         if (fiber_pool_)
         {
+            uint64_t deadline_us = 0;
+            int timeout_ms = asInt(context->request.header()[s_timeout_key]);
+            if (timeout_ms > 0)
+                deadline_us = FiberPool::now_us() + (uint64_t)timeout_ms*1000;
             fiber_pool_->schedule_task(boost::bind(&FiberDriverConnection::handleRequestFunc,
-                    shared_from_this(), context));
+                    shared_from_this(), context, ticket),
+                priority, deadline_us,
+                boost::bind(&FiberDriverConnection::writeError, shared_from_this(),
+                    context, std::string("Deadline Exceeded.")));
         }
         else
         {
-            handleRequestFunc(context);
+            handleRequestFunc(context, ticket);
         }
     }
     // Error if send end is closed, just ignore it
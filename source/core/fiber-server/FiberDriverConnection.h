@@ -7,6 +7,7 @@
 #include <util/driver/Writer.h>
 #include <util/driver/Poller.h>
 #include "FiberPool.hpp"
+#include "FibpAdmissionControl.h"
 
 #include <boost/asio.hpp>
 #include <boost/noncopyable.hpp>
@@ -62,7 +63,7 @@ private:
     /// @brief Handle the request
     void handleRequest(context_ptr context,
                        const boost::system::error_code& e);
-    void handleRequestFunc(context_ptr context);
+    void handleRequestFunc(context_ptr context, FibpAdmissionTicketPtr ticket);
 
     /// @brief Write response asynchronously.
     void asyncWriteResponse(context_ptr context);
@@ -86,6 +87,9 @@ private:
 
     void writeError(context_ptr context, const std::string& errmsg);
     void writeRsp(context_ptr context);
+    /// @brief Write the response of the async handler, the admission is
+    /// released after written.
+    void writeAdmittedRsp(context_ptr context, FibpAdmissionTicketPtr ticket);
 
     /// @brief Socket to communicate with the client in this connection.
     boost::asio::ip::tcp::socket socket_;
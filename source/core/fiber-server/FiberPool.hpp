@@ -8,26 +8,43 @@
 #include <boost/unordered_map.hpp>
 #include <boost/enable_shared_from_this.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/atomic.hpp>
+#include <boost/chrono/system_clocks.hpp>
+#include <common/FibpTaskPriority.h>
 #include <vector>
 #include <deque>
+#include <queue>
+#include <stdint.h>
 #include <glog/logging.h>
 
 namespace fibp
 {
 
+// the tasks are dispatched by the weight of their priority classes. In the same
+// class the tasks with the deadline go by the earliest deadline, and the ones
+// without by the arrival, the two queues take turns so neither starves the other
+// (a short deadline only jumps the other tasks with the deadline). The task whose
+// deadline passed before it is started is dropped (the expired task is run instead).
 class FiberPool : public boost::enable_shared_from_this<FiberPool>
 {
 public:
     typedef boost::function<void()> fiber_task_t;
     FiberPool()
-        :need_stop_(false), running_fiber_num_(0)
+        :need_stop_(false), running_fiber_num_(0), task_num_(0), task_seq_(0), expired_num_(0)
     {
+        reset_credits();
     }
     ~FiberPool()
     {
         stop();
     }
 
+    static uint64_t now_us()
+    {
+        return boost::chrono::duration_cast<boost::chrono::microseconds>(
+            boost::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
     void init(std::size_t poolSize)
     {
         for(std::size_t i = 0; i < poolSize; ++i)
@@ -63,11 +80,13 @@ public:
         cond_.notify_all();
     }
 
-    void schedule_task(const fiber_task_t& task)
+    // the deadline is on the steady clock of now_us(), 0 for no deadline.
+    void schedule_task(const fiber_task_t& task, int priority = Priority_Normal,
+        uint64_t deadline_us = 0, const fiber_task_t& expired_task = fiber_task_t())
     {
         {
             boost::unique_lock< boost::mutex > guard_thread(task_thread_lock_);
-            thread_task_list_.push_back(task);
+            thread_task_list_.push_back(PoolTask(task, priority, deadline_us, expired_task));
         }
         thread_cond_.notify_one();
     }
@@ -77,13 +96,13 @@ public:
         boost::this_fiber::yield();
         while(true)
         {
-            while(!fiber_task_list_.empty() && thread_task_list_.empty())
+            while(task_num_ > 0 && thread_task_list_.empty())
             {
                 if (need_stop_)
                     return;
                 boost::this_fiber::yield();
             }
-            std::deque<fiber_task_t> tmp_list;
+            std::deque<PoolTask> tmp_list;
             {
                 boost::unique_lock< boost::mutex > guard_thread(task_thread_lock_);
                 while(thread_task_list_.empty())
@@ -102,12 +121,13 @@ public:
                 if (fiber_pool_.size() == 1)
                 {
                     // no pre-created fibers, create a new fiber for each new task.
-                    boost::fibers::fiber f(tmp_list[i]);
+                    boost::fibers::fiber f(boost::bind(&FiberPool::run_task,
+                            shared_from_this(), tmp_list[i]));
                     f.detach();
                 }
                 else
                 {
-                    fiber_task_list_.push_back(tmp_list[i]);
+                    push_task(tmp_list[i]);
                     cond_.notify_one();
                 }
                 boost::this_fiber::yield();
@@ -116,9 +136,11 @@ public:
     }
 
     // this interface can only be called from the fiber.
-    void schedule_task_from_fiber(const fiber_task_t& task)
+    void schedule_task_from_fiber(const fiber_task_t& task, int priority = Priority_Normal,
+        uint64_t deadline_us = 0, const fiber_task_t& expired_task = fiber_task_t())
     {
-        fiber_task_list_.push_back(task);
+        PoolTask pool_task(task, priority, deadline_us, expired_task);
+        push_task(pool_task);
         // lazy init pool, only init pool when the task is pushed from the main fiber,
         // and resize the pool as needed while the task is growing.
         if (fiber_pool_.empty())
@@ -155,20 +177,134 @@ public:
         boost::this_fiber::yield();
     }
 
+    // can be read by other threads for the stats.
+    std::size_t get_expired_num() const
+    {
+        return expired_num_.load(boost::memory_order_relaxed);
+    }
+
 private:
+    struct PoolTask
+    {
+        PoolTask()
+            : priority(Priority_Normal), deadline_us(0), seq(0)
+        {
+        }
+        PoolTask(const fiber_task_t& t, int p, uint64_t deadline, const fiber_task_t& expired)
+            : task(t), expired_task(expired), priority(p), deadline_us(deadline), seq(0)
+        {
+            if (priority < Priority_High || priority >= Priority_Count)
+                priority = Priority_Normal;
+        }
+        fiber_task_t task;
+        fiber_task_t expired_task;
+        int priority;
+        uint64_t deadline_us;
+        uint64_t seq;
+    };
+    struct PoolTaskLater
+    {
+        bool operator()(const PoolTask& l, const PoolTask& r) const
+        {
+            if (l.deadline_us != r.deadline_us)
+                return l.deadline_us > r.deadline_us;
+            return l.seq > r.seq;
+        }
+    };
+    typedef std::priority_queue<PoolTask, std::vector<PoolTask>, PoolTaskLater> TaskQueueT;
+    struct ClassQueue
+    {
+        ClassQueue()
+            : is_fifo_turn(false)
+        {
+        }
+        bool empty() const
+        {
+            return deadline_tasks.empty() && fifo_tasks.empty();
+        }
+        TaskQueueT deadline_tasks;
+        std::deque<PoolTask> fifo_tasks;
+        bool is_fifo_turn;
+    };
+
+    void reset_credits()
+    {
+        static const int weights[Priority_Count] = {8, 4, 1};
+        for(int i = 0; i < Priority_Count; ++i)
+        {
+            credits_[i] = weights[i];
+        }
+    }
+
+    void push_task(PoolTask& task)
+    {
+        task.seq = task_seq_++;
+        if (task.deadline_us > 0)
+            fiber_task_list_[task.priority].deadline_tasks.push(task);
+        else
+            fiber_task_list_[task.priority].fifo_tasks.push_back(task);
+        ++task_num_;
+    }
+
+    // pick the class which still has credit in this round.
+    bool pop_task(PoolTask& task)
+    {
+        if (task_num_ == 0)
+            return false;
+        while(true)
+        {
+            for(int i = 0; i < Priority_Count; ++i)
+            {
+                ClassQueue& queue = fiber_task_list_[i];
+                if (queue.empty() || credits_[i] <= 0)
+                    continue;
+                --credits_[i];
+                bool use_fifo = queue.deadline_tasks.empty() ||
+                    (!queue.fifo_tasks.empty() && queue.is_fifo_turn);
+                queue.is_fifo_turn = !use_fifo;
+                if (use_fifo)
+                {
+                    task = queue.fifo_tasks.front();
+                    queue.fifo_tasks.pop_front();
+                }
+                else
+                {
+                    task = queue.deadline_tasks.top();
+                    queue.deadline_tasks.pop();
+                }
+                --task_num_;
+                return true;
+            }
+            reset_credits();
+        }
+    }
+
+    void run_task(const PoolTask& task)
+    {
+        if (task.deadline_us > 0 && now_us() > task.deadline_us)
+        {
+            expired_num_.fetch_add(1, boost::memory_order_relaxed);
+            if (task.expired_task)
+                task.expired_task();
+            return;
+        }
+        if (task.task)
+            task.task();
+    }
+
     void run_fiber()
     {
         while(true)
         {
             try
             {
-                fiber_task_t task;
+                PoolTask task;
                 {
                     boost::unique_lock< boost::fibers::mutex > guard(task_lock_);
 
                     if (need_stop_)
                         return;
-                    while (fiber_task_list_.empty())
+                    while (task_num_ == 0)
                     {
                         cond_.wait(guard);
                         if (need_stop_)
@@ -176,15 +312,11 @@ private:
                             return;
                         }
                     }
-                    task = fiber_task_list_.front();
-                    fiber_task_list_.pop_front();
-                }
-                if (task)
-                {
-                    ++running_fiber_num_;
-                    task();
-                    --running_fiber_num_;
+                    pop_task(task);
                 }
+                ++running_fiber_num_;
+                run_task(task);
+                --running_fiber_num_;
             }
             catch(const boost::fibers::fiber_interrupted& e)
             {
@@ -193,14 +325,18 @@ private:
         }
     }
     std::vector<boost::shared_ptr<boost::fibers::fiber> > fiber_pool_;
-    std::deque<fiber_task_t>  fiber_task_list_;
-    std::deque<fiber_task_t>  thread_task_list_;
+    ClassQueue fiber_task_list_[Priority_Count];
+    int credits_[Priority_Count];
+    std::deque<PoolTask>  thread_task_list_;
     boost::fibers::condition_variable  cond_;
     boost::fibers::mutex task_lock_;
     boost::mutex task_thread_lock_;
     boost::condition_variable  thread_cond_;
     bool need_stop_;
     std::size_t running_fiber_num_;
+    std::size_t task_num_;
+    uint64_t task_seq_;
+    boost::atomic<std::size_t> expired_num_;
     static const std::size_t GROW_SIZE = 10;
     static const std::size_t MAX_GROW_SIZE = 15000;
 };
@@ -0,0 +1,114 @@
+#include "FibpAdmissionControl.h"
+#include <glog/logging.h>
+#include <boost/chrono/system_clocks.hpp>
+#include <algorithm>
+
+namespace fibp
+{
+
+static const uint32_t INIT_LIMIT = 1000;
+static const uint32_t MIN_LIMIT = 20;
+// the same as the max fibers grown in the fiber pool.
+static const uint32_t MAX_LIMIT = 15000;
+static const uint64_t TARGET_DELAY_US = 5*1000;
+static const uint64_t INTERVAL_US = 100*1000;
+// nobody is waiting for the response any more.
+static const uint64_t MAX_QUEUE_DELAY_US = 1000*1000;
+
+static inline uint64_t now_us()
+{
+    return boost::chrono::duration_cast<boost::chrono::microseconds>(
+        boost::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+FibpAdmissionTicket::FibpAdmissionTicket(FibpAdmissionControl& ctrl, uint64_t accept_us)
+    : ctrl_(ctrl), accept_us_(accept_us)
+{
+}
+
+FibpAdmissionTicket::~FibpAdmissionTicket()
+{
+    ctrl_.release();
+}
+
+bool FibpAdmissionTicket::on_start()
+{
+    uint64_t delay = now_us() - accept_us_;
+    ctrl_.on_start(delay);
+    if (delay > MAX_QUEUE_DELAY_US)
+    {
+        ++ctrl_.expired_num_;
+        return false;
+    }
+    return true;
+}
+
+FibpAdmissionControl::FibpAdmissionControl()
+    : limit_(INIT_LIMIT), inflight_(0), admitted_num_(0), shed_num_(0), expired_num_(0),
+    interval_start_us_(now_us()), min_delay_us_((uint64_t)-1), max_inflight_(0)
+{
+}
+
+FibpAdmissionTicketPtr FibpAdmissionControl::try_admit()
+{
+    uint32_t inflight = ++inflight_;
+    if (inflight > limit_.load(boost::memory_order_relaxed))
+    {
+        --inflight_;
+        ++shed_num_;
+        return FibpAdmissionTicketPtr();
+    }
+    ++admitted_num_;
+    return FibpAdmissionTicketPtr(new FibpAdmissionTicket(*this, now_us()));
+}
+
+void FibpAdmissionControl::release()
+{
+    --inflight_;
+}
+
+void FibpAdmissionControl::on_start(uint64_t queue_delay_us)
+{
+    boost::mutex::scoped_lock guard(lock_);
+    min_delay_us_ = std::min(min_delay_us_, queue_delay_us);
+    max_inflight_ = std::max(max_inflight_, inflight_.load(boost::memory_order_relaxed));
+    uint64_t now = now_us();
+    if (now - interval_start_us_ >= INTERVAL_US)
+        update_limit(now);
+}
+
+void FibpAdmissionControl::update_limit(uint64_t now)
+{
+    uint32_t limit = limit_.load(boost::memory_order_relaxed);
+    if (min_delay_us_ > TARGET_DELAY_US)
+    {
+        // even the fastest request waited too long, there is a standing queue.
+        uint32_t new_limit = std::max(MIN_LIMIT, limit - limit / 10);
+        if (new_limit != limit)
+        {
+            LOG(INFO) << "admission limit decreased to : " << new_limit
+                << ", min queue delay(us): " << min_delay_us_ << ", inflight: " << max_inflight_;
+        }
+        limit_.store(new_limit, boost::memory_order_relaxed);
+    }
+    else if (max_inflight_ >= limit / 2)
+    {
+        // only grow the limit while it is used.
+        limit_.store(std::min(MAX_LIMIT, limit + std::max(1u, limit / 20)),
+            boost::memory_order_relaxed);
+    }
+    interval_start_us_ = now;
+    min_delay_us_ = (uint64_t)-1;
+    max_inflight_ = 0;
+}
+
+void FibpAdmissionControl::getStats(std::map<std::string, uint64_t>& stats)
+{
+    stats["admission_limit"] = limit_.load(boost::memory_order_relaxed);
+    stats["admission_inflight"] = inflight_.load(boost::memory_order_relaxed);
+    stats["admission_admitted"] = admitted_num_.load(boost::memory_order_relaxed);
+    stats["admission_shed"] = shed_num_.load(boost::memory_order_relaxed);
+    stats["admission_expired"] = expired_num_.load(boost::memory_order_relaxed);
+}
+
+}
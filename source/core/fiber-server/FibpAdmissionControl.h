@@ -0,0 +1,68 @@
+#ifndef FIBP_ADMISSION_CONTROL_H
+#define FIBP_ADMISSION_CONTROL_H
+
+#include <util/singleton.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
+#include <map>
+#include <string>
+#include <stdint.h>
+
+namespace fibp
+{
+
+class FibpAdmissionControl;
+// hold the admission of a request until it is destroyed.
+class FibpAdmissionTicket : private boost::noncopyable
+{
+public:
+    FibpAdmissionTicket(FibpAdmissionControl& ctrl, uint64_t accept_us);
+    ~FibpAdmissionTicket();
+    // called when the request starts being handled in the fiber pool, return false
+    // if the request waited too long in the queue and should be rejected.
+    bool on_start();
+private:
+    FibpAdmissionControl& ctrl_;
+    uint64_t accept_us_;
+};
+typedef boost::shared_ptr<FibpAdmissionTicket> FibpAdmissionTicketPtr;
+
+// adaptive concurrency limit on the requests in the proxy. Like CoDel, the
+// minimum queue delay of the requests in each interval tells whether there is a
+// standing queue, the limit is decreased if the minimum delay is above the
+// target and increased slowly if the limit is reached without queueing.
+class FibpAdmissionControl
+{
+public:
+    static FibpAdmissionControl* get()
+    {
+        return izenelib::util::Singleton<FibpAdmissionControl>::get();
+    }
+    FibpAdmissionControl();
+    // return an empty ticket if the request should be shed.
+    FibpAdmissionTicketPtr try_admit();
+    void getStats(std::map<std::string, uint64_t>& stats);
+
+private:
+    friend class FibpAdmissionTicket;
+    void on_start(uint64_t queue_delay_us);
+    void release();
+    void update_limit(uint64_t now);
+
+    boost::atomic<uint32_t> limit_;
+    boost::atomic<uint32_t> inflight_;
+    boost::atomic<uint64_t> admitted_num_;
+    boost::atomic<uint64_t> shed_num_;
+    boost::atomic<uint64_t> expired_num_;
+    // the statistics of the current interval.
+    boost::mutex lock_;
+    uint64_t interval_start_us_;
+    uint64_t min_delay_us_;
+    uint32_t max_inflight_;
+};
+
+}
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef FIBP_ROUTE_PRIORITY_H
+#define FIBP_ROUTE_PRIORITY_H
+
+#include <common/FibpTaskPriority.h>
+#include <util/singleton.h>
+#include <boost/unordered_map.hpp>
+#include <string>
+
+namespace fibp
+{
+
+// the priority of each controller/action, set while initializing the router and
+// read only after the servers started.
+class FibpRoutePriority
+{
+public:
+    static FibpRoutePriority* get()
+    {
+        return izenelib::util::Singleton<FibpRoutePriority>::get();
+    }
+
+    void set_priority(const std::string& controller, const std::string& action, int priority)
+    {
+        priorities_[controller + "/" + action] = priority;
+    }
+
+    int get_priority(const std::string& controller, const std::string& action) const
+    {
+        PriorityMapT::const_iterator it = priorities_.find(controller + "/" + action);
+        if (it == priorities_.end())
+            return Priority_Normal;
+        return it->second;
+    }
+
+private:
+    typedef boost::unordered_map<std::string, int> PriorityMapT;
+    PriorityMapT priorities_;
+};
+
+}
+
+#endif
@@ -1,6 +1,7 @@
 #include "FibpRpcServer.h"
 #include <forward-manager/FibpForwardManager.h>
 #include <log-manager/FibpLogger.h>
+#include "FibpAdmissionControl.h"
 #include <boost/lexical_cast.hpp>
 #include <glog/logging.h>
 #include <3rdparty/msgpack/msgpack.hpp>
@@ -25,7 +26,8 @@ enum METHOD
 struct RpcServicesReq
 {
     std::vector<ServiceCallReq> req_list;
-    MSGPACK_DEFINE(req_list);
+    ServicesCallOption option;
+    MSGPACK_DEFINE(req_list, option);
 };
 
 struct RpcServicesRsp
@@ -37,21 +39,53 @@ struct RpcServicesRsp
 class RpcRequestContext: public boost::enable_shared_from_this<RpcRequestContext>
 {
 public:
+    RpcRequestContext()
+        : id_(0), is_busy_(false)
+    {
+    }
     std::vector<ServiceCallReq> req_list_;
+    ServicesCallOption option_;
     std::vector<ServiceCallRsp> rsp_list_;
     uint64_t id_;
+    FibpAdmissionTicketPtr admission_ticket_;
+    // rejected when started for waiting too long in the queue.
+    bool is_busy_;
 };
 
+// the queue delay of the request feeds the admission limit, and the request
+// waited too long is rejected as the one not admitted.
+static bool rpc_start_check(boost::shared_ptr<RpcRequestContext> context)
+{
+    if (context->admission_ticket_ && !context->admission_ticket_->on_start())
+        context->is_busy_ = true;
+    return !context->is_busy_;
+}
+
+static bool rpc_reply_busy(msgpack::rpc::request& req, boost::shared_ptr<RpcRequestContext> context)
+{
+    if (!context->is_busy_)
+        return false;
+    req.error(std::string("SERVER_BUSY"));
+    context->admission_ticket_.reset();
+    FibpLogger::get()->endServiceCall(context->id_);
+    return true;
+}
+
 static void rpc_callback(msgpack::rpc::request req, boost::shared_ptr<RpcRequestContext> context)
 {
+    if (rpc_reply_busy(req, context))
+        return;
     RpcServicesRsp rsp;
     rsp.rsp_list.swap(context->rsp_list_);
     req.result(rsp);
+    context->admission_ticket_.reset();
     FibpLogger::get()->endServiceCall(context->id_);
 }
 
 static void rpc_single_service_callback(msgpack::rpc::request req, boost::shared_ptr<RpcRequestContext> context)
 {
+    if (rpc_reply_busy(req, context))
+        return;
     RpcServicesRsp rsp;
     rsp.rsp_list.swap(context->rsp_list_);
     if (rsp.rsp_list.size() != 1)
@@ -74,6 +108,7 @@ static void rpc_single_service_callback(msgpack::rpc::request req, boost::shared
             req.error(rsp.rsp_list[0].error);
         }
     }
+    context->admission_ticket_.reset();
     FibpLogger::get()->endServiceCall(context->id_);
 }
 
@@ -106,13 +141,15 @@ void FibpRpcServer::stop()
 void FibpRpcServer::call_single_service_async(msgpack::rpc::request req, boost::shared_ptr<RpcRequestContext> context)
 {
     fibp_forward_mgr_->call_services_in_fiber(context->id_, context->req_list_,
-        context->rsp_list_, boost::bind(&rpc_single_service_callback, req, context));
+        context->rsp_list_, boost::bind(&rpc_single_service_callback, req, context), false,
+        ServicesCallOption(), boost::bind(&rpc_start_check, context));
 }
 
 void FibpRpcServer::call_services_async(msgpack::rpc::request req, boost::shared_ptr<RpcRequestContext> context)
 {
     fibp_forward_mgr_->call_services_in_fiber(context->id_, context->req_list_,
-        context->rsp_list_, boost::bind(&rpc_callback, req, context));
+        context->rsp_list_, boost::bind(&rpc_callback, req, context), false, context->option_,
+        boost::bind(&rpc_start_check, context));
 }
 
 void FibpRpcServer::dispatch(msgpack::rpc::request req)
@@ -127,6 +164,12 @@ void FibpRpcServer::dispatch(msgpack::rpc::request req)
         }
         else if (method == method_names[METHOD_CALL_SERVICES_ASYNC])
         {
+            FibpAdmissionTicketPtr ticket = FibpAdmissionControl::get()->try_admit();
+            if (!ticket)
+            {
+                req.error(std::string("SERVER_BUSY"));
+                return;
+            }
             uint64_t id = FibpLogger::get()->startServiceCall(__FUNCTION__);
             msgpack::type::tuple<RpcServicesReq> params;
             req.params().convert(&params);
@@ -134,6 +177,9 @@ void FibpRpcServer::dispatch(msgpack::rpc::request req)
             boost::shared_ptr<RpcRequestContext> context(new RpcRequestContext);
             context->id_ = id;
             rpc_req.req_list.swap(context->req_list_);
+            context->option_ = rpc_req.option;
+            context->admission_ticket_ = ticket;
+            FibpForwardManager::set_deadline(context->req_list_, 0);
             call_services_async(req, context);
         }
         else if (method.find(method_names[METHOD_CALL_SINGLE_SERVICE_ASYNC]) == 0)
@@ -145,6 +191,12 @@ void FibpRpcServer::dispatch(msgpack::rpc::request req)
                 req.error(std::string("ARGUMENT_ERROR"));
                 return;
             }
+            FibpAdmissionTicketPtr ticket = FibpAdmissionControl::get()->try_admit();
+            if (!ticket)
+            {
+                req.error(std::string("SERVER_BUSY"));
+                return;
+            }
             RpcServicesReq rpc_req;
             rpc_req.req_list.resize(1);
             rpc_req.req_list.back().service_name = server_method.substr(0, split_pos);
@@ -159,6 +211,7 @@ void FibpRpcServer::dispatch(msgpack::rpc::request req)
             boost::shared_ptr<RpcRequestContext> context(new RpcRequestContext);
             context->id_ = id;
             rpc_req.req_list.swap(context->req_list_);
+            context->admission_ticket_ = ticket;
             call_single_service_async(req, context);
         }
         else
@@ -4,11 +4,13 @@
 #include <util/driver/writers/JsonWriter.h>
 #include <util/driver/Keys.h>
 #include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
 #include <boost/algorithm/string/classification.hpp>
 #include <boost/algorithm/string/split.hpp>
 #include <boost/algorithm/string/trim.hpp>
 #include <iostream>
 #include <log-manager/FibpLogger.h>
+#include "FibpRoutePriority.h"
 
 using namespace izenelib;
 namespace fibp
@@ -17,8 +19,189 @@ namespace fibp
 static const std::string s_err_rsp_500("HTTP/1.1 500 Internal Server Error\r\n");
 static const std::string s_err_rsp_400("HTTP/1.1 400 Bad Request\r\n");
 static const std::string s_err_rsp_404("HTTP/1.1 404 Not Found\r\n");
+static const std::string s_err_rsp_503("HTTP/1.1 503 Service Unavailable\r\n");
+static const std::string s_err_rsp_504("HTTP/1.1 504 Gateway Timeout\r\n");
+static const std::string s_timeout_key("timeout_ms");
+static const std::string s_priority_key("priority");
 static int s_guess_client_num = 0;
 
+// relay the response of the upstream http service to the client as it arrives,
+// the body is passed through as chunks unless the length is known.
+class HttpConnection::RspStream : public http::response_stream_t
+{
+public:
+    RspStream(HttpConnection& conn, const http::request_t& req)
+        : conn_(conn), keep_alive_(req.keep_alive_),
+        is_http11_(req.http_major_ > 1 || (req.http_major_ == 1 && req.http_minor_ >= 1)),
+        is_head_(req.method_ == http::HEAD), is_started_(false), is_chunked_(false),
+        has_body_(true), is_completed_(false)
+    {
+    }
+    bool on_head(const http::response_t& rsp);
+    bool on_body(const char* data, std::size_t size);
+    bool on_complete();
+    bool is_started() const
+    {
+        return is_started_;
+    }
+    bool is_completed() const
+    {
+        return is_completed_;
+    }
+    bool keep_alive() const
+    {
+        return keep_alive_;
+    }
+
+private:
+    bool write(const std::vector<boost::asio::const_buffer>& bufs);
+
+    HttpConnection& conn_;
+    bool keep_alive_;
+    bool is_http11_;
+    bool is_head_;
+    bool is_started_;
+    bool is_chunked_;
+    // no body for the HEAD request and the 1xx, 204 and 304 responses.
+    bool has_body_;
+    bool is_completed_;
+    std::string head_;
+};
+
+// the headers only meaningful to the upstream connection.
+static bool is_hop_header(const std::string& name)
+{
+    return boost::algorithm::iequals(name, "Connection") ||
+        boost::algorithm::iequals(name, "Keep-Alive") ||
+        boost::algorithm::iequals(name, "Transfer-Encoding") ||
+        boost::algorithm::iequals(name, "Content-Length");
+}
+
+// used if the upstream sent no reason phrase.
+static const char* default_reason(int code)
+{
+    switch(code)
+    {
+    case 100: return "Continue";
+    case 200: return "OK";
+    case 201: return "Created";
+    case 202: return "Accepted";
+    case 204: return "No Content";
+    case 206: return "Partial Content";
+    case 301: return "Moved Permanently";
+    case 302: return "Found";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 401: return "Unauthorized";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 429: return "Too Many Requests";
+    case 500: return "Internal Server Error";
+    case 502: return "Bad Gateway";
+    case 503: return "Service Unavailable";
+    case 504: return "Gateway Timeout";
+    default: break;
+    }
+    if (code < 200)
+        return "Informational";
+    if (code < 300)
+        return "Success";
+    if (code < 400)
+        return "Redirection";
+    if (code < 500)
+        return "Client Error";
+    return "Server Error";
+}
+
+bool HttpConnection::RspStream::on_head(const http::response_t& rsp)
+{
+    is_started_ = true;
+    int code = rsp.code_;
+    bool no_length = (code >= 100 && code < 200) || code == 204;
+    has_body_ = !is_head_ && !no_length && code != 304;
+    // the length of the HEAD and 304 response is of the body not sent.
+    std::string content_len;
+    if (!no_length)
+        content_len = http::find_header_nocase(rsp.headers_, "Content-Length");
+    is_chunked_ = has_body_ && (content_len.empty() ||
+        !http::find_header_nocase(rsp.headers_, "Transfer-Encoding").empty());
+    // the HTTP/1.0 client knows the end of the body without the length by the close.
+    if (is_chunked_ && !is_http11_)
+    {
+        is_chunked_ = false;
+        keep_alive_ = false;
+    }
+    std::ostringstream oss;
+    oss << "HTTP/1.1 " << code << " ";
+    if (rsp.status_message_.empty())
+        oss << default_reason(code);
+    else
+        oss << rsp.status_message_;
+    oss << "\r\n";
+    for(std::size_t i = 0; i < rsp.headers_.size(); ++i)
+    {
+        const http::header_t& h = rsp.headers_[i];
+        if (!is_hop_header(h.first))
+            oss << h.first << ": " << h.second << "\r\n";
+    }
+    if (is_chunked_)
+        oss << "Transfer-Encoding: chunked\r\n";
+    else if (!content_len.empty())
+        oss << "Content-Length: " << content_len << "\r\n";
+    if (keep_alive_)
+        oss << "Connection: keep-alive\r\nKeep-Alive: timeout=100\r\n";
+    else
+        oss << "Connection: close\r\n";
+    oss << "\r\n";
+    head_ = oss.str();
+    std::vector<boost::asio::const_buffer> bufs;
+    bufs.push_back(boost::asio::const_buffer(head_.data(), head_.size()));
+    return write(bufs);
+}
+
+bool HttpConnection::RspStream::on_body(const char* data, std::size_t size)
+{
+    if (!has_body_)
+        return true;
+    std::vector<boost::asio::const_buffer> bufs;
+    char chunk_head[32];
+    if (is_chunked_)
+    {
+        int len = sprintf(chunk_head, "%lx\r\n", (unsigned long)size);
+        bufs.push_back(boost::asio::const_buffer(chunk_head, len));
+    }
+    bufs.push_back(boost::asio::const_buffer(data, size));
+    if (is_chunked_)
+        bufs.push_back(boost::asio::const_buffer("\r\n", 2));
+    return write(bufs);
+}
+
+bool HttpConnection::RspStream::on_complete()
+{
+    if (is_chunked_)
+    {
+        std::vector<boost::asio::const_buffer> bufs;
+        bufs.push_back(boost::asio::const_buffer("0\r\n\r\n", 5));
+        if (!write(bufs))
+            return false;
+    }
+    is_completed_ = true;
+    return true;
+}
+
+// the upstream is not read until the client took the data written.
+bool HttpConnection::RspStream::write(const std::vector<boost::asio::const_buffer>& bufs)
+{
+    boost::system::error_code ec;
+    boost::asio::async_write(conn_.socket_, bufs, boost::fibers::asio::yield[ec]);
+    if (ec)
+    {
+        LOG(INFO) << "relay response to client failed: " << ec.message();
+        return false;
+    }
+    return true;
+}
+
 HttpConnection::HttpConnection(boost::asio::io_service& s,
     const router_ptr& router, fiber_pool_ptr_t pool)
 : socket_(s)
@@ -66,6 +249,11 @@ void HttpConnection::write_error_rsp(const std::string& rsp)
 
 void HttpConnection::write_rsp(context_ptr context)
 {
+    if (context->rsp_stream_ && context->rsp_stream_->is_started())
+    {
+        finish_stream(context);
+        return;
+    }
     if (izenelib::driver::asBool(context->jsonRequest_.header()["check_fibp_time"]))
     {
         context->jsonResponse_[driver::Keys::timers][driver::Keys::total_server_time] = context->serverTimer_.elapsed();
@@ -89,16 +277,29 @@ void HttpConnection::write_rsp(context_ptr context)
     {
         context->rsp_.headers_.push_back(std::make_pair("Connection", "close"));
     }
-    std::ostringstream oss;
-    oss << context->rsp_;
-    boost::asio::async_write(socket_,
-        boost::asio::const_buffers_1(oss.str().data(), oss.str().size()),
-        boost::fibers::asio::yield);
+    std::vector<boost::asio::const_buffer> bufs;
+    prepare_rsp_buffers(context, bufs);
+    boost::asio::async_write(socket_, bufs, boost::fibers::asio::yield);
     FIBP_THREAD_MARK_LOG(0);
 
     after_write(context);
 }
 
+void HttpConnection::finish_stream(context_ptr context)
+{
+    RspStream* stream = static_cast<RspStream*>(context->rsp_stream_.get());
+    FIBP_THREAD_MARK_LOG(0);
+    if (stream->is_completed() && stream->keep_alive())
+    {
+        after_write(context);
+        return;
+    }
+    // the client can only tell the relayed response is broken by the close.
+    boost::system::error_code ec;
+    socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_send, ec);
+    shutdown();
+}
+
 void HttpConnection::async_write_error_rsp(const std::string& rsp)
 {
     std::string final_rsp = rsp + "Content-Length: 0\r\n\r\n";
@@ -134,14 +335,29 @@ void HttpConnection::async_write_rsp(context_ptr context)
     {
         context->rsp_.headers_.push_back(std::make_pair("Connection", "close"));
     }
-    std::ostringstream oss;
-    oss << context->rsp_;
-    boost::asio::async_write(socket_,
-        boost::asio::const_buffers_1(oss.str().data(), oss.str().size()),
+    std::vector<boost::asio::const_buffer> bufs;
+    prepare_rsp_buffers(context, bufs);
+    boost::asio::async_write(socket_, bufs,
         boost::bind(&HttpConnection::after_write, shared_from_this(), context));
     FIBP_THREAD_MARK_LOG(0);
 }
 
+// the body is written from the response directly without copying it
+// into the stream together with the head.
+void HttpConnection::prepare_rsp_buffers(context_ptr context,
+    std::vector<boost::asio::const_buffer>& bufs)
+{
+    std::ostringstream oss;
+    http::write_head(oss, context->rsp_);
+    context->rsp_head_ = oss.str();
+    bufs.push_back(boost::asio::const_buffer(context->rsp_head_.data(), context->rsp_head_.size()));
+    if (!context->rsp_.body_.empty())
+    {
+        bufs.push_back(boost::asio::const_buffer(context->rsp_.body_.data(),
+                context->rsp_.body_.size()));
+    }
+}
+
 void HttpConnection::after_write(context_ptr context)
 {
     FIBP_THREAD_MARK_LOG(0);
@@ -188,6 +404,11 @@ bool HttpConnection::handleRequestFunc(const std::string& controller,
     const std::string& action, context_ptr context)
 {
     //LOG(INFO) << "handle in fiber : " << boost::this_fiber::get_id() << " for conn:" << context.get();
+    if (context->admission_ticket_ && !context->admission_ticket_->on_start())
+    {
+        write_error_rsp(s_err_rsp_503);
+        return false;
+    }
     izenelib::driver::Router::handler_ptr handler = router_->find(
         controller, action);
     if (!handler)
@@ -209,6 +430,9 @@ bool HttpConnection::handleRequestFunc(const std::string& controller,
 
         if (handler->is_async())
         {
+            // the handler calling the single http service can relay the response.
+            context->rsp_stream_.reset(new RspStream(*this, context->req_));
+            http::response_stream_t::set_current(context->rsp_stream_.get());
             handler->invoke_raw_async(
                 context->jsonRequest_,
                 context->jsonResponse_,
@@ -219,6 +443,7 @@ bool HttpConnection::handleRequestFunc(const std::string& controller,
                 path,
                 context->req_.method_
                 );
+            http::response_stream_t::set_current(NULL);
         }
         else
         {
@@ -236,6 +461,7 @@ bool HttpConnection::handleRequestFunc(const std::string& controller,
     }
     catch(const std::exception& e)
     {
+        http::response_stream_t::set_current(NULL);
         LOG(ERROR) << "exception in handler: " << e.what();
         write_error_rsp(s_err_rsp_500);
         return false;
@@ -269,14 +495,47 @@ bool HttpConnection::handleRequest(context_ptr context)
         action = elems.at(1);
     }
 
+    int timeout_ms = 0;
+    std::string timeout = http::find_header_nocase(context->req_.headers_, http::timeout_header);
+    if (!timeout.empty())
+    {
+        try
+        {
+            timeout_ms = boost::lexical_cast<int>(timeout);
+            context->jsonRequest_.header()[s_timeout_key] = timeout_ms;
+        }
+        catch(const boost::bad_lexical_cast& e)
+        {
+            write_error_rsp(s_err_rsp_400);
+            LOG(INFO) << "invalid timeout header : " << timeout;
+            return false;
+        }
+    }
+    int priority = parse_task_priority(
+        http::find_header_nocase(context->req_.headers_, http::priority_header),
+        FibpRoutePriority::get()->get_priority(controller, action));
+    context->jsonRequest_.header()[s_priority_key] = priority;
+
+    context->admission_ticket_ = FibpAdmissionControl::get()->try_admit();
+    if (!context->admission_ticket_)
+    {
+        write_error_rsp(s_err_rsp_503);
+        return false;
+    }
+
     if (fiber_pool_)
     {
         //LOG(INFO) << "schedule_task for " << context.get();
+        uint64_t deadline_us = 0;
+        if (timeout_ms > 0)
+            deadline_us = FiberPool::now_us() + (uint64_t)timeout_ms*1000;
         fiber_pool_->schedule_task(boost::bind(&HttpConnection::handleRequestFunc,
                 shared_from_this(),
                 controller,
                 action,
-                context));
+                context),
+            priority, deadline_us,
+            boost::bind(&HttpConnection::write_error_rsp, shared_from_this(), s_err_rsp_504));
         return true;
     }
     return handleRequestFunc(controller, action, context);
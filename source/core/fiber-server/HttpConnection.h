@@ -44,6 +44,8 @@ public:
     void start();
 
 private:
+    class RspStream;
+
     void async_write_rsp(context_ptr context);
     void async_write_error_rsp(const std::string& rsp);
     context_ptr create_context();
@@ -52,6 +54,10 @@ private:
     void onReadError(const boost::system::error_code& ec);
     void write_error_rsp(const std::string& rsp);
     void write_rsp(context_ptr context);
+    // end the response relayed by the stream.
+    void finish_stream(context_ptr context);
+    void prepare_rsp_buffers(context_ptr context,
+        std::vector<boost::asio::const_buffer>& bufs);
 
     bool handleRequestFunc(const std::string& controller, const std::string& action,
         context_ptr context);
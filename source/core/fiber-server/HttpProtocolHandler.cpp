@@ -340,6 +340,7 @@ struct parser_impl
     int on_msg_begin() {
         resp().clear();
         state_=start;
+        is_streaming_=false;
         return 0;
     }
     int on_url(const char *at, size_t length) {
@@ -378,11 +379,24 @@ struct parser_impl
         return 0;
     }
     int on_headers_complete() {
+        // only the success response is relayed, the others can still be retried.
+        if (stream_ && parser_.status_code == OK)
+        {
+            resp().http_major_ = parser_.http_major;
+            resp().http_minor_ = parser_.http_minor;
+            resp().code_ = OK;
+            resp().keep_alive_ = http_should_keep_alive(&parser_);
+            is_streaming_ = true;
+            if (!stream_->on_head(resp()))
+                return -1;
+        }
         return 0;
     }
     int on_body(const char *at, size_t length) {
-        resp().body_.append(at, length);
         state_=body;
+        if (is_streaming_)
+            return stream_->on_body(at, length) ? 0 : -1;
+        resp().body_.append(at, length);
         return 0;
     }
     int on_msg_complete() {
@@ -392,6 +406,8 @@ struct parser_impl
         resp().code_ = status_code(parser_.status_code);
         resp().keep_alive_ = http_should_keep_alive(&parser_);
         should_continue_=false;
+        // stop here, the data left belongs to the next pipelined response.
+        http_parser_pause(&parser_, 1);
         return 0;
     }
 
@@ -428,10 +444,16 @@ struct parser_impl
     std::string url_;
     parser_state state_;
     bool should_continue_;
-    static const int buf_size = 1024;
+    response_stream_t* stream_;
+    bool is_streaming_;
+    static const int buf_size = 16*1024;
     char buf_[buf_size];
+    // the received data not parsed yet.
+    int buf_pos_;
+    int buf_len_;
     parser_impl(boost::asio::ip::tcp::socket &is, response_t& resp);
-    bool parse(boost::system::error_code& ec);
+    bool parse(boost::system::error_code& ec, response_stream_t* stream);
+    void reset();
 };
 
 http_parser_settings parser_impl::settings_ = {
@@ -446,61 +468,104 @@ http_parser_settings parser_impl::settings_ = {
 };
 
 parser_impl::parser_impl(boost::asio::ip::tcp::socket &is, response_t &resp)
-:is_(is), response_(resp)
+:is_(is), response_(resp), stream_(NULL), is_streaming_(false), buf_pos_(0), buf_len_(0)
 {
     parser_.data = reinterpret_cast<void*>(this);
     http_parser_init(&parser_, HTTP_RESPONSE);
 }
 
-bool parser_impl::parse(boost::system::error_code& ec)
+void parser_impl::reset()
+{
+    http_parser_init(&parser_, HTTP_RESPONSE);
+    buf_pos_ = 0;
+    buf_len_ = 0;
+}
+
+bool parser_impl::parse(boost::system::error_code& ec, response_stream_t* stream)
 {
     should_continue_ = true;
     state_ = none;
+    stream_ = stream;
+    is_streaming_ = false;
     int recved = 0;
     int nparsed = 0;
-    while(is_.is_open())
+    while(buf_len_ > 0 || is_.is_open())
     {
-        recved = is_.async_read_some(boost::asio::mutable_buffers_1(buf_, buf_size),
-            boost::fibers::asio::yield[ec]);
-        if (ec && ec != boost::asio::error::eof)
+        if (buf_len_ == 0)
         {
-            http_parser_init(&parser_, HTTP_RESPONSE);
-            return false;
+            recved = is_.async_read_some(boost::asio::mutable_buffers_1(buf_, buf_size),
+                boost::fibers::asio::yield[ec]);
+            if (ec && ec != boost::asio::error::eof)
+            {
+                reset();
+                return false;
+            }
+            if (recved < 0)
+            {
+                reset();
+                return false;
+            }
+            if (recved == 0)
+            {
+                // closed
+                http_parser_execute(&parser_, &settings_, buf_, recved);
+                reset();
+                break;
+            }
+            buf_pos_ = 0;
+            buf_len_ = recved;
+        }
+        nparsed = http_parser_execute(&parser_, &settings_, buf_ + buf_pos_, buf_len_);
+        if (HTTP_PARSER_ERRNO(&parser_) == HPE_PAUSED)
+        {
+            http_parser_pause(&parser_, 0);
+            buf_pos_ += nparsed;
+            buf_len_ -= nparsed;
         }
-        if (recved < 0)
+        else if (nparsed != buf_len_)
         {
-            http_parser_init(&parser_, HTTP_RESPONSE);
+            std::cerr << http_errno_description(HTTP_PARSER_ERRNO(&parser_)) << std::endl;
+            reset();
             return false;
         }
-        nparsed = http_parser_execute(&parser_, &settings_, buf_, recved);
-        if (recved == 0)
+        else
         {
-            // closed
-            http_parser_init(&parser_, HTTP_RESPONSE);
-            return true;
+            buf_len_ = 0;
         }
 
         if (!should_continue_)
         {
             if (!resp().keep_alive_)
             {
-                http_parser_init(&parser_, HTTP_RESPONSE);
+                reset();
             }
             break;
         }
-        if (nparsed != recved)
-        {
-            std::cerr << http_errno_description(HTTP_PARSER_ERRNO(&parser_)) << std::endl;
-            http_parser_init(&parser_, HTTP_RESPONSE);
+    }
+    if (is_streaming_)
+    {
+        // the relayed body is truncated if the upstream closed before the end.
+        if (state_ != end || !stream_->on_complete())
             return false;
-        }
     }
     return true;
 }
 
 } // namespace response
 
-std::ostream &operator<<(std::ostream &s, response_t &resp)
+static __thread response_stream_t* s_current_stream = NULL;
+
+response_stream_t* response_stream_t::current()
+{
+    return s_current_stream;
+}
+
+void response_stream_t::set_current(response_stream_t* stream)
+{
+    s_current_stream = stream;
+}
+
+std::ostream &write_head(std::ostream &s, const response_t &resp)
 {
     char buf[10];
     sprintf(buf, "%lu", resp.body_.size());
@@ -530,12 +595,19 @@ std::ostream &operator<<(std::ostream &s, response_t &resp)
     {
         s << "Content-Length: " << buf << "\r\n";
     }
-    s << "\r\n" << resp.body_;
+    s << "\r\n";
+    return s;
+}
+
+std::ostream &operator<<(std::ostream &s, response_t &resp)
+{
+    write_head(s, resp);
+    s << resp.body_;
     return s;
 }
 
 // Client side
-std::ostringstream &operator<<(std::ostringstream &s, const request_t &req)
+std::ostream &write_head(std::ostream &s, const request_t &req, std::size_t body_size)
 {
     s << METHOD_STRING[req.method_] << " " << req.path_;
     if (!req.query_.empty())
@@ -547,7 +619,7 @@ std::ostringstream &operator<<(std::ostringstream &s, const request_t &req)
     {
         s << req.headers_[i].first << ": " << req.headers_[i].second << "\r\n";
     }
-    s << "Content-Length: " << req.body_.size() << "\r\n";
+    s << "Content-Length: " << body_size << "\r\n";
     if (req.keep_alive_)
     {
         s << "Connection: Keep-Alive\r\n";
@@ -557,6 +629,12 @@ std::ostringstream &operator<<(std::ostringstream &s, const request_t &req)
         s << "Connection: close\r\n";
     }
     s << "\r\n";
+    return s;
+}
+
+std::ostringstream &operator<<(std::ostringstream &s, const request_t &req)
+{
+    write_head(s, req, req.body_.size());
     if (!req.body_.empty())
     {
         s << req.body_;
@@ -571,7 +649,17 @@ response_parser::response_parser(boost::asio::ip::tcp::socket& socket, response_
 
 bool response_parser::parse_response(boost::system::error_code& ec)
 {
-    return impl_->parse(ec);
+    return impl_->parse(ec, NULL);
+}
+
+bool response_parser::parse_response(boost::system::error_code& ec, response_stream_t* stream)
+{
+    return impl_->parse(ec, stream);
+}
+
+void response_parser::reset()
+{
+    impl_->reset();
 }
 
 } // namespace http
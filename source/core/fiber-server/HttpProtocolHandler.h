@@ -4,12 +4,14 @@
 #include <util/driver/Request.h>
 #include <util/driver/Response.h>
 #include <util/ClockTimer.h>
+#include "FibpAdmissionControl.h"
 
 #include <boost/function.hpp>
 #include <boost/asio.hpp>
 #include <boost/system/error_code.hpp>
 #include <boost/enable_shared_from_this.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/algorithm/string/predicate.hpp>
 
 #include <string>
 #include <vector>
@@ -52,6 +54,23 @@ inline std::string find_header(const headers_t &headers, const std::string &key)
     return "";
 }
 
+inline std::string find_header_nocase(const headers_t &headers, const std::string &key)
+{
+    headers_t::const_iterator it = headers.begin();
+    for(; it != headers.end(); ++it)
+    {
+        if (boost::algorithm::iequals(it->first, key))
+            return it->second;
+    }
+    return "";
+}
+
+// the time in milliseconds the caller is willing to wait, passed to the upstream
+// services so the chained calls share the same deadline.
+static const char* const timeout_header = "X-Fibp-Timeout-Ms";
+// high, normal or low, overrides the priority of the route.
+static const char* const priority_header = "X-Fibp-Priority";
+
 struct request_t 
 {
     short http_major_;
@@ -138,6 +157,28 @@ struct response_t
     }
 };
 
+// receive the response as it is parsed instead of buffering the body, used to
+// relay a large response to the client with the memory bounded by the read buffer.
+// The parsing waits while the callbacks write, so a slow client slows the reading
+// from the upstream too.
+class response_stream_t
+{
+public:
+    virtual ~response_stream_t() {}
+    // the status line and the headers are parsed, return false to abort.
+    virtual bool on_head(const response_t& rsp) = 0;
+    virtual bool on_body(const char* data, std::size_t size) = 0;
+    virtual bool on_complete() = 0;
+    // the response can not be retried or replaced once anything is relayed.
+    virtual bool is_started() const = 0;
+
+    // the stream of the request dispatched to the handler in this thread, only
+    // valid before the handler yields.
+    static response_stream_t* current();
+    static void set_current(response_stream_t* stream);
+};
+typedef boost::shared_ptr<response_stream_t> response_stream_ptr;
+
 struct session_t
 {
     request_t req_;
@@ -145,6 +186,12 @@ struct session_t
     izenelib::driver::Request jsonRequest_;
     izenelib::driver::Response jsonResponse_;
     izenelib::util::ClockTimer serverTimer_;
+    // released after the response is written.
+    FibpAdmissionTicketPtr admission_ticket_;
+    // the status line and headers of rsp_, kept until the response is written.
+    std::string rsp_head_;
+    // relay the response of the single http service, set by the connection.
+    response_stream_ptr rsp_stream_;
     //int count_;
     //int max_keepalive_;
     session_t()
@@ -158,6 +205,9 @@ struct session_t
         jsonRequest_.swap(other.jsonRequest_);
         jsonResponse_.swap(other.jsonResponse_);
         swap(serverTimer_, other.serverTimer_);
+        admission_ticket_.swap(other.admission_ticket_);
+        rsp_head_.swap(other.rsp_head_);
+        rsp_stream_.swap(other.rsp_stream_);
     }
 };
 inline void swap(session_t& r, session_t& l)
@@ -170,6 +220,10 @@ typedef boost::function<void()> close_handler_t;
 typedef boost::function<void(const boost::system::error_code&)> read_error_handler_t;
 
 std::ostream &operator<<(std::ostream &s, response_t &rsp);
+// only the status line and the headers, the body can be written separately
+// without copying it into the stream.
+std::ostream &write_head(std::ostream &s, const response_t &rsp);
+std::ostream &write_head(std::ostream &s, const request_t &req, std::size_t body_size);
 // For client side
 std::ostringstream &operator<<(std::ostringstream &s, const request_t &req);
 
@@ -199,7 +253,13 @@ class response_parser
 {
 public:
     response_parser(boost::asio::ip::tcp::socket& socket, response_t& rsp);
+    // the responses pipelined on the connection are returned one by one.
     bool parse_response(boost::system::error_code& ec);
+    // the body of the 200 response is passed to the stream instead of rsp.body_,
+    // other responses are buffered as usual.
+    bool parse_response(boost::system::error_code& ec, response_stream_t* stream);
+    // drop the unparsed data, called when the connection is reset.
+    void reset();
 private:
     boost::shared_ptr<response::parser_impl> impl_;
 };
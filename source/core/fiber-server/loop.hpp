@@ -4,6 +4,8 @@
 //    (See accompanying file LICENSE_1_0.txt or copy at
 //          http://www.boost.org/LICENSE_1_0.txt)
 
+#include <algorithm>
+
 #include <boost/asio.hpp>
 #include <boost/asio/high_resolution_timer.hpp>
 #include <boost/bind.hpp>
@@ -26,7 +28,12 @@ namespace asio {
 
 inline void timer_handler( h_timer & timer) {
     boost::fibers::fm_yield();
-    timer.expires_at( boost::fibers::fm_next_wakeup() );
+    // the fiber waiting with a deadline may be notified by another fiber before
+    // the deadline, do not block in run_one longer than the wait interval.
+    boost::chrono::high_resolution_clock::time_point wakeup( boost::fibers::fm_next_wakeup() );
+    boost::chrono::high_resolution_clock::time_point max_wakeup(
+        boost::chrono::high_resolution_clock::now() + boost::fibers::fm_wait_interval() );
+    timer.expires_at( (std::min)( wakeup, max_wakeup) );
     timer.async_wait( boost::bind( timer_handler, boost::ref( timer) ) );
 }
 
@@ -0,0 +1,216 @@
+#include "FibpCircuitBreaker.h"
+#include <glog/logging.h>
+#include <boost/chrono/system_clocks.hpp>
+#include <algorithm>
+
+namespace fibp
+{
+
+static const uint32_t CONSECUTIVE_ERRORS_LIMIT = 5;
+// a timeout costs the caller much more than a refused connection.
+static const uint32_t CONSECUTIVE_TIMEOUTS_LIMIT = 3;
+static const uint32_t WINDOW_SIZE = 20;
+static const uint32_t MIN_WINDOW_NUM = 10;
+static const uint32_t WINDOW_ERRORS_LIMIT = WINDOW_SIZE / 2;
+static const uint64_t BASE_EJECT_US = 5*1000*1000;
+static const uint64_t MAX_EJECT_US = 60*1000*1000;
+// allow another probe if the result of the last one never came back.
+static const uint64_t MAX_PROBE_US = 60*1000*1000;
+// the state of the service or the endpoint without any result this long is
+// removed, mostly it is gone from the service discovery.
+static const uint64_t STATE_IDLE_US = 600ULL*1000*1000;
+
+static inline uint64_t now_us()
+{
+    return boost::chrono::duration_cast<boost::chrono::microseconds>(
+        boost::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static inline uint32_t count_bits(uint32_t v)
+{
+    uint32_t num = 0;
+    for(; v; v &= v - 1)
+        ++num;
+    return num;
+}
+
+bool FibpCircuitBreaker::EndpointState::is_idle(uint64_t since_us)
+{
+    boost::mutex::scoped_lock guard(lock);
+    if (state != Closed || last_result_us >= since_us)
+        return false;
+    is_removed = true;
+    return true;
+}
+
+FibpCircuitBreaker::ServiceState::ServiceState()
+    : ejected_num(0), last_result_us(0), endpoints(STATE_IDLE_US)
+{
+}
+
+FibpCircuitBreaker::FibpCircuitBreaker()
+    : services_(STATE_IDLE_US)
+{
+}
+
+bool FibpCircuitBreaker::has_ejected(const std::string& service_name)
+{
+    ServiceStatePtr service = services_.find(service_name);
+    return service && service->ejected_num.load(boost::memory_order_relaxed) > 0;
+}
+
+bool FibpCircuitBreaker::is_available(const std::string& service_name, const std::string& host_key)
+{
+    ServiceStatePtr service = services_.find(service_name);
+    if (!service)
+        return true;
+    EndpointStatePtr ep = service->endpoints.find(host_key);
+    if (!ep)
+        return true;
+    boost::mutex::scoped_lock guard(ep->lock);
+    switch(ep->state)
+    {
+    case Closed:
+        return true;
+    case Open:
+        return now_us() >= ep->retry_at_us;
+    case HalfOpen:
+        return now_us() >= ep->retry_at_us + MAX_PROBE_US;
+    }
+    return true;
+}
+
+void FibpCircuitBreaker::on_select(const std::string& service_name, const std::string& host_key)
+{
+    ServiceStatePtr service = services_.find(service_name);
+    if (!service || service->ejected_num.load(boost::memory_order_relaxed) == 0)
+        return;
+    EndpointStatePtr ep = service->endpoints.find(host_key);
+    if (!ep)
+        return;
+    boost::mutex::scoped_lock guard(ep->lock);
+    if (ep->state == Closed)
+        return;
+    uint64_t now = now_us();
+    if (ep->state == Open && now < ep->retry_at_us)
+        return;
+    LOG(INFO) << "probing the ejected endpoint: " << service_name << ", " << host_key;
+    ep->state = HalfOpen;
+    ep->retry_at_us = now;
+}
+
+bool FibpCircuitBreaker::should_eject(const EndpointState& ep) const
+{
+    if (ep.consecutive_errors >= CONSECUTIVE_ERRORS_LIMIT)
+        return true;
+    if (ep.consecutive_timeouts >= CONSECUTIVE_TIMEOUTS_LIMIT)
+        return true;
+    return ep.window_num >= MIN_WINDOW_NUM && count_bits(ep.window_bits) >= WINDOW_ERRORS_LIMIT;
+}
+
+void FibpCircuitBreaker::eject(ServiceState& service, EndpointState& ep,
+    const std::string& service_name, const std::string& host_key, uint64_t now)
+{
+    if (ep.state == Closed)
+        ++service.ejected_num;
+    if (ep.eject_us == 0)
+        ep.eject_us = BASE_EJECT_US;
+    else if (ep.eject_us < MAX_EJECT_US)
+        ep.eject_us = std::min(ep.eject_us * 2, MAX_EJECT_US);
+    ep.state = Open;
+    ep.retry_at_us = now + ep.eject_us;
+    LOG(INFO) << "endpoint ejected: " << service_name << ", " << host_key <<
+        ", consecutive errors: " << ep.consecutive_errors <<
+        ", consecutive timeouts: " << ep.consecutive_timeouts <<
+        ", recent errors: " << count_bits(ep.window_bits) << "/" << ep.window_num <<
+        ", ejected for(ms): " << ep.eject_us/1000;
+}
+
+void FibpCircuitBreaker::on_result(const std::string& service_name,
+    const std::string& host_key, Result result)
+{
+    ServiceStatePtr service = services_.get(service_name);
+    EndpointStatePtr ep = service->endpoints.get(host_key);
+    boost::mutex::scoped_lock guard(ep->lock);
+    if (ep->is_removed)
+        return;
+    uint64_t now = now_us();
+    ep->last_result_us = now;
+    service->last_result_us.store(now, boost::memory_order_relaxed);
+    if (result == Cancelled)
+    {
+        // let the next request probe again.
+        if (ep->state == HalfOpen)
+        {
+            ep->state = Open;
+            ep->retry_at_us = now;
+        }
+        return;
+    }
+    bool is_failed = result != Success;
+    ep->window_bits = (ep->window_bits << 1) | (is_failed ? 1 : 0);
+    ep->window_bits &= (1u << WINDOW_SIZE) - 1;
+    if (ep->window_num < WINDOW_SIZE)
+        ++ep->window_num;
+    if (!is_failed)
+    {
+        ep->consecutive_errors = 0;
+        ep->consecutive_timeouts = 0;
+        if (ep->state == HalfOpen)
+        {
+            LOG(INFO) << "ejected endpoint is back: " << service_name << ", " << host_key;
+            ep->state = Closed;
+            ep->eject_us = 0;
+            ep->window_bits = 0;
+            ep->window_num = 0;
+            --service->ejected_num;
+        }
+        return;
+    }
+    ++ep->consecutive_errors;
+    if (result == Timeout)
+        ++ep->consecutive_timeouts;
+    if (ep->state == HalfOpen)
+    {
+        eject(*service, *ep, service_name, host_key, now);
+    }
+    else if (ep->state == Closed && should_eject(*ep))
+    {
+        eject(*service, *ep, service_name, host_key, now);
+    }
+    // the late results of the requests sent before ejected are ignored.
+}
+
+FibpCircuitBreaker::State FibpCircuitBreaker::get_state(const std::string& service_name,
+    const std::string& host_key)
+{
+    ServiceStatePtr service = services_.find(service_name);
+    if (!service)
+        return Closed;
+    EndpointStatePtr ep = service->endpoints.find(host_key);
+    if (!ep)
+        return Closed;
+    boost::mutex::scoped_lock guard(ep->lock);
+    return ep->state;
+}
+
+void FibpCircuitBreaker::remove(const std::string& service_name, const std::string& host_key)
+{
+    ServiceStatePtr service = services_.find(service_name);
+    if (!service)
+        return;
+    EndpointStatePtr ep = service->endpoints.find(host_key);
+    if (!ep)
+        return;
+    {
+        boost::mutex::scoped_lock guard(ep->lock);
+        if (ep->is_removed)
+            return;
+        ep->is_removed = true;
+        if (ep->state != Closed)
+            --service->ejected_num;
+    }
+    service->endpoints.erase(host_key);
+}
+
+}
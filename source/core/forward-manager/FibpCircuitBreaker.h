@@ -0,0 +1,97 @@
+#ifndef FIBP_CIRCUIT_BREAKER_H
+#define FIBP_CIRCUIT_BREAKER_H
+
+#include <string>
+#include <stdint.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
+#include "FibpKeyedStatMap.h"
+
+namespace fibp
+{
+
+// the circuit breaker of each (service, host:port). An endpoint is ejected (open) after
+// too many consecutive errors, timeouts or a high error rate, and after the eject
+// time one probe request is allowed (half-open), the endpoint is back (closed) if
+// the probe succeeded, otherwise it is ejected again for a longer time.
+class FibpCircuitBreaker
+{
+public:
+    enum State
+    {
+        Closed,
+        Open,
+        HalfOpen
+    };
+    enum Result
+    {
+        Success,
+        Failure,
+        Timeout,
+        // the request is given up by us, tells nothing about the endpoint.
+        Cancelled
+    };
+
+    FibpCircuitBreaker();
+    // fast path, no need to check the endpoints if nothing of the service is ejected.
+    bool has_ejected(const std::string& service_name);
+    // closed, or open long enough to be probed.
+    bool is_available(const std::string& service_name, const std::string& host_key);
+    // the request to the chosen endpoint will be the probe if the endpoint is open.
+    void on_select(const std::string& service_name, const std::string& host_key);
+    void on_result(const std::string& service_name, const std::string& host_key, Result result);
+    State get_state(const std::string& service_name, const std::string& host_key);
+    // the endpoint gone from the service, it no longer counts as ejected.
+    void remove(const std::string& service_name, const std::string& host_key);
+
+private:
+    struct EndpointState
+    {
+        EndpointState()
+            : state(Closed), consecutive_errors(0), consecutive_timeouts(0),
+            window_bits(0), window_num(0), eject_us(0), retry_at_us(0),
+            last_result_us(0), is_removed(false)
+        {
+        }
+        // closed and no result for long, the one idle is marked removed so the
+        // late result on it will not eject it without being counted.
+        bool is_idle(uint64_t since_us);
+        boost::mutex lock;
+        State state;
+        uint32_t consecutive_errors;
+        uint32_t consecutive_timeouts;
+        // the recent results, a bit set means failed.
+        uint32_t window_bits;
+        uint32_t window_num;
+        uint64_t eject_us;
+        uint64_t retry_at_us;
+        uint64_t last_result_us;
+        bool is_removed;
+    };
+    typedef FibpKeyedStatMap<EndpointState>::StatPtr EndpointStatePtr;
+
+    struct ServiceState
+    {
+        ServiceState();
+        bool is_idle(uint64_t since_us) const
+        {
+            return ejected_num.load(boost::memory_order_relaxed) == 0 &&
+                last_result_us.load(boost::memory_order_relaxed) < since_us;
+        }
+        boost::atomic<int> ejected_num;
+        boost::atomic<uint64_t> last_result_us;
+        FibpKeyedStatMap<EndpointState> endpoints;
+    };
+    typedef FibpKeyedStatMap<ServiceState>::StatPtr ServiceStatePtr;
+
+    bool should_eject(const EndpointState& ep) const;
+    void eject(ServiceState& service, EndpointState& ep,
+        const std::string& service_name, const std::string& host_key, uint64_t now);
+
+    FibpKeyedStatMap<ServiceState> services_;
+};
+
+}
+
+#endif
@@ -1,10 +1,15 @@
 #include "FibpClient.h"
 #include "FibpClientFuture.h"
+#include "FibpResolverCache.h"
 #include <boost/fiber/all.hpp>
 #include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/chrono/system_clocks.hpp>
 #include <fiber-server/yield.hpp>
 #include <glog/logging.h>
 #include <3rdparty/msgpack/msgpack.hpp>
+#include <sys/socket.h>
+#include <errno.h>
 
 namespace ba = boost::asio;
 namespace bs = boost::system;
@@ -13,7 +18,16 @@ namespace fibp
 {
 
 static const std::string TIMEOUT_ERR("Server Timed Out.");
+static const std::string RELAY_BROKEN_ERR("Response Relay Broken.");
 static const std::string SERVER_RSP_TOO_LARGE_ERR("Server Response Too Large.");
+// do not pipeline to the host which closed the pipelined connection recently.
+static const time_t PIPELINE_FALLBACK_SECS = 60;
+
+static inline uint64_t now_us()
+{
+    return boost::chrono::duration_cast<boost::chrono::microseconds>(
+        boost::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
 static const uint8_t RPC_REQ = 0;
 static const uint8_t RPC_RSP = 1;
@@ -27,6 +41,23 @@ struct msg_rpc
     MSGPACK_DEFINE(type);
 };
 
+// the packed head of the rpc request before the method name, the name and the
+// param are sent after it as they are.
+struct RpcHeadBuffer
+{
+    RpcHeadBuffer()
+        : size(0)
+    {
+    }
+    void write(const char* buf, std::size_t len)
+    {
+        memcpy(data + size, buf, len);
+        size += len;
+    }
+    char data[32];
+    std::size_t size;
+};
+
 struct msg_request
 {
     msg_request()
@@ -60,18 +91,69 @@ struct msg_response
     MSGPACK_DEFINE(type, msgid, err, result);
 };
 
+// skip [type, msgid, nil] of the packed response, return the beginning of the
+// result or NULL if not packed in the usual way.
+static const char* skip_rsp_head(const char* p, const char* end)
+{
+    static const std::size_t uint_size[] = {2, 3, 5, 9};
+    if (end - p < 3 || (uint8_t)*p != 0x94)
+        return NULL;
+    ++p;
+    for(int i = 0; i < 2; ++i)
+    {
+        uint8_t c = *p;
+        if (c < 0x80)
+            p += 1;
+        else if (c >= 0xcc && c <= 0xcf)
+            p += uint_size[c - 0xcc];
+        else if (c >= 0xd0 && c <= 0xd3)
+            p += uint_size[c - 0xd0];
+        else
+            return NULL;
+        if (p >= end)
+            return NULL;
+    }
+    if ((uint8_t)*p != 0xc0)
+        return NULL;
+    ++p;
+    return p < end ? p : NULL;
+}
+
 ClientSession::ClientSession(boost::asio::io_service& service, const std::string& host, const std::string& port)
-    : socket_(service), conn_to_(5000), read_to_(5000), io_(service), deadline_(service), host_(host), port_(port)
+    : socket_(service), conn_to_(5000), read_to_(5000), io_(service), wheel_(FibpTimerWheel::get(service)),
+    host_(host), port_(port), is_ip_host_(false), is_writing_(false)
 {
     connecting_ = false;
-    deadline_.expires_at(boost::posix_time::pos_infin);
+    bs::error_code ec;
+    ba::ip::address addr = ba::ip::address::from_string(host_, ec);
+    if (!ec)
+    {
+        try
+        {
+            endpoint_ = ba::ip::tcp::endpoint(addr, boost::lexical_cast<uint16_t>(port_));
+            is_ip_host_ = true;
+        }
+        catch(const std::exception& e)
+        {
+            // the service name as the port is resolved.
+        }
+    }
 }
 
 bool ClientSession::send_data(const std::string& reqdata)
 {
-    while (connecting_)
+    std::vector<ba::const_buffer> bufs;
+    bufs.push_back(ba::const_buffer(reqdata.data(), reqdata.size()));
+    return send_data(bufs);
+}
+
+bool ClientSession::ensure_connected()
+{
+    if (connecting_)
     {
-        boost::this_fiber::yield();
+        boost::unique_lock<boost::fibers::mutex> guard(connect_mutex_);
+        while (connecting_)
+            connect_cond_.wait(guard);
     }
     if (!socket_.is_open())
     {
@@ -82,47 +164,90 @@ bool ClientSession::send_data(const std::string& reqdata)
             return false;
         }
     }
-    return async_write(reqdata);
+    return true;
+}
+
+bool ClientSession::send_data(const std::vector<ba::const_buffer>& bufs)
+{
+    if (!ensure_connected())
+        return false;
+    return async_write(bufs);
+}
+
+bool ClientSession::send_data_coalesced(const std::vector<ba::const_buffer>& bufs)
+{
+    if (!ensure_connected())
+        return false;
+    OutFrame frame(bufs);
+    out_queue_.push_back(&frame);
+    if (!is_writing_)
+    {
+        // the first one writes for all, let the others ready in this round queue theirs.
+        is_writing_ = true;
+        boost::this_fiber::yield();
+        write_queued();
+        is_writing_ = false;
+    }
+    else
+    {
+        boost::unique_lock<boost::fibers::mutex> guard(write_mutex_);
+        while (!frame.is_done)
+            write_cond_.wait(guard);
+    }
+    return frame.is_sent;
+}
+
+void ClientSession::write_queued()
+{
+    std::vector<OutFrame*> frames;
+    while (!out_queue_.empty())
+    {
+        frames.clear();
+        frames.swap(out_queue_);
+        out_bufs_.clear();
+        for(std::size_t i = 0; i < frames.size(); ++i)
+        {
+            out_bufs_.insert(out_bufs_.end(), frames[i]->bufs.begin(), frames[i]->bufs.end());
+        }
+        // asio writes the buffers by writev.
+        bool ret = async_write(out_bufs_);
+        for(std::size_t i = 0; i < frames.size(); ++i)
+        {
+            frames[i]->is_sent = ret;
+            frames[i]->is_done = true;
+        }
+        write_cond_.notify_all();
+    }
 }
 
 void ClientSession::prepare_timeout(int msec)
 {
     if (msec == 0)
         return;
-    deadline_.expires_from_now(boost::posix_time::milliseconds(msec));
-    deadline_.async_wait(boost::bind(&ClientSession::check_deadline, this, _1));
+    wheel_.arm(deadline_, msec, &ClientSession::on_deadline, this);
 }
 
 void ClientSession::clear_timeout()
 {
-    deadline_.expires_at(boost::posix_time::pos_infin);
     deadline_.cancel();
 }
 
-void ClientSession::check_deadline(const boost::system::error_code& ec)
+void ClientSession::on_deadline(void* arg)
 {
-    if (ec == boost::asio::error::operation_aborted)
-    {
-        deadline_.expires_at(boost::posix_time::pos_infin);
-        return;
-    }
-    if (deadline_.expires_at() <= boost::asio::deadline_timer::traits_type::now())
+    ClientSession* session = (ClientSession*)arg;
+    //LOG(INFO) << "deadline happened.";
+    try
     {
-        //LOG(INFO) << "deadline happened.";
-        try
-        {
-            socket_.cancel();
-            if (socket_.is_open())
-            {
-                shutdown(true);
-            }
-            deadline_.expires_at(boost::posix_time::pos_infin);
-        }
-        catch(const boost::system::system_error& e)
+        session->socket_.cancel();
+        if (session->socket_.is_open())
         {
-            LOG(ERROR) << "check deadline error: " << e.what();
+            session->shutdown(true);
         }
     }
+    catch(const boost::system::system_error& e)
+    {
+        LOG(ERROR) << "check deadline error: " << e.what();
+    }
 }
 
 bs::error_code ClientSession::async_connect()
@@ -132,14 +257,22 @@ bs::error_code ClientSession::async_connect()
     bs::error_code ec;
     try
     {
-        ba::ip::tcp::resolver resolver(io_);
-        ba::ip::tcp::resolver::query q(host_, port_);
-        ba::ip::tcp::resolver::iterator iter = resolver.resolve(q);
-
-        prepare_timeout(conn_to_);
-
         time_t s = time(NULL);
-        ba::async_connect(socket_, iter, boost::fibers::asio::yield[ec]);
+        if (is_ip_host_)
+        {
+            prepare_timeout(conn_to_);
+            socket_.async_connect(endpoint_, boost::fibers::asio::yield[ec]);
+        }
+        else
+        {
+            ba::ip::tcp::resolver::iterator iter;
+            ec = FibpResolverCache::get()->resolve(io_, host_, port_, iter);
+            if (!ec)
+            {
+                prepare_timeout(conn_to_);
+                ba::async_connect(socket_, iter, boost::fibers::asio::yield[ec]);
+            }
+        }
         ret = socket_.is_open() && !ec;
         time_t e = time(NULL);
         if (e - s > 1)
@@ -157,16 +290,38 @@ bs::error_code ClientSession::async_connect()
         shutdown(true);
     }
     connecting_ = false;
+    connect_cond_.notify_all();
     return ec;
 }
 
-bool ClientSession::async_write(const std::string& reqdata)
+bool ClientSession::warm_up()
+{
+    if (connecting_ || socket_.is_open())
+        return true;
+    return !async_connect() && socket_.is_open();
+}
+
+bool ClientSession::check_alive()
+{
+    if (connecting_)
+        return true;
+    if (!socket_.is_open())
+        return false;
+    char c;
+    ssize_t ret = ::recv(socket_.native_handle(), &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return true;
+    // closed, failed or the data left from the last response.
+    shutdown(true);
+    return false;
+}
+
+bool ClientSession::async_write(const std::vector<ba::const_buffer>& bufs)
 {
     try
     {
         bs::error_code ec;
-        ba::async_write(socket_, boost::asio::const_buffers_1(reqdata.data(), reqdata.size()),
-            boost::fibers::asio::yield[ec]);
+        ba::async_write(socket_, bufs, boost::fibers::asio::yield[ec]);
 
         if (ec)
         {
@@ -248,6 +403,11 @@ FibpClientBase::FibpClientBase(boost::asio::io_service& io_service, const std::s
 
 }
 
+bool FibpClientBase::warm_up()
+{
+    return session_->warm_up();
+}
+
 std::string FibpClientBase::host() const
 {
     return session_->host();
@@ -260,7 +420,8 @@ std::string FibpClientBase::port() const
 
 
 FibpHttpClient::FibpHttpClient(boost::asio::io_service& io_service, const std::string& host, const std::string& port)
-    : session_(new ClientSession(io_service, host, port)), rsp_parser_(session_->socket_, next_rsp_), can_retry_(true)
+    : session_(new ClientSession(io_service, host, port)), rsp_parser_(session_->socket_, next_rsp_), can_retry_(true),
+    create_us_(now_us())
 {
 }
 
@@ -278,6 +439,14 @@ std::string FibpHttpClient::port() const
 bool FibpHttpClient::send_http_request(
     http::request_t& http_req,
     int timeout_ms)
+{
+    return send_http_request(http_req, http_req.body_, timeout_ms);
+}
+
+bool FibpHttpClient::send_http_request(
+    http::request_t& http_req,
+    const std::string& reqdata,
+    int timeout_ms)
 {
     can_retry_ = true;
     session_->set_timeout(timeout_ms*2, timeout_ms);
@@ -285,11 +454,16 @@ bool FibpHttpClient::send_http_request(
     http_req.headers_.push_back(std::make_pair("Host", session_->host()+":"+session_->port()));
     request_stream_.clear();
     request_stream_.str(std::string());
-    request_stream_ << http_req;
+    http::write_head(request_stream_, http_req, reqdata.size());
+    const std::string& head = request_stream_.str();
 
     //LOG(INFO) << "sending to: " << session_->host() << ":" << session_->port() <<
-    //    ", request: " << request_stream_.str();
-    bool ret = session_->send_data(request_stream_.str());
+    //    ", request: " << head;
+    std::vector<ba::const_buffer> bufs;
+    bufs.push_back(ba::const_buffer(head.data(), head.size()));
+    if (!reqdata.empty())
+        bufs.push_back(ba::const_buffer(reqdata.data(), reqdata.size()));
+    bool ret = session_->send_data(bufs);
     return ret;
 }
 
@@ -332,11 +506,8 @@ bool FibpHttpClient::get_http_response(http::response_t& http_rsp)
     return false;
 }
 
-bool FibpHttpClient::send_request(
-    const std::string& path,
-    http::method method,
-    const std::string& reqdata,
-    int timeout_ms)
+static void init_http_request(const std::string& path, http::method method,
+    int timeout_ms, http::request_t& http_request)
 {
     // generate the request data for HTTP.
     std::string query;
@@ -348,38 +519,61 @@ bool FibpHttpClient::send_request(
         query = path.substr(pos + 1);
     }
 
-    //LOG(INFO) << "http path: " << path_without_query << ", query:" << query <<
-    //    ", data:" << reqdata;
+    //LOG(INFO) << "http path: " << path_without_query << ", query:" << query;
 
-    http::request_t http_request;
     http_request.method_ = method;
     http_request.path_ = path_without_query;
     http_request.query_ = query;
     http_request.keep_alive_ = true;
-    http_request.body_ = reqdata;
+    if (timeout_ms > 0)
+    {
+        http_request.headers_.push_back(std::make_pair(http::timeout_header,
+                boost::lexical_cast<std::string>(timeout_ms)));
+    }
+}
 
-    bool ret = send_http_request(http_request, timeout_ms);
+bool FibpHttpClient::send_request(
+    const std::string& path,
+    http::method method,
+    const std::string& reqdata,
+    int timeout_ms)
+{
+    abort_err_.clear();
+    http::request_t http_request;
+    init_http_request(path, method, timeout_ms, http_request);
+    bool ret = send_http_request(http_request, reqdata, timeout_ms);
     return ret;
 }
 
 bool FibpHttpClient::get_response(std::string& rsp)
+{
+    return get_response(rsp, NULL);
+}
+
+bool FibpHttpClient::get_response(std::string& rsp, http::response_stream_t* stream)
 {
     can_retry_ = true;
+    if (!abort_err_.empty())
+    {
+        rsp.swap(abort_err_);
+        abort_err_.clear();
+        return false;
+    }
     // parse the HTTP response to json response data.
     session_->prepare_timeout(session_->read_to_);
     next_rsp_.clear();
     boost::system::error_code ec;
-    bool ret = rsp_parser_.parse_response(ec);
+    bool ret = rsp_parser_.parse_response(ec, stream);
     session_->clear_timeout();
-    if (!next_rsp_.keep_alive_ || ec == boost::asio::error::eof
-        || ec == boost::asio::error::operation_aborted)
+    // the connection is not usable after the failed reading.
+    if (!ret || ec || !next_rsp_.keep_alive_)
     {
         LOG(INFO) << "http session closed.";
         session_->shutdown(true);
     }
     if (ret && next_rsp_.code_ == http::OK)
     {
-        rsp = next_rsp_.body_;
+        rsp.swap(next_rsp_.body_);
         return true;
     }
     else
@@ -391,16 +585,234 @@ bool FibpHttpClient::get_response(std::string& rsp)
             can_retry_ = false;
         }
         rsp = next_rsp_.status_message_;
+        if (stream && stream->is_started())
+        {
+            rsp = RELAY_BROKEN_ERR;
+        }
         if (ec == boost::asio::error::operation_aborted)
         {
             rsp = TIMEOUT_ERR;
         }
+        if (!abort_err_.empty())
+        {
+            can_retry_ = true;
+            rsp.swap(abort_err_);
+            abort_err_.clear();
+        }
+        // the client got part of the response already.
+        if (stream && stream->is_started())
+        {
+            can_retry_ = false;
+        }
     }
     return false;
 }
 
+void FibpHttpClient::cancel()
+{
+    session_->shutdown(true);
+}
+
+void FibpHttpClient::abort(const std::string& errinfo)
+{
+    abort_err_ = errinfo;
+    session_->shutdown(true);
+}
+
+FibpHttpPipelineClient::FibpHttpPipelineClient(boost::asio::io_service& io_service,
+    const std::string& host, const std::string& port, std::size_t max_depth)
+    : session_(new ClientSession(io_service, host, port)), rsp_parser_(session_->socket_, next_rsp_),
+    max_depth_(max_depth), broken_time_(0)
+{
+}
+
+FibpHttpPipelineClient::~FibpHttpPipelineClient()
+{
+    session_->shutdown(true);
+}
+
+std::string FibpHttpPipelineClient::host() const
+{
+    return session_->host();
+}
+
+std::string FibpHttpPipelineClient::port() const
+{
+    return session_->port();
+}
+
+bool FibpHttpPipelineClient::warm_up()
+{
+    boost::unique_lock<boost::fibers::mutex> guard(write_mutex_);
+    return session_->warm_up();
+}
+
+void FibpHttpPipelineClient::close(const std::string& errinfo)
+{
+    boost::unique_lock<boost::fibers::mutex> guard(write_mutex_);
+    session_->shutdown(true);
+    rsp_parser_.reset();
+    std::deque<PendingReqPtr> failed_list;
+    failed_list.swap(pending_);
+    for(std::size_t i = 0; i < failed_list.size(); ++i)
+    {
+        PendingReqPtr req = failed_list[i];
+        if (req->future->is_done())
+            continue;
+        std::string err(errinfo);
+        req->future->set_result(err, false, i == 0 || !req->is_sent);
+    }
+}
+
+bool FibpHttpPipelineClient::can_send() const
+{
+    if (broken_time_ != 0 && time(NULL) - broken_time_ < PIPELINE_FALLBACK_SECS)
+        return false;
+    return pending_.size() < max_depth_;
+}
+
+bool FibpHttpPipelineClient::write_request(PendingReq& req, const std::string& body)
+{
+    if (!session_->socket_.is_open())
+    {
+        // the data left from the last connection is useless.
+        rsp_parser_.reset();
+    }
+    std::vector<ba::const_buffer> bufs;
+    bufs.push_back(ba::const_buffer(req.head.data(), req.head.size()));
+    if (!body.empty())
+        bufs.push_back(ba::const_buffer(body.data(), body.size()));
+    req.is_sent = session_->send_data(bufs);
+    return req.is_sent;
+}
+
+FibpClientFuturePtr FibpHttpPipelineClient::send_request(
+    const std::string& path,
+    http::method method,
+    const std::string& reqdata,
+    int timeout_ms)
+{
+    http::request_t http_request;
+    init_http_request(path, method, timeout_ms, http_request);
+    http_request.headers_.push_back(std::make_pair("Host", session_->host()+":"+session_->port()));
+    std::ostringstream oss;
+    http::write_head(oss, http_request, reqdata.size());
+
+    PendingReqPtr req(new PendingReq());
+    req->future.reset(new FibpClientFuture(session_->get_io_service(), 0, timeout_ms));
+    req->head = oss.str();
+    // replaying the non-idempotent request may apply it twice.
+    req->can_replay = (method == http::GET || method == http::HEAD ||
+        method == http::PUT || method == http::DELETE);
+    if (req->can_replay)
+        req->body = reqdata;
+    {
+        boost::unique_lock<boost::fibers::mutex> guard(write_mutex_);
+        pending_.push_back(req);
+        if (!write_request(*req, reqdata))
+        {
+            // the reading fiber will fail the requests left on the connection.
+            if (!pending_.empty() && pending_.back() == req)
+                pending_.pop_back();
+            return FibpClientFuturePtr();
+        }
+    }
+    if (!reading_fiber_)
+    {
+        reading_fiber_.reset(new boost::fibers::fiber(boost::bind(&FibpHttpPipelineClient::handle_read, this)));
+        reading_fiber_->detach();
+    }
+    return req->future;
+}
+
+bool FibpHttpPipelineClient::get_response(FibpClientFuturePtr f, std::string& rsp, bool& can_retry)
+{
+    bool ret = f->getRsp(rsp, can_retry);
+    if (!f->is_done())
+    {
+        // the responses behind are blocked by the timed out one.
+        f->cancel();
+        session_->shutdown(true);
+    }
+    return ret;
+}
+
+void FibpHttpPipelineClient::handle_read()
+{
+    while(!pending_.empty())
+    {
+        std::string errinfo;
+        boost::system::error_code ec;
+        next_rsp_.clear();
+        bool ret = session_->socket_.is_open() && rsp_parser_.parse_response(ec);
+        if (!ret || ec)
+        {
+            errinfo = ec ? ec.message() : std::string("Http Connection Failed.");
+            if (ec == boost::asio::error::operation_aborted)
+                errinfo = TIMEOUT_ERR;
+        }
+        else if (!pending_.empty())
+        {
+            PendingReqPtr req = pending_.front();
+            pending_.pop_front();
+            bool is_success = next_rsp_.code_ == http::OK;
+            bool can_retry = !(next_rsp_.code_ == http::BAD_REQUEST ||
+                next_rsp_.code_ == http::NOT_FOUND);
+            std::string rsp;
+            if (is_success)
+                rsp.swap(next_rsp_.body_);
+            else
+                rsp = next_rsp_.status_message_;
+            req->future->set_result(rsp, is_success, can_retry);
+            if (!next_rsp_.keep_alive_)
+            {
+                errinfo = "Connection Closed.";
+            }
+        }
+        if (!errinfo.empty())
+        {
+            replay_pending(errinfo);
+        }
+    }
+    reading_fiber_.reset();
+}
+
+void FibpHttpPipelineClient::replay_pending(const std::string& errinfo)
+{
+    boost::unique_lock<boost::fibers::mutex> guard(write_mutex_);
+    session_->shutdown(true);
+    rsp_parser_.reset();
+    if (pending_.size() > 1)
+    {
+        LOG(INFO) << "http pipeline closed with " << pending_.size() << " requests pending: "
+            << session_->host() << ":" << session_->port() << ", " << errinfo;
+        broken_time_ = time(NULL);
+    }
+    std::deque<PendingReqPtr> failed_list;
+    failed_list.swap(pending_);
+    for(std::size_t i = 0; i < failed_list.size(); ++i)
+    {
+        PendingReqPtr req = failed_list[i];
+        if (req->future->is_done())
+            continue;
+        if (req->can_replay && req->is_sent)
+        {
+            // only replay once.
+            req->can_replay = false;
+            pending_.push_back(req);
+            if (write_request(*req, req->body))
+                continue;
+            pending_.pop_back();
+        }
+        // the same as the normal client for the first one, the others behind
+        // may have been handled by the upstream if sent.
+        std::string err(errinfo);
+        req->future->set_result(err, false, i == 0 || !req->is_sent);
+    }
+}
+
 FibpRpcClient::FibpRpcClient(boost::asio::io_service& io_service, const std::string& host, const std::string& port)
-    : FibpClientBase(io_service, host, port), fid_(0)
+    : FibpClientBase(io_service, host, port), fid_(0), is_split_(false), inflight_(io_service)
 {
     rpc_pac_.reset(new msgpack::unpacker());
     rpc_buf_.reset(new msgpack::sbuffer());
@@ -420,15 +832,18 @@ FibpClientFuturePtr FibpRpcClient::send_request(
     // path is used as method name in the rpc call.
     uint32_t msgid = ++fid_;
 
-    msg_request rpc_req;
-    rpc_req.msgid = msgid;
-    rpc_req.method = path;
-    rpc_req.packed_param = reqdata;
-    rpc_buf_->clear();
-    msgpack::packer<msgpack::sbuffer> pk(rpc_buf_.get());
-    rpc_req.pack(pk);
-    std::string packed_senddata;
-    packed_senddata.assign(rpc_buf_->data(), rpc_buf_->size());
+    // [type, msgid, method, param], the param is already packed, the method
+    // and the param are sent after the head without copying.
+    RpcHeadBuffer head;
+    msgpack::packer<RpcHeadBuffer> pk(head);
+    pk.pack_array(4);
+    pk.pack(RPC_REQ);
+    pk.pack(msgid);
+    pk.pack_raw(path.size());
+    std::vector<ba::const_buffer> bufs;
+    bufs.push_back(ba::const_buffer(head.data, head.size));
+    bufs.push_back(ba::const_buffer(path.data(), path.size()));
+    bufs.push_back(ba::const_buffer(reqdata.data(), reqdata.size()));
 
     //LOG(INFO) << "begin send rpc request : " << msgid;
     //LOG(INFO) << "rpc packed data: " << packed_senddata_.size();
@@ -437,12 +852,11 @@ FibpClientFuturePtr FibpRpcClient::send_request(
     //    printf(" %02x", (unsigned char)(packed_senddata_[i]));
     //}
     //printf("\n");
-    FibpClientFuturePtr f(new FibpClientFuture(session_->get_io_service(), msgid, timeout_ms));
-    future_list_[msgid] = f;
-    bool ret = session_->send_data(packed_senddata);
+    FibpClientFuturePtr f = inflight_.add(msgid, timeout_ms);
+    bool ret = session_->send_data_coalesced(bufs);
     if (!ret)
     {
-        future_list_.erase(msgid);
+        inflight_.remove(msgid);
         return FibpClientFuturePtr();
     }
 
@@ -464,6 +878,10 @@ void FibpRpcClient::handle_read()
         if (rpc_pac_->execute())
         {
             msgpack::object msg = rpc_pac_->data();
+            // the whole response is still in the buffer until the next read.
+            const char* msg_end = rpc_pac_->nonparsed_buffer();
+            const char* msg_begin = is_split_ ? NULL : msg_end - rpc_pac_->parsed_size();
+            is_split_ = false;
             msgpack::auto_zone z(rpc_pac_->release_zone());
             rpc_pac_->reset();
 
@@ -472,12 +890,19 @@ void FibpRpcClient::handle_read()
             try
             {
                 msg.convert(&rpc_rsp);
+                const char* result_begin = NULL;
                 if (!rpc_rsp.err.is_nil())
                 {
                     rsp.clear();
                     rpc_rsp.err.convert(&rsp);
                     ret = false;
                 }
+                else if (msg_begin && (result_begin = skip_rsp_head(msg_begin, msg_end)) != NULL)
+                {
+                    // the result is the last of the response, take its packed bytes as is.
+                    rsp.assign(result_begin, msg_end - result_begin);
+                    ret = true;
+                }
                 else
                 {
                     rpc_buf_->clear();
@@ -501,7 +926,11 @@ void FibpRpcClient::handle_read()
         }
 
         bs::error_code ec;
+        const char* parsing = rpc_pac_->nonparsed_buffer();
         rpc_pac_->reserve_buffer(1024*32);
+        // the parsed part of the response is left in the old buffer if moved.
+        if (rpc_pac_->parsed_size() > 0 && rpc_pac_->nonparsed_buffer() != parsing)
+            is_split_ = true;
         std::size_t bytes_read = 0;
         //LOG(INFO) << "begin read rpc data.";
         bytes_read = session_->socket_.async_read_some(
@@ -558,32 +987,32 @@ void FibpRpcClient::handle_read()
 
 rpc_fail:
     rpc_pac_.reset(new msgpack::unpacker());
+    is_split_ = false;
     session_->shutdown(true);
     LOG(INFO) << "read error :" << rsp;
     set_all_error(rsp);
     reading_fiber_.reset();
 }
 
-void FibpRpcClient::set_response(uint32_t msgid, const std::string& rsp, bool is_success, bool can_retry)
+void FibpRpcClient::set_response(uint32_t msgid, std::string& rsp, bool is_success, bool can_retry)
 {
-    FibpClientFuturePtr f = future_list_[msgid];
+    FibpClientFuturePtr f = inflight_.remove(msgid);
     if (f)
     {
         f->set_result(rsp, is_success, can_retry);
     }
-    future_list_.erase(msgid);
     //LOG(INFO) << "future ready: " << msgid << " in fiber:" << boost::this_fiber::get_id();
 }
 
+void FibpRpcClient::close(const std::string& errinfo)
+{
+    set_all_error(errinfo);
+    session_->shutdown(true);
+}
+
 void FibpRpcClient::set_all_error(const std::string& errinfo)
 {
-    for(FutureListT::iterator it = future_list_.begin();
-        it != future_list_.end(); ++it)
-    {
-        if (it->second)
-            it->second->set_result(errinfo, false, true);
-    }
-    future_list_.clear();
+    inflight_.set_all_error(errinfo);
 }
 
 bool FibpRpcClient::get_response(FibpClientFuturePtr f, std::string& rsp, bool& can_retry)
@@ -650,7 +1079,7 @@ rpc_fail_get:
 }
 
 FibpRawClient::FibpRawClient(boost::asio::io_service& io_service, const std::string& host, const std::string& port)
-    : FibpClientBase(io_service, host, port), fid_(0)
+    : FibpClientBase(io_service, host, port), fid_(0), inflight_(io_service)
 {
 }
 
@@ -705,27 +1134,24 @@ void FibpRawClient::handle_read()
     reading_fiber_.reset();
 }
 
-void FibpRawClient::set_response(uint32_t msgid, const std::string& rsp, bool is_success, bool can_retry)
+void FibpRawClient::set_response(uint32_t msgid, std::string& rsp, bool is_success, bool can_retry)
 {
-    FibpClientFuturePtr f = future_list_[msgid];
+    FibpClientFuturePtr f = inflight_.remove(msgid);
     if (f)
     {
         f->set_result(rsp, is_success, can_retry);
     }
-    future_list_.erase(msgid);
+}
+
+void FibpRawClient::close(const std::string& errinfo)
+{
+    set_all_error(errinfo);
+    session_->shutdown(true);
 }
 
 void FibpRawClient::set_all_error(const std::string& errinfo)
 {
-    for(FutureListT::iterator it = future_list_.begin();
-        it != future_list_.end(); ++it)
-    {
-        if (it->second)
-        {
-            it->second->set_result(errinfo, false, true);
-        }
-    }
-    future_list_.clear();
+    inflight_.set_all_error(errinfo);
 }
 
 bool FibpRawClient::readRpsHeader(std::string& rsp)
@@ -793,19 +1219,17 @@ FibpClientFuturePtr FibpRawClient::send_request(
     uint32_t fid = ++fid_;
     uint32_t len = reqdata.size();
 
-    std::string packed_senddata;
-    uint32_t fid_n = htonl(fid);
-    len = htonl(len);
-    packed_senddata.resize(sizeof(fid_n) + sizeof(len) + reqdata.size());
-    memcpy(&packed_senddata[0], &fid_n, sizeof(fid_n));
-    memcpy(&packed_senddata[0] + sizeof(fid_n), &len, sizeof(len));
-    memcpy(&packed_senddata[0] + sizeof(fid_n) + sizeof(len), &reqdata[0], reqdata.size());
-    FibpClientFuturePtr f(new FibpClientFuture(session_->get_io_service(), fid, timeout_ms));
-    future_list_[fid] = f;
-    bool ret = session_->send_data(packed_senddata);
+    uint32_t header[2];
+    header[0] = htonl(fid);
+    header[1] = htonl(len);
+    std::vector<ba::const_buffer> bufs;
+    bufs.push_back(ba::const_buffer(header, sizeof(header)));
+    bufs.push_back(ba::const_buffer(reqdata.data(), reqdata.size()));
+    FibpClientFuturePtr f = inflight_.add(fid, timeout_ms);
+    bool ret = session_->send_data_coalesced(bufs);
     if (!ret)
     {
-        future_list_.erase(fid);
+        inflight_.remove(fid);
         return FibpClientFuturePtr();
     }
     if (!reading_fiber_)
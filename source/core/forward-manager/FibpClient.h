@@ -2,14 +2,19 @@
 #ifndef FIBP_CLIENT_H
 #define FIBP_CLIENT_H
 
+#include "FibpInflightTable.h"
+#include "FibpTimerWheel.h"
 #include <common/FibpCommonTypes.h>
 #include <fiber-server/HttpProtocolHandler.h>
 #include <boost/shared_ptr.hpp>
 #include <string>
 #include <boost/asio.hpp>
 #include <boost/asio/buffer.hpp>
-#include <boost/asio/deadline_timer.hpp>
 #include <ostream>
+#include <vector>
+#include <deque>
+#include <boost/fiber/mutex.hpp>
+#include <boost/fiber/condition.hpp>
 
 namespace msgpack
 {
@@ -36,6 +41,12 @@ class ClientSession
 public:
     ClientSession(boost::asio::io_service& service, const std::string& host, const std::string& port);
     bool send_data(const std::string& reqdata);
+    // write all the buffers in one gather write without joining them first.
+    bool send_data(const std::vector<boost::asio::const_buffer>& bufs);
+    // the same as send_data but the buffers sent by all the fibers in the same
+    // round of the scheduler are written together, for the connection shared
+    // by the concurrent requests. The buffers should be valid until returned.
+    bool send_data_coalesced(const std::vector<boost::asio::const_buffer>& bufs);
     void set_timeout(int conn_to_ms, int read_to_ms)
     {
         conn_to_ = conn_to_ms;
@@ -62,20 +73,51 @@ public:
     void clear_timeout();
     void prepare_timeout(int sec);
     boost::system::error_code async_connect();
+    // open the connection before the first request.
+    bool warm_up();
+    // peek the idle connection without blocking, it is closed if the peer closed
+    // it or sent something unexpected, and connected again by the next request.
+    bool check_alive();
 
     boost::asio::ip::tcp::socket socket_;
     int conn_to_;
     int read_to_;
 
 private:
-    bool async_write(const std::string& reqdata);
-    void check_deadline(const boost::system::error_code& ec);
+    bool async_write(const std::vector<boost::asio::const_buffer>& bufs);
+    bool ensure_connected();
+    void write_queued();
+    static void on_deadline(void* arg);
+
+    struct OutFrame
+    {
+        OutFrame(const std::vector<boost::asio::const_buffer>& b)
+            : bufs(b), is_done(false), is_sent(false)
+        {
+        }
+        const std::vector<boost::asio::const_buffer>& bufs;
+        bool is_done;
+        bool is_sent;
+    };
 
     boost::asio::io_service& io_;
-    boost::asio::deadline_timer  deadline_;
+    FibpTimerWheel& wheel_;
+    FibpTimer deadline_;
     std::string host_;
     std::string port_;
+    // connected directly without resolving if the host is an ip.
+    boost::asio::ip::tcp::endpoint endpoint_;
+    bool is_ip_host_;
     bool connecting_;
+    // the fibers sending on the connection being connected wait for it.
+    boost::fibers::mutex connect_mutex_;
+    boost::fibers::condition_variable connect_cond_;
+    // the frames waiting for the fiber writing for all.
+    std::vector<OutFrame*> out_queue_;
+    std::vector<boost::asio::const_buffer> out_bufs_;
+    bool is_writing_;
+    boost::fibers::mutex write_mutex_;
+    boost::fibers::condition_variable write_cond_;
 };
 
 typedef boost::shared_ptr<ClientSession> ClientSessionPtr;
@@ -91,6 +133,11 @@ public:
         int timeout_ms) = 0;
     virtual bool get_response(FibpClientFuturePtr f, std::string& rsp, bool& can_retry) = 0;
     virtual ServiceType get_type() const = 0;
+    // fail all the pending requests with errinfo and close the connection.
+    virtual void close(const std::string& errinfo) = 0;
+    // the client can be destroyed after closed if the reading fiber quit.
+    virtual bool is_closed() const = 0;
+    bool warm_up();
     std::string host() const;
     std::string port() const;
     //bool can_retry() const;
@@ -112,6 +159,14 @@ public:
         const std::string& reqdata,
         int timeout_ms);
     bool get_response(std::string& rsp);
+    // the body of the success response is relayed to the stream instead of rsp.
+    bool get_response(std::string& rsp, http::response_stream_t* stream);
+    // abort the pending request, the connection is closed and will be
+    // connected again by the next request.
+    void cancel();
+    // fail the pending request with errinfo, the caller waiting for the
+    // response can retry on another host.
+    void abort(const std::string& errinfo);
     ServiceType get_type() const
     {
         return HTTP_Service;
@@ -122,6 +177,11 @@ public:
     bool send_http_request(
         http::request_t& http_req,
         int timeout_ms);
+    // the body is sent from the reqdata directly instead of http_req.body_.
+    bool send_http_request(
+        http::request_t& http_req,
+        const std::string& reqdata,
+        int timeout_ms);
     bool get_http_response(http::response_t& http_rsp);
 
     bool can_retry() const
@@ -134,9 +194,102 @@ public:
     http::response_t next_rsp_;
     http::response_parser rsp_parser_;
     bool can_retry_;
+    std::string abort_err_;
+    // on the steady clock, the client is not reused after the max lifetime.
+    uint64_t create_us_;
 };
 typedef boost::shared_ptr<FibpHttpClient> FibpHttpClientPtr;
 
+// the http clients sending the requests of many fibers on one connection, the
+// responses are returned by the futures.
+class FibpHttpMuxClient
+{
+public:
+    virtual ~FibpHttpMuxClient(){}
+    // return empty if the request can not be sent.
+    virtual FibpClientFuturePtr send_request(
+        const std::string& path,
+        http::method method,
+        const std::string& reqdata,
+        int timeout_ms) = 0;
+    virtual bool get_response(FibpClientFuturePtr f, std::string& rsp, bool& can_retry) = 0;
+    // false if the normal http client should be used for the request now.
+    virtual bool can_send() const = 0;
+    virtual std::string host() const = 0;
+    virtual std::string port() const = 0;
+    virtual bool warm_up() = 0;
+    // fail all the pending requests with errinfo and close the connection.
+    virtual void close(const std::string& errinfo) = 0;
+    // the client can be destroyed after closed if the reading fiber quit.
+    virtual bool is_closed() const = 0;
+};
+typedef boost::shared_ptr<FibpHttpMuxClient> FibpHttpMuxClientPtr;
+
+// send the requests on one keep-alive connection without waiting for the
+// previous responses, the responses are matched in the order of the requests.
+// If the connection is closed with requests pending, the idempotent ones are
+// replayed once on a new connection, the others failed.
+class FibpHttpPipelineClient : public FibpHttpMuxClient
+{
+public:
+    FibpHttpPipelineClient(boost::asio::io_service& service, const std::string& host,
+        const std::string& port, std::size_t max_depth);
+    ~FibpHttpPipelineClient();
+    FibpClientFuturePtr send_request(
+        const std::string& path,
+        http::method method,
+        const std::string& reqdata,
+        int timeout_ms);
+    bool get_response(FibpClientFuturePtr f, std::string& rsp, bool& can_retry);
+    void set_max_depth(std::size_t max_depth)
+    {
+        max_depth_ = max_depth;
+    }
+    // no more requests can be queued until some responses arrived, or the
+    // upstream closed the connection in the middle of the pipeline recently.
+    bool can_send() const;
+
+    std::string host() const;
+    std::string port() const;
+    bool warm_up();
+    void close(const std::string& errinfo);
+    bool is_closed() const
+    {
+        return !reading_fiber_;
+    }
+
+private:
+    struct PendingReq
+    {
+        PendingReq()
+            : can_replay(false), is_sent(false)
+        {
+        }
+        FibpClientFuturePtr future;
+        std::string head;
+        // only kept if the request can be replayed.
+        std::string body;
+        bool can_replay;
+        bool is_sent;
+    };
+    typedef boost::shared_ptr<PendingReq> PendingReqPtr;
+    bool write_request(PendingReq& req, const std::string& body);
+    void handle_read();
+    void replay_pending(const std::string& errinfo);
+
+    ClientSessionPtr session_;
+    http::response_t next_rsp_;
+    http::response_parser rsp_parser_;
+    std::size_t max_depth_;
+    // in the order of sending.
+    std::deque<PendingReqPtr> pending_;
+    // keep the order of the requests in the pending list and on the connection.
+    boost::fibers::mutex write_mutex_;
+    boost::shared_ptr<boost::fibers::fiber> reading_fiber_;
+    time_t broken_time_;
+};
+typedef boost::shared_ptr<FibpHttpPipelineClient> FibpHttpPipelineClientPtr;
+
 class FibpRpcClient : public FibpClientBase
 {
 public:
@@ -151,15 +304,21 @@ public:
     {
         return RPC_Service;
     }
+    void close(const std::string& errinfo);
+    bool is_closed() const
+    {
+        return !reading_fiber_;
+    }
 private:
-    void set_response(uint32_t msgid, const std::string& rsp, bool is_success, bool can_retry);
+    void set_response(uint32_t msgid, std::string& rsp, bool is_success, bool can_retry);
     void set_all_error(const std::string& errinfo);
     void handle_read();
     uint32_t fid_;
     boost::shared_ptr<msgpack::unpacker> rpc_pac_;
     boost::shared_ptr<msgpack::sbuffer> rpc_buf_;
-    typedef std::map<uint32_t, FibpClientFuturePtr> FutureListT;
-    FutureListT future_list_;
+    // the response being parsed is not in one piece of the unpacker buffer.
+    bool is_split_;
+    FibpInflightTable inflight_;
     boost::shared_ptr<boost::fibers::fiber> reading_fiber_;
 };
 
@@ -177,9 +336,14 @@ public:
     {
         return Raw_Service;
     }
+    void close(const std::string& errinfo);
+    bool is_closed() const
+    {
+        return !reading_fiber_;
+    }
 
 private:
-    void set_response(uint32_t msgid, const std::string& rsp, bool is_success, bool can_retry);
+    void set_response(uint32_t msgid, std::string& rsp, bool is_success, bool can_retry);
     void set_all_error(const std::string& errinfo);
     void handle_read();
     bool readRpsHeader(std::string& rsp);
@@ -189,8 +353,7 @@ private:
     bool afterReadRspBody(const boost::system::error_code& ec,
         std::string& rsp);
     uint32_t fid_;
-    typedef std::map<uint32_t, FibpClientFuturePtr> FutureListT;
-    FutureListT future_list_;
+    FibpInflightTable inflight_;
     boost::shared_ptr<boost::fibers::fiber> reading_fiber_;
 };
 
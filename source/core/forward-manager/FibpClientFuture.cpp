@@ -14,29 +14,60 @@ namespace fibp
 {
 
 static const std::string TIMEOUT_ERR("Server Timed Out.");
+static const std::string CANCELLED_ERR("Request Cancelled.");
 
 FibpClientFuture::FibpClientFuture(boost::asio::io_service& io, uint32_t fid, uint32_t timeout)
-    :future_id_(fid), timeout_(timeout), is_success_(false), can_retry_(true), done_(false), deadline_(io)
+    :future_id_(fid), timeout_(timeout), is_success_(false), can_retry_(true), done_(false), timed_out_(false),
+    wheel_(FibpTimerWheel::get(io))
 {
 }
 
-void FibpClientFuture::set_result(const std::string& rsp, bool is_success, bool can_retry)
+void FibpClientFuture::set_result(std::string& rsp, bool is_success, bool can_retry)
 {
     //boost::unique_lock<boost::fibers::mutex> lk(mutex_);
-    rsp_ = rsp;
+    rsp_.swap(rsp);
     is_success_ = is_success;
     can_retry_ = can_retry;
     done_ = true;
     deadline_.cancel();
+    cond_.notify_all();
+}
+
+void FibpClientFuture::on_timeout(void* arg)
+{
+    FibpClientFuture* f = (FibpClientFuture*)arg;
+    f->timed_out_ = true;
+    f->cond_.notify_all();
+}
+
+void FibpClientFuture::cancel()
+{
+    if (done_)
+        return;
+    std::string err(CANCELLED_ERR);
+    set_result(err, false, false);
+}
+
+void FibpClientFuture::reuse(uint32_t fid, uint32_t timeout)
+{
+    future_id_ = fid;
+    timeout_ = timeout;
+    rsp_.clear();
+    is_success_ = false;
+    can_retry_ = true;
+    done_ = false;
 }
 
 bool FibpClientFuture::getRsp(std::string& rsp, bool& can_retry)
 {
     if (!done_)
     {
-        boost::system::error_code ec;
-        deadline_.expires_from_now(boost::posix_time::milliseconds(timeout_));
-        deadline_.async_wait(boost::fibers::asio::yield[ec]);
+        boost::unique_lock<boost::fibers::mutex> guard(mutex_);
+        timed_out_ = false;
+        wheel_.arm(deadline_, timeout_, &FibpClientFuture::on_timeout, this);
+        while(!done_ && !timed_out_)
+            cond_.wait(guard);
+        deadline_.cancel();
     }
     //LOG(INFO) << "future returned : " << future_id_ << " in fiber: " << boost::this_fiber::get_id();
     if (!done_)
@@ -46,7 +77,7 @@ bool FibpClientFuture::getRsp(std::string& rsp, bool& can_retry)
     }
     else
     {
-        rsp = rsp_;
+        rsp.swap(rsp_);
         can_retry = can_retry_;
     }
     return is_success_;
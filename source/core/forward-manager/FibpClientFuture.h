@@ -6,8 +6,9 @@
 #include <string>
 #include <stdint.h>
 #include <boost/fiber/condition.hpp>
+#include <boost/fiber/mutex.hpp>
 #include <boost/asio.hpp>
-#include <boost/asio/deadline_timer.hpp>
+#include "FibpTimerWheel.h"
 
 namespace fibp
 {
@@ -17,23 +18,38 @@ class FibpClientFuture
 public:
     FibpClientFuture(boost::asio::io_service& io, uint32_t fid = 0, uint32_t timeout = 2);
     virtual ~FibpClientFuture(){}
-    void set_result(const std::string& rsp, bool is_success, bool can_retry);
+    // the response is swapped in and out to avoid copying the payload, so
+    // getRsp can be called only once.
+    void set_result(std::string& rsp, bool is_success, bool can_retry);
     bool getRsp(std::string& rsp, bool& can_retry);
+    // wake up the waiting fiber, the response arrived later will be ignored.
+    void cancel();
+    // prepare for another call once nobody holds it.
+    void reuse(uint32_t fid, uint32_t timeout);
+    // the result is set, false if it timed out.
+    bool is_done() const
+    {
+        return done_;
+    }
     uint32_t getid()
     {
         return future_id_;
     }
 
 private:
+    static void on_timeout(void* arg);
+
     uint32_t future_id_;
     uint32_t timeout_;
     std::string rsp_;
     bool is_success_;
     bool can_retry_;
     bool done_;
+    bool timed_out_;
     boost::fibers::condition_variable cond_;
     boost::fibers::mutex mutex_;
-    boost::asio::deadline_timer  deadline_;
+    FibpTimerWheel& wheel_;
+    FibpTimer deadline_;
 };
 
 }
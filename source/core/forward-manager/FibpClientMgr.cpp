@@ -1,15 +1,45 @@
 #include "FibpClientMgr.h"
 #include "FibpClientFuture.h"
+#include "FibpSharedClient.h"
 #include <log-manager/FibpLogger.h>
 #include <glog/logging.h>
 #include <boost/fiber/all.hpp>
 #include <fiber-server/loop.hpp>
+#include <boost/chrono/system_clocks.hpp>
+#include <algorithm>
 
 #define MAX_CLIENT_NUM  100
 
 namespace fibp
 {
 
+static const std::string SERVER_REMOVED_ERR("Server Removed.");
+// the longest time to wait for a http client if the pool to the host is full.
+static const int MAX_POOL_WAIT_MS = 1000;
+static const uint64_t IDLE_TIMEOUT_US = 60*1000*1000;
+// the connection is not reused after the lifetime so the upstream load balancer
+// in the middle can rebalance the connections.
+static const uint64_t MAX_LIFETIME_US = 600ULL*1000*1000;
+static const uint64_t REAP_INTERVAL_US = 1000*1000;
+// the routes are published again long before, the removed host can be forgotten
+// then if no request is still waiting on it.
+static const uint64_t REMOVED_HOST_KEEP_US = 60*1000*1000;
+
+static boost::atomic<uint64_t> pool_idle_num(0);
+static boost::atomic<uint64_t> pool_busy_num(0);
+static boost::atomic<uint64_t> pool_waiting_num(0);
+static boost::atomic<uint64_t> pool_wait_num(0);
+static boost::atomic<uint64_t> pool_wait_timeout_num(0);
+static boost::atomic<uint64_t> pool_wait_total_us(0);
+static boost::atomic<uint64_t> pool_reaped_num(0);
+static boost::atomic<uint64_t> pool_dead_num(0);
+
+static inline uint64_t now_us()
+{
+    return boost::chrono::duration_cast<boost::chrono::microseconds>(
+        boost::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 inline std::string getClientId(const std::string& host, const std::string& port)
 {
     static std::string delim(":");
@@ -17,13 +47,17 @@ inline std::string getClientId(const std::string& host, const std::string& port)
 }
 
 FibpClientMgr::FibpClientMgr()
+    : has_pending_changes_(false), owner_io_(NULL), last_reap_us_(0)
 {
     client_pool_list_.resize(End_Service);
+    removed_hosts_.resize(End_Service);
     running_thread_.reset(new boost::thread(boost::bind(&FibpClientMgr::run_service, boost::ref(io_service_))));
+    FibpMembershipNotifier::get()->subscribe(this);
 }
 
 FibpClientMgr::~FibpClientMgr()
 {
+    FibpMembershipNotifier::get()->unsubscribe(this);
     io_service_.stop();
     running_thread_->join();
 }
@@ -33,15 +67,6 @@ void FibpClientMgr::run_service(boost::asio::io_service& io_service)
     boost::fibers::fiber f(boost::bind(boost::fibers::asio::run_service, boost::ref(io_service)));
     f.join();
 }
-FibpHttpClientPtr FibpClientMgr::send_request(
-    const std::string& path,
-    http::method method,
-    const std::string& ip, const std::string& port,
-    const std::string& reqdata, int to_ms)
-{
-    return send_request(io_service_, path, method, ip, port, reqdata, to_ms);
-}
- 
 FibpHttpClientPtr FibpClientMgr::send_request(
     boost::asio::io_service& io,
     const std::string& path,
@@ -49,48 +74,39 @@ FibpHttpClientPtr FibpClientMgr::send_request(
     const std::string& ip, const std::string& port,
     const std::string& reqdata, int to_ms)
 {
-    FibpHttpClientPtr client;
-    HttpClientPoolT& client_pool = http_client_pool_list_;
+    check_membership(io);
+    reap_idle_clients();
     std::string client_id = getClientId(ip, port);
-    HttpClientPoolT::iterator it = client_pool.find(client_id);
-    if (it != client_pool.end() && !it->second.empty())
-    {
-        client = it->second.front();
-        it->second.pop_front();
-    }
-    else
-    {
-        if (client_num_[client_id] > MAX_CLIENT_NUM)
-        {
-            FibpLogger::get()->exceedClientLimit(client_id);
-            return FibpHttpClientPtr();
-        }
-        client.reset(new FibpHttpClient(io, ip, port));
-        client_num_[client_id]++;
-        FibpLogger::get()->logCurrentConnections(client_id, client_num_[client_id]);
-    }
+    if (is_removed(HTTP_Service, client_id))
+        return FibpHttpClientPtr();
+    FibpHttpClientPtr client = acquire_http_client(io, ip, port, to_ms);
+    if (!client)
+        return client;
     bool ret = client->send_request(path, method, reqdata, to_ms);
+    bool removed = is_removed(HTTP_Service, client_id);
     if (!ret)
     {
-        client_pool[client_id].push_back(client);
+        // the connection failed is closed, no need to keep the client.
+        if (removed)
+            release_client(client_id);
+        else
+            drop_http_client(client_id);
         return FibpHttpClientPtr();
     }
+    // removed while sending.
+    if (removed)
+        client->abort(SERVER_REMOVED_ERR);
+    busy_http_clients_[client_id].insert(client.get());
+    ++pool_busy_num;
     return client;
 }
 
-FibpClientFuturePtr FibpClientMgr::send_request(
-    const std::string& path,
-    const std::string& ip, const std::string& port,
-    ServiceType calltype, const std::string& reqdata, int to_ms)
-{
-    return send_request(io_service_, path, ip, port, calltype, reqdata, to_ms);
-}
-
 FibpClientFuturePtr FibpClientMgr::send_request(
     boost::asio::io_service& io,
     const std::string& path,
     const std::string& ip, const std::string& port,
-    ServiceType calltype, const std::string& reqdata, int to_ms)
+    ServiceType calltype, const std::string& reqdata, int to_ms,
+    bool is_shared)
 {
     assert(calltype < client_pool_list_.size());
     if (calltype >= client_pool_list_.size())
@@ -103,46 +119,70 @@ FibpClientFuturePtr FibpClientMgr::send_request(
         LOG(ERROR) << "http not allowed here.";
         throw -1;
     }
+    check_membership(io);
+    FibpClientFuturePtr future;
+    if (is_removed(calltype, getClientId(ip, port)))
+        return future;
+    if (is_shared)
+        return FibpSharedClientMgr::get()->send_request(io, path, ip, port, calltype, reqdata, to_ms);
+    FibpClientBasePtr client = get_client(io, calltype, ip, port);
+    if (!client)
+        return future;
+    future = client->send_request(path, reqdata, to_ms);
+    return future;
+}
+
+FibpClientBasePtr FibpClientMgr::get_client(boost::asio::io_service& io, ServiceType calltype,
+    const std::string& ip, const std::string& port)
+{
     FibpClientBasePtr client;
-    FibpClientFuturePtr future; 
     ClientPoolT& client_pool = client_pool_list_[calltype];
     std::string client_id = getClientId(ip, port);
     ClientPoolT::iterator it = client_pool.find(client_id);
     if (it != client_pool.end() && it->second)
     {
-        client = it->second;
+        return it->second;
     }
-    else
+    switch(calltype)
     {
-        switch(calltype)
-        {
-        case RPC_Service:
-            client.reset(new FibpRpcClient(io, ip, port));
-            break;
-        case Raw_Service:
-            client.reset(new FibpRawClient(io, ip, port));
-            break;
-        default:
-            LOG(ERROR) << "No supported service type." << calltype;
-            return future;
-            break;
-        }
-        client_num_[client_id]++;
-        FibpLogger::get()->logCurrentConnections(client_id, client_num_[client_id]);
-        client_pool[client_id] = client;
+    case RPC_Service:
+        client.reset(new FibpRpcClient(io, ip, port));
+        break;
+    case Raw_Service:
+        client.reset(new FibpRawClient(io, ip, port));
+        break;
+    default:
+        LOG(ERROR) << "No supported service type." << calltype;
+        return client;
+        break;
     }
-    future = client->send_request(path, reqdata, to_ms);
-    return future;
+    client_num_[client_id]++;
+    FibpLogger::get()->logCurrentConnections(client_id, client_num_[client_id]);
+    client_pool[client_id] = client;
+    return client;
 }
 
-bool FibpClientMgr::get_response(FibpHttpClientPtr client, std::string& rsp, bool& can_retry)
+bool FibpClientMgr::get_response(FibpHttpClientPtr client, std::string& rsp, bool& can_retry,
+    http::response_stream_t* stream)
 {
     if (!client)
         return false;
     std::string client_id = getClientId(client->host(), client->port());
-    bool ret = client->get_response(rsp);
+    bool ret = client->get_response(rsp, stream);
     can_retry = client->can_retry();
-    http_client_pool_list_[client_id].push_back(client);
+    BusyHttpClientT::iterator it = busy_http_clients_.find(client_id);
+    if (it != busy_http_clients_.end() && it->second.erase(client.get()) > 0)
+    {
+        --pool_busy_num;
+        if (it->second.empty())
+            busy_http_clients_.erase(it);
+    }
+    if (is_removed(HTTP_Service, client_id))
+        release_client(client_id);
+    else if (!ret && !client->session_->socket_.is_open())
+        drop_http_client(client_id);
+    else
+        put_http_client(client_id, client);
     return ret;
 }
 
@@ -154,4 +194,458 @@ bool FibpClientMgr::get_response(FibpClientFuturePtr f, std::string& rsp, bool&
     return ret;
 }
 
+FibpClientFuturePtr FibpClientMgr::send_mux_request(
+    boost::asio::io_service& io,
+    const std::string& path,
+    http::method method,
+    const std::string& ip, const std::string& port,
+    const std::string& reqdata, int to_ms,
+    bool is_h2c, std::size_t pipeline_depth,
+    FibpHttpMuxClientPtr& client)
+{
+    check_membership(io);
+    std::string client_id = getClientId(ip, port);
+    // the normal http client will not send it either.
+    if (is_removed(HTTP_Service, client_id))
+        return FibpClientFuturePtr();
+    FibpHttpMuxClientPtr mux_client;
+    if (is_h2c)
+    {
+        FibpHttp2ClientPtr& h2_client = h2_client_pool_list_[client_id];
+        if (!h2_client)
+        {
+            h2_client.reset(new FibpHttp2Client(io, ip, port));
+            client_num_[client_id]++;
+            FibpLogger::get()->logCurrentConnections(client_id, client_num_[client_id]);
+        }
+        mux_client = h2_client;
+    }
+    else
+    {
+        FibpHttpPipelineClientPtr& pipeline_client = pipeline_client_pool_list_[client_id];
+        if (!pipeline_client)
+        {
+            pipeline_client.reset(new FibpHttpPipelineClient(io, ip, port, pipeline_depth));
+            client_num_[client_id]++;
+            FibpLogger::get()->logCurrentConnections(client_id, client_num_[client_id]);
+        }
+        pipeline_client->set_max_depth(pipeline_depth);
+        mux_client = pipeline_client;
+    }
+    if (!mux_client->can_send())
+        return FibpClientFuturePtr();
+    FibpClientFuturePtr f = mux_client->send_request(path, method, reqdata, to_ms);
+    // the h2c service does not accept http/1.1, so no fallback for it.
+    if (f || is_h2c)
+        client = mux_client;
+    return f;
+}
+
+bool FibpClientMgr::get_response(FibpHttpMuxClientPtr client, FibpClientFuturePtr f,
+    std::string& rsp, bool& can_retry)
+{
+    if (!client || !f)
+        return false;
+    return client->get_response(f, rsp, can_retry);
+}
+
+bool FibpClientMgr::is_removed(ServiceType type, const std::string& client_id) const
+{
+    if (type >= removed_hosts_.size() || removed_hosts_[type].empty())
+        return false;
+    return removed_hosts_[type].find(client_id) != removed_hosts_[type].end();
+}
+
+void FibpClientMgr::release_client(const std::string& client_id)
+{
+    std::map<std::string, uint32_t>::iterator it = client_num_.find(client_id);
+    if (it == client_num_.end())
+        return;
+    if (it->second > 1)
+    {
+        --it->second;
+        FibpLogger::get()->logCurrentConnections(client_id, it->second);
+    }
+    else
+    {
+        client_num_.erase(it);
+        FibpLogger::get()->logCurrentConnections(client_id, 0);
+    }
+}
+
+void FibpClientMgr::on_membership_change(const FibpMembershipChange& change)
+{
+    boost::unique_lock<boost::mutex> guard(change_lock_);
+    pending_changes_.push_back(change);
+    has_pending_changes_ = true;
+    // without waiting for the next request.
+    if (owner_io_)
+        owner_io_->post(boost::bind(&FibpClientMgr::start_apply_membership, this));
+}
+
+void FibpClientMgr::bind_owner_io(boost::asio::io_service& io)
+{
+    boost::unique_lock<boost::mutex> guard(change_lock_);
+    if (owner_io_ == &io)
+        return;
+    if (owner_io_)
+    {
+        LOG(ERROR) << "client manager is already bound to another io service.";
+        return;
+    }
+    owner_io_ = &io;
+    // the changes published before bound.
+    if (has_pending_changes_)
+        owner_io_->post(boost::bind(&FibpClientMgr::start_apply_membership, this));
+}
+
+void FibpClientMgr::check_membership(boost::asio::io_service& io)
+{
+    assert(&io == owner_io_);
+    if (&io != owner_io_)
+        return;
+    if (has_pending_changes_)
+        apply_membership_changes(io);
+}
+
+void FibpClientMgr::start_apply_membership()
+{
+    if (!has_pending_changes_)
+        return;
+    boost::fibers::fiber f(boost::bind(&FibpClientMgr::apply_membership_changes, this,
+            boost::ref(*owner_io_)));
+    f.detach();
+}
+
+void FibpClientMgr::apply_membership_changes(boost::asio::io_service& io)
+{
+    std::vector<FibpMembershipChange> changes;
+    {
+        boost::unique_lock<boost::mutex> guard(change_lock_);
+        changes.swap(pending_changes_);
+        has_pending_changes_ = false;
+    }
+    std::size_t i = 0;
+    while(i < closed_clients_.size())
+    {
+        if (closed_clients_[i]->is_closed())
+        {
+            closed_clients_[i] = closed_clients_.back();
+            closed_clients_.pop_back();
+        }
+        else
+            ++i;
+    }
+    i = 0;
+    while(i < closed_mux_clients_.size())
+    {
+        if (closed_mux_clients_[i]->is_closed())
+        {
+            closed_mux_clients_[i] = closed_mux_clients_.back();
+            closed_mux_clients_.pop_back();
+        }
+        else
+            ++i;
+    }
+    prune_removed_hosts(now_us());
+    for(i = 0; i < changes.size(); ++i)
+    {
+        const FibpMembershipChange& change = changes[i];
+        if (change.type >= End_Service)
+            continue;
+        for(std::size_t j = 0; j < change.removed_hosts.size(); ++j)
+        {
+            remove_host(change.type, change.removed_hosts[j].first, change.removed_hosts[j].second);
+        }
+        for(std::size_t j = 0; j < change.added_hosts.size(); ++j)
+        {
+            const std::string& ip = change.added_hosts[j].first;
+            const std::string& port = change.added_hosts[j].second;
+            removed_hosts_[change.type].erase(getClientId(ip, port));
+            if (change.prewarm_num <= 0)
+                continue;
+            boost::fibers::fiber f(boost::bind(&FibpClientMgr::prewarm_host, this, boost::ref(io),
+                    change.type, ip, port, change.prewarm_num, change.is_h2c));
+            f.detach();
+        }
+    }
+}
+
+void FibpClientMgr::remove_host(ServiceType type, const std::string& ip, const std::string& port)
+{
+    std::string client_id = getClientId(ip, port);
+    removed_hosts_[type][client_id] = now_us();
+    if (type != HTTP_Service)
+    {
+        ClientPoolT& client_pool = client_pool_list_[type];
+        ClientPoolT::iterator it = client_pool.find(client_id);
+        if (it == client_pool.end())
+            return;
+        FibpClientBasePtr client = it->second;
+        client_pool.erase(it);
+        if (!client)
+            return;
+        release_client(client_id);
+        client->close(SERVER_REMOVED_ERR);
+        closed_clients_.push_back(client);
+        return;
+    }
+    HttpClientPoolT::iterator it = http_client_pool_list_.find(client_id);
+    if (it != http_client_pool_list_.end())
+    {
+        for(std::size_t i = 0; i < it->second.idle_list.size(); ++i)
+        {
+            --pool_idle_num;
+            release_client(client_id);
+        }
+        // the waiters find the host removed once woken up.
+        for(std::size_t i = 0; i < it->second.waiter_list.size(); ++i)
+        {
+            it->second.waiter_list[i]->is_ready = true;
+            it->second.waiter_list[i]->cond.notify_one();
+        }
+        http_client_pool_list_.erase(it);
+    }
+    BusyHttpClientT::iterator busy_it = busy_http_clients_.find(client_id);
+    if (busy_it != busy_http_clients_.end())
+    {
+        for(std::set<FibpHttpClient*>::iterator cit = busy_it->second.begin();
+            cit != busy_it->second.end(); ++cit)
+        {
+            (*cit)->abort(SERVER_REMOVED_ERR);
+        }
+    }
+    // erased from the pool first since closing may switch to other fibers.
+    std::vector<FibpHttpMuxClientPtr> mux_clients;
+    PipelineClientPoolT::iterator pit = pipeline_client_pool_list_.find(client_id);
+    if (pit != pipeline_client_pool_list_.end())
+    {
+        if (pit->second)
+            mux_clients.push_back(pit->second);
+        pipeline_client_pool_list_.erase(pit);
+    }
+    Http2ClientPoolT::iterator h2it = h2_client_pool_list_.find(client_id);
+    if (h2it != h2_client_pool_list_.end())
+    {
+        if (h2it->second)
+            mux_clients.push_back(h2it->second);
+        h2_client_pool_list_.erase(h2it);
+    }
+    for(std::size_t i = 0; i < mux_clients.size(); ++i)
+    {
+        release_client(client_id);
+        closed_mux_clients_.push_back(mux_clients[i]);
+        mux_clients[i]->close(SERVER_REMOVED_ERR);
+    }
+    LOG(INFO) << "removed host closed: " << client_id;
+}
+
+void FibpClientMgr::prune_removed_hosts(uint64_t now)
+{
+    for(std::size_t type = 0; type < removed_hosts_.size(); ++type)
+    {
+        std::map<std::string, uint64_t>::iterator it = removed_hosts_[type].begin();
+        while(it != removed_hosts_[type].end())
+        {
+            // the busy http clients are released rather than pooled once back.
+            if (now < it->second + REMOVED_HOST_KEEP_US ||
+                (type == HTTP_Service && busy_http_clients_.find(it->first) != busy_http_clients_.end()))
+            {
+                ++it;
+                continue;
+            }
+            removed_hosts_[type].erase(it++);
+        }
+    }
+}
+
+void FibpClientMgr::prewarm_host(boost::asio::io_service& io, ServiceType type, const std::string& ip,
+    const std::string& port, int prewarm_num, bool is_h2c)
+{
+    std::string client_id = getClientId(ip, port);
+    if (type != HTTP_Service)
+    {
+        // all the requests to the host share one connection.
+        FibpClientBasePtr client = get_client(io, type, ip, port);
+        if (client)
+            client->warm_up();
+        return;
+    }
+    if (is_h2c)
+    {
+        FibpHttp2ClientPtr h2_client = h2_client_pool_list_[client_id];
+        if (!h2_client)
+        {
+            h2_client.reset(new FibpHttp2Client(io, ip, port));
+            h2_client_pool_list_[client_id] = h2_client;
+            client_num_[client_id]++;
+            FibpLogger::get()->logCurrentConnections(client_id, client_num_[client_id]);
+        }
+        h2_client->warm_up();
+        return;
+    }
+    int idle_num = http_client_pool_list_[client_id].idle_list.size();
+    for(int i = idle_num; i < prewarm_num; ++i)
+    {
+        if (client_num_[client_id] >= MAX_CLIENT_NUM)
+            break;
+        FibpHttpClientPtr client(new FibpHttpClient(io, ip, port));
+        client_num_[client_id]++;
+        FibpLogger::get()->logCurrentConnections(client_id, client_num_[client_id]);
+        if (!client->session_->warm_up() || is_removed(HTTP_Service, client_id))
+        {
+            release_client(client_id);
+            break;
+        }
+        put_http_client(client_id, client);
+    }
+    LOG(INFO) << "prewarmed connections to: " << client_id << ", idle: "
+        << http_client_pool_list_[client_id].idle_list.size();
+}
+
+FibpHttpClientPtr FibpClientMgr::acquire_http_client(boost::asio::io_service& io,
+    const std::string& ip, const std::string& port, int to_ms)
+{
+    std::string client_id = getClientId(ip, port);
+    HttpClientPool& pool = http_client_pool_list_[client_id];
+    uint64_t start = now_us();
+    while(!pool.idle_list.empty())
+    {
+        IdleHttpClient idle = pool.idle_list.back();
+        pool.idle_list.pop_back();
+        --pool_idle_num;
+        if (start - idle.client->create_us_ >= MAX_LIFETIME_US)
+        {
+            ++pool_reaped_num;
+            drop_http_client(client_id);
+            continue;
+        }
+        if (!idle.client->session_->check_alive())
+            ++pool_dead_num;
+        return idle.client;
+    }
+    FibpHttpClientPtr client;
+    if (client_num_[client_id] < MAX_CLIENT_NUM)
+    {
+        client.reset(new FibpHttpClient(io, ip, port));
+        client_num_[client_id]++;
+        FibpLogger::get()->logCurrentConnections(client_id, client_num_[client_id]);
+        return client;
+    }
+    PoolWaiterPtr waiter(new PoolWaiter());
+    pool.waiter_list.push_back(waiter);
+    ++pool_wait_num;
+    ++pool_waiting_num;
+    int wait_ms = (to_ms > 0 && to_ms < MAX_POOL_WAIT_MS) ? to_ms : MAX_POOL_WAIT_MS;
+    uint64_t deadline = start + (uint64_t)wait_ms*1000;
+    {
+        boost::unique_lock<boost::fibers::mutex> guard(waiter->mutex);
+        while(!waiter->is_ready)
+        {
+            uint64_t now = now_us();
+            if (now >= deadline)
+                break;
+            waiter->cond.wait_for(guard, boost::chrono::microseconds(deadline - now));
+        }
+    }
+    --pool_waiting_num;
+    pool_wait_total_us += now_us() - start;
+    if (!waiter->is_ready)
+    {
+        // the pool may be gone while waiting.
+        std::deque<PoolWaiterPtr>& waiter_list = http_client_pool_list_[client_id].waiter_list;
+        std::deque<PoolWaiterPtr>::iterator it = std::find(waiter_list.begin(), waiter_list.end(), waiter);
+        if (it != waiter_list.end())
+            waiter_list.erase(it);
+        ++pool_wait_timeout_num;
+        FibpLogger::get()->exceedClientLimit(client_id);
+        return client;
+    }
+    if (is_removed(HTTP_Service, client_id))
+    {
+        if (waiter->client || waiter->has_permit)
+            release_client(client_id);
+        return client;
+    }
+    if (waiter->client)
+        return waiter->client;
+    // the closed client is replaced, the number of the clients is not changed.
+    client.reset(new FibpHttpClient(io, ip, port));
+    return client;
+}
+
+void FibpClientMgr::put_http_client(const std::string& client_id, FibpHttpClientPtr client)
+{
+    HttpClientPool& pool = http_client_pool_list_[client_id];
+    if (!pool.waiter_list.empty())
+    {
+        PoolWaiterPtr waiter = pool.waiter_list.front();
+        pool.waiter_list.pop_front();
+        waiter->client = client;
+        waiter->is_ready = true;
+        waiter->cond.notify_one();
+        return;
+    }
+    pool.idle_list.push_back(IdleHttpClient(client, now_us()));
+    ++pool_idle_num;
+}
+
+void FibpClientMgr::drop_http_client(const std::string& client_id)
+{
+    HttpClientPoolT::iterator it = http_client_pool_list_.find(client_id);
+    if (it != http_client_pool_list_.end() && !it->second.waiter_list.empty())
+    {
+        PoolWaiterPtr waiter = it->second.waiter_list.front();
+        it->second.waiter_list.pop_front();
+        waiter->has_permit = true;
+        waiter->is_ready = true;
+        waiter->cond.notify_one();
+        return;
+    }
+    release_client(client_id);
+}
+
+void FibpClientMgr::reap_idle_clients()
+{
+    uint64_t now = now_us();
+    if (now - last_reap_us_ < REAP_INTERVAL_US)
+        return;
+    last_reap_us_ = now;
+    HttpClientPoolT::iterator it = http_client_pool_list_.begin();
+    while(it != http_client_pool_list_.end())
+    {
+        std::deque<IdleHttpClient>& idle_list = it->second.idle_list;
+        std::deque<IdleHttpClient>::iterator cit = idle_list.begin();
+        while(cit != idle_list.end())
+        {
+            if (now - cit->idle_us < IDLE_TIMEOUT_US &&
+                now - cit->client->create_us_ < MAX_LIFETIME_US)
+            {
+                ++cit;
+                continue;
+            }
+            cit = idle_list.erase(cit);
+            --pool_idle_num;
+            ++pool_reaped_num;
+            release_client(it->first);
+        }
+        if (idle_list.empty() && it->second.waiter_list.empty())
+            http_client_pool_list_.erase(it++);
+        else
+            ++it;
+    }
+}
+
+void FibpClientMgr::get_pool_stats(std::map<std::string, uint64_t>& stats)
+{
+    stats["pool_idle"] = pool_idle_num.load(boost::memory_order_relaxed);
+    stats["pool_busy"] = pool_busy_num.load(boost::memory_order_relaxed);
+    stats["pool_waiting"] = pool_waiting_num.load(boost::memory_order_relaxed);
+    stats["pool_wait_num"] = pool_wait_num.load(boost::memory_order_relaxed);
+    stats["pool_wait_timeout_num"] = pool_wait_timeout_num.load(boost::memory_order_relaxed);
+    stats["pool_wait_total_us"] = pool_wait_total_us.load(boost::memory_order_relaxed);
+    stats["pool_reaped_num"] = pool_reaped_num.load(boost::memory_order_relaxed);
+    stats["pool_dead_num"] = pool_dead_num.load(boost::memory_order_relaxed);
+}
+
 }
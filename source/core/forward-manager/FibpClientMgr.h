@@ -2,62 +2,155 @@
 #define FIBP_CLIENT_MGR_H
 
 #include "FibpClient.h"
+#include "FibpHttp2Client.h"
+#include "FibpMembership.h"
 #include <boost/asio.hpp>
 #include <boost/thread.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/atomic.hpp>
 #include <common/FibpCommonTypes.h>
 #include <vector>
 #include <deque>
 #include <map>
+#include <set>
 
 namespace fibp
 {
 
-class FibpClientMgr
+// the hosts removed from the service discovery are not used any more and the
+// requests pending on them are failed at once so they can be retried on other
+// hosts, the connections to the new hosts can be opened before any request.
+class FibpClientMgr : public FibpMembershipListener
 {
 public:
     FibpClientMgr();
     ~FibpClientMgr();
 
+    // io is of the thread sending, the clients and their timeouts are bound to it.
+    // the client owned by the shared io thread is used if is_shared.
     FibpClientFuturePtr send_request(
+        boost::asio::io_service& io,
         const std::string& path,
         const std::string& ip, const std::string& port,
-        ServiceType calltype, const std::string& reqdata, int to_ms);
+        ServiceType calltype, const std::string& reqdata, int to_ms,
+        bool is_shared = false);
 
     FibpHttpClientPtr send_request(
+        boost::asio::io_service& io,
         const std::string& path,
         http::method method,
         const std::string& ip, const std::string& port,
         const std::string& reqdata, int to_ms);
 
-    FibpClientFuturePtr send_request(
-        boost::asio::io_service& io,
-        const std::string& path,
-        const std::string& ip, const std::string& port,
-        ServiceType calltype, const std::string& reqdata, int to_ms);
-
-    FibpHttpClientPtr send_request(
+    // send on the connection shared by the fibers to the host, the h2c stream or
+    // the pipelined http request. Return empty with the client not set if the
+    // pipeline is full or not usable, the normal http client should be used then.
+    // The client is always set for h2c, the request failed if empty returned.
+    FibpClientFuturePtr send_mux_request(
         boost::asio::io_service& io,
         const std::string& path,
         http::method method,
         const std::string& ip, const std::string& port,
-        const std::string& reqdata, int to_ms);
+        const std::string& reqdata, int to_ms,
+        bool is_h2c, std::size_t pipeline_depth,
+        FibpHttpMuxClientPtr& client);
 
-    bool get_response(FibpHttpClientPtr client, std::string& rsp, bool& can_retry);
+    bool get_response(FibpHttpClientPtr client, std::string& rsp, bool& can_retry,
+        http::response_stream_t* stream = NULL);
     bool get_response(FibpClientFuturePtr f, std::string& rsp, bool& can_retry);
+    bool get_response(FibpHttpMuxClientPtr client, FibpClientFuturePtr f,
+        std::string& rsp, bool& can_retry);
 
     boost::asio::io_service& get_io_service()
     {
         return io_service_;
     }
+    // bind to the io of the thread sending the requests before any request, the
+    // pools are only changed there, including the membership changes.
+    void bind_owner_io(boost::asio::io_service& io);
+
+    // the change is applied later in the thread sending the requests.
+    void on_membership_change(const FibpMembershipChange& change);
+    // the wait time and occupancy of the http client pools in all the threads.
+    static void get_pool_stats(std::map<std::string, uint64_t>& stats);
 
 private:
     static void run_service(boost::asio::io_service& io_service);
-    typedef std::map<std::string, std::deque<FibpHttpClientPtr> > HttpClientPoolT;
+    FibpClientBasePtr get_client(boost::asio::io_service& io, ServiceType calltype,
+        const std::string& ip, const std::string& port);
+    bool is_removed(ServiceType type, const std::string& client_id) const;
+    void check_membership(boost::asio::io_service& io);
+    void start_apply_membership();
+    void apply_membership_changes(boost::asio::io_service& io);
+    void remove_host(ServiceType type, const std::string& ip, const std::string& port);
+    // forget the hosts removed for a while and no longer used by any request.
+    void prune_removed_hosts(uint64_t now);
+    void prewarm_host(boost::asio::io_service& io, ServiceType type, const std::string& ip,
+        const std::string& port, int prewarm_num, bool is_h2c);
+    void release_client(const std::string& client_id);
+    // wait in the FIFO order if too many clients to the host are in use, return
+    // empty if no client is available before the timeout.
+    FibpHttpClientPtr acquire_http_client(boost::asio::io_service& io,
+        const std::string& ip, const std::string& port, int to_ms);
+    void put_http_client(const std::string& client_id, FibpHttpClientPtr client);
+    // the client is closed, the first waiter can create a new one.
+    void drop_http_client(const std::string& client_id);
+    void reap_idle_clients();
+
+    struct IdleHttpClient
+    {
+        IdleHttpClient(FibpHttpClientPtr c, uint64_t t)
+            : client(c), idle_us(t)
+        {
+        }
+        FibpHttpClientPtr client;
+        uint64_t idle_us;
+    };
+    struct PoolWaiter
+    {
+        PoolWaiter()
+            : is_ready(false), has_permit(false)
+        {
+        }
+        bool is_ready;
+        // the client handed over, or a new one can be created if has_permit.
+        FibpHttpClientPtr client;
+        bool has_permit;
+        boost::fibers::mutex mutex;
+        boost::fibers::condition_variable cond;
+    };
+    typedef boost::shared_ptr<PoolWaiter> PoolWaiterPtr;
+    // the idle clients are reused in the LIFO order so the ones not needed any
+    // more stay idle long enough to be reaped.
+    struct HttpClientPool
+    {
+        std::deque<IdleHttpClient> idle_list;
+        std::deque<PoolWaiterPtr> waiter_list;
+    };
+    typedef std::map<std::string, HttpClientPool> HttpClientPoolT;
     typedef std::map<std::string, FibpClientBasePtr> ClientPoolT;
     HttpClientPoolT  http_client_pool_list_;
+    typedef std::map<std::string, FibpHttpPipelineClientPtr> PipelineClientPoolT;
+    PipelineClientPoolT  pipeline_client_pool_list_;
+    typedef std::map<std::string, FibpHttp2ClientPtr> Http2ClientPoolT;
+    Http2ClientPoolT  h2_client_pool_list_;
     std::vector<ClientPoolT>  client_pool_list_;
     std::map<std::string, uint32_t>  client_num_;
+    // the http clients waiting for the responses, aborted if the host removed.
+    typedef std::map<std::string, std::set<FibpHttpClient*> > BusyHttpClientT;
+    BusyHttpClientT  busy_http_clients_;
+    // the time the host removed, so the late requests picking it from the old
+    // routes are refused.
+    std::vector<std::map<std::string, uint64_t> >  removed_hosts_;
+    // kept until the reading fibers of the closed clients quit.
+    std::vector<FibpClientBasePtr>  closed_clients_;
+    std::vector<FibpHttpMuxClientPtr>  closed_mux_clients_;
+    boost::mutex  change_lock_;
+    std::vector<FibpMembershipChange>  pending_changes_;
+    boost::atomic<bool>  has_pending_changes_;
+    // the io service of the thread sending the requests.
+    boost::asio::io_service*  owner_io_;
+    uint64_t  last_reap_us_;
     boost::shared_ptr<boost::thread> running_thread_;
     boost::asio::io_service io_service_;
 };
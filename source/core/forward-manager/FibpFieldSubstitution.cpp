@@ -0,0 +1,154 @@
+#include "FibpFieldSubstitution.h"
+#include <3rdparty/rapidjson/document.h>
+#include <3rdparty/rapidjson/writer.h>
+#include <3rdparty/rapidjson/stringbuffer.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <algorithm>
+#include <map>
+
+namespace rj = rapidjson;
+namespace fibp
+{
+
+typedef boost::shared_ptr<rj::Document> DocumentPtr;
+typedef std::map<int, DocumentPtr> DocumentMapT;
+
+static bool is_index(const std::string& s)
+{
+    if (s.empty() || s.size() > 9)
+        return false;
+    for(std::size_t i = 0; i < s.size(); ++i)
+    {
+        if (s[i] < '0' || s[i] > '9')
+            return false;
+    }
+    return true;
+}
+
+static const rj::Value* find_field(const rj::Value& root, const std::vector<std::string>& path)
+{
+    const rj::Value* v = &root;
+    // path[0] is the index of the call.
+    for(std::size_t i = 1; i < path.size(); ++i)
+    {
+        const std::string& key = path[i];
+        if (v->IsObject())
+        {
+            const rj::Value* found = NULL;
+            for(rj::Value::ConstMemberIterator itr = v->MemberBegin();
+                itr != v->MemberEnd(); ++itr)
+            {
+                if (key == itr->name.GetString())
+                {
+                    found = &itr->value;
+                    break;
+                }
+            }
+            if (found == NULL)
+                return NULL;
+            v = found;
+        }
+        else if (v->IsArray() && is_index(key))
+        {
+            std::size_t index = boost::lexical_cast<std::size_t>(key);
+            if (index >= v->Size())
+                return NULL;
+            v = &(*v)[(rj::SizeType)index];
+        }
+        else
+        {
+            return NULL;
+        }
+    }
+    return v;
+}
+
+static bool get_field(const std::string& name,
+    const std::vector<int>& depends_on,
+    const std::vector<ServiceCallRsp>& rsp_list,
+    DocumentMapT& docs,
+    std::string& value)
+{
+    std::vector<std::string> path;
+    boost::split(path, name, boost::is_any_of("."));
+    if (!is_index(path[0]))
+        return false;
+    int index = boost::lexical_cast<int>(path[0]);
+    if (std::find(depends_on.begin(), depends_on.end(), index) == depends_on.end() ||
+        index >= (int)rsp_list.size())
+    {
+        return false;
+    }
+    const std::string& rsp = rsp_list[index].rsp;
+    if (path.size() == 1)
+    {
+        value = rsp;
+        return true;
+    }
+    DocumentPtr& doc = docs[index];
+    if (!doc)
+    {
+        doc.reset(new rj::Document());
+        if (doc->Parse<0>(rsp.c_str()).HasParseError())
+            return false;
+    }
+    else if (doc->HasParseError())
+    {
+        return false;
+    }
+    const rj::Value* v = find_field(*doc, path);
+    if (v == NULL)
+        return false;
+    rj::StringBuffer strbuf;
+    rj::Writer<rj::StringBuffer> writer(strbuf);
+    v->Accept(writer);
+    value = strbuf.GetString();
+    if (v->IsString() && value.size() >= 2)
+    {
+        // keep the escaping so it can be put in a json string.
+        value = value.substr(1, value.size() - 2);
+    }
+    return true;
+}
+
+bool FibpFieldSubstitution::has_placeholder(const std::string& tmpl)
+{
+    return tmpl.find("${") != std::string::npos;
+}
+
+bool FibpFieldSubstitution::substitute(const std::string& tmpl,
+    const std::vector<int>& depends_on,
+    const std::vector<ServiceCallRsp>& rsp_list,
+    std::string& result, std::string& error)
+{
+    DocumentMapT docs;
+    result.clear();
+    result.reserve(tmpl.size());
+    std::size_t pos = 0;
+    while(true)
+    {
+        std::size_t start = tmpl.find("${", pos);
+        if (start == std::string::npos)
+            break;
+        std::size_t end = tmpl.find('}', start + 2);
+        if (end == std::string::npos)
+            break;
+        result.append(tmpl, pos, start - pos);
+        std::string name = tmpl.substr(start + 2, end - start - 2);
+        std::string value;
+        if (!get_field(name, depends_on, rsp_list, docs, value))
+        {
+            error = "Field Substitution Failed: ${" + name + "}. ";
+            return false;
+        }
+        result.append(value);
+        pos = end + 1;
+    }
+    result.append(tmpl, pos, std::string::npos);
+    return true;
+}
+
+}
@@ -0,0 +1,28 @@
+#ifndef FIBP_FIELD_SUBSTITUTION_H
+#define FIBP_FIELD_SUBSTITUTION_H
+
+#include <common/FibpCommonTypes.h>
+#include <string>
+#include <vector>
+
+namespace fibp
+{
+
+// replace the placeholders like ${N.field.0.sub} in the request of a dependent call
+// with the field of the json response of the call N in the same list, ${N} is
+// replaced with the whole response. A string field is replaced with its escaped
+// content without the quotes, other fields with their compact json.
+class FibpFieldSubstitution
+{
+public:
+    static bool has_placeholder(const std::string& tmpl);
+    // only the responses of the calls in depends_on can be used.
+    static bool substitute(const std::string& tmpl,
+        const std::vector<int>& depends_on,
+        const std::vector<ServiceCallRsp>& rsp_list,
+        std::string& result, std::string& error);
+};
+
+}
+
+#endif
@@ -5,6 +5,11 @@
 #include "FibpServiceCache.h"
 #include "FibpTransactionMgr.h"
 #include "FibpPortForwardMgr.h"
+#include "FibpLatencyStat.h"
+#include "FibpRetryBudget.h"
+#include "FibpSingleFlight.h"
+#include "FibpFieldSubstitution.h"
+#include "FibpSharedClient.h"
 #include <fiber-server/FiberPool.hpp>
 #include <glog/logging.h>
 #include <boost/lexical_cast.hpp>
@@ -14,30 +19,78 @@
 #include <fiber-server/spawn.hpp>
 #include <log-manager/FibpLogger.h>
 #include <3rdparty/msgpack/msgpack.hpp>
+#include <boost/chrono/system_clocks.hpp>
 #include <cstdlib>
+#include <set>
+#include <deque>
+#include <algorithm>
 #include <time.h>
 
 namespace fibp
 {
 
+static inline uint64_t now_us()
+{
+    return boost::chrono::duration_cast<boost::chrono::microseconds>(
+        boost::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 FibpForwardManager::FibpForwardManager()
+    : coalesce_leader_num_(0), coalesced_num_(0)
 {
 }
 
 void FibpForwardManager::init(const std::string& dns_host_list,
     const std::string& local_ip, uint16_t local_port,
     const std::string& report_ip, const std::string& report_port,
-    std::size_t thread_size)
+    std::size_t thread_size, const std::string& snapshot_path, const std::string& local_zone)
 {
+    // the shared clients only move the bytes and post the results back, a few
+    // threads are enough for all the workers.
+    static const std::size_t SHARED_WORKERS_PER_THREAD = 8;
     std::srand(time(NULL));
+    FibpSharedClientMgr::set_thread_num((thread_size + SHARED_WORKERS_PER_THREAD - 1) /
+        SHARED_WORKERS_PER_THREAD);
     client_mgr_list_.init(thread_size);
     fiber_pool_list_.init(thread_size);
+    single_flight_list_.init(thread_size);
 
-    service_mgr_.reset(new FibpServiceMgr(dns_host_list, local_ip, local_port, report_ip, report_port));
+    service_mgr_.reset(new FibpServiceMgr(dns_host_list, local_ip, local_port, report_ip, report_port,
+            snapshot_path, local_zone));
     port_forward_mgr_.reset(new FibpPortForwardMgr(service_mgr_.get()));
     service_cache_.reset(new FibpServiceCache(1000000));
-    service_fail_stat_.rehash(10000);
+    latency_stat_.reset(new FibpServiceLatencyStat());
+    retry_budget_.reset(new FibpRetryBudget());
     FibpLogger::get()->setServiceMgr(service_mgr_.get());
+    // started after the port forward manager, which is used to restore the forwards.
+    service_mgr_->start();
+}
+
+void FibpForwardManager::set_deadline(std::vector<ServiceCallReq>& call_api_list, int default_timeout_ms)
+{
+    uint64_t now = now_us();
+    for(std::size_t i = 0; i < call_api_list.size(); ++i)
+    {
+        ServiceCallReq& req = call_api_list[i];
+        if (req.timeout_ms <= 0)
+            req.timeout_ms = default_timeout_ms;
+        if (req.timeout_ms > 0)
+            req.deadline_us = now + (uint64_t)req.timeout_ms*1000;
+    }
+}
+
+void FibpForwardManager::getForwardStats(std::map<std::string, uint64_t>& stats)
+{
+    stats["coalesce_leader_num"] = coalesce_leader_num_.load(boost::memory_order_relaxed);
+    stats["coalesced_num"] = coalesced_num_.load(boost::memory_order_relaxed);
+    FibpClientMgr::get_pool_stats(stats);
+    // the tasks dropped by the fiber pools since their deadline passed in the queue.
+    std::vector<boost::shared_ptr<FiberPool> > pools;
+    fiber_pool_list_.getAllObj(pools);
+    uint64_t expired_num = 0;
+    for(std::size_t i = 0; i < pools.size(); ++i)
+        expired_num += pools[i]->get_expired_num();
+    stats["fiber_task_expired_num"] = expired_num;
 }
 
 bool FibpForwardManager::startPortForward(uint16_t &port, const std::string& service_name,
@@ -82,45 +135,406 @@ void FibpForwardManager::stop()
     service_cache_->clear();
     client_mgr_list_.clear();
     fiber_pool_list_.clear();
+    single_flight_list_.clear();
     FibpLogger::get()->setServiceMgr(NULL);
 }
 
 void FibpForwardManager::call_services_in_fiber(boost::asio::io_service& io,
     uint64_t id,
     const std::vector<ServiceCallReq>& call_api_list,
-    ServicesRsp& rsp_list, callback_t cb, bool do_transaction)
+    ServicesRsp& rsp_list, callback_t cb, bool do_transaction,
+    const ServicesCallOption& option)
 {
     FIBP_THREAD_MARK_LOG(id);
     FibpClientMgr& client_mgr = client_mgr_list_.getThreadObj();
+    client_mgr.bind_owner_io(io);
 
+    ServicesCallOption call_option = option;
+    call_option.do_transaction = do_transaction;
     post_to_fiber_pool(
             io, id, client_mgr, call_api_list,
-            rsp_list, cb, do_transaction);
+            rsp_list, cb, call_option, start_check_t());
 }
 
 void FibpForwardManager::call_services_in_fiber(uint64_t id,
     const std::vector<ServiceCallReq>& call_api_list,
-    ServicesRsp& rsp_list, callback_t cb, bool do_transaction)
+    ServicesRsp& rsp_list, callback_t cb, bool do_transaction,
+    const ServicesCallOption& option, start_check_t start_check)
 {
     FIBP_THREAD_MARK_LOG(id);
     FibpClientMgr& client_mgr = client_mgr_list_.getThreadObj();
+    // the requests are sent in the io thread of the client manager.
+    client_mgr.bind_owner_io(client_mgr.get_io_service());
 
+    ServicesCallOption call_option = option;
+    call_option.do_transaction = do_transaction;
     client_mgr.get_io_service().post(
         boost::bind(&FibpForwardManager::post_to_fiber_pool, this,
             boost::ref(client_mgr.get_io_service()), id, boost::ref(client_mgr),
-            boost::ref(call_api_list), boost::ref(rsp_list), cb, do_transaction));
+            boost::ref(call_api_list), boost::ref(rsp_list), cb, call_option, start_check));
     //boost::fibers::detail::scheduler::instance()->wakeup();
     FIBP_THREAD_MARK_LOG(id);
 }
 
+// one request to the chosen host of the service, the hedged call may run two
+// of them at the same time.
+struct FibpForwardManager::ServiceAttempt
+{
+    ServiceAttempt()
+        : is_sent(false), is_success(false), can_retry(true),
+        is_done(false), is_cancelled(false), latency_us(0)
+    {
+    }
+    // a final response (success or rejected by the service) is got.
+    bool is_final() const
+    {
+        return is_done && is_sent && (is_success || !can_retry);
+    }
+    void cancel();
+    std::string ip;
+    std::string port;
+    // ip:port from the route, the key of the host in the balancer and the breaker.
+    std::string host_key;
+    FibpHttpClientPtr http_client;
+    FibpHttpMuxClientPtr mux_client;
+    FibpClientFuturePtr future;
+    // the running hedged call.
+    HedgeCallContextPtr hedge_ctx;
+    std::string rspdata;
+    bool is_sent;
+    bool is_success;
+    bool can_retry;
+    bool is_done;
+    bool is_cancelled;
+    uint64_t latency_us;
+};
+
+// shared by the fibers of the hedged call, the slower fiber may still be
+// running after the call returned.
+struct FibpForwardManager::HedgeCallContext
+{
+    HedgeCallContext()
+        : running(0)
+    {
+    }
+    bool is_finished() const
+    {
+        return running == 0 || attempts[0].is_final() || attempts[1].is_final();
+    }
+    ServiceCallReq req;
+    ServiceAttempt attempts[2];
+    int running;
+    boost::fibers::mutex mutex;
+    boost::fibers::condition_variable cond;
+};
+
+void FibpForwardManager::ServiceAttempt::cancel()
+{
+    if (hedge_ctx)
+    {
+        hedge_ctx->attempts[0].cancel();
+        hedge_ctx->attempts[1].cancel();
+        return;
+    }
+    if (is_done || is_cancelled)
+        return;
+    is_cancelled = true;
+    if (http_client)
+        http_client->cancel();
+    if (future)
+        future->cancel();
+}
+
+// cancel the calls which are not needed any more. The calls of one request run
+// in the fibers of the same thread, so no lock is needed.
+struct FibpForwardManager::CallCancelToken
+{
+    CallCancelToken()
+        : is_cancelled(false)
+    {
+    }
+    void cancel()
+    {
+        is_cancelled = true;
+        std::set<ServiceAttempt*>::const_iterator it = running_attempts.begin();
+        for(; it != running_attempts.end(); ++it)
+        {
+            (*it)->cancel();
+        }
+    }
+    bool is_cancelled;
+    std::set<ServiceAttempt*> running_attempts;
+};
+
+// shared by the fibers of the services called together, the calls cancelled
+// may still be running after the fan-out returned.
+struct FibpForwardManager::FanoutContext
+{
+    FanoutContext()
+        : req_list(NULL), running(0), finished(0), success(0), max_parallel(0),
+        priority(Priority_Normal)
+    {
+    }
+    // point to own_req_list if the fan-out may return before all calls finished,
+    // or the requests need the responses of others.
+    const std::vector<ServiceCallReq>* req_list;
+    std::vector<ServiceCallReq> own_req_list;
+    std::vector<ServiceCallRsp> rsp_list;
+    std::vector<bool> done;
+    // the number of the unfinished calls each call depends on.
+    std::vector<std::size_t> pending_deps;
+    std::vector<std::vector<std::size_t> > dependents;
+    // the calls can be started.
+    std::deque<std::size_t> ready;
+    std::size_t running;
+    std::size_t finished;
+    std::size_t success;
+    std::size_t max_parallel;
+    int priority;
+    CallCancelToken cancel_token;
+    boost::fibers::mutex mutex;
+    boost::fibers::condition_variable cond;
+};
+
+void FibpForwardManager::do_attempt(boost::asio::io_service& io, uint64_t id,
+    FibpClientMgr& client_mgr,
+    const ServiceCallReq& req,
+    int timeout_ms,
+    ServiceAttempt& attempt)
+{
+    FibpLoadBalancer* balancer = service_mgr_->get_load_balancer();
+    FibpLogger::get()->sendServiceRequest(id, req.service_name, attempt.ip, attempt.port);
+    boost::chrono::steady_clock::time_point start = boost::chrono::steady_clock::now();
+    balancer->start_request(attempt.host_key);
+    attempt.is_sent = true;
+    if (req.service_type == HTTP_Service)
+    {
+        bool is_h2c = service_mgr_->is_service_h2c(req.service_name);
+        int pipeline_depth = service_mgr_->get_service_pipeline_depth(req.service_name);
+        if (is_h2c || pipeline_depth > 0)
+        {
+            // the client is not set if the pipeline is full or not usable.
+            attempt.future = client_mgr.send_mux_request(io, req.service_api, (http::method)req.method,
+                attempt.ip, attempt.port, req.service_req_data, timeout_ms, is_h2c, pipeline_depth,
+                attempt.mux_client);
+        }
+        if (attempt.mux_client)
+        {
+            if (!attempt.future)
+            {
+                attempt.is_sent = false;
+            }
+            else
+            {
+                if (attempt.is_cancelled)
+                    attempt.future->cancel();
+                attempt.is_success = client_mgr.get_response(attempt.mux_client, attempt.future,
+                    attempt.rspdata, attempt.can_retry);
+                attempt.future.reset();
+                FibpLogger::get()->getServiceRsp(id, req.service_name);
+            }
+            attempt.mux_client.reset();
+        }
+        else
+        {
+            attempt.http_client = client_mgr.send_request(io, req.service_api, (http::method)req.method,
+                attempt.ip, attempt.port, req.service_req_data, timeout_ms);
+            if (!attempt.http_client)
+            {
+                attempt.is_sent = false;
+            }
+            else
+            {
+                if (attempt.is_cancelled)
+                    attempt.http_client->cancel();
+                attempt.is_success = client_mgr.get_response(attempt.http_client, attempt.rspdata,
+                    attempt.can_retry, get_rsp_stream(req));
+                // the client is back to the pool now.
+                attempt.http_client.reset();
+                FibpLogger::get()->getServiceRsp(id, req.service_name);
+            }
+        }
+    }
+    else
+    {
+        attempt.future = client_mgr.send_request(io, req.service_api, attempt.ip, attempt.port,
+            (ServiceType)req.service_type,
+            req.service_req_data, timeout_ms,
+            service_mgr_->is_service_shared(req.service_name));
+        if (!attempt.future)
+        {
+            attempt.is_sent = false;
+        }
+        else
+        {
+            if (attempt.is_cancelled)
+                attempt.future->cancel();
+            attempt.is_success = client_mgr.get_response(attempt.future, attempt.rspdata, attempt.can_retry);
+            attempt.future.reset();
+            FibpLogger::get()->getServiceRsp(id, req.service_name);
+        }
+    }
+    attempt.latency_us = boost::chrono::duration_cast<boost::chrono::microseconds>(
+        boost::chrono::steady_clock::now() - start).count();
+    FibpCircuitBreaker* breaker = service_mgr_->get_circuit_breaker();
+    const std::string& host_key = attempt.host_key;
+    if (attempt.is_cancelled)
+    {
+        // lost the race to the hedged request, the host itself is fine.
+        balancer->end_request(host_key, attempt.latency_us, true);
+        breaker->on_result(req.service_name, host_key, FibpCircuitBreaker::Cancelled);
+    }
+    else
+    {
+        // the error returned by the service itself (can not retry) means the host is fine.
+        bool is_host_ok = attempt.is_sent && (attempt.is_success || !attempt.can_retry);
+        balancer->end_request(host_key, attempt.latency_us, is_host_ok);
+        if (is_host_ok)
+            breaker->on_result(req.service_name, host_key, FibpCircuitBreaker::Success);
+        else if (attempt.latency_us >= (uint64_t)timeout_ms*1000)
+            breaker->on_result(req.service_name, host_key, FibpCircuitBreaker::Timeout);
+        else
+            breaker->on_result(req.service_name, host_key, FibpCircuitBreaker::Failure);
+        if (attempt.is_success)
+            latency_stat_->add(req.service_name, attempt.latency_us);
+    }
+    attempt.is_done = true;
+}
+
+void FibpForwardManager::run_hedge_attempt(boost::asio::io_service& io, uint64_t id,
+    FibpClientMgr& client_mgr,
+    int timeout_ms,
+    HedgeCallContextPtr ctx,
+    std::size_t index)
+{
+    do_attempt(io, id, client_mgr, ctx->req, timeout_ms, ctx->attempts[index]);
+    boost::unique_lock<boost::fibers::mutex> guard(ctx->mutex);
+    --ctx->running;
+    ctx->cond.notify_all();
+}
+
+void FibpForwardManager::do_hedged_attempt(boost::asio::io_service& io, uint64_t id,
+    FibpClientMgr& client_mgr,
+    const ServiceCallReq& req,
+    int timeout_ms,
+    uint64_t hedge_delay_us,
+    std::size_t& balance_index,
+    ServiceAttempt& attempt)
+{
+    HedgeCallContextPtr ctx(new HedgeCallContext());
+    ctx->req = req;
+    ctx->attempts[0].ip = attempt.ip;
+    ctx->attempts[0].port = attempt.port;
+    ctx->attempts[0].host_key = attempt.host_key;
+    attempt.hedge_ctx = ctx;
+
+    uint64_t start_us = now_us();
+    boost::unique_lock<boost::fibers::mutex> guard(ctx->mutex);
+    ctx->running = 1;
+    boost::fibers::fiber(boost::bind(&FibpForwardManager::run_hedge_attempt, this,
+            boost::ref(io), id, boost::ref(client_mgr), timeout_ms, ctx, 0)).detach();
+    ctx->cond.wait_for(guard, boost::chrono::microseconds(hedge_delay_us),
+        boost::bind(&HedgeCallContext::is_finished, ctx.get()));
+    // the hedged request costs the retry budget too.
+    if (!ctx->attempts[0].is_done && !ctx->attempts[0].is_cancelled &&
+        retry_budget_->try_withdraw(req.service_name))
+    {
+        ServiceAttempt& hedge = ctx->attempts[1];
+        bool ret = service_mgr_->get_service_address(++balance_index, req.service_name,
+            (ServiceType)req.service_type, hedge.ip, hedge.port, hedge.host_key, attempt.host_key);
+        // no other host to hedge.
+        if (ret && hedge.host_key != attempt.host_key)
+        {
+            // what is left of the timeout, so the hedged call ends no later than
+            // the first one.
+            int64_t left_ms = timeout_ms - (int64_t)(now_us() - start_us)/1000;
+            if (left_ms < 1)
+                left_ms = 1;
+            ++ctx->running;
+            boost::fibers::fiber(boost::bind(&FibpForwardManager::run_hedge_attempt, this,
+                    boost::ref(io), id, boost::ref(client_mgr), (int)left_ms, ctx, 1)).detach();
+        }
+    }
+    while(!ctx->is_finished())
+    {
+        ctx->cond.wait(guard);
+    }
+    std::size_t winner = ctx->attempts[1].is_final() && !ctx->attempts[0].is_final() ? 1 : 0;
+    ctx->attempts[1 - winner].cancel();
+    attempt = ctx->attempts[winner];
+}
+
+uint64_t FibpForwardManager::get_hedge_delay_us(const ServiceCallReq& req)
+{
+    int percentile = req.hedge_percentile;
+    if (percentile <= 0)
+        percentile = service_mgr_->get_service_hedge_percentile(req.service_name);
+    if (percentile <= 0 || percentile >= 100)
+        return 0;
+    return latency_stat_->get_percentile(req.service_name, percentile);
+}
+
+http::response_stream_t* FibpForwardManager::get_rsp_stream(const ServiceCallReq& req)
+{
+    if (!req.rsp_stream || req.service_type != HTTP_Service)
+        return NULL;
+    if (!service_mgr_->is_service_stream(req.service_name))
+        return NULL;
+    return req.rsp_stream;
+}
+
 void FibpForwardManager::call_single_service(boost::asio::io_service& io, uint64_t id,
     FibpClientMgr& client_mgr,
     const ServiceCallReq& req,
-    ServiceCallRsp& rsp)
+    ServiceCallRsp& rsp,
+    CallCancelToken* cancel_token)
+{
+    // the relayed response can not be shared.
+    if (!req.enable_coalesce || get_rsp_stream(req))
+    {
+        call_service_with_retry(io, id, client_mgr, req, rsp, cancel_token);
+        return;
+    }
+    FibpSingleFlight& single_flight = single_flight_list_.getThreadObj();
+    FibpSingleFlight::InflightCallPtr call;
+    if (single_flight.join(req, call))
+    {
+        ++coalesce_leader_num_;
+        // the leader is shared by others, not cancelled by one of them.
+        call_service_with_retry(io, id, client_mgr, req, rsp, NULL);
+        single_flight.finish(req, call, rsp);
+        return;
+    }
+    ++coalesced_num_;
+    if (!FibpSingleFlight::wait(call, req.deadline_us, rsp))
+    {
+        rsp.service_name = req.service_name;
+        rsp.error = "Deadline Exceeded. ";
+    }
+    else if (FibpSingleFlight::should_call_again(call, rsp, req.deadline_us))
+    {
+        rsp = ServiceCallRsp();
+        call_service_with_retry(io, id, client_mgr, req, rsp, cancel_token);
+        return;
+    }
+    // the leader may not enable the cache.
+    if (!rsp.error.empty() && req.enable_cache)
+    {
+        service_cache_->get(req, rsp);
+    }
+}
+
+void FibpForwardManager::call_service_with_retry(boost::asio::io_service& io, uint64_t id,
+    FibpClientMgr& client_mgr,
+    const ServiceCallReq& req,
+    ServiceCallRsp& rsp,
+    CallCancelToken* cancel_token)
 {
     FIBP_THREAD_MARK_LOG(id);
     rsp.service_name = req.service_name;
     static const int MAX_RETRY = 3;
+    // no time left for another attempt.
+    static const int MIN_ATTEMPT_TIMEOUT_MS = 1;
     static const std::string local_test("local_test");
     int retry_counter = 0;
     if (req.service_name == local_test)
@@ -132,68 +546,77 @@ void FibpForwardManager::call_single_service(boost::asio::io_service& io, uint64
     }
     std::size_t balance_index = rand();
     bool is_success = false;
+    std::string last_failed_host;
+    // only one attempt can write to the client at the same time.
+    uint64_t hedge_delay_us = get_rsp_stream(req) ? 0 : get_hedge_delay_us(req);
+    retry_budget_->deposit(req.service_name);
     while(++retry_counter <= MAX_RETRY)
     {
-        std::string ip;
-        std::string port;
+        if (cancel_token && cancel_token->is_cancelled)
+        {
+            rsp.error = "Cancelled. " + rsp.error;
+            break;
+        }
+        ServiceAttempt attempt;
         int timeout_ms = 5000*retry_counter;
+        if (req.deadline_us > 0)
+        {
+            uint64_t now = now_us();
+            if (now + MIN_ATTEMPT_TIMEOUT_MS*1000 > req.deadline_us)
+            {
+                rsp.error = "Deadline Exceeded. " + rsp.error;
+                break;
+            }
+            timeout_ms = std::min(timeout_ms, (int)((req.deadline_us - now)/1000));
+        }
+        if (retry_counter > 1 && !retry_budget_->try_withdraw(req.service_name))
+        {
+            rsp.error = "Retry Budget Exhausted. " + rsp.error;
+            break;
+        }
         bool ret = service_mgr_->get_service_address(++balance_index, req.service_name,
-            (ServiceType)req.service_type, ip, port);
+            (ServiceType)req.service_type, attempt.ip, attempt.port, attempt.host_key,
+            last_failed_host);
         if (!ret)
         {
             //LOG(INFO) << "service not found: " << req.service_name << " in cluster:" << req.service_cluster;
             rsp.error = "Service Not Found.";
             break;
         }
-        FibpLogger::get()->sendServiceRequest(id, req.service_name, ip, port);
-        std::string rspdata;
-        bool can_retry = true;
-        rsp.host = ip;
-        rsp.port = port;
-        if (req.service_type == HTTP_Service)
+        if (cancel_token)
+            cancel_token->running_attempts.insert(&attempt);
+        if (hedge_delay_us > 0 && hedge_delay_us < (uint64_t)timeout_ms*1000)
         {
-            FibpHttpClientPtr f = client_mgr.send_request(io, req.service_api, (http::method)req.method, ip, port,
-                req.service_req_data, timeout_ms);
-            if (!f)
-            {
-                FibpLogger::get()->logServiceFailed(id, req.service_name, "Send Data Failed.");
-                ++service_fail_stat_[req.service_name];
-                if (retry_counter == MAX_RETRY)
-                    rsp.error = "Send Service Request Failed. ";
-                continue;
-            }
-            ret = client_mgr.get_response(f, rspdata, can_retry);
-            FibpLogger::get()->getServiceRsp(id, req.service_name);
+            do_hedged_attempt(io, id, client_mgr, req, timeout_ms, hedge_delay_us,
+                balance_index, attempt);
         }
         else
         {
-            FibpClientFuturePtr f = client_mgr.send_request(io, req.service_api, ip, port,
-                (ServiceType)req.service_type,
-                req.service_req_data, timeout_ms);
-            if (!f)
-            {
-                FibpLogger::get()->logServiceFailed(id, req.service_name, "Send Data Failed.");
-                ++service_fail_stat_[req.service_name];
-                if (retry_counter == MAX_RETRY)
-                    rsp.error = "Send Service Request Failed. ";
-                continue;
-            }
-            ret = client_mgr.get_response(f, rspdata, can_retry);
-            FibpLogger::get()->getServiceRsp(id, req.service_name);
+            do_attempt(io, id, client_mgr, req, timeout_ms, attempt);
         }
-        if (!ret)
+        if (cancel_token)
+            cancel_token->running_attempts.erase(&attempt);
+        rsp.host = attempt.ip;
+        rsp.port = attempt.port;
+        if (!attempt.is_sent)
         {
-            FibpLogger::get()->logServiceFailed(id, req.service_name, rspdata);
-            ++service_fail_stat_[req.service_name];
-            if (!can_retry || retry_counter == MAX_RETRY)
-            {
-                rsp.error = "Get Service Response Failed. " + rspdata;
+            FibpLogger::get()->logServiceFailed(id, req.service_name, "Send Data Failed.");
+            last_failed_host = attempt.host_key;
+            rsp.error = "Send Service Request Failed. ";
+            continue;
+        }
+        if (!attempt.is_success)
+        {
+            FibpLogger::get()->logServiceFailed(id, req.service_name, attempt.rspdata);
+            last_failed_host = attempt.host_key;
+            rsp.error = "Get Service Response Failed. " + attempt.rspdata;
+            if (!attempt.can_retry)
                 break;
-            }
         }
         else
         {
-            rsp.rsp = rspdata;
+            rsp.error.clear();
+            rsp.rsp.swap(attempt.rspdata);
             is_success = true;
             break;
         }
@@ -202,45 +625,267 @@ void FibpForwardManager::call_single_service(boost::asio::io_service& io, uint64
     {
         service_cache_->set(req, rsp);
     }
-    else
+    else if (req.enable_cache)
+    {
+        service_cache_->get(req, rsp);
+    }
+}
+
+void FibpForwardManager::post_to_fiber_pool(boost::asio::io_service& io,
+    uint64_t id,
+    FibpClientMgr& client_mgr,
+    const std::vector<ServiceCallReq>& call_api_list,
+    ServicesRsp& rsp_list, callback_t cb,
+    const ServicesCallOption& option,
+    start_check_t start_check)
+{
+    FiberPool& pool = fiber_pool_list_.getThreadObj();
+    // drop the calls in the pool if all of them are already late.
+    uint64_t deadline_us = 0;
+    for(std::size_t i = 0; i < call_api_list.size(); ++i)
+    {
+        if (call_api_list[i].deadline_us == 0)
+        {
+            deadline_us = 0;
+            break;
+        }
+        deadline_us = std::max(deadline_us, call_api_list[i].deadline_us);
+    }
+    callback_t task = boost::bind(&FibpForwardManager::call_services_in_fiber, this,
+        boost::ref(pool), boost::ref(io), id, boost::ref(client_mgr),
+        boost::ref(call_api_list), boost::ref(rsp_list), cb, option);
+    if (start_check)
+    {
+        task = boost::bind(&FibpForwardManager::start_services, this, start_check, task,
+            boost::ref(call_api_list), boost::ref(rsp_list), cb);
+    }
+    pool.schedule_task_from_fiber(task,
+        option.priority, deadline_us,
+        boost::bind(&FibpForwardManager::expire_services, this,
+            boost::ref(call_api_list), boost::ref(rsp_list), cb));
+}
+
+void FibpForwardManager::start_services(start_check_t start_check, callback_t task,
+    const std::vector<ServiceCallReq>& call_api_list,
+    ServicesRsp& rsp_list, callback_t cb)
+{
+    if (start_check())
+    {
+        task();
+        return;
+    }
+    rsp_list.resize(call_api_list.size());
+    for(std::size_t i = 0; i < call_api_list.size(); ++i)
+    {
+        rsp_list[i].service_name = call_api_list[i].service_name;
+        rsp_list[i].error = "Server Busy. ";
+    }
+    cb();
+}
+
+void FibpForwardManager::expire_services(const std::vector<ServiceCallReq>& call_api_list,
+    ServicesRsp& rsp_list, callback_t cb)
+{
+    rsp_list.resize(call_api_list.size());
+    for(std::size_t i = 0; i < call_api_list.size(); ++i)
+    {
+        rsp_list[i].service_name = call_api_list[i].service_name;
+        rsp_list[i].error = "Deadline Exceeded. ";
+    }
+    cb();
+}
+
+bool FibpForwardManager::prepare_dependent_call(FanoutContext& ctx, std::size_t index)
+{
+    ServiceCallReq& req = ctx.own_req_list[index];
+    ServiceCallRsp& rsp = ctx.rsp_list[index];
+    for(std::size_t i = 0; i < req.depends_on.size(); ++i)
     {
-        if(service_fail_stat_[req.service_name] % 10 == 0)
+        int dep = req.depends_on[i];
+        if (dep < 0 || dep >= (int)index)
         {
-            LOG(INFO) << "service get response failed. " << req.service_name <<
-                ", total failed: " << service_fail_stat_[req.service_name];
+            rsp.error = "Invalid Dependency. ";
+            return false;
         }
-        if (req.enable_cache)
+        if (!ctx.rsp_list[dep].error.empty())
         {
-            service_cache_->get(req, rsp);
+            rsp.error = "Dependency Failed: " + ctx.own_req_list[dep].service_name + ". ";
+            return false;
         }
     }
+    std::string data;
+    if (FibpFieldSubstitution::has_placeholder(req.service_api))
+    {
+        if (!FibpFieldSubstitution::substitute(req.service_api, req.depends_on,
+                ctx.rsp_list, data, rsp.error))
+            return false;
+        req.service_api.swap(data);
+    }
+    // the rpc request data is packed already.
+    if (req.service_type != RPC_Service &&
+        FibpFieldSubstitution::has_placeholder(req.service_req_data))
+    {
+        if (!FibpFieldSubstitution::substitute(req.service_req_data, req.depends_on,
+                ctx.rsp_list, data, rsp.error))
+            return false;
+        req.service_req_data.swap(data);
+    }
+    return true;
 }
- 
-void FibpForwardManager::call_single_service(boost::asio::io_service& io, uint64_t id,
-    FibpClientMgr& client_mgr,
-    const ServiceCallReq& req,
-    ServiceCallRsp& rsp,
-    int& call_num, boost::fibers::condition_variable& cond)
+
+void FibpForwardManager::finish_fanout_call(FanoutContext& ctx, std::size_t index)
 {
-    call_single_service(io, id, client_mgr, req, rsp);
-    --call_num;
-    if (call_num == 0)
+    ctx.done[index] = true;
+    ++ctx.finished;
+    if (ctx.rsp_list[index].error.empty())
+        ++ctx.success;
+    if (ctx.dependents.empty())
+        return;
+    const std::vector<std::size_t>& dependents = ctx.dependents[index];
+    for(std::size_t i = 0; i < dependents.size(); ++i)
     {
-        cond.notify_all();
+        if (--ctx.pending_deps[dependents[i]] == 0)
+            ctx.ready.push_back(dependents[i]);
     }
 }
 
-void FibpForwardManager::post_to_fiber_pool(boost::asio::io_service& io,
-    uint64_t id,
-    FibpClientMgr& client_mgr,
+void FibpForwardManager::start_fanout_calls(FiberPool& pool,
+    boost::asio::io_service& io,
+    uint64_t id, FibpClientMgr& client_mgr,
+    FanoutContextPtr ctx)
+{
+    while(!ctx->cancel_token.is_cancelled && ctx->running < ctx->max_parallel &&
+        !ctx->ready.empty())
+    {
+        std::size_t index = ctx->ready.front();
+        ctx->ready.pop_front();
+        const ServiceCallReq& req = (*ctx->req_list)[index];
+        if (!req.depends_on.empty() && !prepare_dependent_call(*ctx, index))
+        {
+            ctx->rsp_list[index].service_name = req.service_name;
+            finish_fanout_call(*ctx, index);
+            continue;
+        }
+        ++ctx->running;
+        pool.schedule_task_from_fiber(
+            boost::bind(&FibpForwardManager::run_fanout_call, this,
+                boost::ref(pool), boost::ref(io), id, boost::ref(client_mgr),
+                ctx, index),
+            ctx->priority);
+    }
+}
+
+void FibpForwardManager::run_fanout_call(FiberPool& pool,
+    boost::asio::io_service& io,
+    uint64_t id, FibpClientMgr& client_mgr,
+    FanoutContextPtr ctx, std::size_t index)
+{
+    call_single_service(io, id, client_mgr, (*ctx->req_list)[index], ctx->rsp_list[index],
+        &ctx->cancel_token);
+    boost::unique_lock<boost::fibers::mutex> guard(ctx->mutex);
+    --ctx->running;
+    finish_fanout_call(*ctx, index);
+    start_fanout_calls(pool, io, id, client_mgr, ctx);
+    ctx->cond.notify_all();
+}
+
+void FibpForwardManager::fanout_services(FiberPool& pool,
+    boost::asio::io_service& io,
+    uint64_t id, FibpClientMgr& client_mgr,
     const std::vector<ServiceCallReq>& call_api_list,
-    ServicesRsp& rsp_list, callback_t cb, bool do_transaction)
+    ServicesRsp& rsp_list,
+    const ServicesCallOption& option)
 {
-    FiberPool& pool = fiber_pool_list_.getThreadObj();
-    pool.schedule_task_from_fiber(
-        boost::bind(&FibpForwardManager::call_services_in_fiber, this,
-            boost::ref(pool), boost::ref(io), id, boost::ref(client_mgr),
-            boost::ref(call_api_list), boost::ref(rsp_list), cb, do_transaction));
+    static const std::size_t DEFAULT_MAX_PARALLEL = 64;
+    FanoutContextPtr ctx(new FanoutContext());
+    bool has_dependency = false;
+    for(std::size_t i = 0; i < call_api_list.size(); ++i)
+    {
+        if (!call_api_list[i].depends_on.empty())
+        {
+            has_dependency = true;
+            break;
+        }
+    }
+    uint64_t deadline_us = 0;
+    if (option.need_wait_all() && !has_dependency)
+    {
+        // the request list lives until all the calls finished.
+        ctx->req_list = &call_api_list;
+    }
+    else
+    {
+        ctx->own_req_list = call_api_list;
+        ctx->req_list = &ctx->own_req_list;
+        if (option.timeout_ms > 0)
+        {
+            deadline_us = now_us() + (uint64_t)option.timeout_ms*1000;
+            // no retry after the list timeout.
+            for(std::size_t i = 0; i < ctx->own_req_list.size(); ++i)
+            {
+                uint64_t& req_deadline = ctx->own_req_list[i].deadline_us;
+                if (req_deadline == 0 || req_deadline > deadline_us)
+                    req_deadline = deadline_us;
+            }
+        }
+    }
+    ctx->rsp_list.resize(call_api_list.size());
+    ctx->done.resize(call_api_list.size(), false);
+    ctx->max_parallel = option.max_parallel > 0 ? option.max_parallel : DEFAULT_MAX_PARALLEL;
+    ctx->priority = option.priority;
+    if (has_dependency)
+    {
+        ctx->pending_deps.resize(call_api_list.size(), 0);
+        ctx->dependents.resize(call_api_list.size());
+    }
+    for(std::size_t i = 0; i < call_api_list.size(); ++i)
+    {
+        const std::vector<int>& depends_on = call_api_list[i].depends_on;
+        for(std::size_t j = 0; j < depends_on.size(); ++j)
+        {
+            // the invalid one will fail when the call is prepared.
+            if (depends_on[j] >= 0 && depends_on[j] < (int)i)
+            {
+                ++ctx->pending_deps[i];
+                ctx->dependents[depends_on[j]].push_back(i);
+            }
+        }
+        if (!has_dependency || ctx->pending_deps[i] == 0)
+            ctx->ready.push_back(i);
+    }
+
+    boost::unique_lock<boost::fibers::mutex> guard(ctx->mutex);
+    start_fanout_calls(pool, io, id, client_mgr, ctx);
+    while(ctx->finished < call_api_list.size())
+    {
+        if (option.wait_success_num > 0 && ctx->success >= (std::size_t)option.wait_success_num)
+            break;
+        if (deadline_us == 0)
+        {
+            ctx->cond.wait(guard);
+            continue;
+        }
+        uint64_t now = now_us();
+        if (now >= deadline_us)
+            break;
+        ctx->cond.wait_for(guard, boost::chrono::microseconds(deadline_us - now));
+    }
+    if (ctx->finished < call_api_list.size())
+    {
+        ctx->cancel_token.cancel();
+    }
+    for(std::size_t i = 0; i < call_api_list.size(); ++i)
+    {
+        if (ctx->done[i])
+        {
+            rsp_list[i].swap(ctx->rsp_list[i]);
+        }
+        else
+        {
+            rsp_list[i].service_name = call_api_list[i].service_name;
+            rsp_list[i].error = "Cancelled.";
+        }
+    }
 }
 
 void FibpForwardManager::call_services_in_fiber(
@@ -250,8 +895,9 @@ void FibpForwardManager::call_services_in_fiber(
     FibpClientMgr& client_mgr,
     const std::vector<ServiceCallReq>& call_api_list,
     ServicesRsp& rsp_list, callback_t cb,
-    bool do_transaction)
+    const ServicesCallOption& option)
 {
+    bool do_transaction = option.do_transaction;
     rsp_list.resize(call_api_list.size());
     bool check = true;
     if (do_transaction)
@@ -279,32 +925,24 @@ void FibpForwardManager::call_services_in_fiber(
         FIBP_THREAD_MARK_LOG(id);
         // try call all services, any failed service will not affect the others,
         // only success response will be returned (failed message from business server may be returned).
-        if (call_api_list.size() == 1)
+        if (call_api_list.size() == 1 && option.need_wait_all() &&
+            call_api_list[0].depends_on.empty())
         {
             const ServiceCallReq& req = call_api_list[0];
             call_single_service(io, id, client_mgr, req, rsp_list[0]);
         }
+        else if (do_transaction)
+        {
+            // the transaction need the result of all services, the parallelism
+            // and the priority are kept.
+            ServicesCallOption tran_option = option;
+            tran_option.wait_success_num = 0;
+            tran_option.timeout_ms = 0;
+            fanout_services(pool, io, id, client_mgr, call_api_list, rsp_list, tran_option);
+        }
         else
         {
-            boost::fibers::condition_variable cond;
-            int call_num = call_api_list.size();
-            for(std::size_t i = 0; i < call_api_list.size(); ++i)
-            {
-                const ServiceCallReq& req = call_api_list[i];
-                pool.schedule_task_from_fiber(
-                    boost::bind(&FibpForwardManager::call_single_service, this,
-                        boost::ref(io), id,
-                        boost::ref(client_mgr), boost::ref(req),
-                        boost::ref(rsp_list[i]), boost::ref(call_num),
-                        boost::ref(cond)));
-            }
-
-            boost::fibers::mutex lock;
-            boost::unique_lock<boost::fibers::mutex> guard(lock);
-            while(call_num > 0)
-            {
-                cond.wait(guard);
-            }
+            fanout_services(pool, io, id, client_mgr, call_api_list, rsp_list, option);
         }
         FIBP_THREAD_MARK_LOG(id);
         if (do_transaction)
@@ -333,12 +971,12 @@ void FibpForwardManager::call_services_in_fiber(
                     {
                         continue;
                     }
-                    transaction_mgr_->cancel(&client_mgr, rsp_list[i].host, rsp_list[i].port,
+                    transaction_mgr_->cancel(io, &client_mgr, rsp_list[i].host, rsp_list[i].port,
                         call_api_list[i].service_api, tran_id_list[i]);
                 }
                 else
                 {
-                    transaction_mgr_->confirm(&client_mgr, rsp_list[i].host, rsp_list[i].port,
+                    transaction_mgr_->confirm(io, &client_mgr, rsp_list[i].host, rsp_list[i].port,
                         call_api_list[i].service_api, tran_id_list[i]);
                 }
             }
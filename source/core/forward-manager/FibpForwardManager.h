@@ -8,6 +8,7 @@
 #include <boost/fiber/all.hpp>
 #include <boost/asio.hpp>
 #include <boost/unordered_map.hpp>
+#include <boost/atomic.hpp>
 #include <util/singleton.h>
 #include <map>
 #include <3rdparty/folly/RWSpinLock.h>
@@ -20,29 +21,47 @@ class FibpServiceCache;
 class FibpTransactionMgr;
 class FiberPool;
 class FibpPortForwardMgr;
+class FibpServiceLatencyStat;
+class FibpRetryBudget;
+class FibpSingleFlight;
 
 class FibpForwardManager
 {
 public:
     typedef boost::function<void()> callback_t;
+    // called when the calls start in the fiber pool, false to reject them.
+    typedef boost::function<bool()> start_check_t;
     static FibpForwardManager* get()
     {
         return izenelib::util::Singleton<FibpForwardManager>::get();
     }
     FibpForwardManager();
+    // the services and the port forwards in the snapshot file are restored before
+    // return, the file is not used if the path is empty. The hosts in the local
+    // zone are preferred if it is given.
     void init(const std::string& dns_host_list, const std::string& local_ip,
         uint16_t local_port, const std::string& report_ip, const std::string& report_port,
-        std::size_t thread_num);
+        std::size_t thread_num, const std::string& snapshot_path = std::string(),
+        const std::string& local_zone = std::string());
 
+    // the calls are failed with "Server Busy." and cb is called at once if
+    // start_check returns false.
     void call_services_in_fiber(uint64_t id,
         const std::vector<ServiceCallReq>& call_api_list,
-        ServicesRsp& rsp_list, callback_t cb, bool do_transaction = false);
+        ServicesRsp& rsp_list, callback_t cb, bool do_transaction = false,
+        const ServicesCallOption& option = ServicesCallOption(),
+        start_check_t start_check = start_check_t());
 
     // call direct in the io thread.
     void call_services_in_fiber(boost::asio::io_service& io,
         uint64_t id,
         const std::vector<ServiceCallReq>& call_api_list,
-        ServicesRsp& rsp_list, callback_t cb, bool do_transaction = false);
+        ServicesRsp& rsp_list, callback_t cb, bool do_transaction = false,
+        const ServicesCallOption& option = ServicesCallOption());
+
+    // convert the timeout of each request to the deadline, the default timeout
+    // is used for the requests without their own timeout.
+    static void set_deadline(std::vector<ServiceCallReq>& call_api_list, int default_timeout_ms);
 
     bool startPortForward(uint16_t &port, const std::string& service_name,
         int type);
@@ -50,15 +69,33 @@ public:
     void getAllPortForwardServices(const std::string& agentid, std::vector<ForwardInfoT> &forward_services);
 
     bool getForwardService(uint16_t port, ForwardInfoT& info);
+    // the counters of the forwarding, used for monitoring.
+    void getForwardStats(std::map<std::string, uint64_t>& stats);
     void stop();
 
 private:
 
+    struct ServiceAttempt;
+    struct HedgeCallContext;
+    typedef boost::shared_ptr<HedgeCallContext> HedgeCallContextPtr;
+    struct CallCancelToken;
+    struct FanoutContext;
+    typedef boost::shared_ptr<FanoutContext> FanoutContextPtr;
+
     void post_to_fiber_pool(boost::asio::io_service& io,
         uint64_t id,
         FibpClientMgr& client_mgr,
         const std::vector<ServiceCallReq>& call_api_list,
-        ServicesRsp& rsp_list, callback_t cb, bool do_transaction = false);
+        ServicesRsp& rsp_list, callback_t cb,
+        const ServicesCallOption& option,
+        start_check_t start_check);
+    void start_services(start_check_t start_check, callback_t task,
+        const std::vector<ServiceCallReq>& call_api_list,
+        ServicesRsp& rsp_list, callback_t cb);
+
+    // called instead if the calls are still in the pool after the deadline.
+    void expire_services(const std::vector<ServiceCallReq>& call_api_list,
+        ServicesRsp& rsp_list, callback_t cb);
 
     void call_services_in_fiber(
         FiberPool& pool,
@@ -66,20 +103,73 @@ private:
         uint64_t id, FibpClientMgr& client_mgr,
         const std::vector<ServiceCallReq>& call_api_list,
         ServicesRsp& rsp_list, callback_t cb,
-        bool do_transaction = false);
+        const ServicesCallOption& option);
+
+    // call the services in the pool with the parallel limit, and wait as the option.
+    void fanout_services(FiberPool& pool,
+        boost::asio::io_service& io,
+        uint64_t id, FibpClientMgr& client_mgr,
+        const std::vector<ServiceCallReq>& call_api_list,
+        ServicesRsp& rsp_list,
+        const ServicesCallOption& option);
+
+    void run_fanout_call(FiberPool& pool,
+        boost::asio::io_service& io,
+        uint64_t id, FibpClientMgr& client_mgr,
+        FanoutContextPtr ctx, std::size_t index);
+
+    // replace the placeholders using the responses of the calls depended on.
+    bool prepare_dependent_call(FanoutContext& ctx, std::size_t index);
+    void finish_fanout_call(FanoutContext& ctx, std::size_t index);
+    // the calls ready should be started with ctx->mutex locked.
+    void start_fanout_calls(FiberPool& pool,
+        boost::asio::io_service& io,
+        uint64_t id, FibpClientMgr& client_mgr,
+        FanoutContextPtr ctx);
 
     void call_single_service(boost::asio::io_service& io,
         uint64_t id,
         FibpClientMgr& client_mgr,
         const ServiceCallReq& req,
-        ServiceCallRsp& rsp);
+        ServiceCallRsp& rsp,
+        CallCancelToken* cancel_token = NULL);
 
-    void call_single_service(boost::asio::io_service& io,
+    void call_service_with_retry(boost::asio::io_service& io,
         uint64_t id,
         FibpClientMgr& client_mgr,
         const ServiceCallReq& req,
         ServiceCallRsp& rsp,
-        int& call_num, boost::fibers::condition_variable& cond);
+        CallCancelToken* cancel_token);
+
+    void do_attempt(boost::asio::io_service& io,
+        uint64_t id,
+        FibpClientMgr& client_mgr,
+        const ServiceCallReq& req,
+        int timeout_ms,
+        ServiceAttempt& attempt);
+
+    // send the request to another host if the first one is slower than the hedge delay,
+    // the first success response is used and the other request is cancelled.
+    void do_hedged_attempt(boost::asio::io_service& io,
+        uint64_t id,
+        FibpClientMgr& client_mgr,
+        const ServiceCallReq& req,
+        int timeout_ms,
+        uint64_t hedge_delay_us,
+        std::size_t& balance_index,
+        ServiceAttempt& attempt);
+
+    void run_hedge_attempt(boost::asio::io_service& io,
+        uint64_t id,
+        FibpClientMgr& client_mgr,
+        int timeout_ms,
+        HedgeCallContextPtr ctx,
+        std::size_t index);
+
+    // return 0 if no hedged request for this call.
+    uint64_t get_hedge_delay_us(const ServiceCallReq& req);
+    // NULL if the response of the request should be buffered instead of relayed.
+    http::response_stream_t* get_rsp_stream(const ServiceCallReq& req);
 
     typedef MultiThreadObjMgr<FibpClientMgr> ClientMgrListT;
     ClientMgrListT client_mgr_list_;
@@ -88,8 +178,13 @@ private:
     boost::shared_ptr<FibpTransactionMgr> transaction_mgr_;
     typedef MultiThreadObjMgr<FiberPool> FiberPoolListT;
     FiberPoolListT  fiber_pool_list_;
-    boost::unordered_map<std::string, uint32_t>  service_fail_stat_;
+    typedef MultiThreadObjMgr<FibpSingleFlight> SingleFlightListT;
+    SingleFlightListT  single_flight_list_;
     boost::shared_ptr<FibpPortForwardMgr> port_forward_mgr_;
+    boost::shared_ptr<FibpServiceLatencyStat> latency_stat_;
+    boost::shared_ptr<FibpRetryBudget> retry_budget_;
+    boost::atomic<uint64_t> coalesce_leader_num_;
+    boost::atomic<uint64_t> coalesced_num_;
 };
 
 }
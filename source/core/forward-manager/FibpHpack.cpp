@@ -0,0 +1,403 @@
+#include "FibpHpack.h"
+#include <glog/logging.h>
+
+namespace fibp
+{
+
+static const HpackHeaderT STATIC_TABLE[] =
+{
+    HpackHeaderT(":authority", ""),
+    HpackHeaderT(":method", "GET"),
+    HpackHeaderT(":method", "POST"),
+    HpackHeaderT(":path", "/"),
+    HpackHeaderT(":path", "/index.html"),
+    HpackHeaderT(":scheme", "http"),
+    HpackHeaderT(":scheme", "https"),
+    HpackHeaderT(":status", "200"),
+    HpackHeaderT(":status", "204"),
+    HpackHeaderT(":status", "206"),
+    HpackHeaderT(":status", "304"),
+    HpackHeaderT(":status", "400"),
+    HpackHeaderT(":status", "404"),
+    HpackHeaderT(":status", "500"),
+    HpackHeaderT("accept-charset", ""),
+    HpackHeaderT("accept-encoding", "gzip, deflate"),
+    HpackHeaderT("accept-language", ""),
+    HpackHeaderT("accept-ranges", ""),
+    HpackHeaderT("accept", ""),
+    HpackHeaderT("access-control-allow-origin", ""),
+    HpackHeaderT("age", ""),
+    HpackHeaderT("allow", ""),
+    HpackHeaderT("authorization", ""),
+    HpackHeaderT("cache-control", ""),
+    HpackHeaderT("content-disposition", ""),
+    HpackHeaderT("content-encoding", ""),
+    HpackHeaderT("content-language", ""),
+    HpackHeaderT("content-length", ""),
+    HpackHeaderT("content-location", ""),
+    HpackHeaderT("content-range", ""),
+    HpackHeaderT("content-type", ""),
+    HpackHeaderT("cookie", ""),
+    HpackHeaderT("date", ""),
+    HpackHeaderT("etag", ""),
+    HpackHeaderT("expect", ""),
+    HpackHeaderT("expires", ""),
+    HpackHeaderT("from", ""),
+    HpackHeaderT("host", ""),
+    HpackHeaderT("if-match", ""),
+    HpackHeaderT("if-modified-since", ""),
+    HpackHeaderT("if-none-match", ""),
+    HpackHeaderT("if-range", ""),
+    HpackHeaderT("if-unmodified-since", ""),
+    HpackHeaderT("last-modified", ""),
+    HpackHeaderT("link", ""),
+    HpackHeaderT("location", ""),
+    HpackHeaderT("max-forwards", ""),
+    HpackHeaderT("proxy-authenticate", ""),
+    HpackHeaderT("proxy-authorization", ""),
+    HpackHeaderT("range", ""),
+    HpackHeaderT("referer", ""),
+    HpackHeaderT("refresh", ""),
+    HpackHeaderT("retry-after", ""),
+    HpackHeaderT("server", ""),
+    HpackHeaderT("set-cookie", ""),
+    HpackHeaderT("strict-transport-security", ""),
+    HpackHeaderT("transfer-encoding", ""),
+    HpackHeaderT("user-agent", ""),
+    HpackHeaderT("vary", ""),
+    HpackHeaderT("via", ""),
+    HpackHeaderT("www-authenticate", "")
+};
+
+// the huffman code of each symbol, EOS is not included.
+static const uint32_t HUFFMAN_CODES[256] =
+{
+    0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6, 0xfffffe7,
+    0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec,
+    0xfffffed, 0xfffffee, 0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+    0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa, 0xffffffb,
+    0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa,
+    0x3fa, 0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+    0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
+    0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+    0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+    0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+    0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72,
+    0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+    0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5, 0x25, 0x26,
+    0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a, 0x7,
+    0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+    0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd, 0x1ffd, 0xffffffc,
+    0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8, 0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9,
+    0x3fffd6, 0x7fffda, 0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+    0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3,
+    0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef,
+    0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+    0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf, 0x7fffeb, 0x7fffec,
+    0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2, 0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef,
+    0xfffea, 0x3fffe2, 0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+    0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec,
+    0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed,
+    0x7fff2, 0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+    0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4, 0x7ffffe5,
+    0xfffec, 0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3,
+    0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+    0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8, 0x7ffffe9, 0x7ffffea,
+    0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed, 0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee
+};
+
+static const uint8_t HUFFMAN_CODE_LENS[256] =
+{
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26
+};
+
+static const std::size_t STATIC_TABLE_SIZE = sizeof(STATIC_TABLE)/sizeof(STATIC_TABLE[0]);
+static const std::size_t DEFAULT_TABLE_SIZE = 4096;
+static const std::size_t ENTRY_OVERHEAD = 32;
+
+// the huffman codes in a binary tree, built once when loaded.
+struct HuffmanTree
+{
+    struct Node
+    {
+        Node()
+            : sym(-1)
+        {
+            child[0] = child[1] = 0;
+        }
+        int child[2];
+        int sym;
+    };
+    HuffmanTree()
+    {
+        nodes.push_back(Node());
+        for(int sym = 0; sym < 256; ++sym)
+        {
+            int cur = 0;
+            for(int i = HUFFMAN_CODE_LENS[sym] - 1; i >= 0; --i)
+            {
+                int bit = (HUFFMAN_CODES[sym] >> i) & 1;
+                if (nodes[cur].child[bit] == 0)
+                {
+                    nodes[cur].child[bit] = nodes.size();
+                    nodes.push_back(Node());
+                }
+                cur = nodes[cur].child[bit];
+            }
+            nodes[cur].sym = sym;
+        }
+    }
+    bool decode(const char* data, std::size_t len, std::string& out) const
+    {
+        int cur = 0;
+        // the bits since the last symbol, only the EOS prefix (all 1) of
+        // less than 8 bits is allowed as the padding.
+        int pending_bits = 0;
+        bool pending_ones = true;
+        for(std::size_t i = 0; i < len; ++i)
+        {
+            uint8_t c = data[i];
+            for(int j = 7; j >= 0; --j)
+            {
+                int bit = (c >> j) & 1;
+                cur = nodes[cur].child[bit];
+                if (cur == 0)
+                    return false;
+                ++pending_bits;
+                pending_ones = pending_ones && bit;
+                if (nodes[cur].sym >= 0)
+                {
+                    out.push_back((char)nodes[cur].sym);
+                    cur = 0;
+                    pending_bits = 0;
+                    pending_ones = true;
+                }
+            }
+        }
+        return pending_bits < 8 && pending_ones;
+    }
+    std::vector<Node> nodes;
+};
+
+static const HuffmanTree s_huffman_tree;
+
+static void encode_integer(uint64_t value, int prefix_bits, uint8_t first, std::string& out)
+{
+    uint64_t max_prefix = (1 << prefix_bits) - 1;
+    if (value < max_prefix)
+    {
+        out.push_back((char)(first | value));
+        return;
+    }
+    out.push_back((char)(first | max_prefix));
+    value -= max_prefix;
+    while(value >= 128)
+    {
+        out.push_back((char)(value % 128 + 128));
+        value /= 128;
+    }
+    out.push_back((char)value);
+}
+
+static void encode_string(const std::string& s, std::string& out)
+{
+    encode_integer(s.size(), 7, 0, out);
+    out.append(s);
+}
+
+static bool decode_integer(const std::string& block, std::size_t& pos, int prefix_bits,
+    uint64_t& value)
+{
+    if (pos >= block.size())
+        return false;
+    uint64_t max_prefix = (1 << prefix_bits) - 1;
+    value = (uint8_t)block[pos++] & max_prefix;
+    if (value < max_prefix)
+        return true;
+    int shift = 0;
+    while(pos < block.size())
+    {
+        uint8_t c = block[pos++];
+        value += (uint64_t)(c & 127) << shift;
+        if ((c & 128) == 0)
+            return true;
+        shift += 7;
+        if (shift > 56)
+            return false;
+    }
+    return false;
+}
+
+static bool decode_string(const std::string& block, std::size_t& pos, std::string& s)
+{
+    if (pos >= block.size())
+        return false;
+    bool is_huffman = ((uint8_t)block[pos] & 0x80) != 0;
+    uint64_t len = 0;
+    if (!decode_integer(block, pos, 7, len))
+        return false;
+    if (len > block.size() - pos)
+        return false;
+    s.clear();
+    if (is_huffman)
+    {
+        if (!s_huffman_tree.decode(block.data() + pos, len, s))
+            return false;
+    }
+    else
+    {
+        s.assign(block, pos, len);
+    }
+    pos += len;
+    return true;
+}
+
+void FibpHpackEncoder::encode(const HpackHeaderListT& headers, std::string& block)
+{
+    block.clear();
+    for(std::size_t i = 0; i < headers.size(); ++i)
+    {
+        const HpackHeaderT& h = headers[i];
+        std::size_t name_index = 0;
+        std::size_t full_index = 0;
+        for(std::size_t j = 0; j < STATIC_TABLE_SIZE; ++j)
+        {
+            if (STATIC_TABLE[j].first != h.first)
+                continue;
+            if (name_index == 0)
+                name_index = j + 1;
+            if (STATIC_TABLE[j].second == h.second)
+            {
+                full_index = j + 1;
+                break;
+            }
+        }
+        if (full_index > 0)
+        {
+            // indexed header field.
+            encode_integer(full_index, 7, 0x80, block);
+            continue;
+        }
+        // literal header field without indexing.
+        encode_integer(name_index, 4, 0, block);
+        if (name_index == 0)
+            encode_string(h.first, block);
+        encode_string(h.second, block);
+    }
+}
+
+FibpHpackDecoder::FibpHpackDecoder()
+    : dynamic_size_(0), max_dynamic_size_(DEFAULT_TABLE_SIZE)
+{
+}
+
+void FibpHpackDecoder::reset()
+{
+    dynamic_table_.clear();
+    dynamic_size_ = 0;
+    max_dynamic_size_ = DEFAULT_TABLE_SIZE;
+}
+
+bool FibpHpackDecoder::get_indexed(uint64_t index, HpackHeaderT& header) const
+{
+    if (index == 0)
+        return false;
+    if (index <= STATIC_TABLE_SIZE)
+    {
+        header = STATIC_TABLE[index - 1];
+        return true;
+    }
+    index -= STATIC_TABLE_SIZE + 1;
+    if (index >= dynamic_table_.size())
+        return false;
+    header = dynamic_table_[index];
+    return true;
+}
+
+void FibpHpackDecoder::evict(std::size_t max_size)
+{
+    while(dynamic_size_ > max_size && !dynamic_table_.empty())
+    {
+        const HpackHeaderT& h = dynamic_table_.back();
+        dynamic_size_ -= h.first.size() + h.second.size() + ENTRY_OVERHEAD;
+        dynamic_table_.pop_back();
+    }
+}
+
+void FibpHpackDecoder::add_dynamic(const HpackHeaderT& header)
+{
+    std::size_t size = header.first.size() + header.second.size() + ENTRY_OVERHEAD;
+    if (size > max_dynamic_size_)
+    {
+        // too large to be added, the table is emptied.
+        evict(0);
+        return;
+    }
+    evict(max_dynamic_size_ - size);
+    dynamic_table_.push_front(header);
+    dynamic_size_ += size;
+}
+
+bool FibpHpackDecoder::decode(const std::string& block, HpackHeaderListT& headers)
+{
+    headers.clear();
+    std::size_t pos = 0;
+    while(pos < block.size())
+    {
+        uint8_t c = block[pos];
+        uint64_t index = 0;
+        HpackHeaderT header;
+        if (c & 0x80)
+        {
+            // indexed header field.
+            if (!decode_integer(block, pos, 7, index) || !get_indexed(index, header))
+                return false;
+            headers.push_back(header);
+            continue;
+        }
+        if ((c & 0xe0) == 0x20)
+        {
+            // dynamic table size update, we never change the default in the settings.
+            if (!decode_integer(block, pos, 5, index) || index > DEFAULT_TABLE_SIZE)
+                return false;
+            max_dynamic_size_ = index;
+            evict(max_dynamic_size_);
+            continue;
+        }
+        bool need_index = (c & 0xc0) == 0x40;
+        if (!decode_integer(block, pos, need_index ? 6 : 4, index))
+            return false;
+        if (index > 0)
+        {
+            if (!get_indexed(index, header))
+                return false;
+        }
+        else if (!decode_string(block, pos, header.first))
+        {
+            return false;
+        }
+        if (!decode_string(block, pos, header.second))
+            return false;
+        if (need_index)
+            add_dynamic(header);
+        headers.push_back(header);
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,46 @@
+#ifndef FIBP_HPACK_H
+#define FIBP_HPACK_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <utility>
+#include <stdint.h>
+
+namespace fibp
+{
+
+typedef std::pair<std::string, std::string> HpackHeaderT;
+typedef std::vector<HpackHeaderT> HpackHeaderListT;
+
+// the header compression of HTTP/2 (RFC 7541). The encoder only uses the static
+// table and the literals without indexing, so it never changes the dynamic table
+// of the peer and the settings of the table size can be ignored.
+class FibpHpackEncoder
+{
+public:
+    void encode(const HpackHeaderListT& headers, std::string& block);
+};
+
+class FibpHpackDecoder
+{
+public:
+    FibpHpackDecoder();
+    // return false if the block is malformed, the connection should be closed
+    // since the dynamic table can not be kept in sync any more.
+    bool decode(const std::string& block, HpackHeaderListT& headers);
+    void reset();
+
+private:
+    bool get_indexed(uint64_t index, HpackHeaderT& header) const;
+    void add_dynamic(const HpackHeaderT& header);
+    void evict(std::size_t max_size);
+
+    std::deque<HpackHeaderT> dynamic_table_;
+    std::size_t dynamic_size_;
+    std::size_t max_dynamic_size_;
+};
+
+}
+
+#endif
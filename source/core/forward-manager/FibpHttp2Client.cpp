@@ -0,0 +1,687 @@
+#include "FibpHttp2Client.h"
+#include "FibpClientFuture.h"
+#include <boost/fiber/all.hpp>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/algorithm/string/case_conv.hpp>
+#include <string.h>
+#include <fiber-server/yield.hpp>
+#include <glog/logging.h>
+
+namespace ba = boost::asio;
+namespace bs = boost::system;
+
+namespace fibp
+{
+
+static const std::string CONN_PREFACE("PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n");
+static const std::string METHOD_NAMES[5] =
+{
+    "DELETE",
+    "GET",
+    "HEAD",
+    "POST",
+    "PUT"
+};
+
+static const uint8_t FRAME_DATA = 0x0;
+static const uint8_t FRAME_HEADERS = 0x1;
+static const uint8_t FRAME_RST_STREAM = 0x3;
+static const uint8_t FRAME_SETTINGS = 0x4;
+static const uint8_t FRAME_PUSH_PROMISE = 0x5;
+static const uint8_t FRAME_PING = 0x6;
+static const uint8_t FRAME_GOAWAY = 0x7;
+static const uint8_t FRAME_WINDOW_UPDATE = 0x8;
+static const uint8_t FRAME_CONTINUATION = 0x9;
+
+static const uint8_t FLAG_END_STREAM = 0x1;
+static const uint8_t FLAG_ACK = 0x1;
+static const uint8_t FLAG_END_HEADERS = 0x4;
+static const uint8_t FLAG_PADDED = 0x8;
+static const uint8_t FLAG_PRIORITY = 0x20;
+
+static const uint16_t SETTINGS_ENABLE_PUSH = 0x2;
+static const uint16_t SETTINGS_MAX_CONCURRENT_STREAMS = 0x3;
+static const uint16_t SETTINGS_INITIAL_WINDOW_SIZE = 0x4;
+static const uint16_t SETTINGS_MAX_FRAME_SIZE = 0x5;
+
+static const uint32_t ERROR_PROTOCOL = 0x1;
+static const uint32_t ERROR_CANCEL = 0x8;
+
+static const std::size_t FRAME_HEAD_SIZE = 9;
+static const uint32_t DEFAULT_WINDOW = 65535;
+static const uint32_t DEFAULT_MAX_FRAME_SIZE = 16384;
+static const uint32_t MAX_STREAM_ID = 0x7fffffff;
+// the streams allowed before the settings of the peer arrived.
+static const uint32_t DEFAULT_MAX_STREAMS = 100;
+static const uint32_t LOCAL_STREAM_WINDOW = 1024*1024;
+static const uint32_t LOCAL_CONN_WINDOW = 16*1024*1024;
+static const std::size_t MAX_RSP_SIZE = 10*1024*1024;
+// used to wait for the stream and the window if the request has no timeout.
+static const int DEFAULT_WAIT_MS = 5000;
+static const std::size_t READ_BUF_SIZE = 64*1024;
+
+static const std::string TIMEOUT_ERR("Server Timed Out.");
+static const std::string SERVER_RSP_TOO_LARGE_ERR("Server Response Too Large.");
+static const std::string CONN_CLOSED_ERR("Http2 Connection Closed.");
+static const std::string GOAWAY_ERR("Http2 Connection Going Away.");
+
+static inline void append_uint32(std::string& out, uint32_t v)
+{
+    out.push_back((char)(v >> 24));
+    out.push_back((char)(v >> 16));
+    out.push_back((char)(v >> 8));
+    out.push_back((char)v);
+}
+
+static inline uint32_t read_uint32(const char* p)
+{
+    const uint8_t* u = (const uint8_t*)p;
+    return ((uint32_t)u[0] << 24) | ((uint32_t)u[1] << 16) | ((uint32_t)u[2] << 8) | u[3];
+}
+
+static void append_frame_head(std::string& out, uint32_t len, uint8_t type,
+    uint8_t flags, uint32_t stream_id)
+{
+    out.push_back((char)(len >> 16));
+    out.push_back((char)(len >> 8));
+    out.push_back((char)len);
+    out.push_back((char)type);
+    out.push_back((char)flags);
+    append_uint32(out, stream_id & MAX_STREAM_ID);
+}
+
+static void append_setting(std::string& out, uint16_t id, uint32_t value)
+{
+    out.push_back((char)(id >> 8));
+    out.push_back((char)id);
+    append_uint32(out, value);
+}
+
+FibpHttp2Client::FibpHttp2Client(boost::asio::io_service& io_service, const std::string& host,
+    const std::string& port)
+    : session_(new ClientSession(io_service, host, port)),
+    next_stream_id_(1), conn_id_(0), continuation_stream_id_(0), continuation_end_stream_(false),
+    conn_send_window_(DEFAULT_WINDOW), conn_recv_unacked_(0), peer_initial_window_(DEFAULT_WINDOW),
+    peer_max_frame_size_(DEFAULT_MAX_FRAME_SIZE), peer_max_streams_(DEFAULT_MAX_STREAMS),
+    read_buf_(READ_BUF_SIZE), read_pos_(0), read_len_(0),
+    reading_num_(0), is_connected_(false), is_draining_(false)
+{
+}
+
+FibpHttp2Client::~FibpHttp2Client()
+{
+    session_->shutdown(true);
+}
+
+std::string FibpHttp2Client::host() const
+{
+    return session_->host();
+}
+
+std::string FibpHttp2Client::port() const
+{
+    return session_->port();
+}
+
+bool FibpHttp2Client::connect()
+{
+    // the streams left on the old connection will never be answered.
+    fail_streams(0, CONN_CLOSED_ERR);
+    is_connected_ = false;
+    ++conn_id_;
+    if (session_->socket_.is_open())
+        session_->shutdown(true);
+    bs::error_code ec = session_->async_connect();
+    if (ec || !session_->socket_.is_open())
+        return false;
+
+    decoder_.reset();
+    header_block_.clear();
+    next_stream_id_ = 1;
+    continuation_stream_id_ = 0;
+    conn_send_window_ = DEFAULT_WINDOW;
+    conn_recv_unacked_ = 0;
+    peer_initial_window_ = DEFAULT_WINDOW;
+    peer_max_frame_size_ = DEFAULT_MAX_FRAME_SIZE;
+    peer_max_streams_ = DEFAULT_MAX_STREAMS;
+    is_draining_ = false;
+
+    std::string settings;
+    append_setting(settings, SETTINGS_ENABLE_PUSH, 0);
+    append_setting(settings, SETTINGS_INITIAL_WINDOW_SIZE, LOCAL_STREAM_WINDOW);
+    std::string frames(CONN_PREFACE);
+    append_frame_head(frames, settings.size(), FRAME_SETTINGS, 0, 0);
+    frames.append(settings);
+    append_frame_head(frames, 4, FRAME_WINDOW_UPDATE, 0, 0);
+    append_uint32(frames, LOCAL_CONN_WINDOW - DEFAULT_WINDOW);
+    if (!write_frames(frames))
+        return false;
+
+    is_connected_ = true;
+    ++reading_num_;
+    boost::fibers::fiber f(boost::bind(&FibpHttp2Client::read_loop, this, conn_id_));
+    f.detach();
+    LOG(INFO) << "http2 connected: " << session_->host() << ":" << session_->port();
+    return true;
+}
+
+bool FibpHttp2Client::warm_up()
+{
+    boost::unique_lock<boost::fibers::mutex> guard(write_mutex_);
+    if (is_connected_ && session_->socket_.is_open())
+        return true;
+    return connect();
+}
+
+void FibpHttp2Client::close(const std::string& errinfo)
+{
+    // the reading fiber quits since the connection id changed.
+    ++conn_id_;
+    is_connected_ = false;
+    session_->shutdown(true);
+    fail_streams(0, errinfo);
+}
+
+bool FibpHttp2Client::write_frames(const std::string& frames, const char* data, std::size_t len)
+{
+    // the session would connect again without the preface.
+    if (!session_->socket_.is_open())
+        return false;
+    std::vector<ba::const_buffer> bufs;
+    bufs.push_back(ba::const_buffer(frames.data(), frames.size()));
+    if (len > 0)
+        bufs.push_back(ba::const_buffer(data, len));
+    return session_->send_data(bufs);
+}
+
+bool FibpHttp2Client::write_frame(uint8_t type, uint8_t flags, uint32_t stream_id,
+    const char* payload, std::size_t len)
+{
+    std::string head;
+    append_frame_head(head, len, type, flags, stream_id);
+    return write_frames(head, payload, len);
+}
+
+void FibpHttp2Client::reset_stream(uint32_t stream_id, uint32_t error_code)
+{
+    streams_.erase(stream_id);
+    std::string payload;
+    append_uint32(payload, error_code);
+    write_frame(FRAME_RST_STREAM, 0, stream_id, payload.data(), payload.size());
+    cond_.notify_all();
+}
+
+FibpClientFuturePtr FibpHttp2Client::send_request(
+    const std::string& path,
+    http::method method,
+    const std::string& reqdata,
+    int timeout_ms)
+{
+    HpackHeaderListT headers;
+    headers.push_back(std::make_pair(":method", METHOD_NAMES[method]));
+    headers.push_back(std::make_pair(":scheme", "http"));
+    headers.push_back(std::make_pair(":authority", session_->host() + ":" + session_->port()));
+    headers.push_back(std::make_pair(":path", path.empty() ? std::string("/") : path));
+    if (timeout_ms > 0)
+    {
+        headers.push_back(std::make_pair(boost::algorithm::to_lower_copy(std::string(http::timeout_header)),
+                boost::lexical_cast<std::string>(timeout_ms)));
+    }
+    if (!reqdata.empty() || method == http::POST || method == http::PUT)
+    {
+        headers.push_back(std::make_pair("content-length",
+                boost::lexical_cast<std::string>(reqdata.size())));
+    }
+
+    boost::chrono::steady_clock::time_point deadline = boost::chrono::steady_clock::now() +
+        boost::chrono::milliseconds(timeout_ms > 0 ? timeout_ms : DEFAULT_WAIT_MS);
+    boost::unique_lock<boost::fibers::mutex> guard(write_mutex_);
+    while(true)
+    {
+        if (!is_connected_ || !session_->socket_.is_open() || next_stream_id_ > MAX_STREAM_ID)
+        {
+            if (!streams_.empty() && next_stream_id_ > MAX_STREAM_ID)
+            {
+                is_draining_ = true;
+            }
+            else if (!connect())
+            {
+                return FibpClientFuturePtr();
+            }
+        }
+        if (is_draining_ && streams_.empty())
+        {
+            is_connected_ = false;
+            continue;
+        }
+        if (!is_draining_ && streams_.size() < peer_max_streams_)
+            break;
+        if (cond_.wait_until(guard, deadline) == boost::fibers::cv_status::timeout)
+        {
+            LOG(INFO) << "wait for http2 stream timeout: " << session_->host() << ":" << session_->port();
+            return FibpClientFuturePtr();
+        }
+    }
+
+    uint32_t stream_id = next_stream_id_;
+    next_stream_id_ += 2;
+    Http2StreamPtr stream(new Http2Stream());
+    stream->future.reset(new FibpClientFuture(session_->get_io_service(), stream_id, timeout_ms));
+    stream->send_window = peer_initial_window_;
+    streams_[stream_id] = stream;
+
+    std::string block;
+    encoder_.encode(headers, block);
+    std::string frames;
+    std::size_t pos = 0;
+    do
+    {
+        std::size_t len = std::min<std::size_t>(block.size() - pos, peer_max_frame_size_);
+        uint8_t flags = 0;
+        if (pos + len == block.size())
+            flags |= FLAG_END_HEADERS;
+        if (pos == 0 && reqdata.empty())
+            flags |= FLAG_END_STREAM;
+        append_frame_head(frames, len, pos == 0 ? FRAME_HEADERS : FRAME_CONTINUATION, flags, stream_id);
+        frames.append(block, pos, len);
+        pos += len;
+    } while(pos < block.size());
+
+    if (!write_frames(frames) ||
+        (!reqdata.empty() && !send_data(guard, stream_id, reqdata, deadline)))
+    {
+        streams_.erase(stream_id);
+        return FibpClientFuturePtr();
+    }
+    return stream->future;
+}
+
+bool FibpHttp2Client::send_data(boost::unique_lock<boost::fibers::mutex>& guard, uint32_t stream_id,
+    const std::string& reqdata, const boost::chrono::steady_clock::time_point& deadline)
+{
+    uint32_t conn_id = conn_id_;
+    std::size_t pos = 0;
+    while(pos < reqdata.size())
+    {
+        StreamMapT::iterator it = streams_.find(stream_id);
+        if (conn_id != conn_id_ || it == streams_.end())
+        {
+            // reset by the server or the connection closed.
+            return false;
+        }
+        Http2StreamPtr stream = it->second;
+        int64_t window = std::min(conn_send_window_, stream->send_window);
+        if (window <= 0)
+        {
+            if (cond_.wait_until(guard, deadline) == boost::fibers::cv_status::timeout)
+            {
+                LOG(INFO) << "wait for http2 window timeout: " << session_->host() << ":" << session_->port();
+                reset_stream(stream_id, ERROR_CANCEL);
+                return false;
+            }
+            continue;
+        }
+        std::size_t len = std::min<std::size_t>(reqdata.size() - pos,
+            std::min<int64_t>(window, peer_max_frame_size_));
+        uint8_t flags = (pos + len == reqdata.size()) ? FLAG_END_STREAM : 0;
+        if (!write_frame(FRAME_DATA, flags, stream_id, reqdata.data() + pos, len))
+            return false;
+        conn_send_window_ -= len;
+        stream->send_window -= len;
+        pos += len;
+    }
+    return true;
+}
+
+bool FibpHttp2Client::get_response(FibpClientFuturePtr f, std::string& rsp, bool& can_retry)
+{
+    bool ret = f->getRsp(rsp, can_retry);
+    if (!f->is_done())
+    {
+        // only the stream is abandoned, the others on the connection go on.
+        f->cancel();
+        boost::unique_lock<boost::fibers::mutex> guard(write_mutex_);
+        if (streams_.find(f->getid()) != streams_.end())
+            reset_stream(f->getid(), ERROR_CANCEL);
+    }
+    return ret;
+}
+
+void FibpHttp2Client::ack_recv_data(uint32_t stream_id, Http2StreamPtr stream, uint32_t len,
+    bool end_stream)
+{
+    conn_recv_unacked_ += len;
+    std::string frames;
+    if (conn_recv_unacked_ >= LOCAL_CONN_WINDOW / 2)
+    {
+        append_frame_head(frames, 4, FRAME_WINDOW_UPDATE, 0, 0);
+        append_uint32(frames, conn_recv_unacked_);
+        conn_recv_unacked_ = 0;
+    }
+    if (stream && !end_stream)
+    {
+        stream->recv_unacked += len;
+        if (stream->recv_unacked >= LOCAL_STREAM_WINDOW / 2)
+        {
+            append_frame_head(frames, 4, FRAME_WINDOW_UPDATE, 0, stream_id);
+            append_uint32(frames, stream->recv_unacked);
+            stream->recv_unacked = 0;
+        }
+    }
+    if (!frames.empty())
+    {
+        boost::unique_lock<boost::fibers::mutex> guard(write_mutex_);
+        write_frames(frames);
+    }
+}
+
+bs::error_code FibpHttp2Client::read_bytes(char* data, std::size_t len)
+{
+    // the frames are parsed from the buffer, reading each frame head and payload
+    // from the socket separately would cost too many round trips of the fiber.
+    bs::error_code ec;
+    while(len > 0)
+    {
+        if (read_pos_ == read_len_)
+        {
+            read_pos_ = 0;
+            read_len_ = session_->socket_.async_read_some(ba::buffer(read_buf_),
+                boost::fibers::asio::yield[ec]);
+            if (ec)
+            {
+                read_len_ = 0;
+                return ec;
+            }
+        }
+        std::size_t n = std::min(len, read_len_ - read_pos_);
+        memcpy(data, &read_buf_[read_pos_], n);
+        read_pos_ += n;
+        data += n;
+        len -= n;
+    }
+    return ec;
+}
+
+void FibpHttp2Client::read_loop(uint32_t conn_id)
+{
+    handle_read(conn_id);
+    --reading_num_;
+}
+
+void FibpHttp2Client::handle_read(uint32_t conn_id)
+{
+    std::string errinfo;
+    char head[FRAME_HEAD_SIZE];
+    std::string payload;
+    read_pos_ = 0;
+    read_len_ = 0;
+    while(conn_id == conn_id_)
+    {
+        bs::error_code ec = read_bytes(head, FRAME_HEAD_SIZE);
+        if (!ec && conn_id == conn_id_)
+        {
+            uint32_t len = ((uint32_t)(uint8_t)head[0] << 16) | ((uint32_t)(uint8_t)head[1] << 8) |
+                (uint8_t)head[2];
+            // we never increase the max frame size in the settings.
+            if (len > DEFAULT_MAX_FRAME_SIZE)
+            {
+                errinfo = SERVER_RSP_TOO_LARGE_ERR;
+                break;
+            }
+            payload.resize(len);
+            if (len > 0)
+                ec = read_bytes(&payload[0], len);
+        }
+        if (conn_id != conn_id_)
+            return;
+        if (ec)
+        {
+            errinfo = ec.message();
+            if (ec == boost::asio::error::operation_aborted)
+                errinfo = TIMEOUT_ERR;
+            break;
+        }
+        if (!handle_frame(head[3], head[4], read_uint32(head + 5) & MAX_STREAM_ID, payload))
+        {
+            errinfo = "Http2 Protocol Error.";
+            boost::unique_lock<boost::fibers::mutex> guard(write_mutex_);
+            std::string goaway;
+            append_uint32(goaway, 0);
+            append_uint32(goaway, ERROR_PROTOCOL);
+            write_frame(FRAME_GOAWAY, 0, 0, goaway.data(), goaway.size());
+            break;
+        }
+    }
+    if (conn_id != conn_id_)
+        return;
+    LOG(INFO) << "http2 connection closed: " << session_->host() << ":" << session_->port()
+        << ", " << errinfo;
+    is_connected_ = false;
+    session_->shutdown(true);
+    fail_streams(0, errinfo);
+}
+
+bool FibpHttp2Client::handle_frame(uint8_t type, uint8_t flags, uint32_t stream_id,
+    const std::string& payload)
+{
+    if (continuation_stream_id_ != 0 &&
+        (type != FRAME_CONTINUATION || stream_id != continuation_stream_id_))
+    {
+        return false;
+    }
+    std::size_t begin = 0;
+    std::size_t end = payload.size();
+    if ((type == FRAME_DATA || type == FRAME_HEADERS) && (flags & FLAG_PADDED))
+    {
+        if (payload.empty() || (uint8_t)payload[0] >= payload.size())
+            return false;
+        begin = 1;
+        end -= (uint8_t)payload[0];
+    }
+    StreamMapT::iterator it = streams_.find(stream_id);
+    Http2StreamPtr stream;
+    if (stream_id != 0 && it != streams_.end())
+        stream = it->second;
+
+    switch(type)
+    {
+    case FRAME_DATA:
+        ack_recv_data(stream_id, stream, payload.size(), flags & FLAG_END_STREAM);
+        if (!stream)
+            break;
+        stream->body.append(payload, begin, end - begin);
+        if (stream->body.size() > MAX_RSP_SIZE)
+        {
+            std::string err(SERVER_RSP_TOO_LARGE_ERR);
+            stream->future->set_result(err, false, false);
+            boost::unique_lock<boost::fibers::mutex> guard(write_mutex_);
+            reset_stream(stream_id, ERROR_CANCEL);
+        }
+        else if (flags & FLAG_END_STREAM)
+        {
+            finish_stream(stream_id);
+        }
+        break;
+    case FRAME_HEADERS:
+        if (flags & FLAG_PRIORITY)
+            begin += 5;
+        if (begin > end)
+            return false;
+        header_block_.assign(payload, begin, end - begin);
+        if (flags & FLAG_END_HEADERS)
+            return handle_headers(stream_id, flags & FLAG_END_STREAM);
+        continuation_stream_id_ = stream_id;
+        continuation_end_stream_ = flags & FLAG_END_STREAM;
+        break;
+    case FRAME_CONTINUATION:
+        if (continuation_stream_id_ == 0)
+            return false;
+        header_block_.append(payload);
+        if (flags & FLAG_END_HEADERS)
+        {
+            continuation_stream_id_ = 0;
+            return handle_headers(stream_id, continuation_end_stream_);
+        }
+        break;
+    case FRAME_RST_STREAM:
+        if (payload.size() != 4)
+            return false;
+        if (stream)
+        {
+            std::string err = "Http2 Stream Reset: " +
+                boost::lexical_cast<std::string>(read_uint32(payload.data())) + ".";
+            stream->future->set_result(err, false, true);
+            streams_.erase(stream_id);
+            cond_.notify_all();
+        }
+        break;
+    case FRAME_SETTINGS:
+        if (stream_id != 0)
+            return false;
+        return handle_settings(flags, payload);
+    case FRAME_PING:
+        if (payload.size() != 8)
+            return false;
+        if (!(flags & FLAG_ACK))
+        {
+            boost::unique_lock<boost::fibers::mutex> guard(write_mutex_);
+            write_frame(FRAME_PING, FLAG_ACK, 0, payload.data(), payload.size());
+        }
+        break;
+    case FRAME_GOAWAY:
+        if (payload.size() < 8)
+            return false;
+        handle_goaway(payload);
+        break;
+    case FRAME_WINDOW_UPDATE:
+        if (payload.size() != 4)
+            return false;
+        if (stream_id == 0)
+            conn_send_window_ += read_uint32(payload.data()) & MAX_STREAM_ID;
+        else if (stream)
+            stream->send_window += read_uint32(payload.data()) & MAX_STREAM_ID;
+        cond_.notify_all();
+        break;
+    case FRAME_PUSH_PROMISE:
+        // the push is disabled in our settings.
+        return false;
+    default:
+        // PRIORITY and the unknown frames are ignored.
+        break;
+    }
+    return true;
+}
+
+bool FibpHttp2Client::handle_headers(uint32_t stream_id, bool end_stream)
+{
+    HpackHeaderListT headers;
+    // decoded even if the stream is gone to keep the dynamic table in sync.
+    if (!decoder_.decode(header_block_, headers))
+        return false;
+    header_block_.clear();
+    StreamMapT::iterator it = streams_.find(stream_id);
+    if (it == streams_.end())
+        return true;
+    Http2StreamPtr stream = it->second;
+    for(std::size_t i = 0; i < headers.size(); ++i)
+    {
+        if (headers[i].first == ":status" && stream->status == 0)
+        {
+            try
+            {
+                stream->status = boost::lexical_cast<int>(headers[i].second);
+            }
+            catch(const std::exception& e)
+            {
+                return false;
+            }
+            // wait for the final response after the informational ones.
+            if (stream->status < 200)
+                stream->status = 0;
+        }
+    }
+    if (end_stream)
+        finish_stream(stream_id);
+    return true;
+}
+
+bool FibpHttp2Client::handle_settings(uint8_t flags, const std::string& payload)
+{
+    if (flags & FLAG_ACK)
+        return true;
+    if (payload.size() % 6 != 0)
+        return false;
+    for(std::size_t i = 0; i < payload.size(); i += 6)
+    {
+        uint16_t id = ((uint16_t)(uint8_t)payload[i] << 8) | (uint8_t)payload[i + 1];
+        uint32_t value = read_uint32(payload.data() + i + 2);
+        if (id == SETTINGS_MAX_CONCURRENT_STREAMS)
+        {
+            peer_max_streams_ = value;
+        }
+        else if (id == SETTINGS_INITIAL_WINDOW_SIZE)
+        {
+            if (value > MAX_STREAM_ID)
+                return false;
+            // the change applies to the windows of all the open streams.
+            int64_t delta = (int64_t)value - peer_initial_window_;
+            for(StreamMapT::iterator it = streams_.begin(); it != streams_.end(); ++it)
+                it->second->send_window += delta;
+            peer_initial_window_ = value;
+        }
+        else if (id == SETTINGS_MAX_FRAME_SIZE)
+        {
+            if (value < DEFAULT_MAX_FRAME_SIZE || value > 0xffffff)
+                return false;
+            peer_max_frame_size_ = value;
+        }
+    }
+    cond_.notify_all();
+    boost::unique_lock<boost::fibers::mutex> guard(write_mutex_);
+    write_frame(FRAME_SETTINGS, FLAG_ACK, 0, NULL, 0);
+    return true;
+}
+
+void FibpHttp2Client::handle_goaway(const std::string& payload)
+{
+    uint32_t last_stream_id = read_uint32(payload.data()) & MAX_STREAM_ID;
+    LOG(INFO) << "http2 goaway received: " << session_->host() << ":" << session_->port()
+        << ", last stream: " << last_stream_id << ", error: " << read_uint32(payload.data() + 4);
+    // the streams after the last one are not handled and safe to retry.
+    is_draining_ = true;
+    fail_streams(last_stream_id + 1, GOAWAY_ERR);
+}
+
+void FibpHttp2Client::finish_stream(uint32_t stream_id)
+{
+    StreamMapT::iterator it = streams_.find(stream_id);
+    if (it == streams_.end())
+        return;
+    Http2StreamPtr stream = it->second;
+    streams_.erase(it);
+    // the same as the http/1.1 client.
+    bool is_success = stream->status == http::OK;
+    bool can_retry = !(stream->status == http::BAD_REQUEST || stream->status == http::NOT_FOUND);
+    std::string rsp;
+    if (is_success)
+        rsp.swap(stream->body);
+    else
+        rsp = "Http Status: " + boost::lexical_cast<std::string>(stream->status) + ".";
+    stream->future->set_result(rsp, is_success, can_retry);
+    cond_.notify_all();
+}
+
+void FibpHttp2Client::fail_streams(uint32_t min_stream_id, const std::string& errinfo)
+{
+    StreamMapT::iterator it = streams_.lower_bound(min_stream_id);
+    while(it != streams_.end())
+    {
+        std::string err(errinfo);
+        it->second->future->set_result(err, false, true);
+        streams_.erase(it++);
+    }
+    cond_.notify_all();
+}
+
+}
@@ -0,0 +1,113 @@
+#ifndef FIBP_HTTP2_CLIENT_H
+#define FIBP_HTTP2_CLIENT_H
+
+#include "FibpClient.h"
+#include "FibpHpack.h"
+#include <boost/fiber/condition.hpp>
+#include <boost/fiber/mutex.hpp>
+#include <boost/chrono/system_clocks.hpp>
+#include <boost/thread/locks.hpp>
+#include <map>
+#include <vector>
+
+namespace fibp
+{
+
+// the HTTP/2 client over the cleartext connection with prior knowledge (h2c),
+// the requests of all the fibers are sent as the streams multiplexed on one
+// connection to the host.
+class FibpHttp2Client : public FibpHttpMuxClient
+{
+public:
+    FibpHttp2Client(boost::asio::io_service& service, const std::string& host, const std::string& port);
+    ~FibpHttp2Client();
+    FibpClientFuturePtr send_request(
+        const std::string& path,
+        http::method method,
+        const std::string& reqdata,
+        int timeout_ms);
+    bool get_response(FibpClientFuturePtr f, std::string& rsp, bool& can_retry);
+    bool can_send() const
+    {
+        return true;
+    }
+    std::string host() const;
+    std::string port() const;
+    bool warm_up();
+    void close(const std::string& errinfo);
+    bool is_closed() const
+    {
+        return reading_num_ == 0;
+    }
+
+private:
+    struct Http2Stream
+    {
+        Http2Stream()
+            : send_window(0), recv_unacked(0), status(0)
+        {
+        }
+        FibpClientFuturePtr future;
+        int64_t send_window;
+        uint32_t recv_unacked;
+        int status;
+        std::string body;
+    };
+    typedef boost::shared_ptr<Http2Stream> Http2StreamPtr;
+    typedef std::map<uint32_t, Http2StreamPtr> StreamMapT;
+
+    // the methods writing to the connection should be called with the write
+    // mutex locked.
+    bool connect();
+    bool write_frames(const std::string& frames, const char* data = NULL, std::size_t len = 0);
+    bool write_frame(uint8_t type, uint8_t flags, uint32_t stream_id,
+        const char* payload, std::size_t len);
+    bool send_data(boost::unique_lock<boost::fibers::mutex>& guard, uint32_t stream_id,
+        const std::string& reqdata, const boost::chrono::steady_clock::time_point& deadline);
+    void reset_stream(uint32_t stream_id, uint32_t error_code);
+    void ack_recv_data(uint32_t stream_id, Http2StreamPtr stream, uint32_t len, bool end_stream);
+
+    boost::system::error_code read_bytes(char* data, std::size_t len);
+    void read_loop(uint32_t conn_id);
+    void handle_read(uint32_t conn_id);
+    bool handle_frame(uint8_t type, uint8_t flags, uint32_t stream_id, const std::string& payload);
+    bool handle_headers(uint32_t stream_id, bool end_stream);
+    bool handle_settings(uint8_t flags, const std::string& payload);
+    void handle_goaway(const std::string& payload);
+    void finish_stream(uint32_t stream_id);
+    void fail_streams(uint32_t min_stream_id, const std::string& errinfo);
+
+    ClientSessionPtr session_;
+    FibpHpackEncoder encoder_;
+    FibpHpackDecoder decoder_;
+    StreamMapT streams_;
+    uint32_t next_stream_id_;
+    // changed for each new connection, the fiber reading the old one quits.
+    uint32_t conn_id_;
+    // the header block not finished until the CONTINUATION frames arrived.
+    std::string header_block_;
+    uint32_t continuation_stream_id_;
+    bool continuation_end_stream_;
+    int64_t conn_send_window_;
+    uint32_t conn_recv_unacked_;
+    int64_t peer_initial_window_;
+    uint32_t peer_max_frame_size_;
+    uint32_t peer_max_streams_;
+    std::vector<char> read_buf_;
+    std::size_t read_pos_;
+    std::size_t read_len_;
+    // the fibers reading the connections, the old one may not quit yet.
+    int reading_num_;
+    bool is_connected_;
+    // no new stream on the connection after GOAWAY, reconnect once the
+    // streams left finished.
+    bool is_draining_;
+    boost::fibers::mutex write_mutex_;
+    // notified when a stream finished or the send window increased.
+    boost::fibers::condition_variable cond_;
+};
+typedef boost::shared_ptr<FibpHttp2Client> FibpHttp2ClientPtr;
+
+}
+
+#endif
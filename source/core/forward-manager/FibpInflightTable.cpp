@@ -0,0 +1,96 @@
+#include "FibpInflightTable.h"
+#include "FibpClientFuture.h"
+
+namespace fibp
+{
+
+static const uint32_t INIT_SLOT_NUM = 64;
+static const std::size_t MAX_RECYCLED_NUM = 64;
+
+FibpInflightTable::FibpInflightTable(boost::asio::io_service& io)
+    : io_(io), mask_(INIT_SLOT_NUM - 1)
+{
+    slots_.resize(INIT_SLOT_NUM);
+}
+
+FibpClientFuturePtr FibpInflightTable::add(uint32_t msgid, uint32_t timeout_ms)
+{
+    while(true)
+    {
+        Slot& slot = slots_[msgid & mask_];
+        // nobody waits for the call not answered, the late response is dropped.
+        if (!slot.future || slot.future.unique())
+            break;
+        grow();
+    }
+    Slot& slot = slots_[msgid & mask_];
+    FibpClientFuturePtr f;
+    if (slot.future)
+    {
+        f.swap(slot.future);
+    }
+    while(!f && !recycled_.empty())
+    {
+        if (recycled_.back().unique())
+            f.swap(recycled_.back());
+        recycled_.pop_back();
+    }
+    if (f)
+        f->reuse(msgid, timeout_ms);
+    else
+        f.reset(new FibpClientFuture(io_, msgid, timeout_ms));
+    slot.msgid = msgid;
+    slot.future = f;
+    return f;
+}
+
+FibpClientFuturePtr FibpInflightTable::remove(uint32_t msgid)
+{
+    Slot& slot = slots_[msgid & mask_];
+    FibpClientFuturePtr f;
+    if (slot.future && slot.msgid == msgid)
+    {
+        f.swap(slot.future);
+        recycle(f);
+    }
+    return f;
+}
+
+void FibpInflightTable::set_all_error(const std::string& errinfo)
+{
+    for(std::size_t i = 0; i < slots_.size(); ++i)
+    {
+        if (!slots_[i].future)
+            continue;
+        FibpClientFuturePtr f;
+        f.swap(slots_[i].future);
+        std::string err(errinfo);
+        f->set_result(err, false, true);
+        recycle(f);
+    }
+}
+
+void FibpInflightTable::grow()
+{
+    // the slots keep distinct under the larger mask since the low bits are the same.
+    std::vector<Slot> old;
+    old.swap(slots_);
+    slots_.resize(old.size() * 2);
+    mask_ = slots_.size() - 1;
+    for(std::size_t i = 0; i < old.size(); ++i)
+    {
+        if (!old[i].future)
+            continue;
+        Slot& slot = slots_[old[i].msgid & mask_];
+        slot.msgid = old[i].msgid;
+        slot.future.swap(old[i].future);
+    }
+}
+
+void FibpInflightTable::recycle(const FibpClientFuturePtr& f)
+{
+    if (recycled_.size() < MAX_RECYCLED_NUM)
+        recycled_.push_back(f);
+}
+
+}
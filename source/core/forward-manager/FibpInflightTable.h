@@ -0,0 +1,51 @@
+#ifndef FIBP_INFLIGHT_TABLE_H
+#define FIBP_INFLIGHT_TABLE_H
+
+#include <boost/shared_ptr.hpp>
+#include <boost/asio.hpp>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace fibp
+{
+
+class FibpClientFuture;
+typedef boost::shared_ptr<FibpClientFuture> FibpClientFuturePtr;
+
+// the futures of the calls waiting for the responses on a connection. The msgid
+// is sequential so the slot is indexed by its low bits without any node allocated
+// for each call, and the futures released by the callers are reused. Only used in
+// the thread owning the connection.
+class FibpInflightTable
+{
+public:
+    FibpInflightTable(boost::asio::io_service& io);
+    FibpClientFuturePtr add(uint32_t msgid, uint32_t timeout_ms);
+    // return empty if the msgid is not waited any more.
+    FibpClientFuturePtr remove(uint32_t msgid);
+    void set_all_error(const std::string& errinfo);
+
+private:
+    struct Slot
+    {
+        Slot()
+            : msgid(0)
+        {
+        }
+        uint32_t msgid;
+        FibpClientFuturePtr future;
+    };
+    void grow();
+    void recycle(const FibpClientFuturePtr& f);
+
+    boost::asio::io_service& io_;
+    std::vector<Slot> slots_;
+    uint32_t mask_;
+    // the futures done, reused once the caller releases them.
+    std::vector<FibpClientFuturePtr> recycled_;
+};
+
+}
+
+#endif
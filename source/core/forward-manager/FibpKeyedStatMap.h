@@ -0,0 +1,112 @@
+#ifndef FIBP_KEYED_STAT_MAP_H
+#define FIBP_KEYED_STAT_MAP_H
+
+#include <string>
+#include <stdint.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/chrono/system_clocks.hpp>
+#include <3rdparty/folly/RWSpinLock.h>
+
+namespace fibp
+{
+
+// the stats of each key (a service or an endpoint) shared by all the worker
+// threads. The stat is found under the read lock and created under the write
+// lock, the caller keeps it by the pointer so the updates need no lock here.
+// Whenever a new stat is created, at most once per evict interval, the stats
+// idle for idle_us are removed, T::is_idle(since_us) tells if the stat is not
+// used since then and holds nothing different from a new one that matters.
+template <class T>
+class FibpKeyedStatMap
+{
+public:
+    typedef boost::shared_ptr<T> StatPtr;
+    static const uint64_t EVICT_INTERVAL_US = 60ULL*1000*1000;
+
+    explicit FibpKeyedStatMap(uint64_t idle_us)
+        : idle_us_(idle_us), last_evict_us_(now_us())
+    {
+        stats_.rehash(1000);
+    }
+
+    static uint64_t now_us()
+    {
+        return boost::chrono::duration_cast<boost::chrono::microseconds>(
+            boost::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // empty if never created or evicted.
+    StatPtr find(const std::string& key)
+    {
+        folly::RWSpinLock::ReadHolder guard(lock_);
+        typename MapT::const_iterator it = stats_.find(key);
+        if (it == stats_.end())
+            return StatPtr();
+        return it->second;
+    }
+
+    StatPtr get(const std::string& key)
+    {
+        StatPtr stat = find(key);
+        if (stat)
+            return stat;
+        folly::RWSpinLock::WriteHolder guard(lock_);
+        uint64_t now = now_us();
+        if (now > last_evict_us_ + EVICT_INTERVAL_US)
+            evict_locked(now);
+        StatPtr& new_stat = stats_[key];
+        if (!new_stat)
+            new_stat.reset(new T());
+        return new_stat;
+    }
+
+    // the one still held by the caller is updated in vain.
+    void erase(const std::string& key)
+    {
+        folly::RWSpinLock::WriteHolder guard(lock_);
+        stats_.erase(key);
+    }
+
+    void evict_idle(uint64_t now)
+    {
+        folly::RWSpinLock::WriteHolder guard(lock_);
+        evict_locked(now);
+    }
+
+    std::size_t size()
+    {
+        folly::RWSpinLock::ReadHolder guard(lock_);
+        return stats_.size();
+    }
+
+private:
+    typedef boost::unordered_map<std::string, StatPtr> MapT;
+
+    void evict_locked(uint64_t now)
+    {
+        last_evict_us_ = now;
+        uint64_t since = now > idle_us_ ? now - idle_us_ : 0;
+        typename MapT::iterator it = stats_.begin();
+        while(it != stats_.end())
+        {
+            if (it->second->is_idle(since))
+                it = stats_.erase(it);
+            else
+                ++it;
+        }
+    }
+
+    MapT stats_;
+    folly::RWSpinLock lock_;
+    uint64_t idle_us_;
+    // changed under the write lock.
+    uint64_t last_evict_us_;
+};
+
+template <class T>
+const uint64_t FibpKeyedStatMap<T>::EVICT_INTERVAL_US;
+
+}
+
+#endif
@@ -0,0 +1,98 @@
+#include "FibpLatencyStat.h"
+#include <cmath>
+
+namespace fibp
+{
+
+// the upper bound of bucket i is MIN_LATENCY_US * 2^(i/BUCKETS_PER_OCTAVE)
+static const double MIN_LATENCY_US = 100;
+static const int BUCKETS_PER_OCTAVE = 4;
+static const uint32_t MIN_SAMPLES = 50;
+static const uint32_t DECAY_SAMPLES = 10000;
+static const uint64_t SERVICE_IDLE_US = 600ULL*1000*1000;
+
+FibpLatencyHistogram::FibpLatencyHistogram()
+    : total_(0), is_decaying_(false)
+{
+    for(std::size_t i = 0; i < BUCKET_NUM; ++i)
+    {
+        buckets_[i] = 0;
+    }
+}
+
+std::size_t FibpLatencyHistogram::get_bucket(uint64_t latency_us)
+{
+    if (latency_us <= MIN_LATENCY_US)
+        return 0;
+    std::size_t bucket = (std::size_t)std::ceil(BUCKETS_PER_OCTAVE * std::log(latency_us / MIN_LATENCY_US) / std::log(2.0));
+    if (bucket >= BUCKET_NUM)
+        bucket = BUCKET_NUM - 1;
+    return bucket;
+}
+
+uint64_t FibpLatencyHistogram::get_bucket_upper(std::size_t bucket)
+{
+    return (uint64_t)(MIN_LATENCY_US * std::pow(2.0, (double)bucket / BUCKETS_PER_OCTAVE));
+}
+
+void FibpLatencyHistogram::add(uint64_t latency_us)
+{
+    ++buckets_[get_bucket(latency_us)];
+    if (++total_ < DECAY_SAMPLES)
+        return;
+    // the others passing the threshold meanwhile leave it to the one decaying,
+    // so the buckets are halved once.
+    if (is_decaying_.exchange(true, boost::memory_order_acquire))
+        return;
+    if (total_.load(boost::memory_order_relaxed) >= DECAY_SAMPLES)
+    {
+        // concurrent adders may be lost during the decay, it is fine for the statistics.
+        uint32_t total = 0;
+        for(std::size_t i = 0; i < BUCKET_NUM; ++i)
+        {
+            uint32_t half = buckets_[i].load(boost::memory_order_relaxed) / 2;
+            buckets_[i].store(half, boost::memory_order_relaxed);
+            total += half;
+        }
+        total_.store(total, boost::memory_order_relaxed);
+    }
+    is_decaying_.store(false, boost::memory_order_release);
+}
+
+uint64_t FibpLatencyHistogram::get_percentile(int percentile) const
+{
+    uint32_t total = total_.load(boost::memory_order_relaxed);
+    if (total < MIN_SAMPLES)
+        return 0;
+    uint64_t target = (uint64_t)total * percentile / 100;
+    uint64_t count = 0;
+    for(std::size_t i = 0; i < BUCKET_NUM; ++i)
+    {
+        count += buckets_[i].load(boost::memory_order_relaxed);
+        if (count > target)
+            return get_bucket_upper(i);
+    }
+    return get_bucket_upper(BUCKET_NUM - 1);
+}
+
+FibpServiceLatencyStat::FibpServiceLatencyStat()
+    : service_latency_(SERVICE_IDLE_US)
+{
+}
+
+void FibpServiceLatencyStat::add(const std::string& service_name, uint64_t latency_us)
+{
+    FibpKeyedStatMap<ServiceLatency>::StatPtr stat = service_latency_.get(service_name);
+    stat->histogram.add(latency_us);
+    stat->last_add_us.store(FibpKeyedStatMap<ServiceLatency>::now_us(), boost::memory_order_relaxed);
+}
+
+uint64_t FibpServiceLatencyStat::get_percentile(const std::string& service_name, int percentile)
+{
+    FibpKeyedStatMap<ServiceLatency>::StatPtr stat = service_latency_.find(service_name);
+    if (!stat)
+        return 0;
+    return stat->histogram.get_percentile(percentile);
+}
+
+}
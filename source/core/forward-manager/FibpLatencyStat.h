@@ -0,0 +1,62 @@
+#ifndef FIBP_LATENCY_STAT_H
+#define FIBP_LATENCY_STAT_H
+
+#include <string>
+#include <stdint.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/atomic.hpp>
+#include "FibpKeyedStatMap.h"
+
+namespace fibp
+{
+
+// log scaled latency histogram, old samples are decayed by halving all the
+// buckets once enough samples are collected.
+class FibpLatencyHistogram
+{
+public:
+    FibpLatencyHistogram();
+    void add(uint64_t latency_us);
+    // return 0 if there are not enough samples.
+    uint64_t get_percentile(int percentile) const;
+
+private:
+    enum { BUCKET_NUM = 80 };
+    static std::size_t get_bucket(uint64_t latency_us);
+    static uint64_t get_bucket_upper(std::size_t bucket);
+
+    boost::atomic<uint32_t> buckets_[BUCKET_NUM];
+    boost::atomic<uint32_t> total_;
+    // only one adder decays the buckets at a time.
+    boost::atomic<bool> is_decaying_;
+};
+
+class FibpServiceLatencyStat
+{
+public:
+    FibpServiceLatencyStat();
+    void add(const std::string& service_name, uint64_t latency_us);
+    uint64_t get_percentile(const std::string& service_name, int percentile);
+
+private:
+    struct ServiceLatency
+    {
+        ServiceLatency()
+            : last_add_us(0)
+        {
+        }
+        // the service not called for long is mostly gone, and its samples are
+        // too old to tell the latency now.
+        bool is_idle(uint64_t since_us) const
+        {
+            return last_add_us.load(boost::memory_order_relaxed) < since_us;
+        }
+        FibpLatencyHistogram histogram;
+        boost::atomic<uint64_t> last_add_us;
+    };
+    FibpKeyedStatMap<ServiceLatency> service_latency_;
+};
+
+}
+
+#endif
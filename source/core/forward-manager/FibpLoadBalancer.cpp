@@ -0,0 +1,216 @@
+#include "FibpLoadBalancer.h"
+#include <boost/chrono/system_clocks.hpp>
+#include <cmath>
+
+namespace fibp
+{
+
+// weight of the newest sample in the response time EWMA.
+static const double EWMA_ALPHA = 0.25;
+// the EWMA of an idle endpoint decays to zero with this time constant, so a
+// slow endpoint will be probed again after it has not been chosen for a while.
+static const double IDLE_DECAY_US = 10*1000*1000;
+// a failed request costs at least as much as a very slow one.
+static const uint64_t FAILURE_PENALTY_US = 1000*1000;
+// the EWMA of the endpoint idle this long is decayed to nothing.
+static const uint64_t STAT_IDLE_US = 600ULL*1000*1000;
+
+static inline uint64_t now_us()
+{
+    return boost::chrono::duration_cast<boost::chrono::microseconds>(
+        boost::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// map the position among the candidates to the index in the host list,
+// skipping the excluded index.
+static inline std::size_t candidate_index(std::size_t pos, std::size_t exclude_index)
+{
+    return pos >= exclude_index ? pos + 1 : pos;
+}
+
+static std::size_t find_exclude_index(const std::vector<std::string>& host_keys,
+    const std::string& exclude)
+{
+    if (exclude.empty())
+        return host_keys.size();
+    for(std::size_t i = 0; i < host_keys.size(); ++i)
+    {
+        if (host_keys[i] == exclude)
+            return i;
+    }
+    return host_keys.size();
+}
+
+double FibpLoadBalancer::get_unit_point(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return (x >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// the total weight of the hosts except the excluded one.
+static double total_weight(const std::vector<double>& weights, std::size_t exclude_index)
+{
+    double total = 0;
+    for(std::size_t i = 0; i < weights.size(); ++i)
+    {
+        if (i != exclude_index)
+            total += weights[i];
+    }
+    return total;
+}
+
+// the host at the point (in [0, total)) of the weights laid end to end.
+static std::size_t weighted_index(const std::vector<double>& weights, std::size_t exclude_index,
+    double point)
+{
+    std::size_t last = weights.size();
+    for(std::size_t i = 0; i < weights.size(); ++i)
+    {
+        if (i == exclude_index || weights[i] <= 0)
+            continue;
+        if (point < weights[i])
+            return i;
+        point -= weights[i];
+        last = i;
+    }
+    // only by the rounding.
+    return last;
+}
+
+std::size_t RoundRobinBalancer::select(std::size_t balance_index,
+    const std::vector<std::string>& host_keys,
+    const std::vector<double>& weights,
+    const std::string& exclude)
+{
+    std::size_t size = host_keys.size();
+    if (size <= 1 || weights.size() != size)
+        return select(balance_index, host_keys, exclude);
+    std::size_t exclude_index = find_exclude_index(host_keys, exclude);
+    double total = total_weight(weights, exclude_index);
+    if (total <= 0)
+        return select(balance_index, host_keys, exclude);
+    // the turn of the index among the weights, stepped by the golden ratio so the
+    // hosts are interleaved instead of each taking its weight in a row.
+    uint64_t point = (uint64_t)balance_index * 0x9e3779b97f4a7c15ULL;
+    return weighted_index(weights, exclude_index,
+        (point >> 11) * (1.0 / 9007199254740992.0) * total);
+}
+
+std::size_t RoundRobinBalancer::select(std::size_t balance_index,
+    const std::vector<std::string>& host_keys,
+    const std::string& exclude)
+{
+    std::size_t size = host_keys.size();
+    if (size <= 1)
+        return 0;
+    std::size_t exclude_index = find_exclude_index(host_keys, exclude);
+    if (exclude_index == size)
+        return balance_index % size;
+    return candidate_index(balance_index % (size - 1), exclude_index);
+}
+
+EwmaBalancer::EwmaBalancer()
+    : endpoint_stats_(STAT_IDLE_US)
+{
+}
+
+double EwmaBalancer::get_cost(const std::string& host_key, uint64_t now)
+{
+    EndpointStatPtr stat = endpoint_stats_.find(host_key);
+    if (!stat)
+    {
+        // never used, give it a chance.
+        return 0;
+    }
+    double ewma = stat->ewma_us.load(boost::memory_order_relaxed);
+    uint64_t last = stat->last_update_us.load(boost::memory_order_relaxed);
+    if (now > last)
+    {
+        ewma *= std::exp(-(double)(now - last) / IDLE_DECAY_US);
+    }
+    int inflight = stat->inflight.load(boost::memory_order_relaxed);
+    if (inflight < 0)
+        inflight = 0;
+    return (ewma + 1) * (inflight + 1);
+}
+
+std::size_t EwmaBalancer::select(std::size_t balance_index,
+    const std::vector<std::string>& host_keys,
+    const std::string& exclude)
+{
+    std::size_t size = host_keys.size();
+    if (size <= 1)
+        return 0;
+    std::size_t exclude_index = find_exclude_index(host_keys, exclude);
+    std::size_t candidates = exclude_index == size ? size : size - 1;
+    if (candidates == 1)
+        return candidate_index(0, exclude_index);
+
+    std::size_t first = balance_index % candidates;
+    std::size_t second = (first + 1 + (balance_index / candidates) % (candidates - 1)) % candidates;
+    first = candidate_index(first, exclude_index);
+    second = candidate_index(second, exclude_index);
+
+    uint64_t now = now_us();
+    if (get_cost(host_keys[second], now) < get_cost(host_keys[first], now))
+        return second;
+    return first;
+}
+
+std::size_t EwmaBalancer::select(std::size_t balance_index,
+    const std::vector<std::string>& host_keys,
+    const std::vector<double>& weights,
+    const std::string& exclude)
+{
+    std::size_t size = host_keys.size();
+    if (size <= 1 || weights.size() != size)
+        return select(balance_index, host_keys, exclude);
+    std::size_t exclude_index = find_exclude_index(host_keys, exclude);
+    double total = total_weight(weights, exclude_index);
+    if (total <= 0)
+        return select(balance_index, host_keys, exclude);
+    std::size_t first = weighted_index(weights, exclude_index, get_unit_point(balance_index) * total);
+    std::size_t second = weighted_index(weights, exclude_index,
+        get_unit_point(~(uint64_t)balance_index) * total);
+    if (first == second || first == size || second == size)
+        return first == size ? second : first;
+
+    uint64_t now = now_us();
+    if (get_cost(host_keys[second], now) / weights[second] <
+        get_cost(host_keys[first], now) / weights[first])
+    {
+        return second;
+    }
+    return first;
+}
+
+void EwmaBalancer::start_request(const std::string& host_key)
+{
+    EndpointStatPtr stat = endpoint_stats_.get(host_key);
+    ++stat->inflight;
+}
+
+void EwmaBalancer::end_request(const std::string& host_key, uint64_t latency_us, bool is_success)
+{
+    EndpointStatPtr stat = endpoint_stats_.get(host_key);
+    // the request started on the stat evicted meanwhile, which is rare.
+    if (--stat->inflight < 0)
+        ++stat->inflight;
+
+    if (!is_success && latency_us < FAILURE_PENALTY_US)
+        latency_us = FAILURE_PENALTY_US;
+    uint64_t old_ewma = stat->ewma_us.load(boost::memory_order_relaxed);
+    uint64_t new_ewma = latency_us;
+    if (stat->last_update_us.load(boost::memory_order_relaxed) != 0)
+    {
+        new_ewma = (uint64_t)(old_ewma * (1 - EWMA_ALPHA) + latency_us * EWMA_ALPHA);
+    }
+    // concurrent updates may lose a sample, that is fine for the balancing.
+    stat->ewma_us.store(new_ewma, boost::memory_order_relaxed);
+    stat->last_update_us.store(now_us(), boost::memory_order_relaxed);
+}
+
+}
@@ -0,0 +1,107 @@
+#ifndef FIBP_LOAD_BALANCER_H
+#define FIBP_LOAD_BALANCER_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/atomic.hpp>
+#include "FibpKeyedStatMap.h"
+
+namespace fibp
+{
+
+// choose one endpoint from the host list of a service. The balancer is shared by
+// all the worker threads, so the implementation should be thread safe.
+class FibpLoadBalancer
+{
+public:
+    virtual ~FibpLoadBalancer() {}
+
+    // return the index in host_keys (ip:port, built once with the route), the
+    // host in exclude is avoided if any other host is available.
+    virtual std::size_t select(std::size_t balance_index,
+        const std::vector<std::string>& host_keys,
+        const std::string& exclude) = 0;
+    // the weights are in the same order as host_keys, a host is chosen in
+    // proportion to its weight. The balancer not aware of the weight ignores them.
+    virtual std::size_t select(std::size_t balance_index,
+        const std::vector<std::string>& host_keys,
+        const std::vector<double>& weights,
+        const std::string& exclude)
+    {
+        return select(balance_index, host_keys, exclude);
+    }
+
+    virtual void start_request(const std::string& host_key) {}
+    virtual void end_request(const std::string& host_key, uint64_t latency_us, bool is_success) {}
+
+    static std::string get_host_key(const std::string& ip, const std::string& port)
+    {
+        return ip + ":" + port;
+    }
+    // spread the balance index (often a counter) over [0, 1).
+    static double get_unit_point(uint64_t balance_index);
+};
+typedef boost::shared_ptr<FibpLoadBalancer> FibpLoadBalancerPtr;
+
+// the old way, rotate by the balance index, each host takes the turns in
+// proportion to its weight.
+class RoundRobinBalancer : public FibpLoadBalancer
+{
+public:
+    std::size_t select(std::size_t balance_index,
+        const std::vector<std::string>& host_keys,
+        const std::string& exclude);
+    std::size_t select(std::size_t balance_index,
+        const std::vector<std::string>& host_keys,
+        const std::vector<double>& weights,
+        const std::string& exclude);
+};
+
+// keep the EWMA of the response time and the in-flight requests for each endpoint,
+// and pick the better one from two random candidates (power of two choices).
+// With the weights the candidates are drawn in proportion to them and the cost
+// is divided by the weight.
+class EwmaBalancer : public FibpLoadBalancer
+{
+public:
+    EwmaBalancer();
+    std::size_t select(std::size_t balance_index,
+        const std::vector<std::string>& host_keys,
+        const std::string& exclude);
+    std::size_t select(std::size_t balance_index,
+        const std::vector<std::string>& host_keys,
+        const std::vector<double>& weights,
+        const std::string& exclude);
+    void start_request(const std::string& host_key);
+    void end_request(const std::string& host_key, uint64_t latency_us, bool is_success);
+
+private:
+    struct EndpointStat
+    {
+        EndpointStat()
+            : ewma_us(0), last_update_us(0), inflight(0)
+        {
+        }
+        // the EWMA idle this long is decayed to nothing, the same as never used.
+        bool is_idle(uint64_t since_us) const
+        {
+            return inflight.load(boost::memory_order_relaxed) <= 0 &&
+                last_update_us.load(boost::memory_order_relaxed) < since_us;
+        }
+        boost::atomic<uint64_t> ewma_us;
+        boost::atomic<uint64_t> last_update_us;
+        boost::atomic<int> inflight;
+    };
+    typedef FibpKeyedStatMap<EndpointStat>::StatPtr EndpointStatPtr;
+
+    double get_cost(const std::string& host_key, uint64_t now_us);
+
+    // the endpoints gone from the service discovery are evicted when idle.
+    FibpKeyedStatMap<EndpointStat> endpoint_stats_;
+};
+
+}
+
+#endif
@@ -0,0 +1,35 @@
+#include "FibpMembership.h"
+#include <glog/logging.h>
+
+namespace fibp
+{
+
+void FibpMembershipNotifier::subscribe(FibpMembershipListener* listener)
+{
+    boost::unique_lock<boost::mutex> guard(lock_);
+    listeners_.insert(listener);
+}
+
+void FibpMembershipNotifier::unsubscribe(FibpMembershipListener* listener)
+{
+    boost::unique_lock<boost::mutex> guard(lock_);
+    listeners_.erase(listener);
+}
+
+void FibpMembershipNotifier::publish(const FibpMembershipChange& change)
+{
+    if (change.added_hosts.empty() && change.removed_hosts.empty())
+        return;
+    LOG(INFO) << "service membership changed: " << change.service_name << ", type: " << change.type
+        << ", added: " << change.added_hosts.size() << ", removed: " << change.removed_hosts.size();
+    // the lock is held while calling the listeners, so a listener is never
+    // called after unsubscribed.
+    boost::unique_lock<boost::mutex> guard(lock_);
+    for(std::set<FibpMembershipListener*>::iterator it = listeners_.begin();
+        it != listeners_.end(); ++it)
+    {
+        (*it)->on_membership_change(change);
+    }
+}
+
+}
@@ -0,0 +1,62 @@
+#ifndef FIBP_MEMBERSHIP_H
+#define FIBP_MEMBERSHIP_H
+
+#include <common/FibpCommonTypes.h>
+#include <util/singleton.h>
+#include <boost/thread/mutex.hpp>
+#include <string>
+#include <vector>
+#include <set>
+#include <utility>
+
+namespace fibp
+{
+
+// the hosts of a service added or removed in the service discovery.
+struct FibpMembershipChange
+{
+    typedef std::pair<std::string, std::string> HostPairT;
+    FibpMembershipChange()
+        : type(HTTP_Service), prewarm_num(0), is_h2c(false)
+    {
+    }
+    std::string service_name;
+    ServiceType type;
+    // the number of the connections opened to each added host before any
+    // request, 0 if the service is not tagged with prewarm.
+    int prewarm_num;
+    bool is_h2c;
+    std::vector<HostPairT> added_hosts;
+    // the hosts not used by any service of the type any more.
+    std::vector<HostPairT> removed_hosts;
+};
+
+class FibpMembershipListener
+{
+public:
+    virtual ~FibpMembershipListener(){}
+    // called in the thread watching the service discovery, the listener should
+    // hand the change over to its own thread and return soon.
+    virtual void on_membership_change(const FibpMembershipChange& change) = 0;
+};
+
+class FibpMembershipNotifier
+{
+public:
+    static FibpMembershipNotifier* get()
+    {
+        return izenelib::util::Singleton<FibpMembershipNotifier>::get();
+    }
+    void subscribe(FibpMembershipListener* listener);
+    // the listener will not be called any more once returned.
+    void unsubscribe(FibpMembershipListener* listener);
+    void publish(const FibpMembershipChange& change);
+
+private:
+    boost::mutex lock_;
+    std::set<FibpMembershipListener*> listeners_;
+};
+
+}
+
+#endif
@@ -152,9 +152,25 @@ bool FibpPortForwardMgr::startPortForward(uint16_t &port)
         new PortForwardConnectionFactory(0,
         boost::bind(&FibpPortForwardMgr::create_forward_connection, this, _1, _2, _3)));
 
-    boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::tcp::v4(), 0);
     boost::shared_ptr<PortForwardServer> server;
-    server.reset(new PortForwardServer(endpoint, factory, 4));
+    if (port != 0)
+    {
+        // the port used before the restart, so the agents need no change.
+        try
+        {
+            boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::tcp::v4(), port);
+            server.reset(new PortForwardServer(endpoint, factory, 4));
+        }
+        catch(const boost::system::system_error& e)
+        {
+            LOG(INFO) << "forward port " << port << " not available: " << e.what();
+        }
+    }
+    if (!server)
+    {
+        boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::tcp::v4(), 0);
+        server.reset(new PortForwardServer(endpoint, factory, 4));
+    }
     port = server->getBindedEndpoint().port();
     factory->setBindedPort(port);
     forward_server_list_[port].server = server;
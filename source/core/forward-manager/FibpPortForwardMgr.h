@@ -23,6 +23,7 @@ public:
     void updateForwardService(uint16_t forward_port, const std::string& service_name,
         int type);
 
+    // the port given is tried first if not 0, the port bound is returned.
     bool startPortForward(uint16_t &port);
     void stopPortForward(uint16_t port);
     void stopAll();
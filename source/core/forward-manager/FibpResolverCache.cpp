@@ -0,0 +1,115 @@
+#include "FibpResolverCache.h"
+#include <fiber-server/yield.hpp>
+#include <boost/fiber/all.hpp>
+#include <boost/bind.hpp>
+#include <boost/chrono/system_clocks.hpp>
+#include <glog/logging.h>
+
+namespace ba = boost::asio;
+namespace bs = boost::system;
+
+namespace fibp
+{
+
+static const uint64_t RESOLVE_TTL_US = 60*1000*1000;
+
+static inline uint64_t now_us()
+{
+    return boost::chrono::duration_cast<boost::chrono::microseconds>(
+        boost::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static inline std::string getHostKey(const std::string& host, const std::string& port)
+{
+    return host + ":" + port;
+}
+
+FibpResolverCache::FibpResolverCache()
+{
+    FibpMembershipNotifier::get()->subscribe(this);
+}
+
+FibpResolverCache::~FibpResolverCache()
+{
+    FibpMembershipNotifier::get()->unsubscribe(this);
+}
+
+bs::error_code FibpResolverCache::resolve(ba::io_service& io, const std::string& host,
+    const std::string& port, ba::ip::tcp::resolver::iterator& iter)
+{
+    std::string key = getHostKey(host, port);
+    bool need_refresh = false;
+    {
+        boost::unique_lock<boost::mutex> guard(lock_);
+        EntryMapT::iterator it = entries_.find(key);
+        if (it != entries_.end())
+        {
+            iter = it->second.iter;
+            if (it->second.expire_us <= now_us() && !it->second.is_refreshing)
+            {
+                it->second.is_refreshing = true;
+                need_refresh = true;
+            }
+        }
+    }
+    if (iter != ba::ip::tcp::resolver::iterator())
+    {
+        if (need_refresh)
+        {
+            boost::fibers::fiber f(boost::bind(&FibpResolverCache::refresh, this,
+                    boost::ref(io), host, port));
+            f.detach();
+        }
+        return bs::error_code();
+    }
+    return do_resolve(io, host, port, iter);
+}
+
+bs::error_code FibpResolverCache::do_resolve(ba::io_service& io, const std::string& host,
+    const std::string& port, ba::ip::tcp::resolver::iterator& iter)
+{
+    bs::error_code ec;
+    ba::ip::tcp::resolver resolver(io);
+    ba::ip::tcp::resolver::query q(host, port);
+    iter = resolver.async_resolve(q, boost::fibers::asio::yield[ec]);
+    std::string key = getHostKey(host, port);
+    boost::unique_lock<boost::mutex> guard(lock_);
+    if (ec || iter == ba::ip::tcp::resolver::iterator())
+    {
+        LOG(INFO) << "resolve failed: " << key << ", " << ec.message();
+        EntryMapT::iterator it = entries_.find(key);
+        if (it != entries_.end())
+            it->second.is_refreshing = false;
+        if (!ec)
+            ec = ba::error::host_not_found;
+        return ec;
+    }
+    Entry& entry = entries_[key];
+    entry.iter = iter;
+    entry.expire_us = now_us() + RESOLVE_TTL_US;
+    entry.is_refreshing = false;
+    return ec;
+}
+
+void FibpResolverCache::refresh(ba::io_service& io, const std::string& host, const std::string& port)
+{
+    ba::ip::tcp::resolver::iterator iter;
+    do_resolve(io, host, port, iter);
+}
+
+void FibpResolverCache::on_membership_change(const FibpMembershipChange& change)
+{
+    boost::unique_lock<boost::mutex> guard(lock_);
+    if (entries_.empty())
+        return;
+    for(std::size_t i = 0; i < change.added_hosts.size(); ++i)
+    {
+        entries_.erase(getHostKey(change.added_hosts[i].first, change.added_hosts[i].second));
+    }
+    for(std::size_t i = 0; i < change.removed_hosts.size(); ++i)
+    {
+        entries_.erase(getHostKey(change.removed_hosts[i].first, change.removed_hosts[i].second));
+    }
+}
+
+}
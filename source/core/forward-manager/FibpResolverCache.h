@@ -0,0 +1,56 @@
+#ifndef FIBP_RESOLVER_CACHE_H
+#define FIBP_RESOLVER_CACHE_H
+
+#include "FibpMembership.h"
+#include <util/singleton.h>
+#include <boost/asio.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
+#include <string>
+#include <stdint.h>
+
+namespace fibp
+{
+
+// the resolved endpoints of the host names by host:port. The resolving is
+// asynchronous so the fibers in the same thread are not blocked, the expired
+// entry is still used while it is refreshed in the background. The hosts in the
+// service discovery are usually ip and never resolved, see ClientSession.
+class FibpResolverCache : public FibpMembershipListener
+{
+public:
+    static FibpResolverCache* get()
+    {
+        return izenelib::util::Singleton<FibpResolverCache>::get();
+    }
+    FibpResolverCache();
+    ~FibpResolverCache();
+    // should be called in a fiber.
+    boost::system::error_code resolve(boost::asio::io_service& io, const std::string& host,
+        const std::string& port, boost::asio::ip::tcp::resolver::iterator& iter);
+    // the changed hosts are resolved again next time.
+    void on_membership_change(const FibpMembershipChange& change);
+
+private:
+    struct Entry
+    {
+        Entry()
+            : expire_us(0), is_refreshing(false)
+        {
+        }
+        boost::asio::ip::tcp::resolver::iterator iter;
+        uint64_t expire_us;
+        bool is_refreshing;
+    };
+    boost::system::error_code do_resolve(boost::asio::io_service& io, const std::string& host,
+        const std::string& port, boost::asio::ip::tcp::resolver::iterator& iter);
+    void refresh(boost::asio::io_service& io, const std::string& host, const std::string& port);
+
+    boost::mutex lock_;
+    typedef boost::unordered_map<std::string, Entry> EntryMapT;
+    EntryMapT entries_;
+};
+
+}
+
+#endif
@@ -0,0 +1,55 @@
+#include "FibpRetryBudget.h"
+#include <algorithm>
+
+namespace fibp
+{
+
+// the balance is kept in milli-tokens.
+static const int64_t TOKEN = 1000;
+// retries allowed for every 100 requests.
+static const int64_t DEPOSIT_PER_REQUEST = TOKEN * 20 / 100;
+// allow some retries for the services with little traffic.
+static const int64_t MAX_BALANCE = TOKEN * 100;
+
+FibpRetryBudget::ServiceBalance::ServiceBalance()
+    : balance(MAX_BALANCE)
+{
+}
+
+bool FibpRetryBudget::ServiceBalance::is_idle(uint64_t since_us) const
+{
+    return balance.load(boost::memory_order_relaxed) >= MAX_BALANCE;
+}
+
+FibpRetryBudget::FibpRetryBudget()
+    : service_balance_(0)
+{
+}
+
+void FibpRetryBudget::deposit(const std::string& service_name)
+{
+    FibpKeyedStatMap<ServiceBalance>::StatPtr stat = service_balance_.get(service_name);
+    boost::atomic<int64_t>& balance = stat->balance;
+    int64_t old = balance.load(boost::memory_order_relaxed);
+    while(old < MAX_BALANCE)
+    {
+        int64_t new_balance = std::min(old + DEPOSIT_PER_REQUEST, MAX_BALANCE);
+        if (balance.compare_exchange_weak(old, new_balance, boost::memory_order_relaxed))
+            break;
+    }
+}
+
+bool FibpRetryBudget::try_withdraw(const std::string& service_name)
+{
+    FibpKeyedStatMap<ServiceBalance>::StatPtr stat = service_balance_.get(service_name);
+    boost::atomic<int64_t>& balance = stat->balance;
+    int64_t old = balance.load(boost::memory_order_relaxed);
+    while(old >= TOKEN)
+    {
+        if (balance.compare_exchange_weak(old, old - TOKEN, boost::memory_order_relaxed))
+            return true;
+    }
+    return false;
+}
+
+}
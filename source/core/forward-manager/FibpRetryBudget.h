@@ -0,0 +1,37 @@
+#ifndef FIBP_RETRY_BUDGET_H
+#define FIBP_RETRY_BUDGET_H
+
+#include <string>
+#include <stdint.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/atomic.hpp>
+#include "FibpKeyedStatMap.h"
+
+namespace fibp
+{
+
+// token bucket for the retries of each service, every request deposits a part of
+// a token and every retry (or hedged request) costs one token, so the extra load
+// is limited to a ratio of the normal requests during an outage.
+class FibpRetryBudget
+{
+public:
+    FibpRetryBudget();
+    void deposit(const std::string& service_name);
+    // return false if no token left for the retry.
+    bool try_withdraw(const std::string& service_name);
+
+private:
+    struct ServiceBalance
+    {
+        ServiceBalance();
+        // the full one is the same as a new one, no matter when it was used.
+        bool is_idle(uint64_t since_us) const;
+        boost::atomic<int64_t> balance;
+    };
+    FibpKeyedStatMap<ServiceBalance> service_balance_;
+};
+
+}
+
+#endif
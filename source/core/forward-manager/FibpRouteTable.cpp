@@ -0,0 +1,106 @@
+#include "FibpRouteTable.h"
+#include <algorithm>
+
+namespace fibp
+{
+
+FibpRouteSnapshot::FibpRouteSnapshot()
+    : mask_(0), route_num_(0)
+{
+}
+
+// FNV-1a, computed on the name without any copy.
+uint32_t FibpRouteSnapshot::hash(const std::string& name)
+{
+    uint32_t h = 2166136261U;
+    for(std::size_t i = 0; i < name.size(); ++i)
+    {
+        h ^= (unsigned char)name[i];
+        h *= 16777619U;
+    }
+    return h;
+}
+
+void FibpRouteSnapshot::build_index()
+{
+    route_num_ = routes_.size();
+    // keep the load under half so the probing is short.
+    std::size_t slot_num = 8;
+    while(slot_num < route_num_ * 2)
+        slot_num *= 2;
+    index_.assign(slot_num, IndexSlot());
+    mask_ = slot_num - 1;
+    for(std::size_t i = 0; i < routes_.size(); ++i)
+    {
+        uint32_t h = hash(routes_[i].name);
+        uint32_t pos = h & mask_;
+        while(index_[pos].pos_plus_one != 0)
+            pos = (pos + 1) & mask_;
+        index_[pos].hash = h;
+        index_[pos].pos_plus_one = i + 1;
+    }
+}
+
+const FibpServiceRoute* FibpRouteSnapshot::find(const std::string& name) const
+{
+    if (index_.empty())
+        return NULL;
+    uint32_t h = hash(name);
+    uint32_t pos = h & mask_;
+    while(index_[pos].pos_plus_one != 0)
+    {
+        const IndexSlot& slot = index_[pos];
+        if (slot.hash == h && routes_[slot.pos_plus_one - 1].name == name)
+            return &routes_[slot.pos_plus_one - 1];
+        pos = (pos + 1) & mask_;
+    }
+    return NULL;
+}
+
+FibpRouteTable::FibpRouteTable()
+    : version_(1), current_(new FibpRouteSnapshot())
+{
+}
+
+void FibpRouteTable::publish(std::vector<FibpServiceRoute>& routes)
+{
+    boost::shared_ptr<FibpRouteSnapshot> snapshot(new FibpRouteSnapshot());
+    snapshot->routes_.reserve(routes.size());
+    for(std::size_t i = 0; i < routes.size(); ++i)
+    {
+        if (routes[i].name.empty())
+            continue;
+        snapshot->routes_.push_back(FibpServiceRoute());
+        std::swap(snapshot->routes_.back(), routes[i]);
+    }
+    snapshot->build_index();
+
+    boost::mutex::scoped_lock guard(mutex_);
+    current_ = snapshot;
+    version_.fetch_add(1, boost::memory_order_release);
+}
+
+const FibpRouteSnapshot& FibpRouteTable::snapshot()
+{
+    ReaderCache* cache = cache_.get();
+    if (!cache)
+    {
+        cache = new ReaderCache();
+        cache_.reset(cache);
+    }
+    if (cache->version != version_.load(boost::memory_order_acquire))
+    {
+        boost::mutex::scoped_lock guard(mutex_);
+        cache->snapshot = current_;
+        cache->version = version_.load(boost::memory_order_relaxed);
+    }
+    return *cache->snapshot;
+}
+
+FibpRouteSnapshotPtr FibpRouteTable::current()
+{
+    boost::mutex::scoped_lock guard(mutex_);
+    return current_;
+}
+
+}
@@ -0,0 +1,150 @@
+#ifndef FIBP_ROUTE_TABLE_H
+#define FIBP_ROUTE_TABLE_H
+
+#include <common/FibpCommonTypes.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+#include <string>
+#include <vector>
+#include <utility>
+#include <stdint.h>
+
+namespace fibp
+{
+
+// the weight and the locality of an endpoint in the service discovery.
+struct FibpEndpointMeta
+{
+    FibpEndpointMeta()
+        : weight(1), added_us(0), is_local(false)
+    {
+    }
+    uint32_t weight;
+    std::string zone;
+    // when the endpoint joined, the weight is ramped up from then. 0 if it was
+    // known since the service was seen first.
+    uint64_t added_us;
+    // in the zone of the proxy, set when published.
+    bool is_local;
+};
+
+// how the hosts of a service type are weighted, built when published so the
+// lookup of the service with the equal hosts takes the old path.
+struct FibpEndpointPolicy
+{
+    FibpEndpointPolicy()
+        : is_weighted(false), is_zoned(false), ramp_end_us(0), local_weight(0)
+    {
+    }
+    // the hosts are not of the same weight.
+    bool is_weighted;
+    // some hosts are in the local zone and some are not.
+    bool is_zoned;
+    // the last host joined is ramping up until then, 0 if none.
+    uint64_t ramp_end_us;
+    // the total weight of the hosts in the local zone.
+    double local_weight;
+};
+
+// the hosts and the options of a service in the current cluster.
+struct FibpServiceRoute
+{
+    typedef std::pair<std::string, std::string> HostPairT;
+    FibpServiceRoute()
+        : hedge_percentile(0), pipeline_depth(0), is_h2c(false), is_shared(false),
+        is_stream(false), hosts(End_Service), host_keys(End_Service), host_meta(End_Service),
+        policies(End_Service)
+    {
+    }
+    std::string name;
+    int hedge_percentile;
+    int pipeline_depth;
+    bool is_h2c;
+    bool is_shared;
+    bool is_stream;
+    // indexed by the service type, the host keys (ip:port) are built beforehand
+    // for the balancer and the breaker.
+    std::vector<std::vector<HostPairT> > hosts;
+    std::vector<std::vector<std::string> > host_keys;
+    // in the same order as hosts.
+    std::vector<std::vector<FibpEndpointMeta> > host_meta;
+    std::vector<FibpEndpointPolicy> policies;
+};
+
+// the routes published together, never changed once published so it is read
+// without any lock. Looking up by the name neither allocates nor concatenates.
+class FibpRouteSnapshot
+{
+public:
+    FibpRouteSnapshot();
+    const FibpServiceRoute* find(const std::string& name) const;
+    std::size_t size() const
+    {
+        return route_num_;
+    }
+
+private:
+    friend class FibpRouteTable;
+    static uint32_t hash(const std::string& name);
+    void build_index();
+
+    struct IndexSlot
+    {
+        IndexSlot()
+            : hash(0), pos_plus_one(0)
+        {
+        }
+        uint32_t hash;
+        // the position in routes_, 0 for the empty slot.
+        uint32_t pos_plus_one;
+    };
+    // only the services published, so the snapshot never keeps the ones gone.
+    std::vector<FibpServiceRoute> routes_;
+    // open addressing by the hash of the name with linear probing.
+    std::vector<IndexSlot> index_;
+    uint32_t mask_;
+    std::size_t route_num_;
+};
+typedef boost::shared_ptr<const FibpRouteSnapshot> FibpRouteSnapshotPtr;
+
+// the routing table rebuilt by the service discovery and published as a new
+// snapshot (RCU like). Each reader thread keeps the snapshot it got and only
+// checks the published version, which is changed rarely, so the lookups in the
+// worker threads share no written cache line. The old snapshot is released once
+// every thread moved to a newer one.
+class FibpRouteTable
+{
+public:
+    FibpRouteTable();
+    // the routes are taken (swapped out), called by one writer at a time.
+    void publish(std::vector<FibpServiceRoute>& routes);
+    // valid until the calling fiber yields, the thread may move to a newer
+    // snapshot after that.
+    const FibpRouteSnapshot& snapshot();
+    FibpRouteSnapshotPtr current();
+
+private:
+    struct ReaderCache
+    {
+        ReaderCache()
+            : version(0)
+        {
+        }
+        uint64_t version;
+        FibpRouteSnapshotPtr snapshot;
+    };
+
+    // read by all the worker threads, kept away from the lines written.
+    char pad_before_[64];
+    boost::atomic<uint64_t> version_;
+    char pad_after_[64];
+    boost::mutex mutex_;
+    FibpRouteSnapshotPtr current_;
+    boost::thread_specific_ptr<ReaderCache> cache_;
+};
+
+}
+
+#endif
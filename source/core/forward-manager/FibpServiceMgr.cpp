@@ -1,6 +1,7 @@
 #include "FibpServiceMgr.h"
 #include "FibpClient.h"
 #include "FibpForwardManager.h"
+#include "FibpMembership.h"
 #include <log-manager/FibpLogger.h>
 #include <fiber-server/HttpProtocolHandler.h>
 #include <fiber-server/yield.hpp>
@@ -11,7 +12,10 @@
 #include <boost/algorithm/string/split.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/fiber/all.hpp>
+#include <boost/chrono/system_clocks.hpp>
 #include <glog/logging.h>
+#include <algorithm>
+#include <iterator>
 #include <3rdparty/rapidjson/reader.h>
 #include <3rdparty/rapidjson/document.h>
 #include <util/driver/writers/JsonWriter.h>
@@ -26,11 +30,57 @@ static const std::string http_service_str("http");
 static const std::string rpc_service_str("rpc");
 static const std::string raw_service_str("raw");
 static const std::string dev_cluster_str("dev");
+// the option tag to enable the hedged request, "hedge" or "hedge=percentile".
+static const std::string hedge_tag_str("hedge");
+static const int default_hedge_percentile = 95;
+// the option tag to pipeline the http requests, "pipeline" or "pipeline=depth".
+static const std::string pipeline_tag_str("pipeline");
+static const int default_pipeline_depth = 8;
+static const int max_pipeline_depth = 64;
+// the option tag to send the http requests as the HTTP/2 streams on the cleartext
+// connection, the hosts of the service should accept h2c with prior knowledge.
+static const std::string h2c_tag_str("h2c");
+// the option tag to open the connections to the new hosts of the service before
+// any request, "prewarm" or "prewarm=connections".
+static const std::string prewarm_tag_str("prewarm");
+static const int default_prewarm_num = 2;
+static const int max_prewarm_num = 16;
+// the option tag to share one connection to each host of the rpc/raw service by
+// all the worker threads.
+static const std::string shared_tag_str("shared");
+// the option tag to relay the body of the http response to the client as it
+// arrives instead of buffering all of it, used by the single service api.
+static const std::string stream_tag_str("stream");
+// the endpoint tags "weight=N" and "zone=name", the same as the "weight" and the
+// "zone" in the service meta (or the "zone" in the node meta). The consul weight
+// of the passing endpoint is used if no weight is given.
+static const std::string weight_tag_str("weight");
+static const std::string zone_tag_str("zone");
+static const uint32_t max_endpoint_weight = 65535;
+// the endpoint joined takes the traffic in proportion to the time since it
+// joined until the slow start is over, but no less than the min factor.
+static const uint64_t slow_start_us = 60*1000*1000ULL;
+static const double min_slow_start_factor = 0.1;
+// the local zone takes the share of the traffic of its healthy weight scaled by
+// this, so a few hosts ejected move no traffic to the other zones.
+static const double zone_overprovision_factor = 1.4;
 static const std::string port_forward_key("/v1/kv/fibp-forward-port");
+// the snapshot is written (with fsync) at most once in this time while the
+// services keep changing.
+static const uint32_t snapshot_save_interval_ms = 5*1000;
 
 typedef std::pair<std::string, std::string> HostPairT;
+typedef std::map<HostPairT, FibpEndpointMeta> EndpointMetaMapT;
 
-static bool parseQueryServicesRsp(const std::string& json_rsp, std::vector<std::string>& services)
+static inline uint64_t now_us()
+{
+    return boost::chrono::duration_cast<boost::chrono::microseconds>(
+        boost::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// the services registered with their tags.
+static bool parseQueryServicesRsp(const std::string& json_rsp,
+    std::map<std::string, std::set<std::string> >& services)
 {
     services.clear();
     rj::Document doc;
@@ -48,16 +98,104 @@ static bool parseQueryServicesRsp(const std::string& json_rsp, std::vector<std::
     for(rj::Value::ConstMemberIterator itr = doc.MemberBegin();
         itr != doc.MemberEnd(); ++itr)
     {
-        std::string name = itr->name.GetString();
-        services.push_back(name);
+        std::set<std::string>& tags = services[itr->name.GetString()];
+        if (!itr->value.IsArray())
+            continue;
+        for(rj::SizeType i = 0; i < itr->value.Size(); ++i)
+        {
+            if (itr->value[i].IsString())
+                tags.insert(itr->value[i].GetString());
+        }
     }
     return true;
 }
 
-static bool parseServiceNodeInfo(const rj::Value& v, std::string& host)
+// the number of the checks and the max modify index of them for each service,
+// which is changed if any check of the service is added, removed or changed.
+static bool parseHealthStateRsp(const std::string& json_rsp,
+    std::map<std::string, FibpServiceMgr::CheckSignT>& check_signs)
+{
+    check_signs.clear();
+    rj::Document doc;
+    bool err = doc.Parse<0>(json_rsp.c_str()).HasParseError();
+    if (err)
+    {
+        LOG(INFO) << "parsing failed.";
+        return false;
+    }
+    if (!doc.IsArray())
+    {
+        LOG(INFO) << "health state response is not a list of checks.";
+        return false;
+    }
+    for(rj::SizeType i = 0; i < doc.Size(); ++i)
+    {
+        const rj::Value& check = doc[i];
+        if (!check.IsObject())
+            continue;
+        rj::Value::ConstMemberIterator name_it = check.FindMember("ServiceName");
+        if (name_it == check.MemberEnd() || !name_it->value.IsString() ||
+            name_it->value.GetStringLength() == 0)
+        {
+            // the checks of the nodes are not of any service.
+            continue;
+        }
+        FibpServiceMgr::CheckSignT& sign = check_signs[name_it->value.GetString()];
+        ++sign.first;
+        rj::Value::ConstMemberIterator index_it = check.FindMember("ModifyIndex");
+        if (index_it != check.MemberEnd() && index_it->value.IsUint64())
+            sign.second = std::max(sign.second, (uint64_t)index_it->value.GetUint64());
+    }
+    return true;
+}
+
+static bool parseWeightValue(const std::string& value, uint32_t& weight)
+{
+    int w = 0;
+    try
+    {
+        w = boost::lexical_cast<int>(value);
+    }
+    catch(const std::exception& e)
+    {
+    }
+    if (w <= 0)
+    {
+        LOG(INFO) << "invalid endpoint weight: " << value;
+        return false;
+    }
+    weight = std::min((uint32_t)w, max_endpoint_weight);
+    return true;
+}
+
+// the weight and the zone in the meta of the service or the node.
+static void parseEndpointMeta(const rj::Value& v, uint32_t& weight, std::string& zone)
+{
+    if (!v.IsObject())
+        return;
+    for(rj::Value::ConstMemberIterator itr = v.MemberBegin();
+        itr != v.MemberEnd(); ++itr)
+    {
+        if (!itr->value.IsString())
+            continue;
+        const std::string key = itr->name.GetString();
+        if (key == weight_tag_str)
+        {
+            parseWeightValue(itr->value.GetString(), weight);
+        }
+        else if (key == zone_tag_str)
+        {
+            zone = itr->value.GetString();
+            boost::algorithm::to_lower(zone);
+        }
+    }
+}
+
+static bool parseServiceNodeInfo(const rj::Value& v, std::string& host, std::string& zone)
 {
     if (!v.IsObject())
         return false;
+    bool has_address = false;
     for(rj::Value::ConstMemberIterator itr = v.MemberBegin();
         itr != v.MemberEnd(); ++itr)
     {
@@ -66,18 +204,110 @@ static bool parseServiceNodeInfo(const rj::Value& v, std::string& host)
         if (key == "Address")
         {
             host = itr->value.GetString();
-            return true;
+            has_address = true;
+        }
+        else if (key == "Meta")
+        {
+            uint32_t weight = 0;
+            parseEndpointMeta(itr->value, weight, zone);
         }
     }
-    return false;
+    return has_address;
+}
+
+static bool parseHedgeTag(const std::string& tag, int& hedge_percentile)
+{
+    if (tag == hedge_tag_str)
+    {
+        hedge_percentile = default_hedge_percentile;
+        return true;
+    }
+    if (tag.find(hedge_tag_str + "=") != 0)
+        return false;
+    try
+    {
+        hedge_percentile = boost::lexical_cast<int>(tag.substr(hedge_tag_str.size() + 1));
+    }
+    catch(const std::exception& e)
+    {
+        LOG(INFO) << "invalid hedge tag: " << tag;
+        hedge_percentile = default_hedge_percentile;
+    }
+    if (hedge_percentile <= 0 || hedge_percentile >= 100)
+        hedge_percentile = default_hedge_percentile;
+    return true;
+}
+
+static bool parsePipelineTag(const std::string& tag, int& pipeline_depth)
+{
+    if (tag == pipeline_tag_str)
+    {
+        pipeline_depth = default_pipeline_depth;
+        return true;
+    }
+    if (tag.find(pipeline_tag_str + "=") != 0)
+        return false;
+    try
+    {
+        pipeline_depth = boost::lexical_cast<int>(tag.substr(pipeline_tag_str.size() + 1));
+    }
+    catch(const std::exception& e)
+    {
+        LOG(INFO) << "invalid pipeline tag: " << tag;
+        pipeline_depth = default_pipeline_depth;
+    }
+    if (pipeline_depth <= 0)
+        pipeline_depth = default_pipeline_depth;
+    if (pipeline_depth > max_pipeline_depth)
+        pipeline_depth = max_pipeline_depth;
+    return true;
+}
+
+static bool parsePrewarmTag(const std::string& tag, int& prewarm_num)
+{
+    if (tag == prewarm_tag_str)
+    {
+        prewarm_num = default_prewarm_num;
+        return true;
+    }
+    if (tag.find(prewarm_tag_str + "=") != 0)
+        return false;
+    try
+    {
+        prewarm_num = boost::lexical_cast<int>(tag.substr(prewarm_tag_str.size() + 1));
+    }
+    catch(const std::exception& e)
+    {
+        LOG(INFO) << "invalid prewarm tag: " << tag;
+        prewarm_num = default_prewarm_num;
+    }
+    if (prewarm_num <= 0)
+        prewarm_num = default_prewarm_num;
+    if (prewarm_num > max_prewarm_num)
+        prewarm_num = max_prewarm_num;
+    return true;
 }
 
 static bool parseServiceInfo(const rj::Value& v, std::string& port,
-    std::string& service_name, ServiceType& type, std::vector<std::string>& service_tags)
+    std::string& service_name, ServiceType& type, std::vector<std::string>& service_tags,
+    int& hedge_percentile, int& pipeline_depth, bool& is_h2c, int& prewarm_num,
+    bool& is_shared, bool& is_stream, uint32_t& weight, std::string& zone)
 {
     if (!v.IsObject())
         return false;
+    // the tag over the meta over the consul weights.
+    uint32_t tag_weight = 0;
+    uint32_t meta_weight = 0;
+    uint32_t consul_weight = 0;
+    std::string tag_zone;
+    std::string meta_zone;
     type = Custom_Service;
+    hedge_percentile = 0;
+    pipeline_depth = 0;
+    is_h2c = false;
+    prewarm_num = 0;
+    is_shared = false;
+    is_stream = false;
     service_tags.clear();
     service_name.clear();
     for(rj::Value::ConstMemberIterator itr = v.MemberBegin();
@@ -112,7 +342,29 @@ static bool parseServiceInfo(const rj::Value& v, std::string& port,
                     {
                         type = RPC_Service;
                     }
-                    else
+                    else if (tag == h2c_tag_str)
+                    {
+                        is_h2c = true;
+                    }
+                    else if (tag == shared_tag_str)
+                    {
+                        is_shared = true;
+                    }
+                    else if (tag == stream_tag_str)
+                    {
+                        is_stream = true;
+                    }
+                    else if (tag.find(weight_tag_str + "=") == 0)
+                    {
+                        parseWeightValue(tag.substr(weight_tag_str.size() + 1), tag_weight);
+                    }
+                    else if (tag.find(zone_tag_str + "=") == 0)
+                    {
+                        tag_zone = tag.substr(zone_tag_str.size() + 1);
+                    }
+                    else if (!parseHedgeTag(tag, hedge_percentile) &&
+                        !parsePipelineTag(tag, pipeline_depth) &&
+                        !parsePrewarmTag(tag, prewarm_num))
                     {
                         service_tags.push_back(tag);
                     }
@@ -123,11 +375,26 @@ static bool parseServiceInfo(const rj::Value& v, std::string& port,
         {
             service_name = itr->value.GetString();
         }
+        else if (key == "Meta")
+        {
+            parseEndpointMeta(itr->value, meta_weight, meta_zone);
+        }
+        else if (key == "Weights" && itr->value.IsObject())
+        {
+            rj::Value::ConstMemberIterator passing_it = itr->value.FindMember("Passing");
+            if (passing_it != itr->value.MemberEnd() && passing_it->value.IsInt() &&
+                passing_it->value.GetInt() > 0)
+            {
+                consul_weight = std::min((uint32_t)passing_it->value.GetInt(), max_endpoint_weight);
+            }
+        }
     }
     if (!service_name.empty() && service_tags.empty())
     {
         service_tags.push_back(dev_cluster_str);
     }
+    weight = tag_weight ? tag_weight : (meta_weight ? meta_weight : (consul_weight ? consul_weight : 1));
+    zone = tag_zone.empty() ? meta_zone : tag_zone;
     return true;
 }
 
@@ -158,9 +425,21 @@ static bool parseServiceCheckInfo(const rj::Value& v, bool& is_passing)
     return true;
 }
 
+// hedge_percentile (pipeline_depth, is_h2c, prewarm_num, is_shared, is_stream) is set
+// if any node of the service has the hedge (pipeline, h2c, prewarm, shared, stream) tag.
+// The weight and the zone of each passing endpoint are in endpoint_meta.
 static bool parseServiceInfoRsp(const std::string& json_rsp,
-    std::vector<std::map<std::string, std::set<HostPairT> > >& node_list)
+    std::vector<std::map<std::string, std::set<HostPairT> > >& node_list,
+    int& hedge_percentile, int& pipeline_depth, bool& is_h2c, int& prewarm_num,
+    bool& is_shared, bool& is_stream, EndpointMetaMapT& endpoint_meta)
 {
+    endpoint_meta.clear();
+    hedge_percentile = 0;
+    pipeline_depth = 0;
+    is_h2c = false;
+    prewarm_num = 0;
+    is_shared = false;
+    is_stream = false;
     rj::Document doc;
     bool err = doc.Parse<0>(json_rsp.c_str()).HasParseError();
     if (err)
@@ -181,6 +460,15 @@ static bool parseServiceInfoRsp(const std::string& json_rsp,
         std::string host, port, service_name;
         ServiceType type = Custom_Service;
         std::vector<std::string> service_tags;
+        int node_hedge_percentile = 0;
+        int node_pipeline_depth = 0;
+        bool node_is_h2c = false;
+        int node_prewarm_num = 0;
+        bool node_is_shared = false;
+        bool node_is_stream = false;
+        uint32_t weight = 1;
+        std::string zone;
+        std::string node_zone;
         bool is_passing = false;
         bool ret = true;
         for(rj::Value::ConstMemberIterator itr = node.MemberBegin();
@@ -190,7 +478,7 @@ static bool parseServiceInfoRsp(const std::string& json_rsp,
 
             if (key == "Node")
             {
-                ret = parseServiceNodeInfo(itr->value, host);
+                ret = parseServiceNodeInfo(itr->value, host, node_zone);
                 if (!ret)
                 {
                     LOG(INFO) << "parse node info failed.";
@@ -199,7 +487,9 @@ static bool parseServiceInfoRsp(const std::string& json_rsp,
             }
             else if (key == "Service")
             {
-                ret = parseServiceInfo(itr->value, port, service_name, type, service_tags);
+                ret = parseServiceInfo(itr->value, port, service_name, type, service_tags,
+                    node_hedge_percentile, node_pipeline_depth, node_is_h2c, node_prewarm_num,
+                    node_is_shared, node_is_stream, weight, zone);
                 if (!ret)
                 {
                     LOG(INFO) << "parse service info failed.";
@@ -221,11 +511,26 @@ static bool parseServiceInfoRsp(const std::string& json_rsp,
             LOG(INFO) << "ignore failed node: " << host << ":" << port << ", " << service_name;
             continue;
         }
+        if (node_hedge_percentile > 0)
+            hedge_percentile = node_hedge_percentile;
+        if (node_pipeline_depth > 0 && type == HTTP_Service)
+            pipeline_depth = node_pipeline_depth;
+        if (node_is_h2c && type == HTTP_Service)
+            is_h2c = true;
+        if (node_prewarm_num > 0)
+            prewarm_num = node_prewarm_num;
+        if (node_is_shared && (type == RPC_Service || type == Raw_Service))
+            is_shared = true;
+        if (node_is_stream && type == HTTP_Service)
+            is_stream = true;
         std::map<std::string, std::set<HostPairT> >& server_info = node_list[type];
         for(std::size_t i = 0; i < service_tags.size(); ++i)
         {
             server_info[service_name + connector + service_tags[i]].insert(std::make_pair(host, port));
         }
+        FibpEndpointMeta& meta = endpoint_meta[std::make_pair(host, port)];
+        meta.weight = weight;
+        meta.zone = zone.empty() ? node_zone : zone;
     }
     return true;
 }
@@ -316,17 +621,27 @@ void reportServiceStats(boost::asio::io_service& io_service, std::string report_
             }
         }
         boost::this_fiber::interruption_point();
-        boost::this_fiber::sleep_for(boost::chrono::seconds(10));
+        FibpTimerWheel::get(io_service).sleep_for(10*1000);
     }
 }
 
 FibpServiceMgr::FibpServiceMgr(const std::string& reg_address_list, const std::string& local_ip,
-    uint16_t local_port, const std::string& report_ip, const std::string& report_port)
-    : local_ip_(local_ip), local_port_(local_port), report_ip_(report_ip), report_port_(report_port), need_stop_(false)
+    uint16_t local_port, const std::string& report_ip, const std::string& report_port,
+    const std::string& snapshot_path, const std::string& local_zone)
+    : local_ip_(local_ip), local_port_(local_port), report_ip_(report_ip), report_port_(report_port), need_stop_(false),
+    balancer_(new EwmaBalancer()), breaker_(new FibpCircuitBreaker()), routes_dirty_(false),
+    last_publish_us_(0), snapshot_dirty_(false),
+    local_zone_(local_zone)
 {
     reg_service_host_info_.resize(End_Service);
+    boost::algorithm::to_lower(local_zone_);
 
     curClusterName_ = dev_cluster_str;
+    if (!snapshot_path.empty())
+    {
+        snapshot_file_.reset(new FibpServiceSnapshotFile(snapshot_path));
+        restoreSnapshot();
+    }
     std::vector<std::string> addr_list;
     boost::split(addr_list, reg_address_list, boost::is_any_of(","),
         boost::token_compress_on);
@@ -339,6 +654,11 @@ FibpServiceMgr::FibpServiceMgr(const std::string& reg_address_list, const std::s
         reg_address_list_.push_back(std::make_pair(ip_port[0], ip_port[1]));
         LOG(INFO) << "dns server added :" << ip_port[0] << ":" << ip_port[1];
     }
+}
+
+void FibpServiceMgr::start()
+{
+    restorePortForwards();
     if (reg_address_list_.empty())
     {
         LOG(ERROR) << "No Dns server!";
@@ -347,12 +667,185 @@ FibpServiceMgr::FibpServiceMgr(const std::string& reg_address_list, const std::s
     watching_thread_.reset(new boost::thread(boost::bind(&FibpServiceMgr::runFiber, this)));
 }
 
+void FibpServiceMgr::restoreSnapshot()
+{
+    FibpServiceSnapshot snapshot;
+    if (!snapshot_file_->load(snapshot))
+        return;
+    boost::unique_lock<boost::shared_mutex> guard(lock_);
+    if (!snapshot.cluster.empty())
+        curClusterName_ = snapshot.cluster;
+    for(std::size_t i = 0; i < snapshot.services.size(); ++i)
+    {
+        const FibpServiceSnapshotEntry& service = snapshot.services[i];
+        if (service.hedge_percentile > 0)
+            service_hedge_percentile_[service.name] = service.hedge_percentile;
+        if (service.pipeline_depth > 0)
+            service_pipeline_depth_[service.name] = service.pipeline_depth;
+        if (service.is_h2c)
+            service_h2c_.insert(service.name);
+        if (service.is_shared)
+            service_shared_.insert(service.name);
+        if (service.is_stream)
+            service_stream_.insert(service.name);
+        // fetched again once the registry is reachable, and retired if gone.
+        // The hosts restored are routed already, so the first fetch reports
+        // the ones gone meanwhile as removed.
+        ServiceWatchState& state = watched_services_[service.name];
+        for(std::size_t j = 0; j < service.host_lists.size(); ++j)
+        {
+            const FibpServiceSnapshotEntry::HostList& host_list = service.host_lists[j];
+            reg_service_host_info_[host_list.type][host_list.key] = host_list.hosts;
+            state.service_keys.insert(host_list.key);
+            state.hosts[host_list.type].insert(host_list.hosts.begin(), host_list.hosts.end());
+        }
+        EndpointMetaMapT& endpoint_meta = service_endpoint_meta_[service.name];
+        for(std::size_t j = 0; j < service.endpoints.size(); ++j)
+        {
+            FibpEndpointMeta& meta = endpoint_meta[service.endpoints[j].host];
+            meta.weight = service.endpoints[j].weight;
+            meta.zone = service.endpoints[j].zone;
+        }
+    }
+    forward_entries_.swap(snapshot.forwards);
+    publishRoutes();
+}
+
+void FibpServiceMgr::restorePortForwards()
+{
+    if (forward_entries_.empty())
+        return;
+    // the forward keys of the same service share one port.
+    std::map<std::string, uint16_t> service_port_map;
+    std::vector<FibpForwardSnapshotEntry> entries;
+    for(std::size_t i = 0; i < forward_entries_.size(); ++i)
+    {
+        FibpForwardSnapshotEntry entry = forward_entries_[i];
+        std::string service_uniquestr = entry.service_name + boost::lexical_cast<std::string>(entry.type);
+        std::map<std::string, uint16_t>::const_iterator s_it = service_port_map.find(service_uniquestr);
+        if (s_it != service_port_map.end())
+        {
+            entry.port = s_it->second;
+        }
+        else
+        {
+            bool ret = FibpForwardManager::get()->startPortForward(entry.port, entry.service_name, entry.type);
+            if (!ret)
+            {
+                LOG(WARNING) << "restore port forward failed for service : " << service_uniquestr;
+                continue;
+            }
+            service_port_map[service_uniquestr] = entry.port;
+        }
+        entries.push_back(entry);
+    }
+    boost::unique_lock<boost::shared_mutex> guard(lock_);
+    forward_entries_.swap(entries);
+    for(std::size_t i = 0; i < forward_entries_.size(); ++i)
+    {
+        const FibpForwardSnapshotEntry& entry = forward_entries_[i];
+        ports_used_by_agent_[entry.forward_key.substr(0, AGENT_ID_LEN)].insert(entry.port);
+    }
+    LOG(INFO) << "port forwards restored: " << service_port_map.size();
+    snapshot_dirty_ = true;
+}
+
+void FibpServiceMgr::buildSnapshot(FibpServiceSnapshot& snapshot)
+{
+    snapshot.cluster = curClusterName_;
+    snapshot.services.reserve(watched_services_.size());
+    for(std::map<std::string, ServiceWatchState>::const_iterator it = watched_services_.begin();
+        it != watched_services_.end(); ++it)
+    {
+        const std::string& name = it->first;
+        FibpServiceSnapshotEntry service;
+        service.name = name;
+        std::map<std::string, int>::const_iterator opt_it = service_hedge_percentile_.find(name);
+        if (opt_it != service_hedge_percentile_.end())
+            service.hedge_percentile = opt_it->second;
+        opt_it = service_pipeline_depth_.find(name);
+        if (opt_it != service_pipeline_depth_.end())
+            service.pipeline_depth = opt_it->second;
+        service.is_h2c = service_h2c_.find(name) != service_h2c_.end();
+        service.is_shared = service_shared_.find(name) != service_shared_.end();
+        service.is_stream = service_stream_.find(name) != service_stream_.end();
+        for(std::size_t i = 0; i < reg_service_host_info_.size(); ++i)
+        {
+            for(std::set<std::string>::const_iterator key_it = it->second.service_keys.begin();
+                key_it != it->second.service_keys.end(); ++key_it)
+            {
+                ServiceHostMapT::const_iterator host_it = reg_service_host_info_[i].find(*key_it);
+                if (host_it == reg_service_host_info_[i].end())
+                    continue;
+                service.host_lists.push_back(FibpServiceSnapshotEntry::HostList());
+                FibpServiceSnapshotEntry::HostList& host_list = service.host_lists.back();
+                host_list.type = i;
+                host_list.key = *key_it;
+                host_list.hosts = host_it->second;
+            }
+        }
+        if (service.host_lists.empty())
+            continue;
+        std::map<std::string, EndpointMetaMapT>::const_iterator meta_it = service_endpoint_meta_.find(name);
+        if (meta_it != service_endpoint_meta_.end())
+        {
+            for(EndpointMetaMapT::const_iterator ep_it = meta_it->second.begin();
+                ep_it != meta_it->second.end(); ++ep_it)
+            {
+                service.endpoints.push_back(FibpServiceSnapshotEntry::Endpoint());
+                FibpServiceSnapshotEntry::Endpoint& endpoint = service.endpoints.back();
+                endpoint.host = ep_it->first;
+                endpoint.weight = ep_it->second.weight;
+                endpoint.zone = ep_it->second.zone;
+            }
+        }
+        snapshot.services.push_back(service);
+    }
+    snapshot.forwards = forward_entries_;
+}
+
+void FibpServiceMgr::flushSnapshot()
+{
+    if (!snapshot_file_)
+        return;
+    FibpServiceSnapshot snapshot;
+    {
+        boost::unique_lock<boost::shared_mutex> guard(lock_);
+        if (!snapshot_dirty_)
+            return;
+        buildSnapshot(snapshot);
+        snapshot_dirty_ = false;
+    }
+    if (!snapshot_file_->save(snapshot))
+    {
+        // try again the next time.
+        boost::unique_lock<boost::shared_mutex> guard(lock_);
+        snapshot_dirty_ = true;
+    }
+}
+
+void FibpServiceMgr::saveSnapshotFunc()
+{
+    while(!need_stop_)
+    {
+        FibpTimerWheel::get(io_service_).sleep_for(snapshot_save_interval_ms);
+        flushSnapshot();
+    }
+}
+
 void FibpServiceMgr::stop()
 {
     need_stop_ = true;
+    {
+        // wake up the fetching fibers waiting for the services changed.
+        boost::unique_lock<boost::fibers::mutex> guard(fetch_mutex_);
+        fetch_cond_.notify_all();
+    }
     io_service_.stop();
     if (watching_thread_)
         watching_thread_->join();
+    // the changes since the last save.
+    flushSnapshot();
 }
 
 void FibpServiceMgr::runFiber()
@@ -366,6 +859,8 @@ void FibpServiceMgr::runFiber()
 
     boost::fibers::fiber(boost::bind(&FibpServiceMgr::watchPortForwardChangeFunc, this)).detach();
     boost::fibers::fiber(boost::bind(&FibpServiceMgr::watchCurrentClusterName, this)).detach();
+    if (snapshot_file_)
+        boost::fibers::fiber(boost::bind(&FibpServiceMgr::saveSnapshotFunc, this)).detach();
 
     boost::fibers::fiber(boost::bind(&reportServiceStats, boost::ref(io_service_),
             report_ip_, report_port_, boost::ref(need_stop_))).detach();
@@ -453,7 +948,7 @@ void FibpServiceMgr::watchCurrentClusterName()
 
         boost::this_fiber::interruption_point();
         if (!ret)
-            boost::this_fiber::sleep_for(boost::chrono::seconds(10));
+            FibpTimerWheel::get(io_service_).sleep_for(10*1000);
     }
 }
 
@@ -464,7 +959,102 @@ void FibpServiceMgr::changeCluster(const std::string& newClusterName)
         LOG(INFO) << "empty cluster name.";
         return;
     }
+    boost::unique_lock<boost::shared_mutex> guard(lock_);
     curClusterName_ = newClusterName;
+    publishRoutes();
+}
+
+// the meta of the hosts in the same order, the host not known (restored from the
+// old snapshot) is of the weight 1 in no zone.
+static void buildEndpointPolicy(const EndpointMetaMapT* meta_map, const std::string& local_zone,
+    const std::vector<HostPairT>& hosts, std::vector<FibpEndpointMeta>& host_meta,
+    FibpEndpointPolicy& policy)
+{
+    host_meta.resize(hosts.size());
+    bool has_local = false;
+    bool has_remote = false;
+    uint64_t last_added_us = 0;
+    for(std::size_t i = 0; i < hosts.size(); ++i)
+    {
+        FibpEndpointMeta& meta = host_meta[i];
+        if (meta_map)
+        {
+            EndpointMetaMapT::const_iterator it = meta_map->find(hosts[i]);
+            if (it != meta_map->end())
+                meta = it->second;
+        }
+        meta.is_local = !local_zone.empty() && meta.zone == local_zone;
+        if (meta.is_local)
+        {
+            has_local = true;
+            policy.local_weight += meta.weight;
+        }
+        else
+        {
+            has_remote = true;
+        }
+        if (meta.weight != host_meta[0].weight)
+            policy.is_weighted = true;
+        last_added_us = std::max(last_added_us, meta.added_us);
+    }
+    policy.is_zoned = has_local && has_remote;
+    if (last_added_us > 0 && now_us() < last_added_us + slow_start_us)
+        policy.ramp_end_us = last_added_us + slow_start_us;
+}
+
+void FibpServiceMgr::publishRoutes()
+{
+    // only the hosts in the current cluster are routed, so the lookup is by the
+    // service name alone.
+    const std::string suffix = connector + curClusterName_;
+    std::map<std::string, FibpServiceRoute> route_map;
+    for(std::size_t i = 0; i < reg_service_host_info_.size(); ++i)
+    {
+        for(ServiceHostMapT::const_iterator it = reg_service_host_info_[i].begin();
+            it != reg_service_host_info_[i].end(); ++it)
+        {
+            const std::string& key = it->first;
+            if (it->second.empty() || key.size() <= suffix.size() ||
+                key.compare(key.size() - suffix.size(), suffix.size(), suffix) != 0)
+            {
+                continue;
+            }
+            FibpServiceRoute& route = route_map[key.substr(0, key.size() - suffix.size())];
+            route.hosts[i] = it->second;
+            for(std::size_t j = 0; j < it->second.size(); ++j)
+            {
+                route.host_keys[i].push_back(FibpLoadBalancer::get_host_key(
+                        it->second[j].first, it->second[j].second));
+            }
+        }
+    }
+    std::vector<FibpServiceRoute> routes;
+    routes.reserve(route_map.size());
+    for(std::map<std::string, FibpServiceRoute>::iterator it = route_map.begin();
+        it != route_map.end(); ++it)
+    {
+        routes.push_back(FibpServiceRoute());
+        FibpServiceRoute& route = routes.back();
+        std::swap(route, it->second);
+        route.name = it->first;
+        std::map<std::string, int>::const_iterator opt_it = service_hedge_percentile_.find(route.name);
+        if (opt_it != service_hedge_percentile_.end())
+            route.hedge_percentile = opt_it->second;
+        opt_it = service_pipeline_depth_.find(route.name);
+        if (opt_it != service_pipeline_depth_.end())
+            route.pipeline_depth = opt_it->second;
+        route.is_h2c = service_h2c_.find(route.name) != service_h2c_.end();
+        route.is_shared = service_shared_.find(route.name) != service_shared_.end();
+        route.is_stream = service_stream_.find(route.name) != service_stream_.end();
+        std::map<std::string, EndpointMetaMapT>::const_iterator meta_it = service_endpoint_meta_.find(route.name);
+        for(std::size_t i = 0; i < route.hosts.size(); ++i)
+        {
+            buildEndpointPolicy(meta_it == service_endpoint_meta_.end() ? NULL : &meta_it->second,
+                local_zone_, route.hosts[i], route.host_meta[i], route.policies[i]);
+        }
+    }
+    route_table_.publish(routes);
+    snapshot_dirty_ = true;
 }
 
 bool FibpServiceMgr::longPollingRequest(FibpHttpClient& client, const std::string& path,
@@ -505,54 +1095,271 @@ bool FibpServiceMgr::longPollingRequest(FibpHttpClient& client, const std::strin
     return true;
 }
 
-void FibpServiceMgr::watchServiceNodeChangeFunc(const std::string& name)
+void FibpServiceMgr::applyServiceNodes(const std::string& name, const std::string& json_rsp)
+{
+    ServiceWatchState& state = watched_services_[name];
+    // nothing changed for the service itself, e.g. the index moved by others.
+    if (state.has_nodes && json_rsp == state.last_rsp)
+        return;
+    typedef std::map<std::string, std::set<HostPairT> > MapT;
+    std::vector<MapT> node_list;
+    int hedge_percentile = 0;
+    int pipeline_depth = 0;
+    bool is_h2c = false;
+    int prewarm_num = 0;
+    bool is_shared = false;
+    bool is_stream = false;
+    EndpointMetaMapT endpoint_meta;
+    bool ret = parseServiceInfoRsp(json_rsp, node_list, hedge_percentile, pipeline_depth,
+        is_h2c, prewarm_num, is_shared, is_stream, endpoint_meta);
+    if (!ret)
+    {
+        LOG(INFO) << "parse service node list failed." << name;
+        return;
+    }
+    state.last_rsp = json_rsp;
+    state.has_nodes = true;
+    std::set<std::string> service_keys;
+    {
+        boost::unique_lock<boost::shared_mutex> guard(lock_);
+        if (hedge_percentile > 0)
+            service_hedge_percentile_[name] = hedge_percentile;
+        else
+            service_hedge_percentile_.erase(name);
+        if (pipeline_depth > 0)
+            service_pipeline_depth_[name] = pipeline_depth;
+        else
+            service_pipeline_depth_.erase(name);
+        if (is_h2c)
+            service_h2c_.insert(name);
+        else
+            service_h2c_.erase(name);
+        if (is_shared)
+            service_shared_.insert(name);
+        else
+            service_shared_.erase(name);
+        if (is_stream)
+            service_stream_.insert(name);
+        else
+            service_stream_.erase(name);
+        // the endpoints joined after the service was known are ramped up.
+        std::map<std::string, EndpointMetaMapT>::iterator meta_it = service_endpoint_meta_.find(name);
+        if (meta_it != service_endpoint_meta_.end())
+        {
+            uint64_t now = now_us();
+            for(EndpointMetaMapT::iterator it = endpoint_meta.begin(); it != endpoint_meta.end(); ++it)
+            {
+                EndpointMetaMapT::const_iterator last_it = meta_it->second.find(it->first);
+                it->second.added_us = last_it == meta_it->second.end() ? now : last_it->second.added_us;
+            }
+        }
+        service_endpoint_meta_[name].swap(endpoint_meta);
+        for(std::size_t i = 0; i < node_list.size(); ++i)
+        {
+            for (std::set<std::string>::iterator lastit = state.service_keys.begin();
+                lastit != state.service_keys.end(); ++lastit)
+            {
+                reg_service_host_info_[i].erase(*lastit);
+            }
+            for(MapT::const_iterator it = node_list[i].begin();
+                it != node_list[i].end(); ++it)
+            {
+                std::vector<HostPairT>& host_list = reg_service_host_info_[i][it->first];
+                LOG(INFO) << "service added: " << i << ", " << it->first << ", number:" << it->second.size();
+                host_list.clear();
+                host_list.insert(host_list.end(), it->second.begin(), it->second.end());
+                service_keys.insert(it->first);
+            }
+        }
+    }
+    state.service_keys.swap(service_keys);
+    routes_dirty_ = true;
+    for(std::size_t i = 0; i < node_list.size(); ++i)
+    {
+        std::set<HostPairT> hosts;
+        for(MapT::const_iterator it = node_list[i].begin();
+            it != node_list[i].end(); ++it)
+        {
+            hosts.insert(it->second.begin(), it->second.end());
+        }
+        publishMembership(name, (ServiceType)i, prewarm_num, is_h2c && i == HTTP_Service,
+            hosts, state.hosts[i]);
+    }
+}
+
+void FibpServiceMgr::retireService(const std::string& name)
+{
+    std::map<std::string, ServiceWatchState>::iterator state_it = watched_services_.find(name);
+    if (state_it == watched_services_.end())
+        return;
+    LOG(INFO) << "service deleted: " << name;
+    ServiceWatchState& state = state_it->second;
+    {
+        boost::unique_lock<boost::shared_mutex> guard(lock_);
+        for(std::size_t i = 0; i < reg_service_host_info_.size(); ++i)
+        {
+            for (std::set<std::string>::iterator it = state.service_keys.begin();
+                it != state.service_keys.end(); ++it)
+            {
+                reg_service_host_info_[i].erase(*it);
+            }
+        }
+        service_hedge_percentile_.erase(name);
+        service_pipeline_depth_.erase(name);
+        service_h2c_.erase(name);
+        service_shared_.erase(name);
+        service_stream_.erase(name);
+        service_endpoint_meta_.erase(name);
+    }
+    routes_dirty_ = true;
+    for(std::size_t i = 0; i < state.hosts.size(); ++i)
+    {
+        std::set<HostPairT> hosts;
+        publishMembership(name, (ServiceType)i, 0, false, hosts, state.hosts[i]);
+    }
+    watched_services_.erase(state_it);
+}
+
+void FibpServiceMgr::publishMembership(const std::string& name, ServiceType type,
+    int prewarm_num, bool is_h2c, std::set<HostPairT>& hosts, std::set<HostPairT>& last_hosts)
+{
+    FibpMembershipChange change;
+    change.service_name = name;
+    change.type = type;
+    change.prewarm_num = prewarm_num;
+    change.is_h2c = is_h2c;
+    std::set_difference(hosts.begin(), hosts.end(),
+        last_hosts.begin(), last_hosts.end(), std::back_inserter(change.added_hosts));
+    std::vector<HostPairT> removed_hosts;
+    std::set_difference(last_hosts.begin(), last_hosts.end(),
+        hosts.begin(), hosts.end(), std::back_inserter(removed_hosts));
+    last_hosts.swap(hosts);
+    if (change.added_hosts.empty() && removed_hosts.empty())
+        return;
+    for(std::size_t j = 0; j < removed_hosts.size(); ++j)
+    {
+        breaker_->remove(name, FibpLoadBalancer::get_host_key(removed_hosts[j].first,
+                removed_hosts[j].second));
+    }
+    if (!removed_hosts.empty())
+    {
+        // the host may still be used by another service of the same type.
+        std::set<HostPairT> used_hosts;
+        boost::shared_lock<boost::shared_mutex> guard(lock_);
+        for(ServiceHostMapT::const_iterator it = reg_service_host_info_[type].begin();
+            it != reg_service_host_info_[type].end(); ++it)
+        {
+            used_hosts.insert(it->second.begin(), it->second.end());
+        }
+        for(std::size_t j = 0; j < removed_hosts.size(); ++j)
+        {
+            if (used_hosts.find(removed_hosts[j]) == used_hosts.end())
+                change.removed_hosts.push_back(removed_hosts[j]);
+        }
+    }
+    FibpMembershipNotifier::get()->publish(change);
+}
+
+void FibpServiceMgr::scheduleFetch(const std::string& name)
+{
+    boost::unique_lock<boost::fibers::mutex> guard(fetch_mutex_);
+    if (!fetch_pending_.insert(name).second)
+        return;
+    fetch_queue_.push_back(name);
+    fetch_cond_.notify_one();
+}
+
+// one of the few connections fetching the nodes of the changed services, the
+// routes are published once for all the services fetched together, or at least
+// every second while the queue never drains (churn, or a fetch failing again).
+void FibpServiceMgr::fetchServiceNodesFunc(std::size_t conn_index)
+{
+    static const uint64_t PUBLISH_INTERVAL_US = 1000*1000;
+    uint32_t balance_index = conn_index;
+    const std::pair<std::string, std::string>* ip_port = &reg_address_list_[balance_index % reg_address_list_.size()];
+    boost::shared_ptr<FibpHttpClient> client;
+    client.reset(new FibpHttpClient(io_service_, ip_port->first, ip_port->second));
+    while(!need_stop_)
+    {
+        std::string name;
+        {
+            boost::unique_lock<boost::fibers::mutex> guard(fetch_mutex_);
+            while(fetch_queue_.empty() && !need_stop_)
+                fetch_cond_.wait(guard);
+            if (need_stop_)
+                break;
+            name = fetch_queue_.front();
+            fetch_queue_.pop_front();
+            fetch_pending_.erase(name);
+        }
+        // deleted while waiting in the queue.
+        if (watched_services_.find(name) == watched_services_.end())
+            continue;
+        uint32_t indexid = 0;
+        std::string json_rsp;
+        bool ret = longPollingRequest(*client, "/v1/health/service/" + name, "", indexid, json_rsp, -1);
+        if (!ret)
+        {
+            scheduleFetch(name);
+            FibpTimerWheel::get(io_service_).sleep_for(1000);
+            ++balance_index;
+            ip_port = &reg_address_list_[balance_index % reg_address_list_.size()];
+            client.reset(new FibpHttpClient(io_service_, ip_port->first, ip_port->second));
+        }
+        else if (watched_services_.find(name) != watched_services_.end())
+        {
+            applyServiceNodes(name, json_rsp);
+        }
+        if (!routes_dirty_)
+            continue;
+        bool is_idle = false;
+        {
+            boost::unique_lock<boost::fibers::mutex> guard(fetch_mutex_);
+            is_idle = fetch_queue_.empty();
+        }
+        if (is_idle || now_us() > last_publish_us_ + PUBLISH_INTERVAL_US)
+        {
+            boost::unique_lock<boost::shared_mutex> guard(lock_);
+            routes_dirty_ = false;
+            last_publish_us_ = now_us();
+            publishRoutes();
+        }
+    }
+}
+
+// the health of all the services in one blocking query, only the services whose
+// checks changed are fetched again.
+void FibpServiceMgr::watchServiceHealthFunc()
 {
     uint32_t indexid = 0;
-    std::string query_path = "/v1/health/service/" + name;
     uint32_t balance_index = 0;
-    std::set<std::string> last_service_names;
-
     const std::pair<std::string, std::string>& ip_port = reg_address_list_[0];
     boost::shared_ptr<FibpHttpClient> client;
     client.reset(new FibpHttpClient(io_service_, ip_port.first, ip_port.second));
     while(!need_stop_)
     {
         std::string json_rsp;
-        bool ret = longPollingRequest(*client, query_path, "", indexid, json_rsp);
+        bool ret = longPollingRequest(*client, "/v1/health/state/any", "", indexid, json_rsp);
         if (!ret)
         {
-            boost::this_fiber::sleep_for(boost::chrono::seconds(1));
+            FibpTimerWheel::get(io_service_).sleep_for(1000);
             ++balance_index;
             const std::pair<std::string, std::string>& ip_port = reg_address_list_[balance_index % reg_address_list_.size()];
             client.reset(new FibpHttpClient(io_service_, ip_port.first, ip_port.second));
             continue;
         }
-        //LOG(INFO) << "long polling for service returned: " << query_path;
-        typedef std::map<std::string, std::set<HostPairT> > MapT;
-        std::vector<MapT> node_list;
-        ret = parseServiceInfoRsp(json_rsp, node_list);
-        if (!ret)
-        {
-            LOG(INFO) << "parse service node list failed." << name;
+        std::map<std::string, CheckSignT> check_signs;
+        if (!parseHealthStateRsp(json_rsp, check_signs))
             continue;
-        }
-        for(std::size_t i = 0; i < node_list.size(); ++i)
+        for(std::map<std::string, ServiceWatchState>::iterator it = watched_services_.begin();
+            it != watched_services_.end(); ++it)
         {
-            boost::unique_lock<boost::shared_mutex> guard(lock_);
-            for (std::set<std::string>::iterator lastit = last_service_names.begin();
-                lastit != last_service_names.end(); ++lastit)
-            {
-                reg_service_host_info_[i].erase(*lastit);
-            }
-            for(MapT::const_iterator it = node_list[i].begin();
-                it != node_list[i].end(); ++it)
-            {
-                std::vector<HostPairT>& host_list = reg_service_host_info_[i][it->first];
-                LOG(INFO) << "service added: " << i << ", " << it->first << ", number:" << it->second.size();
-                host_list.clear();
-                host_list.insert(host_list.end(), it->second.begin(), it->second.end());
-                last_service_names.insert(it->first);
-            }
+            std::map<std::string, CheckSignT>::const_iterator sign_it = check_signs.find(it->first);
+            CheckSignT sign = sign_it == check_signs.end() ? CheckSignT(0, 0) : sign_it->second;
+            if (sign == it->second.check_sign)
+                continue;
+            it->second.check_sign = sign;
+            scheduleFetch(it->first);
         }
     }
 }
@@ -561,35 +1368,65 @@ void FibpServiceMgr::watchServiceChangeFunc()
 {
     //registerToServiceDiscovery();
 
-    std::set<std::string> watching_services;
+    // fetch all again once in a while in case any change is missed, e.g. the
+    // node of the service without checks.
+    static const uint64_t RESYNC_INTERVAL_US = 600*1000*1000ULL;
     uint32_t indexid = 0;
     uint32_t balance_index = 0;
+    uint64_t last_resync_us = now_us();
     const std::pair<std::string, std::string>& ip_port = reg_address_list_[0];
     boost::shared_ptr<FibpHttpClient> client;
     client.reset(new FibpHttpClient(io_service_, ip_port.first, ip_port.second));
+    for(std::size_t i = 0; i < FETCH_CONN_NUM; ++i)
+    {
+        boost::fibers::fiber(boost::bind(&FibpServiceMgr::fetchServiceNodesFunc, this, i)).detach();
+    }
+    boost::fibers::fiber(boost::bind(&FibpServiceMgr::watchServiceHealthFunc, this)).detach();
     while(!need_stop_)
     {
         std::string json_rsp;
         bool ret = longPollingRequest(*client, "/v1/catalog/services", "", indexid, json_rsp);
         if (!ret)
         {
-            boost::this_fiber::sleep_for(boost::chrono::seconds(1));
+            FibpTimerWheel::get(io_service_).sleep_for(1000);
             ++balance_index;
 
             const std::pair<std::string, std::string>& ip_port = reg_address_list_[balance_index % reg_address_list_.size()];
             client.reset(new FibpHttpClient(io_service_, ip_port.first, ip_port.second));
             continue;
         }
-        std::vector<std::string> services;
+        std::map<std::string, std::set<std::string> > services;
         ret = parseQueryServicesRsp(json_rsp, services);
-        for(std::size_t i = 0; i < services.size(); ++i)
+        if (!ret)
+            continue;
+        bool need_resync = now_us() - last_resync_us > RESYNC_INTERVAL_US;
+        if (need_resync)
+            last_resync_us = now_us();
+        std::vector<std::string> deleted;
+        for(std::map<std::string, ServiceWatchState>::iterator it = watched_services_.begin();
+            it != watched_services_.end(); ++it)
+        {
+            if (services.find(it->first) == services.end())
+                deleted.push_back(it->first);
+        }
+        for(std::size_t i = 0; i < deleted.size(); ++i)
+        {
+            retireService(deleted[i]);
+        }
+        for(std::map<std::string, std::set<std::string> >::iterator it = services.begin();
+            it != services.end(); ++it)
         {
-            if (watching_services.find(services[i]) != watching_services.end())
+            ServiceWatchState& state = watched_services_[it->first];
+            if (!need_resync && state.has_nodes && state.tags == it->second)
                 continue;
-            boost::fibers::fiber f(boost::bind(&FibpServiceMgr::watchServiceNodeChangeFunc,
-                    this, services[i]));
-            f.detach();
-            watching_services.insert(services[i]);
+            state.tags.swap(it->second);
+            scheduleFetch(it->first);
+        }
+        if (!deleted.empty())
+        {
+            boost::unique_lock<boost::shared_mutex> guard(lock_);
+            routes_dirty_ = false;
+            publishRoutes();
         }
     }
 }
@@ -621,6 +1458,19 @@ void FibpServiceMgr::watchPortForwardChangeFunc()
     std::map<uint16_t, std::set<std::string> > last_ports;
     std::map<std::string, uint16_t> service_port_map;
     std::map<std::string, ServiceInfo> previous_keys;
+    {
+        // the port forwards restored from the snapshot.
+        boost::shared_lock<boost::shared_mutex> guard(lock_);
+        for(std::size_t i = 0; i < forward_entries_.size(); ++i)
+        {
+            const FibpForwardSnapshotEntry& entry = forward_entries_[i];
+            ServiceInfo& si = previous_keys[entry.forward_key];
+            si.service_name = entry.service_name;
+            si.type = entry.type;
+            service_port_map[si.service_name + boost::lexical_cast<std::string>(si.type)] = entry.port;
+            last_ports[entry.port].insert(entry.forward_key.substr(0, AGENT_ID_LEN));
+        }
+    }
     const std::pair<std::string, std::string>& ip_port = reg_address_list_[0];
     boost::shared_ptr<FibpHttpClient> client;
     client.reset(new FibpHttpClient(io_service_, ip_port.first, ip_port.second));
@@ -630,7 +1480,7 @@ void FibpServiceMgr::watchPortForwardChangeFunc()
         bool ret = longPollingRequest(*client, port_forward_key, "keys", indexid, json_rsp);
         if (!ret)
         {
-            boost::this_fiber::sleep_for(boost::chrono::seconds(1));
+            FibpTimerWheel::get(io_service_).sleep_for(1000);
             ++balance_index;
 
             const std::pair<std::string, std::string>& ip_port = reg_address_list_[balance_index % reg_address_list_.size()];
@@ -735,6 +1585,21 @@ void FibpServiceMgr::watchPortForwardChangeFunc()
             LOG(INFO) << "forward port removed: " << *it;
         }
 
+        std::vector<FibpForwardSnapshotEntry> entries;
+        for(std::map<std::string, ServiceInfo>::const_iterator it = new_keys.begin();
+            it != new_keys.end(); ++it)
+        {
+            std::map<std::string, uint16_t>::const_iterator s_it = service_port_map.find(
+                it->second.service_name + boost::lexical_cast<std::string>(it->second.type));
+            if (s_it == service_port_map.end())
+                continue;
+            entries.push_back(FibpForwardSnapshotEntry());
+            entries.back().forward_key = it->first;
+            entries.back().service_name = it->second.service_name;
+            entries.back().type = it->second.type;
+            entries.back().port = s_it->second;
+        }
+
         boost::unique_lock<boost::shared_mutex> guard(lock_);
         for (std::map<uint16_t, std::set<std::string> >::const_iterator it = last_ports.begin();
             it != last_ports.end(); ++it)
@@ -745,6 +1610,8 @@ void FibpServiceMgr::watchPortForwardChangeFunc()
                 ports_used_by_agent_[*it2].insert(it->first);
             }
         }
+        forward_entries_.swap(entries);
+        snapshot_dirty_ = true;
     }
 }
 
@@ -787,29 +1654,151 @@ bool FibpServiceMgr::getForwardPortInfo(FibpHttpClient& client, const std::strin
     return true;
 }
 
+int FibpServiceMgr::get_service_hedge_percentile(const std::string& service_name)
+{
+    const FibpServiceRoute* route = route_table_.snapshot().find(service_name);
+    return route ? route->hedge_percentile : 0;
+}
+
+int FibpServiceMgr::get_service_pipeline_depth(const std::string& service_name)
+{
+    const FibpServiceRoute* route = route_table_.snapshot().find(service_name);
+    return route ? route->pipeline_depth : 0;
+}
+
+bool FibpServiceMgr::is_service_h2c(const std::string& service_name)
+{
+    const FibpServiceRoute* route = route_table_.snapshot().find(service_name);
+    return route && route->is_h2c;
+}
+
+bool FibpServiceMgr::is_service_shared(const std::string& service_name)
+{
+    const FibpServiceRoute* route = route_table_.snapshot().find(service_name);
+    return route && route->is_shared;
+}
+
+bool FibpServiceMgr::is_service_stream(const std::string& service_name)
+{
+    const FibpServiceRoute* route = route_table_.snapshot().find(service_name);
+    return route && route->is_stream;
+}
+
+// the weights of the hosts to select from, index maps them to the hosts of the
+// route if only some are available. The hosts joined lately are ramped up (if
+// now is not 0). If the hosts are in different zones, the local zone is chosen
+// by the share of its healthy weight and the weights of the other side are zeroed.
+static void getEndpointWeights(const FibpServiceRoute& route, ServiceType type,
+    const std::vector<std::size_t>* index, std::size_t balance_index, uint64_t now,
+    const std::string& exclude, std::vector<double>& weights)
+{
+    const std::vector<FibpEndpointMeta>& host_meta = route.host_meta[type];
+    const std::vector<std::string>& host_keys = route.host_keys[type];
+    const FibpEndpointPolicy& policy = route.policies[type];
+    std::size_t size = index ? index->size() : host_meta.size();
+    weights.resize(size);
+    double healthy_local_weight = 0;
+    double local_weight = 0;
+    double remote_weight = 0;
+    for(std::size_t i = 0; i < size; ++i)
+    {
+        const FibpEndpointMeta& meta = host_meta[index ? (*index)[i] : i];
+        double weight = meta.weight;
+        if (now > 0 && meta.added_us > 0 && now < meta.added_us + slow_start_us)
+        {
+            weight *= std::max(min_slow_start_factor,
+                (double)(now - meta.added_us) / slow_start_us);
+        }
+        weights[i] = weight;
+        if (meta.is_local)
+            healthy_local_weight += meta.weight;
+        if (host_keys[index ? (*index)[i] : i] == exclude)
+            continue;
+        if (meta.is_local)
+            local_weight += weight;
+        else
+            remote_weight += weight;
+    }
+    if (!policy.is_zoned || local_weight <= 0 || remote_weight <= 0)
+        return;
+    double local_share = std::min(1.0,
+        healthy_local_weight / policy.local_weight * zone_overprovision_factor);
+    // not the same point the balancer draws from the index.
+    bool use_local = FibpLoadBalancer::get_unit_point(balance_index ^ 0x5bd1e9955bd1e995ULL) < local_share;
+    for(std::size_t i = 0; i < size; ++i)
+    {
+        if (host_meta[index ? (*index)[i] : i].is_local != use_local)
+            weights[i] = 0;
+    }
+}
+
+bool FibpServiceMgr::get_service_address(std::size_t balance_index,
+    const std::string& service_name,
+    ServiceType type,
+    std::string& ip, std::string& port,
+    const std::string& exclude)
+{
+    std::string host_key;
+    return get_service_address(balance_index, service_name, type, ip, port, host_key, exclude);
+}
+
 bool FibpServiceMgr::get_service_address(std::size_t balance_index,
     const std::string& service_name,
     ServiceType type,
-    std::string& ip, std::string& port)
+    std::string& ip, std::string& port, std::string& host_key,
+    const std::string& exclude)
 {
-    if (type >= reg_service_host_info_.size())
+    if (type >= End_Service)
     {
         LOG(ERROR) << "service type error: " << type;
         return false;
     }
-    std::string service_key = service_name + connector + curClusterName_;
-
-    boost::shared_lock<boost::shared_mutex> guard(lock_);
-    ServiceHostMapT::const_iterator host_it = reg_service_host_info_[type].find(service_key);
-    if (host_it == reg_service_host_info_[type].end() ||
-        host_it->second.empty())
+    const FibpServiceRoute* route = route_table_.snapshot().find(service_name);
+    if (!route || route->hosts[type].empty())
     {
-        LOG(INFO) << "service not found : " << service_key;
+        LOG(INFO) << "service not found : " << service_name;
         return false;
     }
-    const HostPairT& host_info = host_it->second[balance_index % host_it->second.size()];
+    const std::vector<std::string>& host_keys = route->host_keys[type];
+    const std::vector<std::string>* select_keys = &host_keys;
+    std::vector<std::string> available_keys;
+    std::vector<std::size_t> available_index;
+    if (breaker_->has_ejected(service_name))
+    {
+        for(std::size_t i = 0; i < host_keys.size(); ++i)
+        {
+            if (breaker_->is_available(service_name, host_keys[i]))
+            {
+                available_keys.push_back(host_keys[i]);
+                available_index.push_back(i);
+            }
+        }
+        // all ejected, try them anyway rather than failing the service.
+        if (!available_keys.empty())
+            select_keys = &available_keys;
+    }
+    const FibpEndpointPolicy& policy = route->policies[type];
+    uint64_t now = policy.ramp_end_us > 0 ? now_us() : 0;
+    bool is_ramping = now > 0 && now < policy.ramp_end_us;
+    std::size_t selected = 0;
+    if (policy.is_weighted || policy.is_zoned || is_ramping)
+    {
+        std::vector<double> weights;
+        getEndpointWeights(*route, type, select_keys == &available_keys ? &available_index : NULL,
+            balance_index, is_ramping ? now : 0, exclude, weights);
+        selected = balancer_->select(balance_index, *select_keys, weights, exclude);
+    }
+    else
+    {
+        selected = balancer_->select(balance_index, *select_keys, exclude);
+    }
+    if (select_keys == &available_keys)
+        selected = available_index[selected];
+    const HostPairT& host_info = route->hosts[type][selected];
     ip = host_info.first;
     port = host_info.second;
+    host_key = host_keys[selected];
+    breaker_->on_select(service_name, host_key);
     return true;
 }
 
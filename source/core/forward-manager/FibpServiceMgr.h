@@ -2,6 +2,10 @@
 #define FIBP_SERVICE_MGR_H
 
 #include <common/FibpCommonTypes.h>
+#include "FibpLoadBalancer.h"
+#include "FibpCircuitBreaker.h"
+#include "FibpRouteTable.h"
+#include "FibpServiceSnapshot.h"
 #include <3rdparty/rapidjson/document.h>
 #include <string>
 #include <utility>
@@ -10,6 +14,9 @@
 #include <boost/asio.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/thread.hpp>
+#include <boost/fiber/mutex.hpp>
+#include <boost/fiber/condition.hpp>
+#include <deque>
 
 namespace fibp
 {
@@ -18,14 +25,75 @@ class FibpHttpClient;
 class FibpServiceMgr
 {
 public:
+    // the services in the snapshot file are routed at once, before the registry
+    // is watched. The hosts in the local zone are preferred if it is not empty.
     FibpServiceMgr(const std::string& reg_address_list, const std::string& local_ip,
-        uint16_t local_port, const std::string& report_ip, const std::string& report_port);
+        uint16_t local_port, const std::string& report_ip, const std::string& report_port,
+        const std::string& snapshot_path = std::string(),
+        const std::string& local_zone = std::string());
+    // restore the port forwards in the snapshot and start watching the registry.
+    void start();
+    // the host in exclude (ip:port) will be avoided if there are other hosts, it is
+    // used by the retry to prefer a different host than the one just failed.
+    // The hosts ejected by the circuit breaker are skipped until probed ok.
+    // The hosts are chosen by their weights, the ones joined lately are ramped
+    // up, and the local zone is preferred while it is healthy enough.
     bool get_service_address(std::size_t balance_index, const std::string& service_name,
-        ServiceType type, std::string& ip, std::string& port);
+        ServiceType type, std::string& ip, std::string& port,
+        const std::string& exclude = std::string());
+    // also give the key (ip:port) of the host built with the route, to be passed
+    // to the balancer and the breaker when the request is done.
+    bool get_service_address(std::size_t balance_index, const std::string& service_name,
+        ServiceType type, std::string& ip, std::string& port, std::string& host_key,
+        const std::string& exclude);
+    // return the latency percentile to send the hedged request for the service,
+    // 0 if the service is not tagged with hedge in the service discovery.
+    int get_service_hedge_percentile(const std::string& service_name);
+    // return the max number of the requests pipelined on one connection to a host
+    // of the http service, 0 if the service is not tagged with pipeline.
+    int get_service_pipeline_depth(const std::string& service_name);
+    // the http service tagged with h2c is called by the HTTP/2 client.
+    bool is_service_h2c(const std::string& service_name);
+    // the rpc/raw service tagged with shared uses one connection to each host for
+    // all the worker threads.
+    bool is_service_shared(const std::string& service_name);
+    // the response of the http service tagged with stream is relayed to the client
+    // as it arrives by the single service api.
+    bool is_service_stream(const std::string& service_name);
+    // created with the manager and never replaced, so the worker threads can
+    // keep the pointer.
+    FibpLoadBalancer* get_load_balancer()
+    {
+        return balancer_.get();
+    }
+    FibpCircuitBreaker* get_circuit_breaker()
+    {
+        return breaker_.get();
+    }
     void stop();
     void get_related_forward_ports(const std::string& agentid, std::vector<uint16_t> &ports);
+    // the number of the health checks of a service and the max modify index of them.
+    typedef std::pair<std::size_t, uint64_t> CheckSignT;
 private:
     typedef std::pair<std::string, std::string> HostPairT;
+    typedef std::map<HostPairT, FibpEndpointMeta> EndpointMetaMapT;
+
+    // what is known of a service watched, only used by the discovery fibers.
+    struct ServiceWatchState
+    {
+        ServiceWatchState()
+            : has_nodes(false), check_sign(0, 0), hosts(End_Service)
+        {
+        }
+        bool has_nodes;
+        std::string last_rsp;
+        std::set<std::string> tags;
+        CheckSignT check_sign;
+        // the keys in reg_service_host_info_ (name-cluster) of the service.
+        std::set<std::string> service_keys;
+        // indexed by the service type, the hosts published to the membership.
+        std::vector<std::set<HostPairT> > hosts;
+    };
 
     bool registerToServiceDiscovery();
     //bool parseServiceNodeInfo(const rapidjson::Value& v, std::string& host);
@@ -39,8 +107,17 @@ private:
     bool longPollingRequest(FibpHttpClient& client, const std::string& path,
         const std::string& query,
         uint32_t& indexid, std::string& json_rsp, int timeout = 120);
-    void watchServiceNodeChangeFunc(const std::string& name);
+    // the catalog and the health of all the services are watched by two blocking
+    // queries, the nodes of the services changed are fetched by a small pool of
+    // connections and only the diff is applied.
     void watchServiceChangeFunc();
+    void watchServiceHealthFunc();
+    void fetchServiceNodesFunc(std::size_t conn_index);
+    void scheduleFetch(const std::string& name);
+    void applyServiceNodes(const std::string& name, const std::string& json_rsp);
+    void retireService(const std::string& name);
+    void publishMembership(const std::string& name, ServiceType type, int prewarm_num,
+        bool is_h2c, std::set<HostPairT>& hosts, std::set<HostPairT>& last_hosts);
     void runFiber();
 
     void watchPortForwardChangeFunc();
@@ -49,6 +126,17 @@ private:
         std::string& service_name, int& type);
     void watchCurrentClusterName();
     void changeCluster(const std::string& newClusterName);
+    // rebuild the routes of the current cluster for the lookups, called with
+    // lock_ held after the services or the cluster changed.
+    void publishRoutes();
+    void restoreSnapshot();
+    void restorePortForwards();
+    // copy the services and the port forwards, called with lock_ held.
+    void buildSnapshot(FibpServiceSnapshot& snapshot);
+    // the changes are saved at most once in a while, the file is written out
+    // of lock_ on the copy.
+    void saveSnapshotFunc();
+    void flushSnapshot();
 
     typedef std::map<std::string, std::vector<HostPairT> > ServiceHostMapT;
     typedef std::vector<ServiceHostMapT> ServiceHostInfoT;
@@ -61,9 +149,35 @@ private:
     bool need_stop_;
     boost::asio::io_service io_service_;
     boost::shared_ptr<boost::thread>  watching_thread_;
+    // guard the service info below, which is only used by the discovery, the
+    // worker threads look up the routes published instead.
     boost::shared_mutex  lock_;
     std::string curClusterName_;
     std::map<std::string, std::set<uint16_t> > ports_used_by_agent_;
+    FibpLoadBalancerPtr balancer_;
+    boost::shared_ptr<FibpCircuitBreaker> breaker_;
+    std::map<std::string, int> service_hedge_percentile_;
+    std::map<std::string, int> service_pipeline_depth_;
+    std::set<std::string> service_h2c_;
+    std::set<std::string> service_shared_;
+    std::set<std::string> service_stream_;
+    // the weight and the zone of the endpoints of each service.
+    std::map<std::string, EndpointMetaMapT> service_endpoint_meta_;
+    FibpRouteTable route_table_;
+    static const std::size_t FETCH_CONN_NUM = 4;
+    std::map<std::string, ServiceWatchState> watched_services_;
+    bool routes_dirty_;
+    // when the fetchers published the routes last, only used by them.
+    uint64_t last_publish_us_;
+    boost::fibers::mutex fetch_mutex_;
+    boost::fibers::condition_variable fetch_cond_;
+    std::deque<std::string> fetch_queue_;
+    std::set<std::string> fetch_pending_;
+    boost::shared_ptr<FibpServiceSnapshotFile> snapshot_file_;
+    // changed since saved, guarded by lock_.
+    bool snapshot_dirty_;
+    std::vector<FibpForwardSnapshotEntry> forward_entries_;
+    std::string local_zone_;
 };
 
 }
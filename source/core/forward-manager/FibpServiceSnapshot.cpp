@@ -0,0 +1,337 @@
+#include "FibpServiceSnapshot.h"
+#include <glog/logging.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstdio>
+#include <cstring>
+
+namespace fibp
+{
+
+static const char snapshot_magic[8] = {'F', 'I', 'B', 'P', 'S', 'V', 'C', '\0'};
+
+struct SnapshotHeader
+{
+    char magic[8];
+    uint32_t format_version;
+    uint32_t header_size;
+    uint64_t body_size;
+    uint64_t checksum;
+};
+
+static const uint8_t h2c_flag = 1;
+static const uint8_t shared_flag = 2;
+static const uint8_t stream_flag = 4;
+
+// FNV-1a 64 of the body, to drop the file truncated or corrupted.
+static uint64_t checksum(const char* data, std::size_t size)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for(std::size_t i = 0; i < size; ++i)
+    {
+        h ^= (unsigned char)data[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+template <class T>
+static void put_value(std::string& data, T v)
+{
+    data.append((const char*)&v, sizeof(v));
+}
+
+static void put_string(std::string& data, const std::string& s)
+{
+    put_value<uint32_t>(data, s.size());
+    data.append(s);
+}
+
+// read the records in place with the bounds checked.
+class SnapshotReader
+{
+public:
+    SnapshotReader(const char* data, std::size_t size)
+        : pos_(data), end_(data + size)
+    {
+    }
+    template <class T>
+    bool get_value(T& v)
+    {
+        if ((std::size_t)(end_ - pos_) < sizeof(v))
+            return false;
+        memcpy(&v, pos_, sizeof(v));
+        pos_ += sizeof(v);
+        return true;
+    }
+    bool get_string(std::string& s)
+    {
+        uint32_t len = 0;
+        if (!get_value(len) || (std::size_t)(end_ - pos_) < len)
+            return false;
+        s.assign(pos_, len);
+        pos_ += len;
+        return true;
+    }
+    // the count should not be more than the bytes left, so the corrupted count
+    // never reserves too much.
+    bool get_count(uint32_t& num)
+    {
+        return get_value(num) && num <= (std::size_t)(end_ - pos_);
+    }
+    bool at_end() const
+    {
+        return pos_ == end_;
+    }
+
+private:
+    const char* pos_;
+    const char* end_;
+};
+
+FibpServiceSnapshotFile::FibpServiceSnapshotFile(const std::string& path)
+    : path_(path)
+{
+}
+
+void FibpServiceSnapshotFile::serialize(const FibpServiceSnapshot& snapshot, std::string& data)
+{
+    data.assign(sizeof(SnapshotHeader), '\0');
+    put_string(data, snapshot.cluster);
+    put_value<uint32_t>(data, snapshot.services.size());
+    for(std::size_t i = 0; i < snapshot.services.size(); ++i)
+    {
+        const FibpServiceSnapshotEntry& service = snapshot.services[i];
+        put_string(data, service.name);
+        put_value<int32_t>(data, service.hedge_percentile);
+        put_value<int32_t>(data, service.pipeline_depth);
+        uint8_t flags = 0;
+        if (service.is_h2c)
+            flags |= h2c_flag;
+        if (service.is_shared)
+            flags |= shared_flag;
+        if (service.is_stream)
+            flags |= stream_flag;
+        put_value<uint8_t>(data, flags);
+        put_value<uint32_t>(data, service.host_lists.size());
+        for(std::size_t j = 0; j < service.host_lists.size(); ++j)
+        {
+            const FibpServiceSnapshotEntry::HostList& host_list = service.host_lists[j];
+            put_value<uint8_t>(data, host_list.type);
+            put_string(data, host_list.key);
+            put_value<uint32_t>(data, host_list.hosts.size());
+            for(std::size_t k = 0; k < host_list.hosts.size(); ++k)
+            {
+                put_string(data, host_list.hosts[k].first);
+                put_string(data, host_list.hosts[k].second);
+            }
+        }
+        put_value<uint32_t>(data, service.endpoints.size());
+        for(std::size_t j = 0; j < service.endpoints.size(); ++j)
+        {
+            const FibpServiceSnapshotEntry::Endpoint& endpoint = service.endpoints[j];
+            put_string(data, endpoint.host.first);
+            put_string(data, endpoint.host.second);
+            put_value<uint32_t>(data, endpoint.weight);
+            put_string(data, endpoint.zone);
+        }
+    }
+    put_value<uint32_t>(data, snapshot.forwards.size());
+    for(std::size_t i = 0; i < snapshot.forwards.size(); ++i)
+    {
+        const FibpForwardSnapshotEntry& forward = snapshot.forwards[i];
+        put_string(data, forward.forward_key);
+        put_string(data, forward.service_name);
+        put_value<int32_t>(data, forward.type);
+        put_value<uint16_t>(data, forward.port);
+    }
+
+    SnapshotHeader header;
+    memcpy(header.magic, snapshot_magic, sizeof(header.magic));
+    header.format_version = FORMAT_VERSION;
+    header.header_size = sizeof(SnapshotHeader);
+    header.body_size = data.size() - sizeof(SnapshotHeader);
+    header.checksum = checksum(data.data() + sizeof(SnapshotHeader), header.body_size);
+    memcpy(&data[0], &header, sizeof(header));
+}
+
+bool FibpServiceSnapshotFile::parse(const char* data, std::size_t size, FibpServiceSnapshot& snapshot)
+{
+    SnapshotHeader header;
+    if (size < sizeof(header))
+        return false;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, snapshot_magic, sizeof(header.magic)) != 0)
+    {
+        LOG(WARNING) << "not a service snapshot.";
+        return false;
+    }
+    if (header.format_version == 0 || header.format_version > FORMAT_VERSION ||
+        header.header_size != sizeof(header))
+    {
+        LOG(WARNING) << "service snapshot version not supported: " << header.format_version;
+        return false;
+    }
+    if (header.body_size != size - sizeof(header) ||
+        header.checksum != checksum(data + sizeof(header), header.body_size))
+    {
+        LOG(WARNING) << "service snapshot corrupted.";
+        return false;
+    }
+    SnapshotReader reader(data + sizeof(header), header.body_size);
+    uint32_t service_num = 0;
+    if (!reader.get_string(snapshot.cluster) || !reader.get_count(service_num))
+        return false;
+    snapshot.services.resize(service_num);
+    for(std::size_t i = 0; i < service_num; ++i)
+    {
+        FibpServiceSnapshotEntry& service = snapshot.services[i];
+        int32_t hedge_percentile = 0;
+        int32_t pipeline_depth = 0;
+        uint8_t flags = 0;
+        uint32_t list_num = 0;
+        if (!reader.get_string(service.name) || !reader.get_value(hedge_percentile) ||
+            !reader.get_value(pipeline_depth) || !reader.get_value(flags) ||
+            !reader.get_count(list_num))
+        {
+            return false;
+        }
+        service.hedge_percentile = hedge_percentile;
+        service.pipeline_depth = pipeline_depth;
+        service.is_h2c = flags & h2c_flag;
+        service.is_shared = flags & shared_flag;
+        service.is_stream = flags & stream_flag;
+        service.host_lists.resize(list_num);
+        for(std::size_t j = 0; j < list_num; ++j)
+        {
+            FibpServiceSnapshotEntry::HostList& host_list = service.host_lists[j];
+            uint8_t type = 0;
+            uint32_t host_num = 0;
+            if (!reader.get_value(type) || type >= End_Service ||
+                !reader.get_string(host_list.key) || !reader.get_count(host_num))
+            {
+                return false;
+            }
+            host_list.type = type;
+            host_list.hosts.resize(host_num);
+            for(std::size_t k = 0; k < host_num; ++k)
+            {
+                if (!reader.get_string(host_list.hosts[k].first) ||
+                    !reader.get_string(host_list.hosts[k].second))
+                {
+                    return false;
+                }
+            }
+        }
+        if (header.format_version < 2)
+            continue;
+        uint32_t endpoint_num = 0;
+        if (!reader.get_count(endpoint_num))
+            return false;
+        service.endpoints.resize(endpoint_num);
+        for(std::size_t j = 0; j < endpoint_num; ++j)
+        {
+            FibpServiceSnapshotEntry::Endpoint& endpoint = service.endpoints[j];
+            if (!reader.get_string(endpoint.host.first) || !reader.get_string(endpoint.host.second) ||
+                !reader.get_value(endpoint.weight) || !reader.get_string(endpoint.zone) ||
+                endpoint.weight == 0)
+            {
+                return false;
+            }
+        }
+    }
+    uint32_t forward_num = 0;
+    if (!reader.get_count(forward_num))
+        return false;
+    snapshot.forwards.resize(forward_num);
+    for(std::size_t i = 0; i < forward_num; ++i)
+    {
+        FibpForwardSnapshotEntry& forward = snapshot.forwards[i];
+        int32_t type = 0;
+        if (!reader.get_string(forward.forward_key) || !reader.get_string(forward.service_name) ||
+            !reader.get_value(type) || !reader.get_value(forward.port))
+        {
+            return false;
+        }
+        forward.type = type;
+    }
+    return reader.at_end();
+}
+
+bool FibpServiceSnapshotFile::load(FibpServiceSnapshot& snapshot)
+{
+    int fd = ::open(path_.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        LOG(INFO) << "no service snapshot: " << path_;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(SnapshotHeader))
+    {
+        ::close(fd);
+        LOG(WARNING) << "service snapshot too small: " << path_;
+        return false;
+    }
+    std::size_t size = st.st_size;
+    void* addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED)
+    {
+        LOG(WARNING) << "map service snapshot failed: " << path_ << ", " << strerror(errno);
+        return false;
+    }
+    bool ret = parse((const char*)addr, size, snapshot);
+    if (ret)
+        last_data_.assign((const char*)addr, size);
+    munmap(addr, size);
+    if (!ret)
+    {
+        LOG(WARNING) << "parse service snapshot failed: " << path_;
+        snapshot = FibpServiceSnapshot();
+        return false;
+    }
+    LOG(INFO) << "service snapshot loaded: " << path_ << ", services: " << snapshot.services.size()
+        << ", forwards: " << snapshot.forwards.size();
+    return true;
+}
+
+bool FibpServiceSnapshotFile::save(const FibpServiceSnapshot& snapshot)
+{
+    std::string data;
+    serialize(snapshot, data);
+    if (data == last_data_)
+        return true;
+    std::string tmp_path = path_ + ".tmp";
+    int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        LOG(WARNING) << "open service snapshot failed: " << tmp_path << ", " << strerror(errno);
+        return false;
+    }
+    std::size_t written = 0;
+    while(written < data.size())
+    {
+        ssize_t ret = ::write(fd, data.data() + written, data.size() - written);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            break;
+        written += ret;
+    }
+    bool ok = written == data.size() && fsync(fd) == 0;
+    ::close(fd);
+    if (!ok || ::rename(tmp_path.c_str(), path_.c_str()) != 0)
+    {
+        LOG(WARNING) << "write service snapshot failed: " << path_ << ", " << strerror(errno);
+        ::unlink(tmp_path.c_str());
+        return false;
+    }
+    last_data_.swap(data);
+    return true;
+}
+
+}
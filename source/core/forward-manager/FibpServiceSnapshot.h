@@ -0,0 +1,104 @@
+#ifndef FIBP_SERVICE_SNAPSHOT_H
+#define FIBP_SERVICE_SNAPSHOT_H
+
+#include <common/FibpCommonTypes.h>
+#include <string>
+#include <vector>
+#include <utility>
+#include <stdint.h>
+
+namespace fibp
+{
+
+// the last known hosts of a service, keyed as in the service discovery
+// (name-cluster) for each service type.
+struct FibpServiceSnapshotEntry
+{
+    typedef std::pair<std::string, std::string> HostPairT;
+    struct HostList
+    {
+        HostList()
+            : type(0)
+        {
+        }
+        int type;
+        std::string key;
+        std::vector<HostPairT> hosts;
+    };
+    struct Endpoint
+    {
+        Endpoint()
+            : weight(1)
+        {
+        }
+        HostPairT host;
+        uint32_t weight;
+        std::string zone;
+    };
+    FibpServiceSnapshotEntry()
+        : hedge_percentile(0), pipeline_depth(0), is_h2c(false), is_shared(false),
+        is_stream(false)
+    {
+    }
+    std::string name;
+    int hedge_percentile;
+    int pipeline_depth;
+    bool is_h2c;
+    bool is_shared;
+    bool is_stream;
+    std::vector<HostList> host_lists;
+    // the weight and the zone of the endpoints, not in the format version 1.
+    std::vector<Endpoint> endpoints;
+};
+
+// the port forwarded for the forward key (agentid + service) in the kv store.
+struct FibpForwardSnapshotEntry
+{
+    FibpForwardSnapshotEntry()
+        : type(0), port(0)
+    {
+    }
+    std::string forward_key;
+    std::string service_name;
+    int type;
+    uint16_t port;
+};
+
+struct FibpServiceSnapshot
+{
+    std::string cluster;
+    std::vector<FibpServiceSnapshotEntry> services;
+    std::vector<FibpForwardSnapshotEntry> forwards;
+};
+
+// the service table written to the disk soon after it changed, so the proxy
+// restarted can route at once and keeps routing while the registry is down.
+// The file is a fixed header (magic, format version, body size and checksum)
+// followed by the length prefixed records in the host byte order. It is mapped
+// and parsed in place when loaded, and replaced by rename when saved, so a
+// crash never leaves a partial file.
+class FibpServiceSnapshotFile
+{
+public:
+    // the older versions are still loaded.
+    static const uint32_t FORMAT_VERSION = 2;
+    FibpServiceSnapshotFile(const std::string& path);
+    const std::string& path() const
+    {
+        return path_;
+    }
+    bool load(FibpServiceSnapshot& snapshot);
+    // nothing is written if the snapshot is the same as the last one.
+    bool save(const FibpServiceSnapshot& snapshot);
+
+    static void serialize(const FibpServiceSnapshot& snapshot, std::string& data);
+    static bool parse(const char* data, std::size_t size, FibpServiceSnapshot& snapshot);
+
+private:
+    std::string path_;
+    std::string last_data_;
+};
+
+}
+
+#endif
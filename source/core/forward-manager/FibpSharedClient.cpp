@@ -0,0 +1,263 @@
+#include "FibpSharedClient.h"
+#include "FibpClientFuture.h"
+#include "FibpTimerWheel.h"
+#include <boost/fiber/all.hpp>
+#include <boost/bind.hpp>
+#include <boost/functional/hash.hpp>
+#include <fiber-server/loop.hpp>
+#include <glog/logging.h>
+#include <algorithm>
+
+namespace fibp
+{
+
+// the io threads owning the shared clients, the hosts are spread among them.
+static boost::atomic<std::size_t> s_thread_num(2);
+// how often to check if the reading fiber of the removed client quit.
+static const uint32_t CLOSE_CHECK_MS = 100;
+static const std::string SEND_FAILED_ERR("Send Failed.");
+static const std::string SERVER_REMOVED_ERR("Server Removed.");
+
+static inline std::string getClientId(const std::string& host, const std::string& port)
+{
+    static std::string delim(":");
+    return host + delim + port;
+}
+
+FibpSharedRequestQueue::FibpSharedRequestQueue()
+    : head_(&stub_), tail_(&stub_)
+{
+}
+
+void FibpSharedRequestQueue::push(FibpSharedRequest* req)
+{
+    req->next.store(NULL, boost::memory_order_relaxed);
+    FibpSharedRequest* prev = head_.exchange(req, boost::memory_order_acq_rel);
+    prev->next.store(req, boost::memory_order_release);
+}
+
+FibpSharedRequest* FibpSharedRequestQueue::pop()
+{
+    FibpSharedRequest* tail = tail_;
+    FibpSharedRequest* next = tail->next.load(boost::memory_order_acquire);
+    if (tail == &stub_)
+    {
+        if (next == NULL)
+            return NULL;
+        tail_ = next;
+        tail = next;
+        next = next->next.load(boost::memory_order_acquire);
+    }
+    if (next != NULL)
+    {
+        tail_ = next;
+        return tail;
+    }
+    if (tail != head_.load(boost::memory_order_acquire))
+        return NULL;
+    // the last one can be popped only if something behind it.
+    push(&stub_);
+    next = tail->next.load(boost::memory_order_acquire);
+    if (next != NULL)
+    {
+        tail_ = next;
+        return tail;
+    }
+    return NULL;
+}
+
+void FibpSharedClientMgr::set_thread_num(std::size_t thread_num)
+{
+    s_thread_num = std::max(thread_num, (std::size_t)1);
+}
+
+FibpSharedClientMgr::FibpSharedClientMgr()
+{
+    client_list_.resize(End_Service);
+    std::size_t thread_num = s_thread_num.load();
+    for(std::size_t i = 0; i < thread_num; ++i)
+    {
+        boost::shared_ptr<boost::asio::io_service> io(new boost::asio::io_service());
+        io_list_.push_back(io);
+        threads_.create_thread(boost::bind(&FibpSharedClientMgr::run_service, boost::ref(*io)));
+    }
+    FibpMembershipNotifier::get()->subscribe(this);
+}
+
+FibpSharedClientMgr::~FibpSharedClientMgr()
+{
+    FibpMembershipNotifier::get()->unsubscribe(this);
+    for(std::size_t i = 0; i < io_list_.size(); ++i)
+    {
+        io_list_[i]->stop();
+    }
+    threads_.join_all();
+}
+
+void FibpSharedClientMgr::run_service(boost::asio::io_service& io_service)
+{
+    boost::fibers::fiber f(boost::bind(boost::fibers::asio::run_service, boost::ref(io_service)));
+    f.join();
+}
+
+FibpSharedClientMgr::SharedClientPtr FibpSharedClientMgr::get_shared_client(ServiceType calltype,
+    const std::string& ip, const std::string& port)
+{
+    std::string client_id = getClientId(ip, port);
+    SharedClientMapT& client_map = client_list_[calltype];
+    {
+        folly::RWSpinLock::ReadHolder guard(lock_);
+        SharedClientMapT::const_iterator it = client_map.find(client_id);
+        if (it != client_map.end())
+            return it->second;
+    }
+    folly::RWSpinLock::WriteHolder guard(lock_);
+    SharedClientPtr& shared = client_map[client_id];
+    if (shared)
+        return shared;
+    boost::asio::io_service& io = *io_list_[boost::hash_value(client_id) % io_list_.size()];
+    shared.reset(new SharedClient(io));
+    switch(calltype)
+    {
+    case RPC_Service:
+        shared->client.reset(new FibpRpcClient(io, ip, port));
+        break;
+    case Raw_Service:
+        shared->client.reset(new FibpRawClient(io, ip, port));
+        break;
+    default:
+        break;
+    }
+    LOG(INFO) << "shared client created: " << client_id << ", type: " << calltype;
+    return shared;
+}
+
+FibpClientFuturePtr FibpSharedClientMgr::send_request(
+    boost::asio::io_service& io,
+    const std::string& path,
+    const std::string& ip, const std::string& port,
+    ServiceType calltype, const std::string& reqdata, int to_ms)
+{
+    if (calltype != RPC_Service && calltype != Raw_Service)
+    {
+        LOG(ERROR) << "No supported service type." << calltype;
+        return FibpClientFuturePtr();
+    }
+    FibpClientFuturePtr future(new FibpClientFuture(io, 0, to_ms));
+    SharedClientPtr shared = get_shared_client(calltype, ip, port);
+    FibpSharedRequest* req = new FibpSharedRequest();
+    req->path = path;
+    req->reqdata = reqdata;
+    req->timeout_ms = to_ms;
+    req->future = future;
+    req->caller_io = &io;
+    shared->queue.push(req);
+    // the owner drains all the requests queued so far, only wake it up once.
+    if (!shared->is_draining.exchange(true))
+    {
+        shared->owner_io.post(boost::bind(&FibpSharedClientMgr::drain, this, shared));
+    }
+    return future;
+}
+
+void FibpSharedClientMgr::drain(SharedClientPtr shared)
+{
+    // the request pushed after this is either popped below or wakes us again.
+    shared->is_draining.store(false);
+    while(FibpSharedRequest* req = shared->queue.pop())
+    {
+        boost::fibers::fiber f(boost::bind(&FibpSharedClientMgr::handle_request, this, shared, req));
+        f.detach();
+    }
+}
+
+void FibpSharedClientMgr::handle_request(SharedClientPtr shared, FibpSharedRequest* req)
+{
+    std::string rsp;
+    bool is_success = false;
+    bool can_retry = true;
+    if (shared->is_removed)
+    {
+        rsp = SERVER_REMOVED_ERR;
+    }
+    else
+    {
+        FibpClientFuturePtr f = shared->client->send_request(req->path, req->reqdata, req->timeout_ms);
+        if (!f)
+            rsp = SEND_FAILED_ERR;
+        else
+            is_success = f->getRsp(rsp, can_retry);
+    }
+    req->caller_io->post(boost::bind(&FibpSharedClientMgr::set_result, req->future,
+            rsp, is_success, can_retry));
+    delete req;
+}
+
+void FibpSharedClientMgr::set_result(FibpClientFuturePtr f, std::string& rsp, bool is_success,
+    bool can_retry)
+{
+    // ignored if the caller timed out.
+    if (!f->is_done())
+        f->set_result(rsp, is_success, can_retry);
+}
+
+void FibpSharedClientMgr::close_client(SharedClientPtr shared, ServiceType calltype,
+    const std::string& client_id)
+{
+    if (!shared->is_removed)
+        return;
+    shared->client->close(SERVER_REMOVED_ERR);
+    boost::fibers::fiber f(boost::bind(&FibpSharedClientMgr::erase_closed_client, this,
+            shared, calltype, client_id));
+    f.detach();
+}
+
+void FibpSharedClientMgr::erase_closed_client(SharedClientPtr shared, ServiceType calltype,
+    std::string client_id)
+{
+    while(!shared->client->is_closed())
+    {
+        FibpTimerWheel::get(shared->owner_io).sleep_for(CLOSE_CHECK_MS);
+    }
+    folly::RWSpinLock::WriteHolder guard(lock_);
+    // the host came back meanwhile, the client connects again when used.
+    if (!shared->is_removed)
+        return;
+    SharedClientMapT& client_map = client_list_[calltype];
+    SharedClientMapT::iterator it = client_map.find(client_id);
+    if (it != client_map.end() && it->second == shared)
+    {
+        client_map.erase(it);
+        LOG(INFO) << "shared client erased: " << client_id << ", type: " << calltype;
+    }
+}
+
+void FibpSharedClientMgr::on_membership_change(const FibpMembershipChange& change)
+{
+    if (change.type != RPC_Service && change.type != Raw_Service)
+        return;
+    folly::RWSpinLock::ReadHolder guard(lock_);
+    const SharedClientMapT& client_map = client_list_[change.type];
+    if (client_map.empty())
+        return;
+    for(std::size_t i = 0; i < change.added_hosts.size(); ++i)
+    {
+        SharedClientMapT::const_iterator it = client_map.find(
+            getClientId(change.added_hosts[i].first, change.added_hosts[i].second));
+        if (it != client_map.end())
+            it->second->is_removed = false;
+    }
+    for(std::size_t i = 0; i < change.removed_hosts.size(); ++i)
+    {
+        std::string client_id = getClientId(change.removed_hosts[i].first,
+            change.removed_hosts[i].second);
+        SharedClientMapT::const_iterator it = client_map.find(client_id);
+        if (it == client_map.end())
+            continue;
+        it->second->is_removed = true;
+        it->second->owner_io.post(boost::bind(&FibpSharedClientMgr::close_client, this, it->second,
+                change.type, client_id));
+    }
+}
+
+}
@@ -0,0 +1,110 @@
+#ifndef FIBP_SHARED_CLIENT_H
+#define FIBP_SHARED_CLIENT_H
+
+#include "FibpClient.h"
+#include "FibpMembership.h"
+#include <util/singleton.h>
+#include <boost/asio.hpp>
+#include <boost/atomic.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <3rdparty/folly/RWSpinLock.h>
+#include <string>
+#include <vector>
+#include <map>
+
+namespace fibp
+{
+
+struct FibpSharedRequest
+{
+    FibpSharedRequest()
+        : next(NULL), timeout_ms(0), caller_io(NULL)
+    {
+    }
+    boost::atomic<FibpSharedRequest*> next;
+    std::string path;
+    std::string reqdata;
+    int timeout_ms;
+    // waited by the caller in its own thread.
+    FibpClientFuturePtr future;
+    boost::asio::io_service* caller_io;
+};
+
+// the intrusive queue of multiple producers and single consumer (Dmitry Vyukov),
+// the fibers in any thread push without lock and only the owner thread pops.
+class FibpSharedRequestQueue
+{
+public:
+    FibpSharedRequestQueue();
+    void push(FibpSharedRequest* req);
+    // return NULL if empty or the request being pushed is not linked yet.
+    FibpSharedRequest* pop();
+
+private:
+    boost::atomic<FibpSharedRequest*> head_;
+    FibpSharedRequest* tail_;
+    FibpSharedRequest stub_;
+};
+
+// the rpc/raw client of a host owned by one io thread and shared by the fibers
+// in all the worker threads, so the number of the connections is the number of
+// the hosts instead of hosts x threads. The requests are handed over by the
+// lock free queue and the results are posted back to the thread of the caller.
+class FibpSharedClientMgr : public FibpMembershipListener
+{
+public:
+    static FibpSharedClientMgr* get()
+    {
+        return izenelib::util::Singleton<FibpSharedClientMgr>::get();
+    }
+    // the number of the io threads owning the shared clients, should be set
+    // before the first use.
+    static void set_thread_num(std::size_t thread_num);
+    FibpSharedClientMgr();
+    ~FibpSharedClientMgr();
+    // never return empty, the failure of sending is set as the result.
+    FibpClientFuturePtr send_request(
+        boost::asio::io_service& io,
+        const std::string& path,
+        const std::string& ip, const std::string& port,
+        ServiceType calltype, const std::string& reqdata, int to_ms);
+    void on_membership_change(const FibpMembershipChange& change);
+
+private:
+    struct SharedClient
+    {
+        SharedClient(boost::asio::io_service& io)
+            : owner_io(io), is_draining(false), is_removed(false)
+        {
+        }
+        boost::asio::io_service& owner_io;
+        // only used in the owner thread.
+        FibpClientBasePtr client;
+        FibpSharedRequestQueue queue;
+        boost::atomic<bool> is_draining;
+        boost::atomic<bool> is_removed;
+    };
+    typedef boost::shared_ptr<SharedClient> SharedClientPtr;
+    typedef std::map<std::string, SharedClientPtr> SharedClientMapT;
+
+    SharedClientPtr get_shared_client(ServiceType calltype, const std::string& ip,
+        const std::string& port);
+    void drain(SharedClientPtr shared);
+    void handle_request(SharedClientPtr shared, FibpSharedRequest* req);
+    void close_client(SharedClientPtr shared, ServiceType calltype, const std::string& client_id);
+    // the removed one is erased once its reading fiber quit, and created again
+    // if the host comes back.
+    void erase_closed_client(SharedClientPtr shared, ServiceType calltype, std::string client_id);
+    static void run_service(boost::asio::io_service& io_service);
+    static void set_result(FibpClientFuturePtr f, std::string& rsp, bool is_success, bool can_retry);
+
+    folly::RWSpinLock lock_;
+    std::vector<SharedClientMapT> client_list_;
+    std::vector<boost::shared_ptr<boost::asio::io_service> > io_list_;
+    boost::thread_group threads_;
+};
+
+}
+
+#endif
@@ -0,0 +1,73 @@
+#include "FibpSingleFlight.h"
+#include <boost/chrono/system_clocks.hpp>
+
+namespace fibp
+{
+
+static inline uint64_t now_us()
+{
+    return boost::chrono::duration_cast<boost::chrono::microseconds>(
+        boost::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+FibpSingleFlight::FibpSingleFlight()
+{
+    inflight_calls_.rehash(1000);
+}
+
+bool FibpSingleFlight::join(const ServiceCallReq& req, InflightCallPtr& call)
+{
+    InflightCallPtr& inflight = inflight_calls_[req];
+    if (inflight)
+    {
+        call = inflight;
+        return false;
+    }
+    inflight.reset(new InflightCall());
+    inflight->deadline_us = req.deadline_us;
+    call = inflight;
+    return true;
+}
+
+void FibpSingleFlight::finish(const ServiceCallReq& req, InflightCallPtr call, const ServiceCallRsp& rsp)
+{
+    inflight_calls_.erase(req);
+    boost::unique_lock<boost::fibers::mutex> guard(call->mutex);
+    call->rsp = rsp;
+    call->done = true;
+    call->cond.notify_all();
+}
+
+bool FibpSingleFlight::wait(InflightCallPtr call, uint64_t deadline_us, ServiceCallRsp& rsp)
+{
+    boost::unique_lock<boost::fibers::mutex> guard(call->mutex);
+    while(!call->done)
+    {
+        if (deadline_us == 0)
+        {
+            call->cond.wait(guard);
+            continue;
+        }
+        uint64_t now = now_us();
+        if (now >= deadline_us)
+            return false;
+        call->cond.wait_for(guard, boost::chrono::microseconds(deadline_us - now));
+    }
+    rsp = call->rsp;
+    return true;
+}
+
+bool FibpSingleFlight::should_call_again(InflightCallPtr call, const ServiceCallRsp& rsp,
+    uint64_t deadline_us)
+{
+    static const std::string deadline_err("Deadline Exceeded.");
+    static const std::string timeout_err("Server Timed Out.");
+    if (rsp.error.empty() || call->deadline_us == 0)
+        return false;
+    if (deadline_us != 0 && (deadline_us <= call->deadline_us || now_us() >= deadline_us))
+        return false;
+    return rsp.error.find(deadline_err) != std::string::npos ||
+        rsp.error.find(timeout_err) != std::string::npos;
+}
+
+}
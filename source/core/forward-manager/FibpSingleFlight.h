@@ -0,0 +1,69 @@
+#ifndef FIBP_SINGLE_FLIGHT_H
+#define FIBP_SINGLE_FLIGHT_H
+
+#include <common/FibpCommonTypes.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/fiber/all.hpp>
+#include <stdint.h>
+
+namespace fibp
+{
+
+struct ServiceCallReqHash
+{
+    std::size_t operator()(const ServiceCallReq& req) const
+    {
+        std::size_t seed = 0;
+        boost::hash_combine(seed, req.service_name);
+        boost::hash_combine(seed, req.service_api);
+        boost::hash_combine(seed, req.service_req_data);
+        boost::hash_combine(seed, req.service_cluster);
+        boost::hash_combine(seed, req.service_type);
+        boost::hash_combine(seed, req.method);
+        return seed;
+    }
+};
+
+// the identical calls running at the same time share the response of the first
+// one (the leader). Each worker thread has its own table and it is only used by
+// the fibers in that thread, so no lock is needed.
+class FibpSingleFlight
+{
+public:
+    struct InflightCall
+    {
+        InflightCall()
+            : done(false), deadline_us(0)
+        {
+        }
+        bool done;
+        // of the leader.
+        uint64_t deadline_us;
+        ServiceCallRsp rsp;
+        boost::fibers::mutex mutex;
+        boost::fibers::condition_variable cond;
+    };
+    typedef boost::shared_ptr<InflightCall> InflightCallPtr;
+
+    FibpSingleFlight();
+    // return true if the caller becomes the leader and should call the service and
+    // finish() the call, otherwise wait() for the leader.
+    bool join(const ServiceCallReq& req, InflightCallPtr& call);
+    void finish(const ServiceCallReq& req, InflightCallPtr call, const ServiceCallRsp& rsp);
+    // return false if the leader did not finish before the deadline (0 for no deadline).
+    static bool wait(InflightCallPtr call, uint64_t deadline_us, ServiceCallRsp& rsp);
+    // true if the leader ran out of its time (the deadline or the timeout) while
+    // the follower with a later deadline still has time to call by itself.
+    static bool should_call_again(InflightCallPtr call, const ServiceCallRsp& rsp,
+        uint64_t deadline_us);
+
+private:
+    typedef boost::unordered_map<ServiceCallReq, InflightCallPtr, ServiceCallReqHash> InflightMapT;
+    InflightMapT inflight_calls_;
+};
+
+}
+
+#endif
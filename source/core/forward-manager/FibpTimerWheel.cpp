@@ -0,0 +1,269 @@
+#include "FibpTimerWheel.h"
+#include <boost/fiber/all.hpp>
+#include <boost/bind.hpp>
+#include <boost/chrono/system_clocks.hpp>
+
+namespace fibp
+{
+
+boost::asio::io_service::id FibpTimerWheel::id;
+
+static inline uint64_t now_us()
+{
+    return boost::chrono::duration_cast<boost::chrono::microseconds>(
+        boost::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static inline void init_slot(FibpTimerLink& slot)
+{
+    slot.prev = &slot;
+    slot.next = &slot;
+}
+
+static inline void link_tail(FibpTimerLink& slot, FibpTimerLink* node)
+{
+    node->prev = slot.prev;
+    node->next = &slot;
+    slot.prev->next = node;
+    slot.prev = node;
+}
+
+static inline void unlink(FibpTimerLink* node)
+{
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->prev = NULL;
+    node->next = NULL;
+}
+
+// move all in the slot to the empty list.
+static inline void splice(FibpTimerLink& slot, FibpTimerLink& list)
+{
+    if (slot.next == &slot)
+        return;
+    list.next = slot.next;
+    list.prev = slot.prev;
+    list.next->prev = &list;
+    list.prev->next = &list;
+    init_slot(slot);
+}
+
+FibpTimer::FibpTimer()
+    : wheel_(NULL), expire_ms_(0), callback_(NULL), arg_(NULL)
+{
+}
+
+FibpTimer::~FibpTimer()
+{
+    cancel();
+}
+
+void FibpTimer::cancel()
+{
+    if (!next)
+        return;
+    unlink(this);
+    --wheel_->timer_num_;
+}
+
+FibpTimerWheel::FibpTimerWheel(boost::asio::io_service& io)
+    : boost::asio::io_service::service(io), start_us_(now_us()), cur_ms_(0), timer_num_(0),
+    driver_(io), is_waiting_(false), wake_ms_(0)
+{
+    for(int i = 0; i < NEAR_SIZE; ++i)
+        init_slot(near_[i]);
+    for(int level = 0; level < FAR_LEVEL; ++level)
+    {
+        for(int i = 0; i < FAR_SIZE; ++i)
+            init_slot(far_[level][i]);
+    }
+}
+
+FibpTimerWheel::~FibpTimerWheel()
+{
+}
+
+void FibpTimerWheel::shutdown_service()
+{
+    // the timers may be destroyed after the io_service, unlink them so
+    // cancelling is no-op.
+    FibpTimerLink list;
+    for(int i = 0; i < NEAR_SIZE; ++i)
+    {
+        init_slot(list);
+        splice(near_[i], list);
+        while(list.next != &list)
+            unlink(list.next);
+    }
+    for(int level = 0; level < FAR_LEVEL; ++level)
+    {
+        for(int i = 0; i < FAR_SIZE; ++i)
+        {
+            init_slot(list);
+            splice(far_[level][i], list);
+            while(list.next != &list)
+                unlink(list.next);
+        }
+    }
+    timer_num_ = 0;
+    boost::system::error_code ec;
+    driver_.cancel(ec);
+}
+
+uint64_t FibpTimerWheel::now_ms() const
+{
+    return (now_us() - start_us_) / 1000;
+}
+
+void FibpTimerWheel::arm(FibpTimer& timer, uint32_t ms, FibpTimer::CallbackT callback, void* arg)
+{
+    timer.cancel();
+    uint64_t now = now_ms();
+    // the wheel is not advanced while empty.
+    if (timer_num_ == 0 && cur_ms_ < now)
+        cur_ms_ = now;
+    timer.wheel_ = this;
+    timer.expire_ms_ = now + ms;
+    timer.callback_ = callback;
+    timer.arg_ = arg;
+    add(&timer);
+    ++timer_num_;
+    schedule(timer.expire_ms_ < cur_ms_ ? cur_ms_ : timer.expire_ms_);
+}
+
+void FibpTimerWheel::add(FibpTimer* timer)
+{
+    uint64_t expire = timer->expire_ms_ < cur_ms_ ? cur_ms_ : timer->expire_ms_;
+    uint64_t delta = expire - cur_ms_;
+    if (delta < (uint64_t)NEAR_SIZE)
+    {
+        link_tail(near_[expire & (NEAR_SIZE - 1)], timer);
+        return;
+    }
+    int level = 0;
+    int shift = NEAR_BITS;
+    while(level < FAR_LEVEL - 1 && delta >= (1ULL << (shift + FAR_BITS)))
+    {
+        ++level;
+        shift += FAR_BITS;
+    }
+    // put the timer too far at the end, it is added again when cascaded.
+    if (delta >= (1ULL << (shift + FAR_BITS)))
+        expire = cur_ms_ + (1ULL << (shift + FAR_BITS)) - 1;
+    link_tail(far_[level][(expire >> shift) & (FAR_SIZE - 1)], timer);
+}
+
+void FibpTimerWheel::cascade(FibpTimerLink& slot)
+{
+    FibpTimerLink list;
+    init_slot(list);
+    splice(slot, list);
+    while(list.next != &list)
+    {
+        FibpTimerLink* node = list.next;
+        unlink(node);
+        add(static_cast<FibpTimer*>(node));
+    }
+}
+
+void FibpTimerWheel::advance(uint64_t now)
+{
+    FibpTimerLink list;
+    while(cur_ms_ <= now && timer_num_ > 0)
+    {
+        int index = cur_ms_ & (NEAR_SIZE - 1);
+        if (index == 0)
+        {
+            int shift = NEAR_BITS;
+            for(int level = 0; level < FAR_LEVEL; ++level)
+            {
+                int far_index = (cur_ms_ >> shift) & (FAR_SIZE - 1);
+                cascade(far_[level][far_index]);
+                if (far_index != 0)
+                    break;
+                shift += FAR_BITS;
+            }
+        }
+        init_slot(list);
+        splice(near_[index], list);
+        // the timers armed by the callbacks are put into the next tick at least.
+        ++cur_ms_;
+        while(list.next != &list)
+        {
+            FibpTimer* timer = static_cast<FibpTimer*>(list.next);
+            unlink(timer);
+            --timer_num_;
+            timer->callback_(timer->arg_);
+        }
+    }
+    if (timer_num_ == 0 && cur_ms_ <= now)
+    {
+        // nothing to process, jump over the idle ticks.
+        cur_ms_ = now + 1;
+    }
+}
+
+uint64_t FibpTimerWheel::next_wakeup() const
+{
+    // the first tick of the near slots in use, or the next round to cascade.
+    uint64_t tick = cur_ms_;
+    while((tick & (NEAR_SIZE - 1)) != 0)
+    {
+        const FibpTimerLink& slot = near_[tick & (NEAR_SIZE - 1)];
+        if (slot.next != &slot)
+            return tick;
+        ++tick;
+    }
+    return tick;
+}
+
+void FibpTimerWheel::schedule(uint64_t wake_ms)
+{
+    if (is_waiting_ && wake_ms >= wake_ms_)
+        return;
+    is_waiting_ = true;
+    wake_ms_ = wake_ms;
+    uint64_t now = now_ms();
+    driver_.expires_from_now(boost::posix_time::milliseconds(wake_ms > now ? wake_ms - now : 0));
+    driver_.async_wait(boost::bind(&FibpTimerWheel::on_tick, this, _1));
+}
+
+void FibpTimerWheel::on_tick(const boost::system::error_code& ec)
+{
+    // reset by an earlier timer.
+    if (ec == boost::asio::error::operation_aborted)
+        return;
+    is_waiting_ = false;
+    advance(now_ms());
+    if (timer_num_ > 0)
+        schedule(next_wakeup());
+}
+
+struct WheelSleeper
+{
+    WheelSleeper()
+        : is_waked(false)
+    {
+    }
+    static void wake(void* arg)
+    {
+        WheelSleeper* sleeper = (WheelSleeper*)arg;
+        sleeper->is_waked = true;
+        sleeper->cond.notify_one();
+    }
+    bool is_waked;
+    boost::fibers::mutex mutex;
+    boost::fibers::condition_variable cond;
+};
+
+void FibpTimerWheel::sleep_for(uint32_t ms)
+{
+    WheelSleeper sleeper;
+    FibpTimer timer;
+    arm(timer, ms, &WheelSleeper::wake, &sleeper);
+    boost::unique_lock<boost::fibers::mutex> guard(sleeper.mutex);
+    while(!sleeper.is_waked)
+        sleeper.cond.wait(guard);
+}
+
+}
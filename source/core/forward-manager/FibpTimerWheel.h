@@ -0,0 +1,101 @@
+#ifndef FIBP_TIMER_WHEEL_H
+#define FIBP_TIMER_WHEEL_H
+
+#include <boost/asio.hpp>
+#include <boost/asio/deadline_timer.hpp>
+#include <stdint.h>
+
+namespace fibp
+{
+
+class FibpTimerWheel;
+
+struct FibpTimerLink
+{
+    FibpTimerLink()
+        : prev(NULL), next(NULL)
+    {
+    }
+    FibpTimerLink* prev;
+    FibpTimerLink* next;
+};
+
+// the timeout armed on the wheel of an io_service, it is linked into the slot of
+// the wheel so arming and cancelling never allocate. Only used in the thread
+// running the io_service.
+class FibpTimer : private FibpTimerLink
+{
+public:
+    typedef void (*CallbackT)(void* arg);
+    FibpTimer();
+    ~FibpTimer();
+    bool is_armed() const
+    {
+        return next != NULL;
+    }
+    // the callback will not be called once cancelled.
+    void cancel();
+
+private:
+    friend class FibpTimerWheel;
+    FibpTimerWheel* wheel_;
+    uint64_t expire_ms_;
+    CallbackT callback_;
+    void* arg_;
+};
+
+// the hierarchical timing wheel (256 slots of 1ms, then 4 levels of 64 slots)
+// for all the timeouts of the proxy in an io thread, instead of a timer of asio
+// for each. Only one asio timer is waited to drive the wheel, and it is only
+// reset if a timer is armed earlier than it.
+class FibpTimerWheel : public boost::asio::io_service::service
+{
+public:
+    static boost::asio::io_service::id id;
+    static FibpTimerWheel& get(boost::asio::io_service& io)
+    {
+        return boost::asio::use_service<FibpTimerWheel>(io);
+    }
+    explicit FibpTimerWheel(boost::asio::io_service& io);
+    ~FibpTimerWheel();
+    // re-armed if armed already, the callback is called in the io thread about
+    // ms later (the resolution is 1ms).
+    void arm(FibpTimer& timer, uint32_t ms, FibpTimer::CallbackT callback, void* arg);
+    // should be called in a fiber of the io thread.
+    void sleep_for(uint32_t ms);
+    std::size_t size() const
+    {
+        return timer_num_;
+    }
+
+private:
+    friend class FibpTimer;
+    static const int NEAR_BITS = 8;
+    static const int NEAR_SIZE = 1 << NEAR_BITS;
+    static const int FAR_BITS = 6;
+    static const int FAR_SIZE = 1 << FAR_BITS;
+    static const int FAR_LEVEL = 4;
+
+    void shutdown_service();
+    uint64_t now_ms() const;
+    void add(FibpTimer* timer);
+    void cascade(FibpTimerLink& slot);
+    void advance(uint64_t now);
+    uint64_t next_wakeup() const;
+    void schedule(uint64_t wake_ms);
+    void on_tick(const boost::system::error_code& ec);
+
+    uint64_t start_us_;
+    // the next tick not processed.
+    uint64_t cur_ms_;
+    std::size_t timer_num_;
+    FibpTimerLink near_[NEAR_SIZE];
+    FibpTimerLink far_[FAR_LEVEL][FAR_SIZE];
+    boost::asio::deadline_timer driver_;
+    bool is_waiting_;
+    uint64_t wake_ms_;
+};
+
+}
+
+#endif
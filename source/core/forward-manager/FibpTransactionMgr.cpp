@@ -34,26 +34,29 @@ std::string FibpTransactionMgr::get_transaction_id(const std::string& service_rp
     return tran_id;
 }
 
-bool FibpTransactionMgr::confirm(FibpClientMgr* client_mgr, const std::string& host, const std::string& port,
+bool FibpTransactionMgr::confirm(boost::asio::io_service& io, FibpClientMgr* client_mgr,
+    const std::string& host, const std::string& port,
     const std::string& api, const std::string& tran_id)
 {
-    return send_transaction_api(client_mgr, host, port, api, tran_id, "/confirm");
+    return send_transaction_api(io, client_mgr, host, port, api, tran_id, "/confirm");
 }
 
-bool FibpTransactionMgr::cancel(FibpClientMgr* client_mgr, const std::string& host, const std::string& port,
+bool FibpTransactionMgr::cancel(boost::asio::io_service& io, FibpClientMgr* client_mgr,
+    const std::string& host, const std::string& port,
     const std::string& api, const std::string& tran_id)
 {
-    return send_transaction_api(client_mgr, host, port, api, tran_id, "/cancel");
+    return send_transaction_api(io, client_mgr, host, port, api, tran_id, "/cancel");
 }
 
-bool FibpTransactionMgr::send_transaction_api(FibpClientMgr* client_mgr, const std::string& host, const std::string& port,
+bool FibpTransactionMgr::send_transaction_api(boost::asio::io_service& io, FibpClientMgr* client_mgr,
+    const std::string& host, const std::string& port,
     const std::string& api, const std::string& tran_id, const std::string& tran_action)
 {
     std::string postdata;
     std::string tran_key("\"transaction_id\"");
     postdata = "{" + tran_key + ":" + "\"" + tran_id + "\"" + "}";
     uint32_t timeout = 1000*10;
-    FibpHttpClientPtr client = client_mgr->send_request(api + tran_action, http::POST, host, port,
+    FibpHttpClientPtr client = client_mgr->send_request(io, api + tran_action, http::POST, host, port,
         postdata, timeout);
     if (!client)
     {
@@ -1,6 +1,7 @@
 #ifndef FIBP_TRANSACTION_MGR_H
 #define FIBP_TRANSACTION_MGR_H
 
+#include <boost/asio.hpp>
 #include <string>
 namespace fibp
 {
@@ -13,13 +14,17 @@ public:
     ~FibpTransactionMgr(){}
 
     std::string get_transaction_id(const std::string& service_rps);
-    bool confirm(FibpClientMgr* client_mgr, const std::string& host, const std::string& port,
+    // io is of the thread calling, which the client manager belongs to.
+    bool confirm(boost::asio::io_service& io, FibpClientMgr* client_mgr,
+        const std::string& host, const std::string& port,
         const std::string& api, const std::string& tran_id);
-    bool cancel(FibpClientMgr* client_mgr, const std::string& host, const std::string& port,
+    bool cancel(boost::asio::io_service& io, FibpClientMgr* client_mgr,
+        const std::string& host, const std::string& port,
         const std::string& api, const std::string& tran_id);
 
 private:
-    bool send_transaction_api(FibpClientMgr* client_mgr, const std::string& host, const std::string& port,
+    bool send_transaction_api(boost::asio::io_service& io, FibpClientMgr* client_mgr,
+        const std::string& host, const std::string& port,
         const std::string& api, const std::string& tran_id, const std::string& tran_action);
 
 };
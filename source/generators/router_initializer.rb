@@ -33,6 +33,7 @@ cpp += <<HEADER
 
 #include "RouterInitializer.h"
 #include <util/driver/ActionHandler.h>
+#include <fiber-server/FibpRoutePriority.h>
 
 #include <memory> // for std::auto_ptr
 
@@ -96,6 +97,13 @@ CONTROLLERSTART
         );
         #{action}Handler.release();
 ACTION
+      priority = (spec["priorities"] || {})[action]
+      if priority
+        cpp += <<PRIORITY
+        FibpRoutePriority::get()->set_priority(controllerName, #{action.inspect},
+            Priority_#{priority.capitalize});
+PRIORITY
+      end
     end
 
     cpp += <<CONTROLLEREND
@@ -112,7 +112,7 @@ bool FibpProcess::initConnectionServer(const ProcessOptions& po)
     std::string report_port = report_addr.substr(port_pos + 1);
     FibpForwardManager::get()->init(dns_servers,
         FibpConfig::get()->distributedCommonConfig_.localHost_,
-        port, report_ip, report_port, threadPoolSize);
+        port, report_ip, report_port, threadPoolSize, po.getServiceSnapshot(), po.getZone());
 
     rpcServer_.reset(new FibpRpcServer(
             port + 2, threadPoolSize));
@@ -71,6 +71,8 @@ ProcessOptions::ProcessOptions()
     po::options_description pidFile;
     po::options_description reportAddr;
     po::options_description registryAddr;
+    po::options_description serviceSnapshot;
+    po::options_description zone;
 
     logPrefix.add_options()
     ("log-prefix,l", po::value<String>(),
@@ -106,7 +108,13 @@ ProcessOptions::ProcessOptions()
     registryAddr.add_options()
         ("registryAddr,D", po::value<String>(), "the service registry server list (ip:port,ip:port).");
 
-    processDescription_.add(base).add(verbose).add(logPrefix).add(configDir).add(pidFile).add(reportAddr).add(registryAddr);
+    serviceSnapshot.add_options()
+        ("serviceSnapshot,S", po::value<String>(), "the file to keep the last known services, empty to disable.");
+
+    zone.add_options()
+        ("zone,Z", po::value<String>(), "the zone (rack) of this proxy, the services in the same zone are preferred.");
+
+    processDescription_.add(base).add(verbose).add(logPrefix).add(configDir).add(pidFile).add(reportAddr).add(registryAddr).add(serviceSnapshot).add(zone);
 }
 
 
@@ -152,6 +160,19 @@ void ProcessOptions::setProcessOptions()
     {
         registryAddr_ = "127.0.0.1:8500";
     }
+    if (variableMap_.count("serviceSnapshot"))
+    {
+        serviceSnapshot_ = variableMap_["serviceSnapshot"].as<String>().str;
+    }
+    else
+    {
+        serviceSnapshot_ = "./fibp-service.snapshot";
+    }
+    zone_.clear();
+    if (variableMap_.count("zone"))
+    {
+        zone_ = variableMap_["zone"].as<String>().str;
+    }
 
 }
 
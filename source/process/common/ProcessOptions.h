@@ -96,6 +96,16 @@ public:
         return registryAddr_;
     }
 
+    inline const std::string& getServiceSnapshot() const
+    {
+        return serviceSnapshot_;
+    }
+
+    inline const std::string& getZone() const
+    {
+        return zone_;
+    }
+
 private:
 
     //Process all the options possible for the processes in 
@@ -125,6 +135,8 @@ private:
     std::string pidFile_;
     std::string reportAddr_;
     std::string registryAddr_;
+    std::string serviceSnapshot_;
+    std::string zone_;
 };
 
 #endif  //PROCESS_OPTIONS_H
@@ -10,6 +10,7 @@
 
 #include "RouterInitializer.h"
 #include <util/driver/ActionHandler.h>
+#include <fiber-server/FibpRoutePriority.h>
 
 #include <memory> // for std::auto_ptr
 
@@ -71,6 +72,8 @@ void initializeDriverRouter(::izenelib::driver::Router& router, bool enableTest)
             check_aliveHandler.get()
         );
         check_aliveHandler.release();
+        FibpRoutePriority::get()->set_priority(controllerName, "check_alive",
+            Priority_High);
     }
 
     {
@@ -79,6 +82,23 @@ void initializeDriverRouter(::izenelib::driver::Router& router, bool enableTest)
         typedef ::izenelib::driver::ActionHandler<APIController> handler_type;
         typedef std::auto_ptr<handler_type> handler_ptr;
 
+        handler_ptr get_statsHandler(
+            new handler_type(
+                api,
+                &APIController::get_stats,
+                false
+            )
+        );
+
+        router.map(
+            controllerName,
+            "get_stats",
+            get_statsHandler.get()
+        );
+        get_statsHandler.release();
+        FibpRoutePriority::get()->set_priority(controllerName, "get_stats",
+            Priority_High);
+
         handler_ptr list_port_forward_servicesHandler(
             new handler_type(
                 api,
@@ -93,6 +113,8 @@ void initializeDriverRouter(::izenelib::driver::Router& router, bool enableTest)
             list_port_forward_servicesHandler.get()
         );
         list_port_forward_servicesHandler.release();
+        FibpRoutePriority::get()->set_priority(controllerName, "list_port_forward_services",
+            Priority_High);
     }
 
 }
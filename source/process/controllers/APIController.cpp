@@ -3,6 +3,7 @@
 #include "ResponseRender.h"
 #include <common/Keys.h>
 #include <forward-manager/FibpForwardManager.h>
+#include <fiber-server/FibpAdmissionControl.h>
 #include <log-manager/FibpLogger.h>
 #include <util/driver/Request.h>
 #include <util/driver/readers/JsonReader.h>
@@ -45,4 +46,17 @@ void APIController::list_port_forward_services()
     ResponseRender::generate_port_forward_services_rsp(infos, response()["ForwardServiceList"]);
 }
 
+void APIController::get_stats()
+{
+    std::map<std::string, uint64_t> stats;
+    forward_mgr_->getForwardStats(stats);
+    FibpAdmissionControl::get()->getStats(stats);
+    Value& ret = response()["Stats"];
+    for(std::map<std::string, uint64_t>::const_iterator it = stats.begin();
+        it != stats.end(); ++it)
+    {
+        ret[it->first] = it->second;
+    }
+}
+
 } // namespace 
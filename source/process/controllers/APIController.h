@@ -15,6 +15,8 @@ class APIController : public izenelib::driver::Controller,
 public:
     APIController();
     void list_port_forward_services();
+    // return the counters of the forwarding.
+    void get_stats();
     void check_alive();
 
     bool preprocess();
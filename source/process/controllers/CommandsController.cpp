@@ -3,7 +3,9 @@
 #include "ResponseRender.h"
 #include <common/Keys.h>
 #include <forward-manager/FibpForwardManager.h>
+#include <common/FibpTaskPriority.h>
 #include <log-manager/FibpLogger.h>
+#include <fiber-server/HttpProtocolHandler.h>
 #include <util/driver/Request.h>
 #include <util/driver/readers/JsonReader.h>
 
@@ -18,6 +20,9 @@ CommandsController::CommandsController()
 
 bool CommandsController::preprocess()
 {
+    // the timeout and the priority from the http header are set before the body is parsed.
+    int timeout_ms = asInt(request().header()[driver::Keys::timeout_ms]);
+    std::string priority = asString(request().header()[driver::Keys::priority]);
     izenelib::driver::Value requestV;
     JsonReader reader;
     if (reader.read(raw_req(), requestV))
@@ -25,11 +30,25 @@ bool CommandsController::preprocess()
         if (requestV.type() == izenelib::driver::Value::kObjectType)
             request().assignTmp(requestV);
     }
+    if (timeout_ms > 0 && asInt(request().header()[driver::Keys::timeout_ms]) <= 0)
+    {
+        request().header()[driver::Keys::timeout_ms] = timeout_ms;
+    }
+    if (!priority.empty() && asString(request().header()[driver::Keys::priority]).empty())
+    {
+        request().header()[driver::Keys::priority] = priority;
+    }
 
     forward_mgr_ = FibpForwardManager::get();
     return forward_mgr_ != NULL;
 }
 
+int CommandsController::get_priority()
+{
+    return parse_task_priority(asString(request().header()[driver::Keys::priority]),
+        Priority_Normal);
+}
+
 void CommandsController::call_single_service_async()
 {
     uint64_t id = FibpLogger::get()->startServiceCall(__FUNCTION__);
@@ -41,9 +60,16 @@ void CommandsController::call_single_service_async()
         Controller::postprocess();
         return;
     }
+    FibpForwardManager::set_deadline(call_api_list_,
+        asInt(request().header()[driver::Keys::timeout_ms]));
+    // the response may be relayed to the client before the call finished.
+    call_api_list_[0].rsp_stream = http::response_stream_t::current();
+    ServicesCallOption option;
+    option.priority = get_priority();
     forward_mgr_->call_services_in_fiber(poller().get_io_service(), id,
         call_api_list_, rsp_list_,
-        boost::bind(&CommandsController::after_call_single_service, shared_from_this(), id));
+        boost::bind(&CommandsController::after_call_single_service, shared_from_this(), id),
+        false, option);
 }
 
 void CommandsController::call_services_async()
@@ -57,6 +83,13 @@ void CommandsController::call_services_async()
         Controller::postprocess();
         return;
     }
+    FibpForwardManager::set_deadline(call_api_list_,
+        asInt(request().header()[driver::Keys::timeout_ms]));
+    ServicesCallOption option;
+    option.wait_success_num = asInt(request()[driver::Keys::wait_success_num]);
+    option.timeout_ms = asInt(request()[driver::Keys::fanout_timeout_ms]);
+    option.max_parallel = asInt(request()[driver::Keys::max_parallel]);
+    option.priority = get_priority();
 
     //call_api_list_.resize(2);
     //for(std::size_t i = 0; i < call_api_list_.size(); ++i)
@@ -71,7 +104,7 @@ void CommandsController::call_services_async()
     forward_mgr_->call_services_in_fiber(poller().get_io_service(), id,
         call_api_list_, rsp_list_,
         boost::bind(&CommandsController::after_call_services, shared_from_this(), id),
-        do_transaction);
+        do_transaction, option);
 }
 
 void CommandsController::after_call_single_service(uint64_t id)
@@ -29,6 +29,8 @@ public:
 private:
     void after_call_services(uint64_t id);
     void after_call_single_service(uint64_t id);
+    // the priority of the route or the request.
+    int get_priority();
     FibpForwardManager* forward_mgr_;
     ServicesRsp rsp_list_;
     std::vector<ServiceCallReq> call_api_list_;
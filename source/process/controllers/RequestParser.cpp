@@ -113,6 +113,17 @@ bool RequestParser::parse_api_request(std::vector<ServiceCallReq> &req_api_list)
                 req_api_list[i].service_req_data.assign(buf.data(), buf.size()); 
             }
             req_api_list[i].enable_cache = asBool(api_data[driver::Keys::enable_cache]);
+            req_api_list[i].hedge_percentile = asInt(api_data[driver::Keys::hedge_percentile]);
+            req_api_list[i].timeout_ms = asInt(api_data[driver::Keys::timeout_ms]);
+            req_api_list[i].enable_coalesce = asBool(api_data[driver::Keys::enable_coalesce]);
+            const Value& depends_on = api_data[driver::Keys::depends_on];
+            if (depends_on.type() == Value::kArrayType)
+            {
+                for(std::size_t j = 0; j < depends_on.size(); ++j)
+                {
+                    req_api_list[i].depends_on.push_back(asInt(depends_on(j)));
+                }
+            }
         }
     }
     catch(const std::exception& e)
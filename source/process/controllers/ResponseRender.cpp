@@ -6,7 +6,7 @@
 using namespace izenelib::driver;
 namespace fibp
 {
-ResponseRender::ResponseRender(const ServicesRsp& rsp_list)
+ResponseRender::ResponseRender(ServicesRsp& rsp_list)
     : rsp_data_(rsp_list)
 {
 }
@@ -31,7 +31,7 @@ void ResponseRender::generate_single_rsp(const std::vector<ServiceCallReq>& req_
         ret.addError(rsp_data_[0].error);
         return;
     }
-    raw_rsp = rsp_data_[0].rsp;
+    raw_rsp.swap(rsp_data_[0].rsp);
 }
 
 void ResponseRender::generate_rsp(const std::vector<ServiceCallReq>& req_list, izenelib::driver::Value& ret)
@@ -39,7 +39,7 @@ void ResponseRender::generate_rsp(const std::vector<ServiceCallReq>& req_list, i
     int i = 0;
     std::string rsp;
     std::string error;
-    for(ServicesRsp::const_iterator it = rsp_data_.begin();
+    for(ServicesRsp::iterator it = rsp_data_.begin();
         it != rsp_data_.end(); ++it)
     {
         rsp.clear();
@@ -62,7 +62,7 @@ void ResponseRender::generate_rsp(const std::vector<ServiceCallReq>& req_list, i
         }
         else
         {
-            rsp = it->rsp;
+            rsp.swap(it->rsp);
         }
 
         Value& r = ret();
@@ -11,14 +11,15 @@ namespace fibp
 class ResponseRender
 {
 public:
-    ResponseRender(const ServicesRsp& rsp_list);
+    // the responses are moved out while rendering to avoid copying the payload.
+    ResponseRender(ServicesRsp& rsp_list);
     void generate_single_rsp(const std::vector<ServiceCallReq>& req_list,
         std::string& raw_rsp, izenelib::driver::Response& ret);
     void generate_rsp(const std::vector<ServiceCallReq>& req_list, izenelib::driver::Value& ret);
 
     static void generate_port_forward_services_rsp(const std::vector<ForwardInfoT>& infos, izenelib::driver::Value& ret);
 private:
-    const ServicesRsp& rsp_data_;
+    ServicesRsp& rsp_data_;
 };
 
 }
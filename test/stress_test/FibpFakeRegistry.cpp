@@ -0,0 +1,597 @@
+#include "FibpFakeRegistry.h"
+#include <forward-manager/FibpTimerWheel.h>
+#include <fiber-server/yield.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/bind.hpp>
+#include <glog/logging.h>
+#include <sstream>
+#include <algorithm>
+#include <cstdio>
+
+namespace fibp
+{
+
+static const std::string kv_prefix("/v1/kv/");
+static const std::string health_service_prefix("/v1/health/service/");
+// the max wait of consul.
+static const uint32_t max_wait_ms = 600*1000;
+static const uint32_t default_wait_ms = 300*1000;
+
+static void append_json_string(std::string& out, const std::string& s)
+{
+    out.push_back('"');
+    for(std::size_t i = 0; i < s.size(); ++i)
+    {
+        char c = s[i];
+        if (c == '"' || c == '\\')
+        {
+            out.push_back('\\');
+            out.push_back(c);
+        }
+        else if ((unsigned char)c < 0x20)
+        {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", (unsigned char)c);
+            out.append(buf);
+        }
+        else
+        {
+            out.push_back(c);
+        }
+    }
+    out.push_back('"');
+}
+
+static std::string host_key(const std::string& ip, uint16_t port)
+{
+    return ip + ":" + boost::lexical_cast<std::string>(port);
+}
+
+// "120s", "5m" or "100ms" as consul accepts.
+static uint32_t parse_wait(const std::string& wait)
+{
+    try
+    {
+        if (boost::algorithm::ends_with(wait, "ms"))
+            return boost::lexical_cast<uint32_t>(wait.substr(0, wait.size() - 2));
+        if (boost::algorithm::ends_with(wait, "s"))
+            return boost::lexical_cast<uint32_t>(wait.substr(0, wait.size() - 1))*1000;
+        if (boost::algorithm::ends_with(wait, "m"))
+            return boost::lexical_cast<uint32_t>(wait.substr(0, wait.size() - 1))*60*1000;
+    }
+    catch(const std::exception& e)
+    {
+        LOG(INFO) << "invalid wait: " << wait;
+    }
+    return default_wait_ms;
+}
+
+static void parse_query(const std::string& query, std::map<std::string, std::string>& params)
+{
+    std::vector<std::string> items;
+    boost::split(items, query, boost::is_any_of("&"), boost::token_compress_on);
+    for(std::size_t i = 0; i < items.size(); ++i)
+    {
+        if (items[i].empty())
+            continue;
+        std::size_t pos = items[i].find('=');
+        if (pos == std::string::npos)
+            params[items[i]] = "";
+        else
+            params[items[i].substr(0, pos)] = items[i].substr(pos + 1);
+    }
+}
+
+FakeRegistryConnection::FakeRegistryConnection(boost::asio::io_service& io,
+    FibpFakeRegistry* registry)
+    : socket_(io), registry_(registry)
+{
+    req_parser_.reset(new http::request_parser(socket_, session_));
+}
+
+void FakeRegistryConnection::start()
+{
+    req_parser_->init_handler(
+        boost::bind(&FakeRegistryConnection::request_cb, shared_from_this()),
+        boost::bind(&FakeRegistryConnection::shutdown, shared_from_this()),
+        boost::bind(&FakeRegistryConnection::onReadError, shared_from_this(), _1));
+    req_parser_->do_parse();
+}
+
+// the blocking query is waited in the fiber of the connection, as consul holds
+// the request.
+bool FakeRegistryConnection::request_cb()
+{
+    http::request_t req = session_.req_;
+    http::response_t rsp;
+    registry_->handle(req, rsp);
+    rsp.keep_alive_ = req.keep_alive_;
+    std::ostringstream oss;
+    http::write_head(oss, rsp);
+    std::string head = oss.str();
+    std::vector<boost::asio::const_buffer> bufs;
+    bufs.push_back(boost::asio::const_buffer(head.data(), head.size()));
+    bufs.push_back(boost::asio::const_buffer(rsp.body_.data(), rsp.body_.size()));
+    boost::system::error_code ec;
+    boost::asio::async_write(socket_, bufs, boost::fibers::asio::yield[ec]);
+    if (ec)
+    {
+        shutdown();
+        return false;
+    }
+    if (!req.keep_alive_)
+        shutdown();
+    return req.keep_alive_;
+}
+
+void FakeRegistryConnection::shutdown()
+{
+    boost::system::error_code ignore_error;
+    socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignore_error);
+    socket_.close(ignore_error);
+}
+
+void FakeRegistryConnection::onReadError(const boost::system::error_code& ec)
+{
+    shutdown();
+}
+
+FakeRegistryConnection* FakeRegistryConnectionFactory::create(boost::asio::io_service& s)
+{
+    registry_->set_io_service(s);
+    return new FakeRegistryConnection(s, registry_);
+}
+
+FibpFakeRegistry::FibpFakeRegistry(uint16_t port)
+    : port_(port), io_(NULL), index_(1), catalog_index_(1), health_index_(1), kv_index_(1),
+    request_num_(0), blocked_num_(0)
+{
+}
+
+FibpFakeRegistry::~FibpFakeRegistry()
+{
+    stop();
+}
+
+void FibpFakeRegistry::start()
+{
+    boost::shared_ptr<FakeRegistryConnectionFactory> factory(new FakeRegistryConnectionFactory(this));
+    boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::address::from_string("127.0.0.1"), port_);
+    // one io thread, so the blocking queries are waited by the fibers of it.
+    server_.reset(new server_type(endpoint, factory, 1));
+    server_->init();
+    port_ = server_->getBindedEndpoint().port();
+    running_thread_.reset(new boost::thread(boost::bind(&server_type::run, server_.get())));
+    LOG(INFO) << "fake registry started at port: " << port_;
+}
+
+void FibpFakeRegistry::stop()
+{
+    if (!server_)
+        return;
+    server_->stop();
+    if (running_thread_)
+        running_thread_->join();
+    running_thread_.reset();
+    server_.reset();
+}
+
+void FibpFakeRegistry::set_io_service(boost::asio::io_service& io)
+{
+    boost::mutex::scoped_lock guard(mutex_);
+    io_ = &io;
+}
+
+void FibpFakeRegistry::register_service(const std::string& name, const std::vector<std::string>& tags,
+    const std::string& ip, uint16_t port)
+{
+    boost::mutex::scoped_lock guard(mutex_);
+    ++index_;
+    std::map<std::string, Service>::iterator it = services_.find(name);
+    if (it == services_.end() || it->second.tags != tags)
+        catalog_index_ = index_;
+    Service& service = services_[name];
+    service.tags = tags;
+    Endpoint& endpoint = service.endpoints[host_key(ip, port)];
+    endpoint.ip = ip;
+    endpoint.port = port;
+    endpoint.passing = true;
+    endpoint.modify_index = index_;
+    service.index = index_;
+    health_index_ = index_;
+    changed();
+}
+
+void FibpFakeRegistry::deregister_service(const std::string& name, const std::string& ip, uint16_t port)
+{
+    boost::mutex::scoped_lock guard(mutex_);
+    std::map<std::string, Service>::iterator it = services_.find(name);
+    if (it == services_.end() || it->second.endpoints.erase(host_key(ip, port)) == 0)
+        return;
+    ++index_;
+    it->second.index = index_;
+    health_index_ = index_;
+    // the service without any instance is gone from the catalog.
+    if (it->second.endpoints.empty())
+    {
+        services_.erase(it);
+        catalog_index_ = index_;
+    }
+    changed();
+}
+
+void FibpFakeRegistry::remove_service(const std::string& name)
+{
+    boost::mutex::scoped_lock guard(mutex_);
+    if (services_.erase(name) == 0)
+        return;
+    ++index_;
+    catalog_index_ = index_;
+    health_index_ = index_;
+    changed();
+}
+
+void FibpFakeRegistry::set_passing(const std::string& name, const std::string& ip, uint16_t port,
+    bool passing)
+{
+    boost::mutex::scoped_lock guard(mutex_);
+    std::map<std::string, Service>::iterator it = services_.find(name);
+    if (it == services_.end())
+        return;
+    std::map<std::string, Endpoint>::iterator ep_it = it->second.endpoints.find(host_key(ip, port));
+    if (ep_it == it->second.endpoints.end() || ep_it->second.passing == passing)
+        return;
+    ++index_;
+    ep_it->second.passing = passing;
+    ep_it->second.modify_index = index_;
+    it->second.index = index_;
+    health_index_ = index_;
+    changed();
+}
+
+std::size_t FibpFakeRegistry::flap(std::size_t num, uint32_t seed)
+{
+    boost::mutex::scoped_lock guard(mutex_);
+    std::vector<std::pair<Service*, Endpoint*> > all;
+    for(std::map<std::string, Service>::iterator it = services_.begin(); it != services_.end(); ++it)
+    {
+        for(std::map<std::string, Endpoint>::iterator ep_it = it->second.endpoints.begin();
+            ep_it != it->second.endpoints.end(); ++ep_it)
+        {
+            all.push_back(std::make_pair(&it->second, &ep_it->second));
+        }
+    }
+    if (all.empty() || num == 0)
+        return 0;
+    ++index_;
+    std::size_t flapped = 0;
+    uint32_t r = seed;
+    for(std::size_t i = 0; i < num && i < all.size(); ++i)
+    {
+        r = r*1103515245U + 12345U;
+        std::pair<Service*, Endpoint*>& picked = all[(r >> 8) % all.size()];
+        if (picked.second->modify_index == index_)
+            continue;
+        picked.second->passing = !picked.second->passing;
+        picked.second->modify_index = index_;
+        picked.first->index = index_;
+        ++flapped;
+    }
+    health_index_ = index_;
+    changed();
+    return flapped;
+}
+
+void FibpFakeRegistry::put_kv(const std::string& key, const std::string& value)
+{
+    boost::mutex::scoped_lock guard(mutex_);
+    ++index_;
+    kv_[key] = std::make_pair(value, index_);
+    kv_index_ = index_;
+    changed();
+}
+
+void FibpFakeRegistry::delete_kv(const std::string& key)
+{
+    boost::mutex::scoped_lock guard(mutex_);
+    if (kv_.erase(key) == 0)
+        return;
+    ++index_;
+    kv_index_ = index_;
+    changed();
+}
+
+uint64_t FibpFakeRegistry::index()
+{
+    boost::mutex::scoped_lock guard(mutex_);
+    return index_;
+}
+
+std::size_t FibpFakeRegistry::endpoint_num()
+{
+    boost::mutex::scoped_lock guard(mutex_);
+    std::size_t num = 0;
+    for(std::map<std::string, Service>::const_iterator it = services_.begin(); it != services_.end(); ++it)
+        num += it->second.endpoints.size();
+    return num;
+}
+
+void FibpFakeRegistry::changed()
+{
+    if (io_)
+        io_->post(boost::bind(&FibpFakeRegistry::notify_waiters, this));
+}
+
+void FibpFakeRegistry::notify_waiters()
+{
+    wait_cond_.notify_all();
+}
+
+void FibpFakeRegistry::on_wait_timeout(void* arg)
+{
+    Waiter* waiter = (Waiter*)arg;
+    waiter->timed_out = true;
+    waiter->registry->wait_cond_.notify_all();
+}
+
+uint64_t FibpFakeRegistry::current_index(Resource res, const std::string& name)
+{
+    boost::mutex::scoped_lock guard(mutex_);
+    switch(res)
+    {
+    case Catalog:
+        return catalog_index_;
+    case ServiceHealth:
+        {
+            std::map<std::string, Service>::const_iterator it = services_.find(name);
+            // consul returns the index of the catalog for the service not found.
+            return it == services_.end() ? catalog_index_ : it->second.index;
+        }
+    case HealthState:
+        return health_index_;
+    case KVStore:
+        return kv_index_;
+    }
+    return index_;
+}
+
+void FibpFakeRegistry::wait_index(Resource res, const std::string& name, uint64_t index,
+    uint32_t wait_ms)
+{
+    if (current_index(res, name) > index)
+        return;
+    ++blocked_num_;
+    Waiter waiter;
+    waiter.registry = this;
+    FibpTimer timer;
+    FibpTimerWheel::get(*io_).arm(timer, wait_ms, &FibpFakeRegistry::on_wait_timeout, &waiter);
+    boost::unique_lock<boost::fibers::mutex> guard(wait_mutex_);
+    while(!waiter.timed_out && current_index(res, name) <= index)
+        wait_cond_.wait(guard);
+    timer.cancel();
+}
+
+void FibpFakeRegistry::handle(const http::request_t& req, http::response_t& rsp)
+{
+    ++request_num_;
+    std::map<std::string, std::string> params;
+    parse_query(req.query_, params);
+    Resource res = Catalog;
+    std::string name;
+    if (req.path_ == "/v1/catalog/services")
+    {
+        res = Catalog;
+    }
+    else if (boost::algorithm::starts_with(req.path_, health_service_prefix))
+    {
+        res = ServiceHealth;
+        name = req.path_.substr(health_service_prefix.size());
+    }
+    else if (req.path_ == "/v1/health/state/any")
+    {
+        res = HealthState;
+    }
+    else if (boost::algorithm::starts_with(req.path_, kv_prefix))
+    {
+        res = KVStore;
+        name = req.path_.substr(kv_prefix.size());
+        if (req.method_ == http::PUT)
+        {
+            put_kv(name, req.body_);
+            rsp.code_ = http::OK;
+            rsp.body_ = "true";
+            return;
+        }
+        if (req.method_ == http::DELETE)
+        {
+            delete_kv(name);
+            rsp.code_ = http::OK;
+            rsp.body_ = "true";
+            return;
+        }
+    }
+    else
+    {
+        rsp.code_ = http::NOT_FOUND;
+        return;
+    }
+
+    std::map<std::string, std::string>::const_iterator index_it = params.find("index");
+    if (index_it != params.end())
+    {
+        uint64_t index = 0;
+        try
+        {
+            index = boost::lexical_cast<uint64_t>(index_it->second);
+        }
+        catch(const std::exception& e)
+        {
+            rsp.code_ = http::BAD_REQUEST;
+            return;
+        }
+        uint32_t wait_ms = default_wait_ms;
+        std::map<std::string, std::string>::const_iterator wait_it = params.find("wait");
+        if (wait_it != params.end())
+            wait_ms = std::min(parse_wait(wait_it->second), max_wait_ms);
+        wait_index(res, name, index, wait_ms);
+    }
+
+    uint64_t index = current_index(res, name);
+    rsp.code_ = http::OK;
+    switch(res)
+    {
+    case Catalog:
+        write_catalog(rsp.body_);
+        break;
+    case ServiceHealth:
+        write_service_health(name, rsp.body_);
+        break;
+    case HealthState:
+        write_health_state(rsp.body_);
+        break;
+    case KVStore:
+        if (params.find("keys") == params.end() && params.find("raw") == params.end())
+        {
+            // the values encoded in base64 are not used by the proxy.
+            rsp.code_ = http::NOT_IMPLEMENTED;
+            return;
+        }
+        if (!write_kv(name, params.find("keys") != params.end(), rsp.body_))
+            rsp.code_ = http::NOT_FOUND;
+        break;
+    }
+    rsp.headers_.push_back(std::make_pair("X-Consul-Index", boost::lexical_cast<std::string>(index)));
+    rsp.headers_.push_back(std::make_pair("Content-Type", "application/json"));
+}
+
+void FibpFakeRegistry::write_catalog(std::string& body)
+{
+    boost::mutex::scoped_lock guard(mutex_);
+    body = "{";
+    for(std::map<std::string, Service>::const_iterator it = services_.begin(); it != services_.end(); ++it)
+    {
+        if (it != services_.begin())
+            body.push_back(',');
+        append_json_string(body, it->first);
+        body.append(":[");
+        for(std::size_t i = 0; i < it->second.tags.size(); ++i)
+        {
+            if (i > 0)
+                body.push_back(',');
+            append_json_string(body, it->second.tags[i]);
+        }
+        body.push_back(']');
+    }
+    body.push_back('}');
+}
+
+void FibpFakeRegistry::write_service_health(const std::string& name, std::string& body)
+{
+    boost::mutex::scoped_lock guard(mutex_);
+    body = "[";
+    std::map<std::string, Service>::const_iterator it = services_.find(name);
+    if (it == services_.end())
+    {
+        body.push_back(']');
+        return;
+    }
+    const Service& service = it->second;
+    for(std::map<std::string, Endpoint>::const_iterator ep_it = service.endpoints.begin();
+        ep_it != service.endpoints.end(); ++ep_it)
+    {
+        const Endpoint& endpoint = ep_it->second;
+        std::string id = name + "-" + ep_it->first;
+        if (ep_it != service.endpoints.begin())
+            body.push_back(',');
+        body.append("{\"Node\":{\"Node\":");
+        append_json_string(body, "node-" + endpoint.ip);
+        body.append(",\"Address\":");
+        append_json_string(body, endpoint.ip);
+        body.append("},\"Service\":{\"ID\":");
+        append_json_string(body, id);
+        body.append(",\"Service\":");
+        append_json_string(body, name);
+        body.append(",\"Tags\":[");
+        for(std::size_t i = 0; i < service.tags.size(); ++i)
+        {
+            if (i > 0)
+                body.push_back(',');
+            append_json_string(body, service.tags[i]);
+        }
+        body.append("],\"Address\":");
+        append_json_string(body, endpoint.ip);
+        body.append(",\"Port\":" + boost::lexical_cast<std::string>(endpoint.port));
+        body.append("},\"Checks\":[{\"Node\":");
+        append_json_string(body, "node-" + endpoint.ip);
+        body.append(",\"CheckID\":");
+        append_json_string(body, "service:" + id);
+        body.append(",\"Status\":");
+        body.append(endpoint.passing ? "\"passing\"" : "\"critical\"");
+        body.append(",\"ServiceID\":");
+        append_json_string(body, id);
+        body.append(",\"ServiceName\":");
+        append_json_string(body, name);
+        body.append(",\"ModifyIndex\":" + boost::lexical_cast<std::string>(endpoint.modify_index));
+        body.append("}]}");
+    }
+    body.push_back(']');
+}
+
+void FibpFakeRegistry::write_health_state(std::string& body)
+{
+    boost::mutex::scoped_lock guard(mutex_);
+    body = "[";
+    bool first = true;
+    for(std::map<std::string, Service>::const_iterator it = services_.begin(); it != services_.end(); ++it)
+    {
+        for(std::map<std::string, Endpoint>::const_iterator ep_it = it->second.endpoints.begin();
+            ep_it != it->second.endpoints.end(); ++ep_it)
+        {
+            std::string id = it->first + "-" + ep_it->first;
+            if (!first)
+                body.push_back(',');
+            first = false;
+            body.append("{\"Node\":");
+            append_json_string(body, "node-" + ep_it->second.ip);
+            body.append(",\"CheckID\":");
+            append_json_string(body, "service:" + id);
+            body.append(",\"Status\":");
+            body.append(ep_it->second.passing ? "\"passing\"" : "\"critical\"");
+            body.append(",\"ServiceID\":");
+            append_json_string(body, id);
+            body.append(",\"ServiceName\":");
+            append_json_string(body, it->first);
+            body.append(",\"ModifyIndex\":" + boost::lexical_cast<std::string>(ep_it->second.modify_index));
+            body.push_back('}');
+        }
+    }
+    body.push_back(']');
+}
+
+bool FibpFakeRegistry::write_kv(const std::string& key, bool keys, std::string& body)
+{
+    boost::mutex::scoped_lock guard(mutex_);
+    if (!keys)
+    {
+        std::map<std::string, std::pair<std::string, uint64_t> >::const_iterator it = kv_.find(key);
+        if (it == kv_.end())
+            return false;
+        body = it->second.first;
+        return true;
+    }
+    body = "[";
+    bool found = false;
+    for(std::map<std::string, std::pair<std::string, uint64_t> >::const_iterator it = kv_.lower_bound(key);
+        it != kv_.end() && boost::algorithm::starts_with(it->first, key); ++it)
+    {
+        if (found)
+            body.push_back(',');
+        found = true;
+        append_json_string(body, it->first);
+    }
+    body.push_back(']');
+    return found;
+}
+
+}
@@ -0,0 +1,181 @@
+#ifndef FIBP_FAKE_REGISTRY_H
+#define FIBP_FAKE_REGISTRY_H
+
+#include <fiber-server/HttpProtocolHandler.h>
+#include <fiber-server/AsyncMultiIOServicesServer.h>
+#include <boost/asio.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+#include <boost/fiber/mutex.hpp>
+#include <boost/fiber/condition.hpp>
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace fibp
+{
+
+class FibpFakeRegistry;
+
+class FakeRegistryConnection : public boost::enable_shared_from_this<FakeRegistryConnection>,
+    private boost::noncopyable
+{
+public:
+    FakeRegistryConnection(boost::asio::io_service& io, FibpFakeRegistry* registry);
+    inline boost::asio::ip::tcp::socket& socket()
+    {
+        return socket_;
+    }
+    void start();
+
+private:
+    bool request_cb();
+    void shutdown();
+    void onReadError(const boost::system::error_code& ec);
+
+    boost::asio::ip::tcp::socket socket_;
+    http::session_t session_;
+    boost::shared_ptr<http::request_parser> req_parser_;
+    FibpFakeRegistry* registry_;
+};
+
+class FakeRegistryConnectionFactory
+{
+public:
+    typedef FakeRegistryConnection connection_type;
+    FakeRegistryConnectionFactory(FibpFakeRegistry* registry)
+        : registry_(registry)
+    {
+    }
+    FakeRegistryConnection* create(boost::asio::io_service& s);
+
+private:
+    FibpFakeRegistry* registry_;
+};
+
+// the consul stand-in for the discovery tests and the benchmarks, served in the
+// process by the fiber http server. Only what the service manager uses is
+// implemented: /v1/catalog/services, /v1/health/service/<name>,
+// /v1/health/state/any and /v1/kv/<key> (keys, raw, PUT and DELETE). A query
+// with index=N&wait=T is blocked until the index of what it asks is over N or
+// the wait is over, and X-Consul-Index is returned as consul does. The
+// services can be changed by any thread while serving.
+class FibpFakeRegistry
+{
+public:
+    typedef AsyncMultiIOServicesServer<FakeRegistryConnectionFactory> server_type;
+    // 0 to bind any free port.
+    explicit FibpFakeRegistry(uint16_t port = 0);
+    ~FibpFakeRegistry();
+    uint16_t port() const
+    {
+        return port_;
+    }
+    void start();
+    void stop();
+
+    void register_service(const std::string& name, const std::vector<std::string>& tags,
+        const std::string& ip, uint16_t port);
+    void deregister_service(const std::string& name, const std::string& ip, uint16_t port);
+    void remove_service(const std::string& name);
+    void set_passing(const std::string& name, const std::string& ip, uint16_t port, bool passing);
+    // flip the health of num endpoints picked by the seed in one change, which
+    // is what a rolling deploy or a flaky rack looks like to the watchers.
+    std::size_t flap(std::size_t num, uint32_t seed);
+    void put_kv(const std::string& key, const std::string& value);
+    void delete_kv(const std::string& key);
+
+    uint64_t index();
+    std::size_t endpoint_num();
+    uint64_t request_num() const
+    {
+        return request_num_;
+    }
+    uint64_t blocked_num() const
+    {
+        return blocked_num_;
+    }
+
+    void handle(const http::request_t& req, http::response_t& rsp);
+    void set_io_service(boost::asio::io_service& io);
+
+private:
+    struct Endpoint
+    {
+        Endpoint()
+            : port(0), passing(true), modify_index(0)
+        {
+        }
+        std::string ip;
+        uint16_t port;
+        bool passing;
+        uint64_t modify_index;
+    };
+    struct Service
+    {
+        Service()
+            : index(0)
+        {
+        }
+        std::vector<std::string> tags;
+        // keyed by ip:port.
+        std::map<std::string, Endpoint> endpoints;
+        uint64_t index;
+    };
+    enum Resource
+    {
+        Catalog,
+        ServiceHealth,
+        HealthState,
+        KVStore
+    };
+    struct Waiter
+    {
+        Waiter()
+            : registry(NULL), timed_out(false)
+        {
+        }
+        FibpFakeRegistry* registry;
+        bool timed_out;
+    };
+
+    uint64_t current_index(Resource res, const std::string& name);
+    void wait_index(Resource res, const std::string& name, uint64_t index, uint32_t wait_ms);
+    static void on_wait_timeout(void* arg);
+    // called with mutex_ held after any change.
+    void changed();
+    void notify_waiters();
+
+    void write_catalog(std::string& body);
+    void write_service_health(const std::string& name, std::string& body);
+    void write_health_state(std::string& body);
+    bool write_kv(const std::string& key, bool keys, std::string& body);
+
+    uint16_t port_;
+    boost::shared_ptr<server_type> server_;
+    boost::shared_ptr<boost::thread> running_thread_;
+    // the io thread of the server, set by the first connection.
+    boost::asio::io_service* io_;
+
+    boost::mutex mutex_;
+    std::map<std::string, Service> services_;
+    // keyed by the key, with the modify index.
+    std::map<std::string, std::pair<std::string, uint64_t> > kv_;
+    uint64_t index_;
+    uint64_t catalog_index_;
+    uint64_t health_index_;
+    uint64_t kv_index_;
+
+    // only used in the io thread.
+    boost::fibers::mutex wait_mutex_;
+    boost::fibers::condition_variable wait_cond_;
+    boost::atomic<uint64_t> request_num_;
+    boost::atomic<uint64_t> blocked_num_;
+};
+
+}
+
+#endif
@@ -0,0 +1,103 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE testadmissioncontrol
+#include <fiber-server/FibpAdmissionControl.h>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread/thread.hpp>
+#include <vector>
+
+using namespace fibp;
+
+static uint64_t get_stat(FibpAdmissionControl& ctrl, const std::string& name)
+{
+    std::map<std::string, uint64_t> stats;
+    ctrl.getStats(stats);
+    return stats[name];
+}
+
+static void admit(FibpAdmissionControl& ctrl, std::size_t num,
+    std::vector<FibpAdmissionTicketPtr>& tickets)
+{
+    for(std::size_t i = 0; i < num; ++i)
+    {
+        FibpAdmissionTicketPtr ticket = ctrl.try_admit();
+        BOOST_REQUIRE(ticket);
+        tickets.push_back(ticket);
+    }
+}
+
+static void start_all(std::vector<FibpAdmissionTicketPtr>& tickets)
+{
+    for(std::size_t i = 0; i < tickets.size(); ++i)
+        BOOST_CHECK(tickets[i]->on_start());
+}
+
+static void sleep_ms(int ms)
+{
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(ms));
+}
+
+BOOST_AUTO_TEST_SUITE(TestAdmissionControlSuite)
+
+BOOST_AUTO_TEST_CASE(test_shed)
+{
+    FibpAdmissionControl ctrl;
+    uint64_t limit = get_stat(ctrl, "admission_limit");
+    std::vector<FibpAdmissionTicketPtr> tickets;
+    admit(ctrl, limit, tickets);
+    BOOST_CHECK(!ctrl.try_admit());
+    BOOST_CHECK_EQUAL(get_stat(ctrl, "admission_shed"), 1U);
+    BOOST_CHECK_EQUAL(get_stat(ctrl, "admission_inflight"), limit);
+    // the finished requests give back the admission.
+    tickets.pop_back();
+    BOOST_CHECK(ctrl.try_admit());
+    tickets.clear();
+    BOOST_CHECK_EQUAL(get_stat(ctrl, "admission_inflight"), 0U);
+    BOOST_CHECK_EQUAL(get_stat(ctrl, "admission_admitted"), limit + 1);
+}
+
+BOOST_AUTO_TEST_CASE(test_decrease)
+{
+    FibpAdmissionControl ctrl;
+    uint64_t limit = get_stat(ctrl, "admission_limit");
+    std::vector<FibpAdmissionTicketPtr> tickets;
+    admit(ctrl, 10, tickets);
+    // even the fastest one waited over the target in the interval.
+    sleep_ms(110);
+    start_all(tickets);
+    BOOST_CHECK_EQUAL(get_stat(ctrl, "admission_limit"), limit - limit / 10);
+    tickets.clear();
+    admit(ctrl, 10, tickets);
+    sleep_ms(110);
+    start_all(tickets);
+    BOOST_CHECK(get_stat(ctrl, "admission_limit") < limit - limit / 10);
+}
+
+BOOST_AUTO_TEST_CASE(test_increase)
+{
+    FibpAdmissionControl ctrl;
+    uint64_t limit = get_stat(ctrl, "admission_limit");
+    std::vector<FibpAdmissionTicketPtr> tickets;
+    // not queued but hardly used, no need to grow.
+    sleep_ms(110);
+    admit(ctrl, 10, tickets);
+    start_all(tickets);
+    BOOST_CHECK_EQUAL(get_stat(ctrl, "admission_limit"), limit);
+    tickets.clear();
+    // not queued and over half used.
+    sleep_ms(110);
+    admit(ctrl, limit / 2 + 1, tickets);
+    start_all(tickets);
+    BOOST_CHECK(get_stat(ctrl, "admission_limit") > limit);
+}
+
+BOOST_AUTO_TEST_CASE(test_expired)
+{
+    FibpAdmissionControl ctrl;
+    FibpAdmissionTicketPtr ticket = ctrl.try_admit();
+    BOOST_REQUIRE(ticket);
+    sleep_ms(1100);
+    BOOST_CHECK(!ticket->on_start());
+    BOOST_CHECK_EQUAL(get_stat(ctrl, "admission_expired"), 1U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
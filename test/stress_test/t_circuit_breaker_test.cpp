@@ -0,0 +1,120 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE testcircuitbreaker
+#include <forward-manager/FibpCircuitBreaker.h>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread/thread.hpp>
+#include <string>
+
+using namespace fibp;
+
+static const std::string s_service("svc");
+static const std::string s_host("10.0.0.1:80");
+static const std::string s_other("10.0.0.2:80");
+
+static void add_results(FibpCircuitBreaker& breaker, const std::string& host,
+    FibpCircuitBreaker::Result result, int num)
+{
+    for(int i = 0; i < num; ++i)
+        breaker.on_result(s_service, host, result);
+}
+
+BOOST_AUTO_TEST_SUITE(TestCircuitBreakerSuite)
+
+BOOST_AUTO_TEST_CASE(test_consecutive_errors)
+{
+    FibpCircuitBreaker breaker;
+    BOOST_CHECK(!breaker.has_ejected(s_service));
+    BOOST_CHECK(breaker.is_available(s_service, s_host));
+    add_results(breaker, s_host, FibpCircuitBreaker::Failure, 4);
+    // a success in between starts over.
+    add_results(breaker, s_host, FibpCircuitBreaker::Success, 1);
+    add_results(breaker, s_host, FibpCircuitBreaker::Failure, 4);
+    BOOST_CHECK_EQUAL(breaker.get_state(s_service, s_host), FibpCircuitBreaker::Closed);
+    BOOST_CHECK(!breaker.has_ejected(s_service));
+    add_results(breaker, s_host, FibpCircuitBreaker::Failure, 1);
+    BOOST_CHECK_EQUAL(breaker.get_state(s_service, s_host), FibpCircuitBreaker::Open);
+    BOOST_CHECK(breaker.has_ejected(s_service));
+    BOOST_CHECK(!breaker.is_available(s_service, s_host));
+    BOOST_CHECK(breaker.is_available(s_service, s_other));
+    // the late results of the requests sent before keep it open.
+    add_results(breaker, s_host, FibpCircuitBreaker::Success, 3);
+    BOOST_CHECK_EQUAL(breaker.get_state(s_service, s_host), FibpCircuitBreaker::Open);
+    // not probed before the eject time.
+    breaker.on_select(s_service, s_host);
+    BOOST_CHECK_EQUAL(breaker.get_state(s_service, s_host), FibpCircuitBreaker::Open);
+}
+
+BOOST_AUTO_TEST_CASE(test_timeouts_and_window)
+{
+    FibpCircuitBreaker breaker;
+    add_results(breaker, s_host, FibpCircuitBreaker::Timeout, 3);
+    BOOST_CHECK_EQUAL(breaker.get_state(s_service, s_host), FibpCircuitBreaker::Open);
+    // the cancelled requests tell nothing.
+    add_results(breaker, s_other, FibpCircuitBreaker::Cancelled, 20);
+    BOOST_CHECK_EQUAL(breaker.get_state(s_service, s_other), FibpCircuitBreaker::Closed);
+    // half of the recent results failed, never many in a row.
+    for(int i = 0; i < 9; ++i)
+    {
+        breaker.on_result(s_service, s_other, FibpCircuitBreaker::Success);
+        breaker.on_result(s_service, s_other, FibpCircuitBreaker::Failure);
+    }
+    BOOST_CHECK_EQUAL(breaker.get_state(s_service, s_other), FibpCircuitBreaker::Closed);
+    breaker.on_result(s_service, s_other, FibpCircuitBreaker::Success);
+    breaker.on_result(s_service, s_other, FibpCircuitBreaker::Failure);
+    BOOST_CHECK_EQUAL(breaker.get_state(s_service, s_other), FibpCircuitBreaker::Open);
+}
+
+BOOST_AUTO_TEST_CASE(test_probe)
+{
+    FibpCircuitBreaker breaker;
+    add_results(breaker, s_host, FibpCircuitBreaker::Failure, 5);
+    BOOST_CHECK(!breaker.is_available(s_service, s_host));
+    // the first eject time is 5s.
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(5100));
+    BOOST_CHECK(breaker.is_available(s_service, s_host));
+    breaker.on_select(s_service, s_host);
+    BOOST_CHECK_EQUAL(breaker.get_state(s_service, s_host), FibpCircuitBreaker::HalfOpen);
+    // only one probe at a time.
+    BOOST_CHECK(!breaker.is_available(s_service, s_host));
+    // the probe given up by us, the next request probes again.
+    breaker.on_result(s_service, s_host, FibpCircuitBreaker::Cancelled);
+    BOOST_CHECK_EQUAL(breaker.get_state(s_service, s_host), FibpCircuitBreaker::Open);
+    BOOST_CHECK(breaker.is_available(s_service, s_host));
+    breaker.on_select(s_service, s_host);
+    breaker.on_result(s_service, s_host, FibpCircuitBreaker::Success);
+    BOOST_CHECK_EQUAL(breaker.get_state(s_service, s_host), FibpCircuitBreaker::Closed);
+    BOOST_CHECK(!breaker.has_ejected(s_service));
+
+    // the failed probe ejects it again for longer.
+    add_results(breaker, s_host, FibpCircuitBreaker::Failure, 5);
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(5100));
+    breaker.on_select(s_service, s_host);
+    breaker.on_result(s_service, s_host, FibpCircuitBreaker::Failure);
+    BOOST_CHECK_EQUAL(breaker.get_state(s_service, s_host), FibpCircuitBreaker::Open);
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(5100));
+    BOOST_CHECK(!breaker.is_available(s_service, s_host));
+    BOOST_CHECK(breaker.has_ejected(s_service));
+}
+
+BOOST_AUTO_TEST_CASE(test_remove)
+{
+    FibpCircuitBreaker breaker;
+    add_results(breaker, s_host, FibpCircuitBreaker::Failure, 5);
+    add_results(breaker, s_other, FibpCircuitBreaker::Failure, 5);
+    BOOST_CHECK(breaker.has_ejected(s_service));
+    breaker.remove(s_service, s_host);
+    BOOST_CHECK(breaker.has_ejected(s_service));
+    breaker.remove(s_service, s_other);
+    // nothing of the service is ejected, the fast path again.
+    BOOST_CHECK(!breaker.has_ejected(s_service));
+    BOOST_CHECK_EQUAL(breaker.get_state(s_service, s_host), FibpCircuitBreaker::Closed);
+    // removed twice or never known.
+    breaker.remove(s_service, s_host);
+    breaker.remove("none", s_host);
+    BOOST_CHECK(!breaker.has_ejected(s_service));
+    // the host added back starts over.
+    add_results(breaker, s_host, FibpCircuitBreaker::Failure, 4);
+    BOOST_CHECK_EQUAL(breaker.get_state(s_service, s_host), FibpCircuitBreaker::Closed);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,225 @@
+#include "FibpFakeRegistry.h"
+#include <forward-manager/FibpServiceMgr.h>
+#include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/chrono/system_clocks.hpp>
+#include <boost/lexical_cast.hpp>
+#include <glog/logging.h>
+#include <algorithm>
+#include <vector>
+
+// run the service manager against the fake registry with thousands of endpoints,
+// measure the lookup latency in the worker threads while the endpoints flap, and
+// how long a change in the registry takes to be routed (the update cost seen by
+// the proxy, including the blocking queries, the fetches and the publishing).
+
+using namespace fibp;
+
+static const std::string sentinel_service("churn_sentinel");
+static const std::string sentinel_ip("10.255.255.1");
+
+static inline uint64_t now_ns()
+{
+    return boost::chrono::duration_cast<boost::chrono::nanoseconds>(
+        boost::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static std::string service_name(std::size_t i)
+{
+    return "service_" + boost::lexical_cast<std::string>(i);
+}
+
+static std::string endpoint_ip(std::size_t i, std::size_t j)
+{
+    return "10." + boost::lexical_cast<std::string>(i / 256) + "." +
+        boost::lexical_cast<std::string>(i % 256) + "." + boost::lexical_cast<std::string>(j % 250 + 1);
+}
+
+static uint64_t percentile(std::vector<uint64_t>& samples, double p)
+{
+    if (samples.empty())
+        return 0;
+    std::size_t pos = (std::size_t)(samples.size() * p);
+    if (pos >= samples.size())
+        pos = samples.size() - 1;
+    std::nth_element(samples.begin(), samples.begin() + pos, samples.end());
+    return samples[pos];
+}
+
+struct LookupResult
+{
+    LookupResult()
+        : lookups(0), found(0)
+    {
+    }
+    uint64_t lookups;
+    uint64_t found;
+    // one in 16 lookups is timed.
+    std::vector<uint64_t> samples;
+};
+
+static void lookup_func(FibpServiceMgr* mgr, std::size_t service_num, std::size_t seed,
+    boost::atomic<bool>* stop, LookupResult* result)
+{
+    std::string ip;
+    std::string port;
+    std::size_t i = seed;
+    while(!*stop)
+    {
+        for(std::size_t k = 0; k < 256; ++k, ++i)
+        {
+            const std::string name = service_name(i % service_num);
+            bool timed = (i & 15) == 0;
+            uint64_t start = timed ? now_ns() : 0;
+            if (mgr->get_service_address(i, name, HTTP_Service, ip, port))
+                ++result->found;
+            if (timed)
+                result->samples.push_back(now_ns() - start);
+        }
+        result->lookups += 256;
+    }
+}
+
+static void run_lookups(const char* label, FibpServiceMgr& mgr, std::size_t service_num,
+    std::size_t thread_num, uint32_t ms, boost::function<void(boost::atomic<bool>*)> churn)
+{
+    boost::atomic<bool> stop(false);
+    std::vector<LookupResult> results(thread_num);
+    boost::thread_group threads;
+    uint64_t start = now_ns();
+    for(std::size_t i = 0; i < thread_num; ++i)
+    {
+        threads.create_thread(boost::bind(&lookup_func, &mgr, service_num, i*7919,
+                &stop, &results[i]));
+    }
+    boost::shared_ptr<boost::thread> churn_thread;
+    if (churn)
+        churn_thread.reset(new boost::thread(boost::bind(churn, &stop)));
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(ms));
+    stop = true;
+    threads.join_all();
+    if (churn_thread)
+        churn_thread->join();
+    uint64_t used = now_ns() - start;
+    uint64_t lookups = 0;
+    uint64_t found = 0;
+    std::vector<uint64_t> samples;
+    for(std::size_t i = 0; i < thread_num; ++i)
+    {
+        lookups += results[i].lookups;
+        found += results[i].found;
+        samples.insert(samples.end(), results[i].samples.begin(), results[i].samples.end());
+    }
+    LOG(INFO) << label << " threads: " << thread_num << ", lookups: " << lookups
+        << ", found: " << found << ", " << (double)lookups * 1000 / (used ? used : 1) << "M/s"
+        << ", latency p50: " << percentile(samples, 0.5) << "ns, p99: " << percentile(samples, 0.99)
+        << "ns, p999: " << percentile(samples, 0.999) << "ns";
+}
+
+// flap the endpoints every step and move the sentinel to a new port, then wait
+// until the sentinel is routed to the new port.
+static void churn_func(FibpFakeRegistry* registry, FibpServiceMgr* mgr, std::size_t flap_num,
+    uint32_t step_ms, boost::atomic<bool>* stop)
+{
+    std::vector<std::string> tags(1, "http");
+    std::vector<uint64_t> delays;
+    uint64_t flapped = 0;
+    uint64_t timeouts = 0;
+    uint64_t request_start = registry->request_num();
+    uint16_t port = 1;
+    std::string ip;
+    std::string cur_port;
+    for(uint32_t step = 0; !*stop; ++step)
+    {
+        uint64_t step_start = now_ns();
+        flapped += registry->flap(flap_num, step);
+        registry->register_service(sentinel_service, tags, sentinel_ip, port + 1);
+        registry->deregister_service(sentinel_service, sentinel_ip, port);
+        ++port;
+        const std::string expected = boost::lexical_cast<std::string>(port);
+        uint64_t change_start = now_ns();
+        while(true)
+        {
+            if (mgr->get_service_address(0, sentinel_service, HTTP_Service, ip, cur_port) &&
+                cur_port == expected)
+            {
+                delays.push_back(now_ns() - change_start);
+                break;
+            }
+            if (now_ns() - change_start > 10ULL*1000*1000*1000)
+            {
+                ++timeouts;
+                break;
+            }
+            boost::this_thread::sleep_for(boost::chrono::microseconds(100));
+        }
+        uint64_t used_ms = (now_ns() - step_start)/1000000;
+        if (used_ms < step_ms)
+            boost::this_thread::sleep_for(boost::chrono::milliseconds(step_ms - used_ms));
+    }
+    uint64_t requests = registry->request_num() - request_start;
+    LOG(INFO) << "churn steps: " << delays.size() + timeouts << ", endpoints flapped: " << flapped
+        << ", timeouts: " << timeouts << ", registry requests per step: "
+        << (double)requests / (delays.size() + timeouts ? delays.size() + timeouts : 1)
+        << ", routed after p50: " << percentile(delays, 0.5)/1000 << "us, p99: "
+        << percentile(delays, 0.99)/1000 << "us, max: " << percentile(delays, 1.0)/1000 << "us";
+}
+
+int main(int argc, char* argv[])
+{
+    std::size_t service_num = 200;
+    std::size_t endpoint_num = 20;
+    std::size_t flap_num = 100;
+    uint32_t step_ms = 100;
+    uint32_t seconds = 10;
+    std::size_t thread_num = 8;
+    if (argc > 1)
+        service_num = boost::lexical_cast<std::size_t>(argv[1]);
+    if (argc > 2)
+        endpoint_num = boost::lexical_cast<std::size_t>(argv[2]);
+    if (argc > 3)
+        flap_num = boost::lexical_cast<std::size_t>(argv[3]);
+    if (argc > 4)
+        step_ms = boost::lexical_cast<uint32_t>(argv[4]);
+    if (argc > 5)
+        seconds = boost::lexical_cast<uint32_t>(argv[5]);
+    if (argc > 6)
+        thread_num = boost::lexical_cast<std::size_t>(argv[6]);
+
+    FibpFakeRegistry registry;
+    std::vector<std::string> tags(1, "http");
+    for(std::size_t i = 0; i < service_num; ++i)
+    {
+        for(std::size_t j = 0; j < endpoint_num; ++j)
+            registry.register_service(service_name(i), tags, endpoint_ip(i, j), 8000 + j / 250);
+    }
+    registry.register_service(sentinel_service, tags, sentinel_ip, 1);
+    registry.start();
+    LOG(INFO) << "services: " << service_num << ", endpoints: " << registry.endpoint_num();
+
+    const std::string reg_addr = "127.0.0.1:" + boost::lexical_cast<std::string>(registry.port());
+    uint64_t start = now_ns();
+    FibpServiceMgr mgr(reg_addr, "127.0.0.1", 0, "127.0.0.1",
+        boost::lexical_cast<std::string>(registry.port()));
+    mgr.start();
+    std::string ip;
+    std::string port;
+    for(std::size_t i = 0; i < service_num; ++i)
+    {
+        while(!mgr.get_service_address(0, service_name(i), HTTP_Service, ip, port))
+            boost::this_thread::sleep_for(boost::chrono::milliseconds(1));
+    }
+    LOG(INFO) << "all services routed in " << (now_ns() - start)/1000 << "us, registry requests: "
+        << registry.request_num();
+
+    run_lookups("quiet", mgr, service_num, thread_num, seconds*1000/2,
+        boost::function<void(boost::atomic<bool>*)>());
+    run_lookups("churn", mgr, service_num, thread_num, seconds*1000/2,
+        boost::bind(&churn_func, &registry, &mgr, flap_num, step_ms, _1));
+    LOG(INFO) << "registry requests: " << registry.request_num() << ", blocked: " << registry.blocked_num();
+    mgr.stop();
+    registry.stop();
+    return 0;
+}
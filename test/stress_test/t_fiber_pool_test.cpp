@@ -0,0 +1,99 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE testfiberpool
+#include <fiber-server/FiberPool.hpp>
+#include <boost/test/unit_test.hpp>
+#include <string>
+
+using namespace fibp;
+
+// the tasks queued before the pool runs, the first one (the high one first in
+// arrival) holds the only pool fiber until all the others are queued, so they
+// run in the order of the pool.
+class TaskRecorder
+{
+public:
+    TaskRecorder(std::size_t task_num)
+        : pool_(new FiberPool()), task_num_(task_num)
+    {
+        pool_->schedule_task(boost::bind(&TaskRecorder::hold), Priority_High);
+    }
+
+    void schedule(char name, int priority, uint64_t deadline_us = 0)
+    {
+        pool_->schedule_task(boost::bind(&TaskRecorder::record, this, name),
+            priority, deadline_us, boost::bind(&TaskRecorder::record, this, 'x'));
+    }
+
+    // return the names in the order they ran, x for the expired ones.
+    const std::string& run()
+    {
+        pool_->init(1);
+        pool_->run();
+        return order_;
+    }
+
+    fiber_pool_ptr_t pool()
+    {
+        return pool_;
+    }
+
+private:
+    static void hold()
+    {
+        boost::this_fiber::sleep_for(boost::chrono::milliseconds(50));
+    }
+
+    void record(char name)
+    {
+        order_.push_back(name);
+        if (order_.size() == task_num_)
+            pool_->stop();
+    }
+
+    fiber_pool_ptr_t pool_;
+    std::size_t task_num_;
+    std::string order_;
+};
+
+BOOST_AUTO_TEST_SUITE(TestFiberPoolSuite)
+
+BOOST_AUTO_TEST_CASE(test_weighted)
+{
+    TaskRecorder recorder(26);
+    for(int i = 0; i < 2; ++i)
+        recorder.schedule('l', Priority_Low);
+    for(int i = 0; i < 8; ++i)
+        recorder.schedule('n', Priority_Normal);
+    for(int i = 0; i < 16; ++i)
+        recorder.schedule('h', Priority_High);
+    // 8:4:1 in each round, the holding task used a high credit of the first round.
+    BOOST_CHECK_EQUAL(recorder.run(), "hhhhhhhnnnnlhhhhhhhhnnnnlh");
+}
+
+BOOST_AUTO_TEST_CASE(test_deadline)
+{
+    TaskRecorder recorder(5);
+    uint64_t now = FiberPool::now_us();
+    recorder.schedule('3', Priority_Normal, now + 3000*1000);
+    recorder.schedule('a', Priority_Normal);
+    recorder.schedule('1', Priority_Normal, now + 1000*1000);
+    recorder.schedule('b', Priority_Normal);
+    recorder.schedule('2', Priority_Normal, now + 2000*1000);
+    // the earliest deadline first, taking turns with the ones by arrival.
+    BOOST_CHECK_EQUAL(recorder.run(), "1a2b3");
+}
+
+BOOST_AUTO_TEST_CASE(test_expired)
+{
+    TaskRecorder recorder(4);
+    uint64_t now = FiberPool::now_us();
+    // expired while the pool fiber is held.
+    recorder.schedule('a', Priority_Normal, now + 10*1000);
+    recorder.schedule('b', Priority_Normal, now + 10*1000*1000);
+    recorder.schedule('c', Priority_Normal, 1);
+    recorder.schedule('d', Priority_Normal);
+    BOOST_CHECK_EQUAL(recorder.run(), "xdxb");
+    BOOST_CHECK_EQUAL(recorder.pool()->get_expired_num(), 2U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,102 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE testfieldsubstitution
+#include <forward-manager/FibpFieldSubstitution.h>
+#include <boost/test/unit_test.hpp>
+#include <string>
+#include <vector>
+
+using namespace fibp;
+
+static std::vector<ServiceCallRsp> make_rsp_list()
+{
+    std::vector<ServiceCallRsp> rsp_list(3);
+    rsp_list[0].rsp = "{\"user\":{\"id\":42,\"name\":\"tom\",\"tags\":[\"a\",\"b\"],"
+        "\"quote\":\"say \\\"hi\\\"\\n\",\"extra\":{\"x\":1,\"y\":[true,null]}}}";
+    rsp_list[1].rsp = "[{\"id\":\"first\"},{\"id\":\"second\"}]";
+    rsp_list[2].rsp = "not a json";
+    return rsp_list;
+}
+
+static std::vector<int> all_depends()
+{
+    std::vector<int> depends_on;
+    depends_on.push_back(0);
+    depends_on.push_back(1);
+    depends_on.push_back(2);
+    return depends_on;
+}
+
+static bool substitute(const std::string& tmpl, std::string& result, std::string& error)
+{
+    return FibpFieldSubstitution::substitute(tmpl, all_depends(), make_rsp_list(), result, error);
+}
+
+BOOST_AUTO_TEST_SUITE(TestFieldSubstitutionSuite)
+
+BOOST_AUTO_TEST_CASE(test_has_placeholder)
+{
+    BOOST_CHECK(FibpFieldSubstitution::has_placeholder("{\"id\":${0.user.id}}"));
+    BOOST_CHECK(!FibpFieldSubstitution::has_placeholder("{\"id\":1}"));
+    BOOST_CHECK(!FibpFieldSubstitution::has_placeholder("$ {0}"));
+}
+
+BOOST_AUTO_TEST_CASE(test_nested_path)
+{
+    std::string result;
+    std::string error;
+    BOOST_CHECK(substitute("{\"id\":${0.user.id},\"name\":\"${0.user.name}\"}", result, error));
+    BOOST_CHECK_EQUAL(result, "{\"id\":42,\"name\":\"tom\"}");
+    // the array index in the path, also at the top.
+    BOOST_CHECK(substitute("${0.user.tags.1}-${1.0.id}-${1.1.id}", result, error));
+    BOOST_CHECK_EQUAL(result, "b-first-second");
+    // the object and the array are put as the compact json.
+    BOOST_CHECK(substitute("${0.user.extra}", result, error));
+    BOOST_CHECK_EQUAL(result, "{\"x\":1,\"y\":[true,null]}");
+    BOOST_CHECK(substitute("${0.user.tags}", result, error));
+    BOOST_CHECK_EQUAL(result, "[\"a\",\"b\"]");
+    // the whole response without parsing, even not a json.
+    BOOST_CHECK(substitute("<${2}>", result, error));
+    BOOST_CHECK_EQUAL(result, "<not a json>");
+}
+
+BOOST_AUTO_TEST_CASE(test_escaping)
+{
+    std::string result;
+    std::string error;
+    // the string keeps escaped so it can be put in a json string again.
+    BOOST_CHECK(substitute("{\"q\":\"${0.user.quote}\"}", result, error));
+    BOOST_CHECK_EQUAL(result, "{\"q\":\"say \\\"hi\\\"\\n\"}");
+    // the text around and without the closing brace is kept.
+    BOOST_CHECK(substitute("a${0.user.id}b${0.user.id", result, error));
+    BOOST_CHECK_EQUAL(result, "a42b${0.user.id");
+    BOOST_CHECK(substitute("no placeholder", result, error));
+    BOOST_CHECK_EQUAL(result, "no placeholder");
+}
+
+BOOST_AUTO_TEST_CASE(test_missing_field)
+{
+    std::string result;
+    std::string error;
+    BOOST_CHECK(!substitute("${0.user.age}", result, error));
+    BOOST_CHECK_EQUAL(error, "Field Substitution Failed: ${0.user.age}. ");
+    // the index out of the array and the key on a scalar.
+    BOOST_CHECK(!substitute("${0.user.tags.2}", result, error));
+    BOOST_CHECK(!substitute("${0.user.id.x}", result, error));
+    BOOST_CHECK(!substitute("${0.user.tags.x}", result, error));
+    // the response not a json.
+    BOOST_CHECK(!substitute("${2.id}", result, error));
+    // not a call index, or the call out of the list.
+    BOOST_CHECK(!substitute("${user.id}", result, error));
+    BOOST_CHECK(!substitute("${}", result, error));
+    BOOST_CHECK(!substitute("${5}", result, error));
+
+    // only the calls depended on can be used.
+    std::vector<int> depends_on(1, 1);
+    BOOST_CHECK(!FibpFieldSubstitution::substitute("${0.user.id}", depends_on,
+            make_rsp_list(), result, error));
+    BOOST_CHECK(FibpFieldSubstitution::substitute("${1.0.id}", depends_on,
+            make_rsp_list(), result, error));
+    BOOST_CHECK_EQUAL(result, "first");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
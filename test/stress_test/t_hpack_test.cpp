@@ -0,0 +1,283 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE testhpack
+#include <forward-manager/FibpHpack.h>
+#include <boost/test/unit_test.hpp>
+#include <string>
+
+// the decoder against the examples of RFC 7541 Appendix C.
+
+using namespace fibp;
+
+static std::string from_hex(const std::string& hex)
+{
+    std::string out;
+    int high = -1;
+    for(std::size_t i = 0; i < hex.size(); ++i)
+    {
+        char c = hex[i];
+        int v = -1;
+        if (c >= '0' && c <= '9')
+            v = c - '0';
+        else if (c >= 'a' && c <= 'f')
+            v = c - 'a' + 10;
+        if (v < 0)
+            continue;
+        if (high < 0)
+        {
+            high = v;
+        }
+        else
+        {
+            out.push_back((char)(high * 16 + v));
+            high = -1;
+        }
+    }
+    BOOST_REQUIRE(high < 0);
+    return out;
+}
+
+static void check_headers(const HpackHeaderListT& headers, const char* expected[][2],
+    std::size_t num)
+{
+    BOOST_REQUIRE_EQUAL(headers.size(), num);
+    for(std::size_t i = 0; i < num; ++i)
+    {
+        BOOST_CHECK_EQUAL(headers[i].first, expected[i][0]);
+        BOOST_CHECK_EQUAL(headers[i].second, expected[i][1]);
+    }
+}
+
+static const char* s_req1[][2] =
+{
+    {":method", "GET"},
+    {":scheme", "http"},
+    {":path", "/"},
+    {":authority", "www.example.com"}
+};
+
+static const char* s_req2[][2] =
+{
+    {":method", "GET"},
+    {":scheme", "http"},
+    {":path", "/"},
+    {":authority", "www.example.com"},
+    {"cache-control", "no-cache"}
+};
+
+static const char* s_req3[][2] =
+{
+    {":method", "GET"},
+    {":scheme", "https"},
+    {":path", "/index.html"},
+    {":authority", "www.example.com"},
+    {"custom-key", "custom-value"}
+};
+
+static const char* s_rsp1[][2] =
+{
+    {":status", "302"},
+    {"cache-control", "private"},
+    {"date", "Mon, 21 Oct 2013 20:13:21 GMT"},
+    {"location", "https://www.example.com"}
+};
+
+static const char* s_rsp2[][2] =
+{
+    {":status", "307"},
+    {"cache-control", "private"},
+    {"date", "Mon, 21 Oct 2013 20:13:21 GMT"},
+    {"location", "https://www.example.com"}
+};
+
+static const char* s_rsp3[][2] =
+{
+    {":status", "200"},
+    {"cache-control", "private"},
+    {"date", "Mon, 21 Oct 2013 20:13:22 GMT"},
+    {"location", "https://www.example.com"},
+    {"content-encoding", "gzip"},
+    {"set-cookie", "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1"}
+};
+
+// the table size of the response examples is 256, which the peer announces
+// by the size update at the start of the first block.
+static const char* s_table_256 = "3fe101";
+
+BOOST_AUTO_TEST_SUITE(TestHpackSuite)
+
+BOOST_AUTO_TEST_CASE(test_requests_without_huffman)
+{
+    // C.3
+    FibpHpackDecoder decoder;
+    HpackHeaderListT headers;
+    BOOST_CHECK(decoder.decode(from_hex("8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d"),
+            headers));
+    check_headers(headers, s_req1, 4);
+    BOOST_CHECK(decoder.decode(from_hex("8286 84be 5808 6e6f 2d63 6163 6865"), headers));
+    check_headers(headers, s_req2, 5);
+    BOOST_CHECK(decoder.decode(from_hex("8287 85bf 400a 6375 7374 6f6d 2d6b 6579"
+                "0c63 7573 746f 6d2d 7661 6c75 65"), headers));
+    check_headers(headers, s_req3, 5);
+
+    // the dynamic table is [custom-key, cache-control, :authority].
+    BOOST_CHECK(decoder.decode(from_hex("bebfc0"), headers));
+    BOOST_REQUIRE_EQUAL(headers.size(), 3U);
+    BOOST_CHECK_EQUAL(headers[0].first, "custom-key");
+    BOOST_CHECK_EQUAL(headers[1].first, "cache-control");
+    BOOST_CHECK_EQUAL(headers[2].first, ":authority");
+    BOOST_CHECK(!decoder.decode(from_hex("c1"), headers));
+}
+
+BOOST_AUTO_TEST_CASE(test_requests_with_huffman)
+{
+    // C.4
+    FibpHpackDecoder decoder;
+    HpackHeaderListT headers;
+    BOOST_CHECK(decoder.decode(from_hex("8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff"), headers));
+    check_headers(headers, s_req1, 4);
+    BOOST_CHECK(decoder.decode(from_hex("8286 84be 5886 a8eb 1064 9cbf"), headers));
+    check_headers(headers, s_req2, 5);
+    BOOST_CHECK(decoder.decode(from_hex("8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925"
+                "a849 e95b b8e8 b4bf"), headers));
+    check_headers(headers, s_req3, 5);
+}
+
+BOOST_AUTO_TEST_CASE(test_responses_with_eviction)
+{
+    // C.5, each response evicts the oldest entries of the 256 bytes table.
+    FibpHpackDecoder decoder;
+    HpackHeaderListT headers;
+    BOOST_CHECK(decoder.decode(from_hex(s_table_256) + from_hex(
+                "4803 3330 3258 0770 7269 7661 7465 611d"
+                "4d6f 6e2c 2032 3120 4f63 7420 3230 3133"
+                "2032 303a 3133 3a32 3120 474d 546e 1768"
+                "7474 7073 3a2f 2f77 7777 2e65 7861 6d70"
+                "6c65 2e63 6f6d"), headers));
+    check_headers(headers, s_rsp1, 4);
+    BOOST_CHECK(decoder.decode(from_hex("4803 3330 37c1 c0bf"), headers));
+    check_headers(headers, s_rsp2, 4);
+    BOOST_CHECK(decoder.decode(from_hex(
+                "88c1 611d 4d6f 6e2c 2032 3120 4f63 7420"
+                "3230 3133 2032 303a 3133 3a32 3220 474d"
+                "54c0 5a04 677a 6970 7738 666f 6f3d 4153"
+                "444a 4b48 514b 425a 584f 5157 454f 5049"
+                "5541 5851 5745 4f49 553b 206d 6178 2d61"
+                "6765 3d33 3630 303b 2076 6572 7369 6f6e"
+                "3d31"), headers));
+    check_headers(headers, s_rsp3, 6);
+
+    // only set-cookie, content-encoding and date are left.
+    BOOST_CHECK(decoder.decode(from_hex("c0"), headers));
+    BOOST_REQUIRE_EQUAL(headers.size(), 1U);
+    BOOST_CHECK_EQUAL(headers[0].first, "date");
+    BOOST_CHECK_EQUAL(headers[0].second, "Mon, 21 Oct 2013 20:13:22 GMT");
+    BOOST_CHECK(!decoder.decode(from_hex("c1"), headers));
+}
+
+BOOST_AUTO_TEST_CASE(test_responses_with_huffman)
+{
+    // C.6
+    FibpHpackDecoder decoder;
+    HpackHeaderListT headers;
+    BOOST_CHECK(decoder.decode(from_hex(s_table_256) + from_hex(
+                "4882 6402 5885 aec3 771a 4b61 96d0 7abe"
+                "9410 54d4 44a8 2005 9504 0b81 66e0 82a6"
+                "2d1b ff6e 919d 29ad 1718 63c7 8f0b 97c8"
+                "e9ae 82ae 43d3"), headers));
+    check_headers(headers, s_rsp1, 4);
+    BOOST_CHECK(decoder.decode(from_hex("4883 640e ffc1 c0bf"), headers));
+    check_headers(headers, s_rsp2, 4);
+    BOOST_CHECK(decoder.decode(from_hex(
+                "88c1 6196 d07a be94 1054 d444 a820 0595"
+                "040b 8166 e084 a62d 1bff c05a 839b d9ab"
+                "77ad 94e7 821d d7f2 e6c7 b335 dfdf cd5b"
+                "3960 d5af 2708 7f36 72c1 ab27 0fb5 291f"
+                "9587 3160 65c0 03ed 4ee5 b106 3d50 07"), headers));
+    check_headers(headers, s_rsp3, 6);
+}
+
+BOOST_AUTO_TEST_CASE(test_integer)
+{
+    FibpHpackDecoder decoder;
+    HpackHeaderListT headers;
+    // C.1.2, 1337 with the 5 bits prefix, as the table size.
+    BOOST_CHECK(decoder.decode(from_hex("3f9a0a"), headers));
+    BOOST_CHECK(headers.empty());
+    // larger than the size in our settings.
+    BOOST_CHECK(!decoder.decode(from_hex("3fe21f"), headers));
+    // too many continuation bytes.
+    BOOST_CHECK(!decoder.decode(from_hex("3fffffffffffffffffff01"), headers));
+    // the continuation is missing.
+    BOOST_CHECK(!decoder.decode(from_hex("3f9a"), headers));
+
+    // the length of the long value takes more than one byte.
+    HpackHeaderListT in;
+    in.push_back(HpackHeaderT("x-long", std::string(1000, 'v')));
+    in.push_back(HpackHeaderT(":status", "200"));
+    std::string block;
+    FibpHpackEncoder encoder;
+    encoder.encode(in, block);
+    BOOST_CHECK(decoder.decode(block, headers));
+    BOOST_CHECK(headers == in);
+}
+
+BOOST_AUTO_TEST_CASE(test_size_update)
+{
+    FibpHpackDecoder decoder;
+    HpackHeaderListT headers;
+    BOOST_CHECK(decoder.decode(from_hex("8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d"),
+            headers));
+    BOOST_CHECK(decoder.decode(from_hex("be"), headers));
+    // the size 0 empties the table.
+    BOOST_CHECK(decoder.decode(from_hex("20"), headers));
+    BOOST_CHECK(!decoder.decode(from_hex("be"), headers));
+
+    // 48 bytes hold one entry of "key: v", the next one evicts it.
+    BOOST_CHECK(decoder.decode(from_hex("3f11"), headers));
+    BOOST_CHECK(decoder.decode(from_hex("4003 6b65 7901 76"), headers));
+    BOOST_CHECK(decoder.decode(from_hex("be"), headers));
+    BOOST_CHECK_EQUAL(headers[0].first, "key");
+    BOOST_CHECK(decoder.decode(from_hex("4004 6b65 7932 0276 32"), headers));
+    BOOST_CHECK(decoder.decode(from_hex("be"), headers));
+    BOOST_CHECK_EQUAL(headers[0].first, "key2");
+    BOOST_CHECK(!decoder.decode(from_hex("bf"), headers));
+
+    // shrinking the table evicts, the entry larger than the table is not added.
+    BOOST_CHECK(decoder.decode(from_hex("3f03"), headers));
+    BOOST_CHECK(!decoder.decode(from_hex("be"), headers));
+    BOOST_CHECK(decoder.decode(from_hex("4003 6b65 7901 76"), headers));
+    BOOST_REQUIRE_EQUAL(headers.size(), 1U);
+    BOOST_CHECK(!decoder.decode(from_hex("be"), headers));
+
+    // reset goes back to the default size and an empty table.
+    decoder.reset();
+    BOOST_CHECK(decoder.decode(from_hex("4004 6b65 7932 0276 32"), headers));
+    BOOST_CHECK(decoder.decode(from_hex("be"), headers));
+    BOOST_CHECK_EQUAL(headers[0].second, "v2");
+}
+
+BOOST_AUTO_TEST_CASE(test_malformed)
+{
+    FibpHpackDecoder decoder;
+    HpackHeaderListT headers;
+    std::string block = from_hex("8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d");
+    // cut in the middle of the literal.
+    for(std::size_t len = 4; len < block.size(); ++len)
+    {
+        FibpHpackDecoder fresh;
+        BOOST_CHECK(!fresh.decode(block.substr(0, len), headers));
+    }
+    // the index 0 and the index out of both tables.
+    BOOST_CHECK(!decoder.decode(from_hex("80"), headers));
+    BOOST_CHECK(!decoder.decode(from_hex("be"), headers));
+    BOOST_CHECK(!decoder.decode(from_hex("0f2f"), headers));
+    // the huffman padding is not the EOS prefix.
+    BOOST_CHECK(!decoder.decode(from_hex("0001 6181 00"), headers));
+    // the huffman padding of 8 bits.
+    BOOST_CHECK(!decoder.decode(from_hex("0001 6182 1fff"), headers));
+    BOOST_CHECK(decoder.decode(from_hex("0001 6181 1f"), headers));
+    BOOST_REQUIRE_EQUAL(headers.size(), 1U);
+    BOOST_CHECK_EQUAL(headers[0].second, "a");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
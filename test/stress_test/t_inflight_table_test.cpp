@@ -0,0 +1,129 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE testinflighttable
+#include <forward-manager/FibpInflightTable.h>
+#include <forward-manager/FibpClientFuture.h>
+#include <boost/test/unit_test.hpp>
+#include <boost/asio.hpp>
+#include <string>
+#include <vector>
+
+using namespace fibp;
+
+// the number of the slots before the table grows.
+static const uint32_t s_init_slots = 64;
+
+// the future done returns at once without waiting in a fiber.
+static bool get_done_rsp(const FibpClientFuturePtr& f, std::string& rsp, bool& can_retry)
+{
+    BOOST_REQUIRE(f->is_done());
+    return f->getRsp(rsp, can_retry);
+}
+
+BOOST_AUTO_TEST_SUITE(TestInflightTableSuite)
+
+BOOST_AUTO_TEST_CASE(test_add_remove)
+{
+    boost::asio::io_service io;
+    FibpInflightTable table(io);
+    FibpClientFuturePtr f = table.add(1, 100);
+    BOOST_REQUIRE(f);
+    BOOST_CHECK_EQUAL(f->getid(), 1U);
+    BOOST_CHECK(!f->is_done());
+    BOOST_CHECK(table.remove(1) == f);
+    // the response arrived twice.
+    BOOST_CHECK(!table.remove(1));
+    // the msgid never added, in the used slot and in an empty one.
+    FibpClientFuturePtr f2 = table.add(2, 100);
+    BOOST_CHECK(!table.remove(2 + s_init_slots));
+    BOOST_CHECK(!table.remove(3));
+    BOOST_CHECK(table.remove(2) == f2);
+}
+
+BOOST_AUTO_TEST_CASE(test_grow)
+{
+    boost::asio::io_service io;
+    FibpInflightTable table(io);
+    // all waited by the callers, the colliding msgids grow the table.
+    std::vector<FibpClientFuturePtr> futures;
+    for(uint32_t msgid = 0; msgid < s_init_slots * 3; ++msgid)
+        futures.push_back(table.add(msgid, 100));
+    for(uint32_t msgid = 0; msgid < futures.size(); ++msgid)
+    {
+        BOOST_CHECK_EQUAL(futures[msgid]->getid(), msgid);
+        BOOST_CHECK(table.remove(msgid) == futures[msgid]);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_reuse)
+{
+    boost::asio::io_service io;
+    FibpInflightTable table(io);
+    FibpClientFuturePtr f = table.add(5, 100);
+    FibpClientFuture* old = f.get();
+    // the caller gave up without the response, the slot is taken by the next call
+    // and the late response of the old one is dropped.
+    f.reset();
+    f = table.add(5 + s_init_slots, 200);
+    BOOST_CHECK(f.get() == old);
+    BOOST_CHECK_EQUAL(f->getid(), 5 + s_init_slots);
+    BOOST_CHECK(!table.remove(5));
+    BOOST_CHECK(table.remove(5 + s_init_slots) == f);
+
+    // the future removed is reused once the caller releases it.
+    std::string rsp("ok");
+    f->set_result(rsp, true, false);
+    f.reset();
+    f = table.add(6, 100);
+    BOOST_CHECK(f.get() == old);
+    BOOST_CHECK_EQUAL(f->getid(), 6U);
+    BOOST_CHECK(!f->is_done());
+
+    // not reused while the caller still holds it.
+    FibpClientFuturePtr held = table.remove(6);
+    f.reset();
+    FibpClientFuturePtr f2 = table.add(7, 100);
+    BOOST_CHECK(f2 != held);
+}
+
+BOOST_AUTO_TEST_CASE(test_cancel)
+{
+    boost::asio::io_service io;
+    FibpInflightTable table(io);
+    FibpClientFuturePtr f = table.add(8, 100);
+    f->cancel();
+    std::string rsp;
+    bool can_retry = true;
+    BOOST_CHECK(!get_done_rsp(f, rsp, can_retry));
+    BOOST_CHECK_EQUAL(rsp, "Request Cancelled.");
+    BOOST_CHECK(!can_retry);
+    // cancelled twice keeps the same.
+    f->cancel();
+
+    // the cancelled call still owns the slot until the caller releases it.
+    FibpClientFuturePtr f2 = table.add(8 + s_init_slots, 100);
+    BOOST_CHECK(f2 != f);
+    BOOST_CHECK(table.remove(8) == f);
+    f.reset();
+    BOOST_CHECK(table.remove(8 + s_init_slots) == f2);
+}
+
+BOOST_AUTO_TEST_CASE(test_set_all_error)
+{
+    boost::asio::io_service io;
+    FibpInflightTable table(io);
+    std::vector<FibpClientFuturePtr> futures;
+    for(uint32_t msgid = 10; msgid < 13; ++msgid)
+        futures.push_back(table.add(msgid, 100));
+    table.set_all_error("Connection Closed.");
+    for(std::size_t i = 0; i < futures.size(); ++i)
+    {
+        std::string rsp;
+        bool can_retry = false;
+        BOOST_CHECK(!get_done_rsp(futures[i], rsp, can_retry));
+        BOOST_CHECK_EQUAL(rsp, "Connection Closed.");
+        BOOST_CHECK(can_retry);
+        BOOST_CHECK(!table.remove(10 + i));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
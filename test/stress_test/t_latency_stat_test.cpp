@@ -0,0 +1,75 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE testlatencystat
+#include <forward-manager/FibpLatencyStat.h>
+#include <boost/test/unit_test.hpp>
+#include <string>
+
+using namespace fibp;
+
+BOOST_AUTO_TEST_SUITE(TestLatencyStatSuite)
+
+BOOST_AUTO_TEST_CASE(test_min_samples)
+{
+    FibpLatencyHistogram h;
+    BOOST_CHECK_EQUAL(h.get_percentile(50), 0U);
+    for(int i = 0; i < 49; ++i)
+        h.add(1000);
+    BOOST_CHECK_EQUAL(h.get_percentile(50), 0U);
+    h.add(1000);
+    BOOST_CHECK(h.get_percentile(50) > 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_percentile)
+{
+    FibpLatencyHistogram h;
+    // 1ms to 100ms, one each.
+    for(uint64_t ms = 1; ms <= 100; ++ms)
+        h.add(ms*1000);
+    // the upper bound of the bucket, at most a quarter octave (19%) above.
+    uint64_t p50 = h.get_percentile(50);
+    BOOST_CHECK(p50 >= 50*1000 && p50 <= 60*1000);
+    uint64_t p90 = h.get_percentile(90);
+    BOOST_CHECK(p90 >= 90*1000 && p90 <= 108*1000);
+    uint64_t p99 = h.get_percentile(99);
+    BOOST_CHECK(p99 >= 99*1000 && p99 <= 119*1000);
+    BOOST_CHECK(p50 <= p90 && p90 <= p99);
+    // below the first bucket and beyond the last one.
+    FibpLatencyHistogram edge;
+    for(int i = 0; i < 100; ++i)
+        edge.add(i < 50 ? 10 : 1000ULL*1000*1000*1000);
+    BOOST_CHECK_EQUAL(edge.get_percentile(10), 100U);
+    // the last bucket holds everything beyond about 88s.
+    BOOST_CHECK(edge.get_percentile(90) > 60ULL*1000*1000);
+}
+
+BOOST_AUTO_TEST_CASE(test_decay)
+{
+    FibpLatencyHistogram h;
+    for(int i = 0; i < 9000; ++i)
+        h.add(100*1000);
+    BOOST_CHECK(h.get_percentile(50) >= 100*1000);
+    // the old samples are halved, the new latency takes over soon.
+    for(int i = 0; i < 12000; ++i)
+        h.add(1000);
+    uint64_t p50 = h.get_percentile(50);
+    BOOST_CHECK(p50 >= 1000 && p50 < 2000);
+    BOOST_CHECK(h.get_percentile(90) >= 100*1000);
+}
+
+BOOST_AUTO_TEST_CASE(test_service_stat)
+{
+    FibpServiceLatencyStat stat;
+    BOOST_CHECK_EQUAL(stat.get_percentile("a", 95), 0U);
+    for(int i = 0; i < 100; ++i)
+    {
+        stat.add("a", 1000);
+        stat.add("b", 100*1000);
+    }
+    uint64_t a = stat.get_percentile("a", 95);
+    uint64_t b = stat.get_percentile("b", 95);
+    BOOST_CHECK(a >= 1000 && a < 2000);
+    BOOST_CHECK(b >= 100*1000 && b < 200*1000);
+    BOOST_CHECK_EQUAL(stat.get_percentile("c", 95), 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,192 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE testloadbalancer
+#include <forward-manager/FibpLoadBalancer.h>
+#include <forward-manager/FibpKeyedStatMap.h>
+#include <boost/test/unit_test.hpp>
+#include <string>
+#include <vector>
+
+using namespace fibp;
+
+static std::vector<std::string> make_hosts(std::size_t num)
+{
+    std::vector<std::string> hosts;
+    for(std::size_t i = 0; i < num; ++i)
+    {
+        hosts.push_back(FibpLoadBalancer::get_host_key("10.0.0." + std::string(1, '1' + i), "80"));
+    }
+    return hosts;
+}
+
+static void finish_request(FibpLoadBalancer& balancer, const std::string& host,
+    uint64_t latency_us, bool is_success)
+{
+    balancer.start_request(host);
+    balancer.end_request(host, latency_us, is_success);
+}
+
+// how many times each host is chosen by the balance index 0..num-1.
+static std::vector<std::size_t> count_selected(FibpLoadBalancer& balancer,
+    const std::vector<std::string>& hosts, const std::vector<double>* weights,
+    const std::string& exclude, std::size_t num)
+{
+    std::vector<std::size_t> counts(hosts.size(), 0);
+    for(std::size_t i = 0; i < num; ++i)
+    {
+        std::size_t selected = weights ? balancer.select(i, hosts, *weights, exclude) :
+            balancer.select(i, hosts, exclude);
+        BOOST_REQUIRE(selected < hosts.size());
+        ++counts[selected];
+    }
+    return counts;
+}
+
+struct TestStat
+{
+    TestStat()
+        : last_us(0), is_busy(false)
+    {
+    }
+    bool is_idle(uint64_t since_us) const
+    {
+        return !is_busy && last_us < since_us;
+    }
+    uint64_t last_us;
+    bool is_busy;
+};
+
+BOOST_AUTO_TEST_SUITE(TestLoadBalancerSuite)
+
+BOOST_AUTO_TEST_CASE(test_round_robin)
+{
+    RoundRobinBalancer balancer;
+    std::vector<std::string> hosts = make_hosts(3);
+    std::vector<std::size_t> counts = count_selected(balancer, hosts, NULL, "", 300);
+    BOOST_CHECK_EQUAL(counts[0], 100U);
+    BOOST_CHECK_EQUAL(counts[1], 100U);
+    BOOST_CHECK_EQUAL(counts[2], 100U);
+    // the excluded one is skipped, unless it is the only one.
+    counts = count_selected(balancer, hosts, NULL, hosts[1], 300);
+    BOOST_CHECK_EQUAL(counts[1], 0U);
+    BOOST_CHECK_EQUAL(counts[0], 150U);
+    std::vector<std::string> single = make_hosts(1);
+    BOOST_CHECK_EQUAL(balancer.select(5, single, single[0]), 0U);
+    // an unknown host to exclude changes nothing.
+    counts = count_selected(balancer, hosts, NULL, "10.0.0.9:80", 300);
+    BOOST_CHECK_EQUAL(counts[2], 100U);
+}
+
+BOOST_AUTO_TEST_CASE(test_round_robin_weighted)
+{
+    RoundRobinBalancer balancer;
+    std::vector<std::string> hosts = make_hosts(2);
+    std::vector<double> weights;
+    weights.push_back(3);
+    weights.push_back(1);
+    std::vector<std::size_t> counts = count_selected(balancer, hosts, &weights, "", 4000);
+    BOOST_CHECK(counts[0] > 2900 && counts[0] < 3100);
+    // the zero weight is never chosen, all zero falls back to the rotation.
+    weights[1] = 0;
+    counts = count_selected(balancer, hosts, &weights, "", 100);
+    BOOST_CHECK_EQUAL(counts[1], 0U);
+    weights[0] = 0;
+    counts = count_selected(balancer, hosts, &weights, "", 100);
+    BOOST_CHECK_EQUAL(counts[0], 50U);
+}
+
+BOOST_AUTO_TEST_CASE(test_ewma_prefer_fast)
+{
+    EwmaBalancer balancer;
+    std::vector<std::string> hosts = make_hosts(2);
+    // never used, both have the chance.
+    std::vector<std::size_t> counts = count_selected(balancer, hosts, NULL, "", 100);
+    BOOST_CHECK(counts[0] > 0 && counts[1] > 0);
+    for(int i = 0; i < 10; ++i)
+    {
+        finish_request(balancer, hosts[0], 100*1000, true);
+        finish_request(balancer, hosts[1], 1000, true);
+    }
+    // both are always the candidates of two hosts.
+    counts = count_selected(balancer, hosts, NULL, "", 100);
+    BOOST_CHECK_EQUAL(counts[1], 100U);
+    // unless the fast one is excluded.
+    counts = count_selected(balancer, hosts, NULL, hosts[1], 100);
+    BOOST_CHECK_EQUAL(counts[0], 100U);
+}
+
+BOOST_AUTO_TEST_CASE(test_ewma_inflight_and_failure)
+{
+    EwmaBalancer balancer;
+    std::vector<std::string> hosts = make_hosts(2);
+    finish_request(balancer, hosts[0], 1000, true);
+    finish_request(balancer, hosts[1], 1000, true);
+    // the same latency, the one with the requests in flight costs more.
+    for(int i = 0; i < 5; ++i)
+        balancer.start_request(hosts[0]);
+    std::vector<std::size_t> counts = count_selected(balancer, hosts, NULL, "", 100);
+    BOOST_CHECK_EQUAL(counts[1], 100U);
+    for(int i = 0; i < 5; ++i)
+        balancer.end_request(hosts[0], 1000, true);
+    // the fast failure is not mistaken for a fast host.
+    for(int i = 0; i < 10; ++i)
+        finish_request(balancer, hosts[1], 10, false);
+    counts = count_selected(balancer, hosts, NULL, "", 100);
+    BOOST_CHECK_EQUAL(counts[0], 100U);
+    // the unbalanced end is ignored.
+    balancer.end_request(hosts[0], 1000, true);
+    balancer.end_request(hosts[0], 1000, true);
+    counts = count_selected(balancer, hosts, NULL, "", 100);
+    BOOST_CHECK_EQUAL(counts[0], 100U);
+}
+
+BOOST_AUTO_TEST_CASE(test_ewma_weighted)
+{
+    EwmaBalancer balancer;
+    std::vector<std::string> hosts = make_hosts(3);
+    std::vector<double> weights(3, 1);
+    weights[2] = 0;
+    std::vector<std::size_t> counts = count_selected(balancer, hosts, &weights, "", 1000);
+    BOOST_CHECK_EQUAL(counts[2], 0U);
+    BOOST_CHECK(counts[0] > 300 && counts[1] > 300);
+    // the cost is divided by the weight, the heavy host takes more even if a bit slower.
+    weights[0] = 10;
+    weights[2] = 1;
+    for(int i = 0; i < 10; ++i)
+    {
+        finish_request(balancer, hosts[0], 2000, true);
+        finish_request(balancer, hosts[1], 1000, true);
+        finish_request(balancer, hosts[2], 1000, true);
+    }
+    counts = count_selected(balancer, hosts, &weights, "", 1000);
+    BOOST_CHECK(counts[0] > counts[1] + counts[2]);
+    counts = count_selected(balancer, hosts, &weights, hosts[0], 1000);
+    BOOST_CHECK_EQUAL(counts[0], 0U);
+}
+
+BOOST_AUTO_TEST_CASE(test_keyed_stat_map)
+{
+    FibpKeyedStatMap<TestStat> stats(1000);
+    BOOST_CHECK(!stats.find("a"));
+    FibpKeyedStatMap<TestStat>::StatPtr a = stats.get("a");
+    BOOST_REQUIRE(a);
+    BOOST_CHECK(stats.get("a") == a);
+    BOOST_CHECK(stats.find("a") == a);
+    FibpKeyedStatMap<TestStat>::StatPtr b = stats.get("b");
+    FibpKeyedStatMap<TestStat>::StatPtr c = stats.get("c");
+    a->last_us = 5000;
+    b->is_busy = true;
+    BOOST_CHECK_EQUAL(stats.size(), 3U);
+    // idle since 4000, the used one and the busy one are kept.
+    stats.evict_idle(5000);
+    BOOST_CHECK_EQUAL(stats.size(), 2U);
+    BOOST_CHECK(stats.find("a") == a);
+    BOOST_CHECK(stats.find("b") == b);
+    BOOST_CHECK(!stats.find("c"));
+    // created again as new.
+    BOOST_CHECK(stats.get("c") != c);
+    stats.erase("a");
+    BOOST_CHECK(!stats.find("a"));
+    BOOST_CHECK_EQUAL(stats.size(), 2U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
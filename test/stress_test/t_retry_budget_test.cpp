@@ -0,0 +1,49 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE testretrybudget
+#include <forward-manager/FibpRetryBudget.h>
+#include <boost/test/unit_test.hpp>
+#include <string>
+
+using namespace fibp;
+
+static int withdraw_all(FibpRetryBudget& budget, const std::string& service)
+{
+    int num = 0;
+    while(budget.try_withdraw(service))
+        ++num;
+    return num;
+}
+
+BOOST_AUTO_TEST_SUITE(TestRetryBudgetSuite)
+
+BOOST_AUTO_TEST_CASE(test_exhaust)
+{
+    FibpRetryBudget budget;
+    // a new service starts with the full balance.
+    BOOST_CHECK_EQUAL(withdraw_all(budget, "a"), 100);
+    BOOST_CHECK(!budget.try_withdraw("a"));
+    // the other service has its own.
+    BOOST_CHECK(budget.try_withdraw("b"));
+}
+
+BOOST_AUTO_TEST_CASE(test_deposit)
+{
+    FibpRetryBudget budget;
+    withdraw_all(budget, "a");
+    // a retry for every 5 requests.
+    for(int i = 0; i < 4; ++i)
+        budget.deposit("a");
+    BOOST_CHECK(!budget.try_withdraw("a"));
+    budget.deposit("a");
+    BOOST_CHECK(budget.try_withdraw("a"));
+    BOOST_CHECK(!budget.try_withdraw("a"));
+    for(int i = 0; i < 100; ++i)
+        budget.deposit("a");
+    BOOST_CHECK_EQUAL(withdraw_all(budget, "a"), 20);
+    // never over the full balance.
+    for(int i = 0; i < 10000; ++i)
+        budget.deposit("a");
+    BOOST_CHECK_EQUAL(withdraw_all(budget, "a"), 100);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,174 @@
+#include <forward-manager/FibpRouteTable.h>
+#include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/chrono/system_clocks.hpp>
+#include <boost/lexical_cast.hpp>
+#include <glog/logging.h>
+#include <map>
+
+// compare the route lookup of the published snapshot with the lookup of the
+// map under the shared lock (as the service manager did) from 1 to 32 threads,
+// while the routes are published again in the background.
+
+typedef std::pair<std::string, std::string> HostPairT;
+typedef std::map<std::string, std::vector<HostPairT> > ServiceHostMapT;
+
+static const std::string s_cluster("dev");
+static const std::size_t s_host_num = 8;
+
+static inline uint64_t now_us()
+{
+    return boost::chrono::duration_cast<boost::chrono::microseconds>(
+        boost::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static std::string service_name(std::size_t i)
+{
+    return "service_" + boost::lexical_cast<std::string>(i);
+}
+
+static void build_routes(std::size_t service_num, std::vector<fibp::FibpServiceRoute>& routes)
+{
+    routes.resize(service_num);
+    for(std::size_t i = 0; i < service_num; ++i)
+    {
+        routes[i].name = service_name(i);
+        for(std::size_t j = 0; j < s_host_num; ++j)
+        {
+            std::string ip = "10.0.0." + boost::lexical_cast<std::string>(j);
+            routes[i].hosts[fibp::HTTP_Service].push_back(std::make_pair(ip, "8080"));
+            routes[i].host_keys[fibp::HTTP_Service].push_back(ip + ":8080");
+        }
+    }
+}
+
+struct LockedTable
+{
+    boost::shared_mutex lock;
+    ServiceHostMapT hosts;
+    std::string cluster;
+};
+
+static void lookup_locked(LockedTable* table, const std::vector<std::string>* names,
+    std::size_t num, boost::atomic<uint64_t>* found)
+{
+    uint64_t ok = 0;
+    std::string ip;
+    std::string port;
+    for(std::size_t i = 0; i < num; ++i)
+    {
+        const std::string& name = (*names)[i % names->size()];
+        std::string key = name + "-" + table->cluster;
+        boost::shared_lock<boost::shared_mutex> guard(table->lock);
+        ServiceHostMapT::const_iterator it = table->hosts.find(key);
+        if (it == table->hosts.end())
+            continue;
+        const HostPairT& host = it->second[i % it->second.size()];
+        ip = host.first;
+        port = host.second;
+        ++ok;
+    }
+    *found += ok;
+}
+
+static void lookup_snapshot(fibp::FibpRouteTable* table, const std::vector<std::string>* names,
+    std::size_t num, boost::atomic<uint64_t>* found)
+{
+    uint64_t ok = 0;
+    std::string ip;
+    std::string port;
+    for(std::size_t i = 0; i < num; ++i)
+    {
+        const std::string& name = (*names)[i % names->size()];
+        const fibp::FibpServiceRoute* route = table->snapshot().find(name);
+        if (!route)
+            continue;
+        const std::vector<HostPairT>& hosts = route->hosts[fibp::HTTP_Service];
+        const HostPairT& host = hosts[i % hosts.size()];
+        ip = host.first;
+        port = host.second;
+        ++ok;
+    }
+    *found += ok;
+}
+
+static void publish_locked(LockedTable* table, std::size_t service_num, boost::atomic<bool>* stop)
+{
+    while(!*stop)
+    {
+        ServiceHostMapT hosts;
+        for(std::size_t i = 0; i < service_num; ++i)
+        {
+            std::vector<HostPairT>& host_list = hosts[service_name(i) + "-" + s_cluster];
+            for(std::size_t j = 0; j < s_host_num; ++j)
+                host_list.push_back(std::make_pair("10.0.0." + boost::lexical_cast<std::string>(j), "8080"));
+        }
+        {
+            boost::unique_lock<boost::shared_mutex> guard(table->lock);
+            table->hosts.swap(hosts);
+        }
+        boost::this_thread::sleep_for(boost::chrono::milliseconds(10));
+    }
+}
+
+static void publish_snapshot(fibp::FibpRouteTable* table, std::size_t service_num, boost::atomic<bool>* stop)
+{
+    while(!*stop)
+    {
+        std::vector<fibp::FibpServiceRoute> routes;
+        build_routes(service_num, routes);
+        table->publish(routes);
+        boost::this_thread::sleep_for(boost::chrono::milliseconds(10));
+    }
+}
+
+template <class TableT, class LookupT, class PublishT>
+static void run(const char* label, TableT& table, LookupT lookup, PublishT publish,
+    const std::vector<std::string>& names, std::size_t service_num,
+    std::size_t thread_num, std::size_t num)
+{
+    boost::atomic<bool> stop(false);
+    boost::atomic<uint64_t> found(0);
+    boost::thread writer(boost::bind(publish, &table, service_num, &stop));
+    uint64_t start = now_us();
+    boost::thread_group readers;
+    for(std::size_t i = 0; i < thread_num; ++i)
+        readers.create_thread(boost::bind(lookup, &table, &names, num, &found));
+    readers.join_all();
+    uint64_t used = now_us() - start;
+    stop = true;
+    writer.join();
+    LOG(INFO) << label << " threads: " << thread_num << ", lookups: " << num * thread_num
+        << ", found: " << found << ", used: " << used << "us, "
+        << (double)num * thread_num / (used ? used : 1) << "M/s";
+}
+
+int main(int argc, char* argv[])
+{
+    std::size_t num = 2000000;
+    std::size_t service_num = 1000;
+    if (argc > 1)
+        num = boost::lexical_cast<std::size_t>(argv[1]);
+    if (argc > 2)
+        service_num = boost::lexical_cast<std::size_t>(argv[2]);
+    std::vector<std::string> names;
+    for(std::size_t i = 0; i < service_num; ++i)
+        names.push_back(service_name(i));
+
+    LockedTable locked;
+    locked.cluster = s_cluster;
+    fibp::FibpRouteTable snapshot;
+    std::vector<fibp::FibpServiceRoute> routes;
+    build_routes(service_num, routes);
+    snapshot.publish(routes);
+
+    for(std::size_t thread_num = 1; thread_num <= 32; thread_num *= 2)
+    {
+        run("locked map", locked, &lookup_locked, &publish_locked, names, service_num,
+            thread_num, num);
+        run("snapshot", snapshot, &lookup_snapshot, &publish_snapshot, names, service_num,
+            thread_num, num);
+    }
+    return 0;
+}
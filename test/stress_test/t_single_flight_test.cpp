@@ -0,0 +1,114 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE testsingleflight
+#include <forward-manager/FibpSingleFlight.h>
+#include <boost/test/unit_test.hpp>
+#include <boost/bind.hpp>
+#include <boost/chrono/system_clocks.hpp>
+#include <string>
+
+using namespace fibp;
+
+static uint64_t now_us()
+{
+    return boost::chrono::duration_cast<boost::chrono::microseconds>(
+        boost::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static ServiceCallReq make_req(const std::string& data, uint64_t deadline_us)
+{
+    ServiceCallReq req;
+    req.service_name = "svc";
+    req.service_api = "/api";
+    req.service_req_data = data;
+    req.deadline_us = deadline_us;
+    return req;
+}
+
+static void follow(FibpSingleFlight::InflightCallPtr call, uint64_t deadline_us,
+    bool& is_done, ServiceCallRsp& rsp)
+{
+    is_done = FibpSingleFlight::wait(call, deadline_us, rsp);
+}
+
+BOOST_AUTO_TEST_SUITE(TestSingleFlightSuite)
+
+BOOST_AUTO_TEST_CASE(test_coalesce)
+{
+    FibpSingleFlight flight;
+    ServiceCallReq req = make_req("a", 0);
+    FibpSingleFlight::InflightCallPtr leader;
+    FibpSingleFlight::InflightCallPtr follower;
+    FibpSingleFlight::InflightCallPtr other;
+    BOOST_CHECK(flight.join(req, leader));
+    BOOST_CHECK(!flight.join(req, follower));
+    BOOST_CHECK(follower == leader);
+    // the different request data is not the same call.
+    BOOST_CHECK(flight.join(make_req("b", 0), other));
+    BOOST_CHECK(other != leader);
+
+    bool is_done = false;
+    ServiceCallRsp follower_rsp;
+    boost::fibers::fiber f(boost::bind(follow, follower, 0, boost::ref(is_done),
+            boost::ref(follower_rsp)));
+    boost::this_fiber::yield();
+    BOOST_CHECK(!is_done);
+    ServiceCallRsp rsp;
+    rsp.rsp = "result";
+    flight.finish(req, leader, rsp);
+    f.join();
+    BOOST_CHECK(is_done);
+    BOOST_CHECK_EQUAL(follower_rsp.rsp, "result");
+    // the finished call is not joined any more.
+    FibpSingleFlight::InflightCallPtr next;
+    BOOST_CHECK(flight.join(req, next));
+    BOOST_CHECK(next != leader);
+    // the one joined after finished gets the response at once.
+    ServiceCallRsp late_rsp;
+    BOOST_CHECK(FibpSingleFlight::wait(leader, 0, late_rsp));
+    BOOST_CHECK_EQUAL(late_rsp.rsp, "result");
+}
+
+BOOST_AUTO_TEST_CASE(test_wait_deadline)
+{
+    FibpSingleFlight flight;
+    ServiceCallReq req = make_req("a", 0);
+    FibpSingleFlight::InflightCallPtr leader;
+    BOOST_CHECK(flight.join(req, leader));
+    ServiceCallRsp rsp;
+    uint64_t start = now_us();
+    BOOST_CHECK(!FibpSingleFlight::wait(leader, start + 20*1000, rsp));
+    BOOST_CHECK(now_us() >= start + 20*1000);
+    BOOST_CHECK(!FibpSingleFlight::wait(leader, 1, rsp));
+}
+
+BOOST_AUTO_TEST_CASE(test_call_again)
+{
+    FibpSingleFlight flight;
+    uint64_t now = now_us();
+    uint64_t leader_deadline = now + 1000*1000;
+    ServiceCallReq req = make_req("a", leader_deadline);
+    FibpSingleFlight::InflightCallPtr leader;
+    BOOST_CHECK(flight.join(req, leader));
+    ServiceCallRsp rsp;
+    BOOST_CHECK(!FibpSingleFlight::should_call_again(leader, rsp, 0));
+    rsp.error = "Server Timed Out.";
+    // a later deadline or no deadline still has time.
+    BOOST_CHECK(FibpSingleFlight::should_call_again(leader, rsp, leader_deadline + 1000*1000));
+    BOOST_CHECK(FibpSingleFlight::should_call_again(leader, rsp, 0));
+    rsp.error = "Deadline Exceeded.";
+    BOOST_CHECK(FibpSingleFlight::should_call_again(leader, rsp, leader_deadline + 1000*1000));
+    // no more time than the leader, or already passed.
+    BOOST_CHECK(!FibpSingleFlight::should_call_again(leader, rsp, leader_deadline));
+    BOOST_CHECK(!FibpSingleFlight::should_call_again(leader, rsp, now - 1));
+    // the other errors will happen again.
+    rsp.error = "Service Not Found.";
+    BOOST_CHECK(!FibpSingleFlight::should_call_again(leader, rsp, 0));
+
+    // the leader without deadline had all the time.
+    FibpSingleFlight::InflightCallPtr no_deadline;
+    BOOST_CHECK(flight.join(make_req("b", 0), no_deadline));
+    rsp.error = "Server Timed Out.";
+    BOOST_CHECK(!FibpSingleFlight::should_call_again(no_deadline, rsp, 0));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
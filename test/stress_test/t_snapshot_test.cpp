@@ -0,0 +1,290 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE testsnapshot
+#include <forward-manager/FibpServiceSnapshot.h>
+#include <boost/test/unit_test.hpp>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+using namespace fibp;
+
+// the layout of the file header, the checksum covers the body only.
+static const std::size_t s_header_size = 32;
+static const std::size_t s_version_offset = 8;
+static const std::size_t s_body_size_offset = 16;
+static const std::size_t s_checksum_offset = 24;
+
+static uint64_t fnv1a(const char* data, std::size_t size)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for(std::size_t i = 0; i < size; ++i)
+    {
+        h ^= (unsigned char)data[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+template <class T>
+static void put_value(std::string& data, T v)
+{
+    data.append((const char*)&v, sizeof(v));
+}
+
+static void put_string(std::string& data, const std::string& s)
+{
+    put_value<uint32_t>(data, s.size());
+    data.append(s);
+}
+
+// write the header for the body changed by the test, so the parse goes past the
+// checksum.
+static void reseal(std::string& data, uint32_t version)
+{
+    uint64_t body_size = data.size() - s_header_size;
+    uint64_t sum = fnv1a(data.data() + s_header_size, body_size);
+    memcpy(&data[s_version_offset], &version, sizeof(version));
+    memcpy(&data[s_body_size_offset], &body_size, sizeof(body_size));
+    memcpy(&data[s_checksum_offset], &sum, sizeof(sum));
+}
+
+static FibpServiceSnapshot make_snapshot()
+{
+    FibpServiceSnapshot snapshot;
+    snapshot.cluster = "dev";
+    FibpServiceSnapshotEntry service;
+    service.name = "search";
+    service.hedge_percentile = 95;
+    service.pipeline_depth = 4;
+    service.is_h2c = true;
+    service.is_stream = true;
+    FibpServiceSnapshotEntry::HostList host_list;
+    host_list.type = RPC_Service;
+    host_list.key = "search-dev";
+    host_list.hosts.push_back(std::make_pair("10.0.0.1", "18181"));
+    host_list.hosts.push_back(std::make_pair("10.0.0.2", "18181"));
+    service.host_lists.push_back(host_list);
+    FibpServiceSnapshotEntry::Endpoint endpoint;
+    endpoint.host = host_list.hosts[0];
+    endpoint.weight = 7;
+    endpoint.zone = "zone-a";
+    service.endpoints.push_back(endpoint);
+    snapshot.services.push_back(service);
+    FibpForwardSnapshotEntry forward;
+    forward.forward_key = "agent1search";
+    forward.service_name = "search";
+    forward.type = RPC_Service;
+    forward.port = 20001;
+    snapshot.forwards.push_back(forward);
+    return snapshot;
+}
+
+static void check_snapshot(const FibpServiceSnapshot& snapshot, bool has_endpoints)
+{
+    BOOST_CHECK_EQUAL(snapshot.cluster, "dev");
+    BOOST_REQUIRE_EQUAL(snapshot.services.size(), 1U);
+    const FibpServiceSnapshotEntry& service = snapshot.services[0];
+    BOOST_CHECK_EQUAL(service.name, "search");
+    BOOST_CHECK_EQUAL(service.hedge_percentile, 95);
+    BOOST_CHECK_EQUAL(service.pipeline_depth, 4);
+    BOOST_CHECK(service.is_h2c);
+    BOOST_CHECK(!service.is_shared);
+    BOOST_CHECK(service.is_stream);
+    BOOST_REQUIRE_EQUAL(service.host_lists.size(), 1U);
+    BOOST_CHECK_EQUAL(service.host_lists[0].type, (int)RPC_Service);
+    BOOST_CHECK_EQUAL(service.host_lists[0].key, "search-dev");
+    BOOST_REQUIRE_EQUAL(service.host_lists[0].hosts.size(), 2U);
+    BOOST_CHECK_EQUAL(service.host_lists[0].hosts[1].first, "10.0.0.2");
+    BOOST_CHECK_EQUAL(service.host_lists[0].hosts[1].second, "18181");
+    if (has_endpoints)
+    {
+        BOOST_REQUIRE_EQUAL(service.endpoints.size(), 1U);
+        BOOST_CHECK_EQUAL(service.endpoints[0].host.first, "10.0.0.1");
+        BOOST_CHECK_EQUAL(service.endpoints[0].weight, 7U);
+        BOOST_CHECK_EQUAL(service.endpoints[0].zone, "zone-a");
+    }
+    else
+    {
+        BOOST_CHECK(service.endpoints.empty());
+    }
+    BOOST_REQUIRE_EQUAL(snapshot.forwards.size(), 1U);
+    BOOST_CHECK_EQUAL(snapshot.forwards[0].forward_key, "agent1search");
+    BOOST_CHECK_EQUAL(snapshot.forwards[0].service_name, "search");
+    BOOST_CHECK_EQUAL(snapshot.forwards[0].type, (int)RPC_Service);
+    BOOST_CHECK_EQUAL(snapshot.forwards[0].port, 20001);
+}
+
+static bool parse(const std::string& data)
+{
+    FibpServiceSnapshot snapshot;
+    return FibpServiceSnapshotFile::parse(data.data(), data.size(), snapshot);
+}
+
+static std::string temp_path()
+{
+    char path[] = "/tmp/fibp_snapshot_XXXXXX";
+    int fd = mkstemp(path);
+    BOOST_REQUIRE(fd >= 0);
+    close(fd);
+    return path;
+}
+
+static void write_file(const std::string& path, const std::string& data)
+{
+    FILE* f = fopen(path.c_str(), "wb");
+    BOOST_REQUIRE(f != NULL);
+    BOOST_REQUIRE_EQUAL(fwrite(data.data(), 1, data.size(), f), data.size());
+    fclose(f);
+}
+
+BOOST_AUTO_TEST_SUITE(TestSnapshotSuite)
+
+BOOST_AUTO_TEST_CASE(test_parse)
+{
+    std::string data;
+    FibpServiceSnapshotFile::serialize(make_snapshot(), data);
+    FibpServiceSnapshot snapshot;
+    BOOST_CHECK(FibpServiceSnapshotFile::parse(data.data(), data.size(), snapshot));
+    check_snapshot(snapshot, true);
+}
+
+BOOST_AUTO_TEST_CASE(test_truncated)
+{
+    std::string data;
+    FibpServiceSnapshotFile::serialize(make_snapshot(), data);
+    for(std::size_t len = 0; len < data.size(); ++len)
+    {
+        std::string truncated = data.substr(0, len);
+        BOOST_CHECK(!parse(truncated));
+        // the records themselves are checked if the header is right.
+        if (len >= s_header_size)
+        {
+            reseal(truncated, FibpServiceSnapshotFile::FORMAT_VERSION);
+            BOOST_CHECK(!parse(truncated));
+        }
+    }
+    // nothing is left over after the records.
+    std::string longer = data + "x";
+    reseal(longer, FibpServiceSnapshotFile::FORMAT_VERSION);
+    BOOST_CHECK(!parse(longer));
+}
+
+BOOST_AUTO_TEST_CASE(test_corrupted)
+{
+    std::string data;
+    FibpServiceSnapshotFile::serialize(make_snapshot(), data);
+
+    std::string bad_magic = data;
+    bad_magic[0] = 'X';
+    BOOST_CHECK(!parse(bad_magic));
+
+    std::string bad_checksum = data;
+    ++bad_checksum[s_checksum_offset];
+    BOOST_CHECK(!parse(bad_checksum));
+
+    // any changed byte of the body fails the checksum.
+    for(std::size_t i = s_header_size; i < data.size(); ++i)
+    {
+        std::string changed = data;
+        changed[i] ^= 0x5a;
+        BOOST_CHECK(!parse(changed));
+    }
+
+    std::string newer = data;
+    reseal(newer, FibpServiceSnapshotFile::FORMAT_VERSION + 1);
+    BOOST_CHECK(!parse(newer));
+    std::string zero_version = data;
+    reseal(zero_version, 0);
+    BOOST_CHECK(!parse(zero_version));
+
+    // the service count larger than the bytes left, with a right checksum.
+    std::string bad_count = data;
+    uint32_t count = 0xffffff;
+    memcpy(&bad_count[s_header_size + 4 + 3], &count, sizeof(count));
+    reseal(bad_count, FibpServiceSnapshotFile::FORMAT_VERSION);
+    BOOST_CHECK(!parse(bad_count));
+}
+
+BOOST_AUTO_TEST_CASE(test_version_1)
+{
+    // the version 1 has no endpoints after the host lists.
+    std::string data(s_header_size, '\0');
+    memcpy(&data[0], "FIBPSVC", 8);
+    uint32_t header_size = s_header_size;
+    memcpy(&data[12], &header_size, sizeof(header_size));
+    put_string(data, "dev");
+    put_value<uint32_t>(data, 1);
+    put_string(data, "search");
+    put_value<int32_t>(data, 95);
+    put_value<int32_t>(data, 4);
+    put_value<uint8_t>(data, 1 | 4);
+    put_value<uint32_t>(data, 1);
+    put_value<uint8_t>(data, RPC_Service);
+    put_string(data, "search-dev");
+    put_value<uint32_t>(data, 2);
+    put_string(data, "10.0.0.1");
+    put_string(data, "18181");
+    put_string(data, "10.0.0.2");
+    put_string(data, "18181");
+    put_value<uint32_t>(data, 1);
+    put_string(data, "agent1search");
+    put_string(data, "search");
+    put_value<int32_t>(data, RPC_Service);
+    put_value<uint16_t>(data, 20001);
+    reseal(data, 1);
+
+    FibpServiceSnapshot snapshot;
+    BOOST_CHECK(FibpServiceSnapshotFile::parse(data.data(), data.size(), snapshot));
+    check_snapshot(snapshot, false);
+
+    // the same body is not a version 2 one.
+    reseal(data, 2);
+    BOOST_CHECK(!parse(data));
+}
+
+BOOST_AUTO_TEST_CASE(test_save_and_load)
+{
+    std::string path = temp_path();
+    FibpServiceSnapshotFile file(path);
+    BOOST_CHECK(file.save(make_snapshot()));
+    // the same snapshot is not written again.
+    BOOST_CHECK(file.save(make_snapshot()));
+
+    FibpServiceSnapshotFile loaded_file(path);
+    FibpServiceSnapshot snapshot;
+    BOOST_CHECK(loaded_file.load(snapshot));
+    check_snapshot(snapshot, true);
+    BOOST_CHECK(access((path + ".tmp").c_str(), F_OK) != 0);
+
+    // the snapshot changed is written over the old one.
+    FibpServiceSnapshot changed = make_snapshot();
+    changed.forwards.clear();
+    BOOST_CHECK(loaded_file.save(changed));
+    BOOST_CHECK(file.load(snapshot));
+    BOOST_CHECK(snapshot.forwards.empty());
+    unlink(path.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(test_load_bad_file)
+{
+    std::string path = temp_path();
+    FibpServiceSnapshotFile file(path);
+    FibpServiceSnapshot snapshot;
+    // the empty file.
+    BOOST_CHECK(!file.load(snapshot));
+
+    std::string data;
+    FibpServiceSnapshotFile::serialize(make_snapshot(), data);
+    write_file(path, data.substr(0, data.size() - 1));
+    BOOST_CHECK(!file.load(snapshot));
+    // nothing is left from the failed parse.
+    BOOST_CHECK(snapshot.cluster.empty());
+    BOOST_CHECK(snapshot.services.empty());
+
+    write_file(path, data);
+    BOOST_CHECK(file.load(snapshot));
+    unlink(path.c_str());
+    BOOST_CHECK(!file.load(snapshot));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,162 @@
+#include <forward-manager/FibpTimerWheel.h>
+#include <boost/asio.hpp>
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/bind.hpp>
+#include <boost/chrono/system_clocks.hpp>
+#include <boost/lexical_cast.hpp>
+#include <glog/logging.h>
+#include <stdlib.h>
+#include <vector>
+
+// compare the timer wheel with the asio timer per request:
+// 1. arm and cancel, as most of the request timeouts never happen.
+// 2. arm the timers with random timeouts and wait all of them fired.
+
+static inline uint64_t now_us()
+{
+    return boost::chrono::duration_cast<boost::chrono::microseconds>(
+        boost::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static std::size_t g_fired = 0;
+static uint64_t g_late_total_us = 0;
+
+struct WheelItem
+{
+    fibp::FibpTimer timer;
+    uint64_t expire_us;
+};
+
+static void on_wheel_timeout(void* arg)
+{
+    WheelItem* item = (WheelItem*)arg;
+    ++g_fired;
+    uint64_t now = now_us();
+    if (now > item->expire_us)
+        g_late_total_us += now - item->expire_us;
+}
+
+struct AsioItem
+{
+    AsioItem(boost::asio::io_service& io)
+        : timer(io), expire_us(0)
+    {
+    }
+    boost::asio::deadline_timer timer;
+    uint64_t expire_us;
+};
+
+static void on_asio_timeout(AsioItem* item, const boost::system::error_code& ec)
+{
+    if (ec)
+        return;
+    ++g_fired;
+    uint64_t now = now_us();
+    if (now > item->expire_us)
+        g_late_total_us += now - item->expire_us;
+}
+
+static void bench_arm_cancel(std::size_t num, std::size_t concurrent)
+{
+    {
+        boost::asio::io_service io;
+        fibp::FibpTimerWheel& wheel = fibp::FibpTimerWheel::get(io);
+        std::vector<WheelItem> items(concurrent);
+        uint64_t start = now_us();
+        for(std::size_t i = 0; i < num; ++i)
+        {
+            WheelItem& item = items[i % concurrent];
+            item.timer.cancel();
+            wheel.arm(item.timer, 1000 + i % 5000, &on_wheel_timeout, &item);
+        }
+        for(std::size_t i = 0; i < concurrent; ++i)
+            items[i].timer.cancel();
+        io.poll();
+        uint64_t used = now_us() - start;
+        LOG(INFO) << "wheel arm/cancel: " << num << ", used: " << used << "us, "
+            << used * 1000.0 / num << "ns/op";
+    }
+    {
+        boost::asio::io_service io;
+        std::vector<AsioItem*> items;
+        for(std::size_t i = 0; i < concurrent; ++i)
+            items.push_back(new AsioItem(io));
+        uint64_t start = now_us();
+        for(std::size_t i = 0; i < num; ++i)
+        {
+            AsioItem* item = items[i % concurrent];
+            item->timer.cancel();
+            item->timer.expires_from_now(boost::posix_time::milliseconds(1000 + i % 5000));
+            item->timer.async_wait(boost::bind(&on_asio_timeout, item, _1));
+            // the cancelled handlers are queued, run them as the io thread would.
+            if (i % concurrent == concurrent - 1)
+                io.poll();
+        }
+        for(std::size_t i = 0; i < concurrent; ++i)
+            items[i]->timer.cancel();
+        io.poll();
+        uint64_t used = now_us() - start;
+        LOG(INFO) << "asio arm/cancel: " << num << ", used: " << used << "us, "
+            << used * 1000.0 / num << "ns/op";
+        for(std::size_t i = 0; i < concurrent; ++i)
+            delete items[i];
+    }
+}
+
+static void bench_fire(std::size_t num, int max_ms)
+{
+    std::vector<int> timeouts(num);
+    for(std::size_t i = 0; i < num; ++i)
+        timeouts[i] = rand() % max_ms + 1;
+    {
+        boost::asio::io_service io;
+        fibp::FibpTimerWheel& wheel = fibp::FibpTimerWheel::get(io);
+        std::vector<WheelItem> items(num);
+        g_fired = 0;
+        g_late_total_us = 0;
+        uint64_t start = now_us();
+        for(std::size_t i = 0; i < num; ++i)
+        {
+            items[i].expire_us = now_us() + timeouts[i] * 1000;
+            wheel.arm(items[i].timer, timeouts[i], &on_wheel_timeout, &items[i]);
+        }
+        uint64_t armed = now_us() - start;
+        io.run();
+        LOG(INFO) << "wheel fired: " << g_fired << ", arm used: " << armed << "us, average late: "
+            << g_late_total_us / (g_fired ? g_fired : 1) << "us";
+    }
+    {
+        boost::asio::io_service io;
+        std::vector<AsioItem*> items;
+        for(std::size_t i = 0; i < num; ++i)
+            items.push_back(new AsioItem(io));
+        g_fired = 0;
+        g_late_total_us = 0;
+        uint64_t start = now_us();
+        for(std::size_t i = 0; i < num; ++i)
+        {
+            items[i]->expire_us = now_us() + timeouts[i] * 1000;
+            items[i]->timer.expires_from_now(boost::posix_time::milliseconds(timeouts[i]));
+            items[i]->timer.async_wait(boost::bind(&on_asio_timeout, items[i], _1));
+        }
+        uint64_t armed = now_us() - start;
+        io.run();
+        LOG(INFO) << "asio fired: " << g_fired << ", arm used: " << armed << "us, average late: "
+            << g_late_total_us / (g_fired ? g_fired : 1) << "us";
+        for(std::size_t i = 0; i < num; ++i)
+            delete items[i];
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    std::size_t num = 1000000;
+    std::size_t concurrent = 10000;
+    if (argc > 1)
+        num = boost::lexical_cast<std::size_t>(argv[1]);
+    if (argc > 2)
+        concurrent = boost::lexical_cast<std::size_t>(argv[2]);
+    bench_arm_cancel(num, concurrent);
+    bench_fire(num / 10, 2000);
+    return 0;
+}